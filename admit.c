@@ -0,0 +1,106 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "admit.h"
+#include <pthread.h>
+
+#define ADMIT_SLICE_NS	(50 * 1000000)	/* Cancel flag is looked at this often */
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t room;		/* A job has left or limit has grown */
+	pthread_once_t once;
+	unsigned int running, limit;
+} admit = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	PTHREAD_ONCE_INIT, 0, ADMIT_DEFAULT };
+
+/**
+ * Makes the condition variable wait by monotonic clock, as deadlines of
+ * jobs are set by it
+ */
+static void admit_init(){
+	pthread_condattr_t attr;
+	pthread_condattr_init(& attr);
+	pthread_condattr_setclock(& attr, CLOCK_MONOTONIC);
+	pthread_cond_destroy(& admit.room);
+	pthread_cond_init(& admit.room, & attr);
+	pthread_condattr_destroy(& attr);
+}
+
+void admit_limit(unsigned int n){
+	pthread_once(& admit.once, admit_init);
+	pthread_mutex_lock(& admit.lock);
+	admit.limit = n;
+	pthread_cond_broadcast(& admit.room);
+	pthread_mutex_unlock(& admit.lock);
+}
+
+/**
+ * Tells whether the first time is before the second one
+ */
+static char admit_before(const struct timespec * a, const struct timespec * b){
+	return a -> tv_sec < b -> tv_sec ||
+		( a -> tv_sec == b -> tv_sec && a -> tv_nsec < b -> tv_nsec );
+}
+
+char admit_enter(const struct timespec * deadline, const int * cancel){
+	pthread_once(& admit.once, admit_init);
+	char rv = 0;
+	pthread_mutex_lock(& admit.lock);
+	while ( admit.limit && admit.running >= admit.limit ){
+		if ( NULL != cancel && __atomic_load_n(cancel, __ATOMIC_RELAXED) ){
+			rv = 2;
+			break;
+		}
+		struct timespec until;
+		clock_gettime(CLOCK_MONOTONIC, & until);
+		if ( NULL != deadline && ! admit_before(& until, deadline) ){
+			rv = 1;
+			break;
+		}
+		if ( NULL != cancel ){
+			/* Waking up now and then to look at the flag */
+			until.tv_nsec += ADMIT_SLICE_NS;
+			if ( until.tv_nsec >= 1000000000 ){
+				until.tv_sec += 1;
+				until.tv_nsec -= 1000000000;
+			}
+			if ( NULL != deadline && admit_before(deadline, & until) ){
+				until = * deadline;
+			}
+			pthread_cond_timedwait(& admit.room, & admit.lock, & until);
+		}else if ( NULL != deadline ){
+			pthread_cond_timedwait(& admit.room, & admit.lock, deadline);
+		}else{
+			pthread_cond_wait(& admit.room, & admit.lock);
+		}
+	}
+	if ( 0 == rv ){
+		admit.running += 1;
+	}
+	pthread_mutex_unlock(& admit.lock);
+	return rv;
+}
+
+void admit_leave(){
+	pthread_mutex_lock(& admit.lock);
+	admit.running -= 1;
+	pthread_cond_signal(& admit.room);
+	pthread_mutex_unlock(& admit.lock);
+}
@@ -0,0 +1,52 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ADMIT_H
+#define ADMIT_H
+#include <time.h>
+/**
+ * This module is a process-wide gate for heavy jobs: only a few of them
+ * run at once, the others wait for their turn, so that several big
+ * carriers, coming together, don't take all the memory there is.
+ */
+
+#define ADMIT_DEFAULT	1	/* Heavy jobs at once, unless set otherwise */
+
+/**
+ * Sets how many heavy jobs may run at once. Jobs, waiting already, are
+ * let in, if there is room for them now.
+ * @param n - number of jobs, 0 for no limit
+ */
+void admit_limit(unsigned int n);
+
+/**
+ * Waits until there is room for one more heavy job and takes it.
+ * @param deadline - CLOCK_MONOTONIC time to give up at, NULL for none
+ * @param cancel - flag to give up, when it becomes not 0, NULL for none
+ * @return 0 if the job is in, 1 if the deadline has come, 2 if the job
+ * is cancelled
+ */
+char admit_enter(const struct timespec * deadline, const int * cancel);
+
+/**
+ * Gives the room, taken with admit_enter, back.
+ */
+void admit_leave();
+
+#endif
@@ -0,0 +1,283 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "arena.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <sys/mman.h>
+
+#define ARENA_ALIGN		16				/* Enough for any C type */
+#define ARENA_MIN_BLOCK	(1024 * 1024)
+#define ARENA_HUGE_PAGE	(2 * 1024 * 1024)
+
+struct arena_block {
+	struct arena_block * next;
+	size_t size;	/* Usable bytes after the header */
+	size_t used;
+};
+
+/* Header size, rounded to alignment */
+#define ARENA_HEAD ((sizeof(struct arena_block) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+struct arena {
+	struct arena_block * first;
+	struct arena_block * current;	/* Block to take memory from */
+	unsigned int frames;			/* Open frames */
+	unsigned int flags;
+	size_t in_use;					/* Bytes taken, not counting block tails skipped */
+	size_t peak;
+};
+
+static __thread struct arena thread_arena;
+
+const char arena_jpeg_owner = 0;
+
+/**
+ * Takes a new block from OS
+ * @param size - usable bytes wanted
+ * @return block or NULL if out of memory
+ */
+static struct arena_block * arena_block_new(size_t size, unsigned int flags){
+	size_t page = flags & ARENA_HUGEPAGES ? ARENA_HUGE_PAGE : 4096;
+	if ( size < ARENA_MIN_BLOCK ){
+		size = ARENA_MIN_BLOCK;
+	}
+	size_t whole = (size + ARENA_HEAD + page - 1) / page * page;
+	if ( whole < size ){
+		return NULL;/* overflow */
+	}
+	void * p = mmap(NULL, whole, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ( MAP_FAILED == p ){
+		return NULL;
+	}
+#ifdef MADV_HUGEPAGE
+	if ( flags & ARENA_HUGEPAGES ){
+		madvise(p, whole, MADV_HUGEPAGE);/* Only a hint, failure is OK */
+	}
+#endif
+	struct arena_block * b = p;
+	b -> next = NULL;
+	b -> size = whole - ARENA_HEAD;
+	b -> used = 0;
+	return b;
+}
+
+void arena_begin(struct arena_frame * frame){
+	struct arena * a = & thread_arena;
+	frame -> block = a -> current;
+	frame -> used = a -> current ? a -> current -> used : 0;
+	a -> frames += 1;
+}
+
+void arena_end(struct arena_frame * frame){
+	struct arena * a = & thread_arena;
+	assert(a -> frames);
+	a -> frames -= 1;
+	/* Blocks after the saved one become empty, but stay for reuse */
+	struct arena_block * b = frame -> block ? frame -> block -> next : a -> first;
+	for ( ; b != NULL; b = b -> next ){
+		a -> in_use -= b -> used;
+		b -> used = 0;
+	}
+	if ( NULL != frame -> block ){
+		a -> in_use -= frame -> block -> used - frame -> used;
+		frame -> block -> used = frame -> used;
+		a -> current = frame -> block;
+	}else{
+		a -> current = a -> first;
+	}
+}
+
+void * arena_alloc(size_t size){
+	struct arena * a = & thread_arena;
+	if ( 0 == a -> frames ){
+		return NULL;
+	}
+	size_t need = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if ( need < size ){
+		return NULL;/* overflow */
+	}
+	/* Looking for space in the current block and empty blocks after it */
+	struct arena_block * b = a -> current;
+	struct arena_block * prev = NULL;
+	if ( NULL == b ){
+		b = a -> first;
+	}
+	while ( NULL != b && b -> size - b -> used < need ){
+		/* Blocks after the current one are empty, too small ones are
+		 * skipped until the frame is closed */
+		prev = b;
+		b = b -> next;
+	}
+	if ( NULL == b ){
+		b = arena_block_new(need, a -> flags);
+		if ( NULL == b ){
+			return NULL;
+		}
+		if ( NULL == prev ){
+			a -> first = b;
+		}else{
+			prev -> next = b;
+		}
+	}
+	void * p = (unsigned char *) b + ARENA_HEAD + b -> used;
+	b -> used += need;
+	a -> current = b;
+	a -> in_use += need;
+	if ( a -> in_use > a -> peak ){
+		a -> peak = a -> in_use;
+	}
+	return p;
+}
+
+char arena_reserve(size_t bytes, unsigned int flags){
+	struct arena * a = & thread_arena;
+	a -> flags = flags;
+	/* Is there an empty block, big enough? */
+	struct arena_block * b, * last = NULL;
+	for ( b = a -> current ? a -> current -> next : a -> first; b != NULL; b = b -> next ){
+		if ( b -> size >= bytes ){
+			return 0;
+		}
+		last = b;
+	}
+	if ( NULL == last && NULL != a -> current ){
+		last = a -> current;
+	}
+	b = arena_block_new(bytes, flags);
+	if ( NULL == b ){
+		return 1;
+	}
+	if ( NULL == last ){
+		a -> first = b;
+	}else{
+		last -> next = b;
+	}
+	return 0;
+}
+
+void arena_release(){
+	struct arena * a = & thread_arena;
+	assert(0 == a -> frames);
+	struct arena_block * b = a -> first;
+	while ( NULL != b ){
+		struct arena_block * next = b -> next;
+		munmap(b, b -> size + ARENA_HEAD);
+		b = next;
+	}
+	a -> first = NULL;
+	a -> current = NULL;
+	a -> in_use = 0;
+}
+
+void arena_trim(size_t keep){
+	struct arena * a = & thread_arena;
+	assert(0 == a -> frames);
+	struct arena_block ** p = & a -> first;
+	size_t kept = 0;
+	while ( NULL != * p ){
+		struct arena_block * b = * p;
+		if ( b -> size <= keep - kept ){
+			kept += b -> size;
+			p = & b -> next;
+			continue;
+		}
+		* p = b -> next;
+		munmap(b, b -> size + ARENA_HEAD);
+	}
+	a -> current = a -> first;
+}
+
+size_t arena_peak_reset(){
+	struct arena * a = & thread_arena;
+	size_t peak = a -> peak;
+	a -> peak = a -> in_use;
+	return peak;
+}
+
+
+#ifdef STEGANOLAB_JPEG_ARENA
+/**
+ * Jpeg library memory back-end. Every object is prepended with a tag,
+ * that tells if it came from an arena or from malloc, so objects can be
+ * freed by any thread and after frame is closed.
+ */
+#include <stdio.h>
+#include <jpeglib.h>
+
+#define ARENA_TAG	ARENA_ALIGN
+#define TAG_MALLOC	0
+#define TAG_ARENA	1
+
+static void * arena_jpeg_get(j_common_ptr cinfo, size_t size){
+	unsigned char * p = NULL;
+	if ( size + ARENA_TAG < size ){
+		return NULL;
+	}
+	if ( ARENA_JPEG_OWNER == cinfo -> client_data ){
+		p = arena_alloc(size + ARENA_TAG);
+	}
+	if ( NULL != p ){
+		p[0] = TAG_ARENA;
+	}else{
+		/* Not a job object, no frame, or arena is out of memory */
+		p = malloc(size + ARENA_TAG);
+		if ( NULL == p ){
+			return NULL;
+		}
+		p[0] = TAG_MALLOC;
+	}
+	return p + ARENA_TAG;
+}
+
+static void arena_jpeg_free(void * object){
+	unsigned char * p = (unsigned char *) object - ARENA_TAG;
+	if ( TAG_MALLOC == p[0] ){
+		free(p);
+	}/* Arena memory is given back by frame closing */
+}
+
+/* Prototypes as in jmemsys.h, which is not installed with the library */
+void * jpeg_get_small(j_common_ptr cinfo, size_t sizeofobject);
+void jpeg_free_small(j_common_ptr cinfo, void * object, size_t sizeofobject);
+void * jpeg_get_large(j_common_ptr cinfo, size_t sizeofobject);
+void jpeg_free_large(j_common_ptr cinfo, void * object, size_t sizeofobject);
+
+void * jpeg_get_small(j_common_ptr cinfo, size_t sizeofobject){
+	return arena_jpeg_get(cinfo, sizeofobject);
+}
+
+void jpeg_free_small(j_common_ptr cinfo, void * object, size_t sizeofobject){
+	(void) cinfo;
+	(void) sizeofobject;
+	arena_jpeg_free(object);
+}
+
+void * jpeg_get_large(j_common_ptr cinfo, size_t sizeofobject){
+	return arena_jpeg_get(cinfo, sizeofobject);
+}
+
+void jpeg_free_large(j_common_ptr cinfo, void * object, size_t sizeofobject){
+	(void) cinfo;
+	(void) sizeofobject;
+	arena_jpeg_free(object);
+}
+#endif
@@ -0,0 +1,109 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+/**
+ * This module provides memory for steganolab jobs.
+ *
+ * Every thread has it's own arena: a list of big memory blocks, taken
+ * from OS with mmap. A job opens a frame, takes memory by moving a
+ * pointer and closes the frame, which makes all the memory, taken since
+ * opening, free at once. Blocks are kept for the next job, so a worker
+ * thread, doing jobs one after one, stops asking OS for memory after
+ * the first (biggest) job. Frames may be nested.
+ *
+ * If STEGANOLAB_JPEG_ARENA is defined, the module also replaces jpeg
+ * library memory back-end (jpeg_get_small, jpeg_get_large and their
+ * free-ers from jmemsys.h), so that jpeg objects of jobs take their
+ * memory from the arena too. The replacement serves the whole process,
+ * so only objects, marked with ARENA_JPEG_OWNER in client_data before
+ * they are created, use the arena, and only while a frame is open;
+ * jpeg objects of anyone else get memory from malloc as usual.
+ */
+
+#define ARENA_HUGEPAGES	0x01	/* Ask OS for transparent huge pages */
+
+extern const char arena_jpeg_owner;
+#define ARENA_JPEG_OWNER	((void *) & arena_jpeg_owner)	/* client_data of job jpeg objects */
+
+struct arena_block;
+
+/**
+ * Arena state, saved at frame opening
+ */
+struct arena_frame {
+	struct arena_block * block;
+	size_t used;
+};
+
+/**
+ * Opens a frame in the current thread arena
+ * @param frame - place to save arena state to
+ */
+void arena_begin(struct arena_frame * frame);
+
+/**
+ * Closes a frame: all the memory, taken after arena_begin, is free.
+ * Frames must be closed in the reverse order of opening.
+ * @param frame - state, saved by arena_begin
+ */
+void arena_end(struct arena_frame * frame);
+
+/**
+ * Takes memory from the current thread arena. The memory is aligned
+ * as malloc's one and lives until the innermost frame is closed.
+ * @param size - bytes to take
+ * @return pointer to memory or NULL if out of memory or there is no
+ * frame open
+ */
+void * arena_alloc(size_t size);
+
+/**
+ * Makes sure the current thread arena can give given number of bytes
+ * without asking OS for memory. Flags are remembered for blocks, taken
+ * later.
+ * @param bytes - bytes to have ready
+ * @param flags - ARENA_* bits
+ * @return 0 if OK, 1 if out of memory
+ */
+char arena_reserve(size_t bytes, unsigned int flags);
+
+/**
+ * Gives all the current thread arena memory back to OS. No frames may
+ * be open.
+ */
+void arena_release();
+
+/**
+ * Gives memory of the current thread arena back to OS, but for blocks
+ * of given size in all, so that the next job of usual size doesn't ask
+ * OS for memory again. No frames may be open.
+ * @param keep - bytes to keep at most
+ */
+void arena_trim(size_t keep);
+
+/**
+ * @return maximal number of bytes, taken from the current thread arena
+ * at once since the last call
+ */
+size_t arena_peak_reset();
+
+#endif
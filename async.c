@@ -0,0 +1,84 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "steganolab.h"
+#include <stdlib.h>
+
+#include "pool.h" /* Executor */
+
+/**
+ * This file implements steganolab_submit: jobs, run by the executor of
+ * pool.c and reported through a callback.
+ */
+
+/**
+ * Job on it's way through the executor
+ */
+struct async_call {
+	struct pool_job job;	/* Must go first */
+	struct steganolab_task * task;
+	steganolab_callback done;
+	void * user;
+};
+
+/**
+ * Runs the job on an executor thread and tells the caller
+ */
+static void async_run(struct pool_job * job){
+	struct async_call * call = (struct async_call *) job;
+	struct steganolab_task * t = call -> task;
+	t -> out = NULL;
+	t -> out_len = 0;
+	if ( NULL != t -> data ){
+		t -> status = steganolab_encode_mem(t -> jpeg, t -> jpeg_len, & t -> out,
+			& t -> out_len, t -> data, t -> len, t -> password, t -> DCT_radius,
+			t -> opts, t -> stats);
+	}else{
+		char * msg;
+		unsigned int len;
+		t -> status = steganolab_decode_mem_opt(t -> jpeg, t -> jpeg_len, &msg,
+			&len, t -> password, t -> DCT_radius, t -> opts, t -> stats);
+		if ( 0 == t -> status ){
+			t -> out = msg;
+			t -> out_len = len;
+		}
+	}
+	steganolab_callback done = call -> done;
+	void * user = call -> user;
+	free(call);
+	done(user, t);
+}
+
+int steganolab_submit(struct steganolab_task * task, steganolab_callback done,
+		void * user){
+	struct async_call * call = malloc(sizeof(struct async_call));
+	if ( NULL == call ){
+		return 20;/* Out of memory */
+	}
+	call -> job.run = async_run;
+	call -> job.priority = task -> priority;
+	call -> task = task;
+	call -> done = done;
+	call -> user = user;
+	if ( pool_submit(& call -> job) ){
+		free(call);
+		return 20;/* No threads */
+	}
+	return 0;
+}
@@ -0,0 +1,616 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "steganolab.h"
+#include "synth.h"
+
+/**
+ * This program measures whole jobs of the library: estimate, encode and
+ * decode over a synthetic carrier corpus (see synth.h), with several
+ * message sizes and DCT radii. Results go to stdout as JSON, one case
+ * per line, so that a run can be kept and given to a later run as a
+ * baseline: cases, that became slower than the baseline by more than
+ * the tolerance, are listed as regressions, and the program fails.
+ *
+ * With --check every message also goes the other way: jpeg in memory
+ * is read and written through TurboJPEG, if it is built in, and a
+ * stream, that can't be mapped, through jpeg library, so that each is
+ * decoded by the other one.
+ */
+
+#define PASSWORD		"benchmark"
+#define MAX_LIST		16
+#define MAX_KEY			96
+
+/**
+ * Run settings from command line
+ */
+struct settings {
+	unsigned int max_mp;		/* Largest carriers to make, megapixels */
+	unsigned int runs;			/* Timed runs of every case */
+	unsigned int payloads[MAX_LIST], npayloads;
+	unsigned int radii[MAX_LIST], nradii;
+	unsigned int threads;
+	char warm;					/* not 0 to keep shuffle tables */
+	char check;					/* not 0 to cross memory and stream jobs */
+	const char * only;			/* Carrier name part, NULL for all */
+	const char * baseline;		/* Baseline file, NULL for none */
+	double tolerance;			/* Slowdown, that is still fine, 0.1 for 10% */
+};
+
+/**
+ * Throughput of a case from an earlier run
+ */
+struct baseline {
+	char key[MAX_KEY];
+	double images_per_s;
+};
+
+/**
+ * Baselines and the cases, that fell behind them
+ */
+struct verdict {
+	struct baseline * known;
+	size_t nknown;
+	char (* slow)[MAX_KEY * 3];	/* JSON objects of regressions */
+	size_t nslow;
+};
+
+static double now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, & ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @return peak resident set size of the process so far, KiB
+ */
+static long peak_rss_kb(){
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, & ru);
+	return ru.ru_maxrss;
+}
+
+static int compare_doubles(const void * a, const void * b){
+	double x = * (const double *) a, y = * (const double *) b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * @param sorted - latencies in ascending order
+ * @param p - fraction, 0.5 for median
+ * @return nearest rank percentile
+ */
+static double percentile(const double * sorted, unsigned int n, double p){
+	unsigned int rank = (unsigned int) (p * n + 0.999999);
+	return sorted[rank ? rank - 1 : 0];
+}
+
+/**
+ * Parses comma separated numbers
+ * @return number of them, 0 if the string is bad
+ */
+static unsigned int parse_list(const char * s, unsigned int * list){
+	unsigned int n = 0;
+	while ( n < MAX_LIST ){
+		char * end;
+		unsigned long v = strtoul(s, & end, 10);
+		if ( end == s ){
+			return 0;
+		}
+		list[n ++] = v;
+		if ( * end == 0 ){
+			return n;
+		}
+		if ( * end != ',' ){
+			return 0;
+		}
+		s = end + 1;
+	}
+	return 0;
+}
+
+/**
+ * Reads results of an earlier run
+ * @return 0 if OK, 1 if the file can't be read
+ */
+static char load_baseline(const char * path, struct verdict * v){
+	FILE * f = fopen(path, "r");
+	char line[4096];
+	if ( NULL == f ){
+		return 1;
+	}
+	while ( fgets(line, sizeof(line), f) ){
+		const char * key = strstr(line, "\"key\": \"");
+		const char * ips = strstr(line, "\"images_per_s\": ");
+		struct baseline * grown;
+		size_t klen;
+		if ( NULL == key || NULL == ips ){
+			continue;
+		}
+		key += strlen("\"key\": \"");
+		klen = strcspn(key, "\"");
+		if ( klen >= MAX_KEY ){
+			continue;
+		}
+		grown = realloc(v -> known, (v -> nknown + 1) * sizeof(* grown));
+		if ( NULL == grown ){
+			fclose(f);
+			return 1;
+		}
+		v -> known = grown;
+		memcpy(grown[v -> nknown].key, key, klen);
+		grown[v -> nknown].key[klen] = 0;
+		grown[v -> nknown].images_per_s = strtod(ips + strlen("\"images_per_s\": "), NULL);
+		v -> nknown += 1;
+	}
+	fclose(f);
+	return 0;
+}
+
+/**
+ * Compares a case with it's baseline, if there is one
+ */
+static void judge(struct verdict * v, const char * key, double images_per_s,
+		double tolerance){
+	size_t i;
+	for(i = 0; i < v -> nknown; i += 1){
+		if ( strcmp(v -> known[i].key, key) ){
+			continue;
+		}
+		if ( images_per_s < v -> known[i].images_per_s * (1 - tolerance) ){
+			void * grown = realloc(v -> slow, (v -> nslow + 1) * sizeof(* v -> slow));
+			if ( NULL == grown ){
+				return;
+			}
+			v -> slow = grown;
+			snprintf(v -> slow[v -> nslow], sizeof(* v -> slow),
+				"{\"key\": \"%s\", \"baseline\": %.4f, \"images_per_s\": %.4f}",
+				key, v -> known[i].images_per_s, images_per_s);
+			v -> nslow += 1;
+		}
+		return;
+	}
+}
+
+/**
+ * Description of one measured case
+ */
+struct bench_case {
+	const char * image;			/* Carrier name */
+	const struct synth_carrier * carrier;
+	size_t jpeg_len;
+	const char * op;
+	unsigned int radius, payload;
+};
+
+/**
+ * Prints a case result line and judges it
+ * @param lat - latencies of runs, seconds, sorted here
+ * @param first - not 0 for the first line of results
+ */
+static void report(const struct bench_case * c, double * lat, unsigned int n,
+		size_t job_peak, const struct settings * s, struct verdict * v,
+		char first){
+	char key[MAX_KEY];
+	double total = 0;
+	unsigned int i;
+	for(i = 0; i < n; i += 1){
+		total += lat[i];
+	}
+	qsort(lat, n, sizeof(* lat), compare_doubles);
+	if ( c -> payload ){
+		snprintf(key, sizeof(key), "%s/%s/r%u/p%u", c -> image, c -> op,
+			c -> radius, c -> payload);
+	}else{
+		snprintf(key, sizeof(key), "%s/%s/r%u", c -> image, c -> op, c -> radius);
+	}
+	printf("%s\n    {\"key\": \"%s\", \"image\": \"%s\", \"width\": %u, "
+		"\"height\": %u, \"layout\": \"%s\", \"progressive\": %s, "
+		"\"restart_rows\": %u, \"jpeg_bytes\": %zu, \"op\": \"%s\", "
+		"\"radius\": %u, \"payload\": %u, \"runs\": %u, "
+		"\"images_per_s\": %.4f, \"payload_mb_per_s\": %.4f, "
+		"\"p50_ms\": %.3f, \"p99_ms\": %.3f, \"job_peak_bytes\": %zu, "
+		"\"peak_rss_kb\": %ld}",
+		first ? "" : ",", key, c -> image, c -> carrier -> width,
+		c -> carrier -> height, synth_layout_name(c -> carrier -> layout),
+		c -> carrier -> progressive ? "true" : "false",
+		c -> carrier -> restart_rows, c -> jpeg_len, c -> op, c -> radius,
+		c -> payload, n, n / total, c -> payload * (double) n / total / 1e6,
+		percentile(lat, n, 0.5) * 1e3, percentile(lat, n, 0.99) * 1e3,
+		job_peak, peak_rss_kb());
+	fflush(stdout);
+	judge(v, key, n / total, s -> tolerance);
+}
+
+/**
+ * Runs one operation over a carrier: a warm-up run, that is not timed,
+ * and timed ones
+ * @param out - for encode, place to put the last output jpeg to, to be
+ * freed by the caller
+ * @param lat - place for latencies, settings -> runs of them
+ * @param job_peak - place to put job memory peak to
+ * @return 0 if OK, library error code otherwise
+ */
+static int run_op(const struct bench_case * c, const char * jpeg, size_t jpeg_len,
+		const char * message, const struct settings * s, char ** out,
+		size_t * out_len, double * lat, size_t * job_peak){
+	struct steganolab_options opts;
+	unsigned int i;
+	steganolab_options_init(& opts);
+	opts.threads = s -> threads;
+	* job_peak = 0;
+	for(i = 0; i <= s -> runs; i += 1){
+		struct steganolab_statistics stats;
+		char * data = NULL;
+		unsigned int len = 0;
+		int rv;
+		double t = now();
+		if ( ! strcmp(c -> op, "estimate") ){
+			rv = steganolab_estimate_mem(jpeg, jpeg_len, c -> radius, & stats);
+		}else if ( ! strcmp(c -> op, "encode") ){
+			free(* out);
+			* out = NULL;
+			rv = steganolab_encode_mem(jpeg, jpeg_len, out, out_len, message,
+				c -> payload, PASSWORD, c -> radius, & opts, & stats);
+		}else{
+			rv = steganolab_decode_mem_opt(jpeg, jpeg_len, & data, & len,
+				PASSWORD, c -> radius, & opts, & stats);
+			if ( ! rv && (len != c -> payload || memcmp(data, message, len)) ){
+				/* Not a library code: the message came back wrong */
+				rv = -1;
+			}
+			free(data);
+		}
+		t = now() - t;
+		if ( rv ){
+			return rv;
+		}
+		if ( i ){
+			lat[i - 1] = t;
+		}
+		if ( stats.peak_memory > * job_peak ){
+			* job_peak = stats.peak_memory;
+		}
+		steganolab_free_statistics(& stats);
+	}
+	return 0;
+}
+
+/**
+ * Decodes a jpeg from a stream, that can't be mapped, so that it goes
+ * through jpeg library, and compares the message
+ * @return 0 if OK, -1 if the message differs, library error code
+ * otherwise
+ */
+static int check_stream_decode(const char * jpeg, size_t jpeg_len,
+		const char * message, unsigned int len, uint8_t radius,
+		const struct steganolab_options * opts){
+	FILE * f = fmemopen((void *) jpeg, jpeg_len, "rb");
+	char * data = NULL;
+	unsigned int got = 0;
+	int rv;
+	if ( NULL == f ){
+		return -1;
+	}
+	rv = steganolab_decode_opt(f, & data, & got, PASSWORD, radius, opts, NULL);
+	fclose(f);
+	if ( ! rv && (got != len || memcmp(data, message, len)) ){
+		rv = -1;
+	}
+	free(data);
+	return rv;
+}
+
+/**
+ * Crosses memory and stream jobs: the output of a memory encode is
+ * decoded from a stream, the output of a stream encode is decoded from
+ * memory
+ * @param stego, stego_len - output of steganolab_encode_mem
+ * @return 0 if OK, -1 if a message differs, library error code
+ * otherwise
+ */
+static int check_cross(const struct bench_case * c, const char * jpeg,
+		size_t jpeg_len, const char * stego, size_t stego_len,
+		const char * message, const struct settings * s){
+	struct steganolab_options opts;
+	char * out = NULL, * data = NULL;
+	size_t out_len = 0;
+	unsigned int len = 0;
+	FILE * in, * outf;
+	int rv;
+	steganolab_options_init(& opts);
+	opts.threads = s -> threads;
+	rv = check_stream_decode(stego, stego_len, message, c -> payload,
+		c -> radius, & opts);
+	if ( rv ){
+		return rv;
+	}
+	in = fmemopen((void *) jpeg, jpeg_len, "rb");
+	outf = open_memstream(& out, & out_len);
+	if ( NULL == in || NULL == outf ){
+		if ( NULL != in ){
+			fclose(in);
+		}
+		if ( NULL != outf ){
+			fclose(outf);
+		}
+		free(out);
+		return -1;
+	}
+	rv = steganolab_encode_opt(in, outf, message, c -> payload, PASSWORD,
+		c -> radius, & opts, NULL);
+	fclose(in);
+	fclose(outf);
+	if ( ! rv ){
+		rv = steganolab_decode_mem_opt(out, out_len, & data, & len, PASSWORD,
+			c -> radius, & opts, NULL);
+		if ( ! rv && (len != c -> payload || memcmp(data, message, len)) ){
+			rv = -1;
+		}
+		free(data);
+	}
+	free(out);
+	return rv;
+}
+
+/**
+ * Measures every operation over one carrier
+ * @param first - not 0 until the first result line is printed
+ * @return 0 if OK, 1 if a job failed
+ */
+static char bench_carrier(const char * name, const struct synth_carrier * carrier,
+		const char * message, const struct settings * s, struct verdict * v,
+		char * first){
+	char * jpeg;
+	size_t jpeg_len;
+	double * lat = malloc(s -> runs * sizeof(* lat));
+	unsigned int r, p;
+	if ( NULL == lat ){
+		return 1;
+	}
+	fprintf(stderr, "%s: making carrier\n", name);
+	if ( synth_make(carrier, & jpeg, & jpeg_len) ){
+		fprintf(stderr, "%s: can't make carrier\n", name);
+		free(lat);
+		return 1;
+	}
+	for(r = 0; r < s -> nradii; r += 1){
+		struct bench_case c = { name, carrier, jpeg_len, "estimate", s -> radii[r], 0 };
+		struct steganolab_statistics stats;
+		unsigned int capacity;
+		size_t job_peak;
+		int rv;
+		rv = run_op(& c, jpeg, jpeg_len, message, s, NULL, NULL, lat, & job_peak);
+		if ( rv ){
+			fprintf(stderr, "%s: estimate failed: %s\n", name, steganolab_describe(rv));
+			goto failed;
+		}
+		report(& c, lat, s -> runs, job_peak, s, v, * first);
+		* first = 0;
+		steganolab_estimate_mem(jpeg, jpeg_len, c.radius, & stats);
+		capacity = steganolab_message_capacity(stats.bits_available);
+		steganolab_free_statistics(& stats);
+		for(p = 0; p < s -> npayloads; p += 1){
+			char * stego = NULL;
+			size_t stego_len;
+			c.payload = s -> payloads[p];
+			if ( c.payload == 0 || c.payload > capacity ){
+				fprintf(stderr, "%s: %u bytes don't fit, skipped\n", name, c.payload);
+				continue;
+			}
+			c.op = "encode";
+			rv = run_op(& c, jpeg, jpeg_len, message, s, & stego, & stego_len,
+				lat, & job_peak);
+			if ( rv ){
+				fprintf(stderr, "%s: encode failed: %s\n", name, steganolab_describe(rv));
+				free(stego);
+				goto failed;
+			}
+			report(& c, lat, s -> runs, job_peak, s, v, 0);
+			c.op = "decode";
+			c.jpeg_len = stego_len;
+			rv = run_op(& c, stego, stego_len, message, s, NULL, NULL, lat, & job_peak);
+			if ( ! rv && s -> check ){
+				rv = check_cross(& c, jpeg, jpeg_len, stego, stego_len, message, s);
+				if ( rv ){
+					fprintf(stderr, "%s: memory and stream jobs disagree: %s\n", name,
+						rv < 0 ? "message differs" : steganolab_describe(rv));
+					free(stego);
+					goto failed;
+				}
+			}
+			free(stego);
+			c.jpeg_len = jpeg_len;
+			if ( rv ){
+				fprintf(stderr, "%s: decode failed: %s\n", name,
+					rv < 0 ? "message differs" : steganolab_describe(rv));
+				goto failed;
+			}
+			report(& c, lat, s -> runs, job_peak, s, v, 0);
+		}
+	}
+	free(jpeg);
+	free(lat);
+	return 0;
+failed:
+	free(jpeg);
+	free(lat);
+	return 1;
+}
+
+static void usage(){
+	fprintf(stderr, "Usage:\t... [options] > results.json\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  --max-mp N       largest carriers, megapixels (12; 100 for the whole corpus)\n");
+	fprintf(stderr, "  --runs N         timed runs of every case (5), after one warm-up run\n");
+	fprintf(stderr, "  --payloads A,B   message sizes, bytes (64,1024,65536)\n");
+	fprintf(stderr, "  --radii A,B      DCT radii (2)\n");
+	fprintf(stderr, "  --threads N      threads for one job (0 - all processors)\n");
+	fprintf(stderr, "  --warm           keep shuffle tables between jobs (64 MiB)\n");
+	fprintf(stderr, "  --check          decode memory jobs from streams and the other way\n");
+	fprintf(stderr, "  --only TEXT      carriers, whose names have TEXT in\n");
+	fprintf(stderr, "  --baseline FILE  results of an earlier run to compare with\n");
+	fprintf(stderr, "  --tolerance F    slowdown, allowed against baseline (0.1)\n");
+	fprintf(stderr, "Exit code is 1 if some case fell behind the baseline, 2 on errors.\n");
+}
+
+/**
+ * @return 0 if OK, 1 if command line is bad
+ */
+static char parse_settings(int argc, char ** argv, struct settings * s){
+	int i;
+	s -> max_mp = 12;
+	s -> runs = 5;
+	s -> payloads[0] = 64;
+	s -> payloads[1] = 1024;
+	s -> payloads[2] = 65536;
+	s -> npayloads = 3;
+	s -> radii[0] = 2;
+	s -> nradii = 1;
+	s -> threads = 0;
+	s -> warm = 0;
+	s -> check = 0;
+	s -> only = NULL;
+	s -> baseline = NULL;
+	s -> tolerance = 0.1;
+	for(i = 1; i < argc; i += 1){
+		const char * arg = argv[i];
+		const char * val = i + 1 < argc ? argv[i + 1] : NULL;
+		if ( ! strcmp(arg, "--warm") ){
+			s -> warm = 1;
+			continue;
+		}
+		if ( ! strcmp(arg, "--check") ){
+			s -> check = 1;
+			continue;
+		}
+		if ( NULL == val ){
+			return 1;
+		}
+		i += 1;
+		if ( ! strcmp(arg, "--max-mp") ){
+			s -> max_mp = atoi(val);
+		}else if ( ! strcmp(arg, "--runs") ){
+			s -> runs = atoi(val);
+			if ( s -> runs == 0 ){
+				return 1;
+			}
+		}else if ( ! strcmp(arg, "--payloads") ){
+			if ( ! (s -> npayloads = parse_list(val, s -> payloads)) ){
+				return 1;
+			}
+		}else if ( ! strcmp(arg, "--radii") ){
+			if ( ! (s -> nradii = parse_list(val, s -> radii)) ){
+				return 1;
+			}
+		}else if ( ! strcmp(arg, "--threads") ){
+			s -> threads = atoi(val);
+		}else if ( ! strcmp(arg, "--only") ){
+			s -> only = val;
+		}else if ( ! strcmp(arg, "--baseline") ){
+			s -> baseline = val;
+		}else if ( ! strcmp(arg, "--tolerance") ){
+			s -> tolerance = atof(val);
+		}else{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char ** argv){
+	struct settings s;
+	struct verdict v = { NULL, 0, NULL, 0 };
+	char * message;
+	unsigned int max_payload = 0, i, size, layout, progressive, restart;
+	uint32_t seed = 1;
+	char first = 1;
+	int toreturn = 0;
+
+	if ( parse_settings(argc, argv, & s) ){
+		usage();
+		return 2;
+	}
+	if ( s.baseline && load_baseline(s.baseline, & v) ){
+		fprintf(stderr, "Can't read baseline %s\n", s.baseline);
+		return 2;
+	}
+	if ( s.warm ){
+		steganolab_shuffle_cache_limit(64 * 1024 * 1024);
+	}
+	/* The same message for all cases, it's beginning for short ones */
+	for(i = 0; i < s.npayloads; i += 1){
+		if ( s.payloads[i] > max_payload ){
+			max_payload = s.payloads[i];
+		}
+	}
+	message = malloc(max_payload + 1);
+	if ( NULL == message ){
+		return 2;
+	}
+	for(i = 0; i < max_payload; i += 1){
+		message[i] = (i * 2654435761u) >> 24;
+	}
+
+	printf("{\"runs\": %u, \"threads\": %u, \"warm\": %s, \"results\": [",
+		s.runs, s.threads, s.warm ? "true" : "false");
+	for(size = 0; size < SYNTH_SIZES; size += 1){
+		if ( (unsigned long long) synth_sizes[size].width * synth_sizes[size].height >
+				s.max_mp * 1000000ull + 500000 ){
+			break;
+		}
+		for(layout = SYNTH_GRAY; layout <= SYNTH_420; layout += 1)
+		for(progressive = 0; progressive < 2; progressive += 1)
+		for(restart = 0; restart < 2; restart += 1){
+			struct synth_carrier carrier = { synth_sizes[size].width,
+				synth_sizes[size].height, layout, progressive, restart, 85, seed ++ };
+			char name[64];
+			snprintf(name, sizeof(name), "%s-%s-%s%s", synth_sizes[size].name,
+				synth_layout_name(layout), progressive ? "prog" : "base",
+				restart ? "-rst" : "");
+			if ( s.only && ! strstr(name, s.only) ){
+				continue;
+			}
+			if ( bench_carrier(name, & carrier, message, & s, & v, & first) ){
+				toreturn = 2;
+			}
+		}
+	}
+	printf("\n  ],\n  \"regressions\": [");
+	for(i = 0; i < v.nslow; i += 1){
+		printf("%s\n    %s", i ? "," : "", v.slow[i]);
+	}
+	printf("%s],\n  \"peak_rss_kb\": %ld\n}\n", v.nslow ? "\n  " : "", peak_rss_kb());
+	if ( v.nslow ){
+		fprintf(stderr, "%zu cases fell behind the baseline\n", v.nslow);
+		if ( ! toreturn ){
+			toreturn = 1;
+		}
+	}
+	free(message);
+	free(v.known);
+	free(v.slow);
+	return toreturn;
+}
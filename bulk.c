@@ -0,0 +1,336 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "steganolab.h"
+#include <stdlib.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "uring.h" /* Asynchronous IO */
+#include "jio.h" /* Publishing outputs */
+
+/**
+ * This file implements steganolab_bulk: a pipeline, that keeps reading
+ * next carriers and writing outputs of jobs done, while the current job
+ * is processed. With io_uring the reads and writes go on in kernel;
+ * without it, or if the ring fails, they are done in place, one by one.
+ * An output replaces the file, that may have it's name, only when it is
+ * completely written.
+ */
+
+#define SLOT_IDLE		0
+#define SLOT_READING	1
+#define SLOT_READY		2
+#define SLOT_WRITING	3
+#define SLOT_FAILED		4
+
+/* Biggest single request, Linux won't do more anyway */
+#define BULK_MAX_IO		0x7ffff000
+
+/**
+ * State of a file being read or written for a job
+ */
+struct bulk_slot {
+	int fd;
+	struct jio_publish out;	/* output file, while writing */
+	char * buf;		/* file contents */
+	size_t len;		/* buf length */
+	size_t done;	/* bytes read or written */
+	char state;
+};
+
+/**
+ * Pipeline state
+ */
+struct bulk {
+	struct steganolab_job * jobs;
+	size_t njobs;
+	struct bulk_slot * slots;
+	struct uring ring;
+	char have_ring;
+	unsigned int writes;	/* outputs being written */
+};
+
+/* Tags of io_uring requests: job index and direction */
+#define TAG(job, write)	((uint64_t)(job) << 1 | (write))
+
+/**
+ * Requests the next piece of slot file to be read or written
+ * @return 0 if OK, 1 if failed
+ */
+static char bulk_next_io(struct bulk * b, size_t job, char write){
+	struct bulk_slot * s = & b -> slots[job];
+	size_t left = s -> len - s -> done;
+	unsigned int piece = left > BULK_MAX_IO ? BULK_MAX_IO : left;
+	if ( b -> have_ring ){
+		char fail;
+		if ( write ){
+			fail = uring_write(& b -> ring, s -> fd, s -> buf + s -> done, piece, s -> done, TAG(job, 1));
+		}else{
+			fail = uring_read(& b -> ring, s -> fd, s -> buf + s -> done, piece, s -> done, TAG(job, 0));
+		}
+		return fail;
+	}
+	/* No io_uring: doing the whole right now */
+	while ( s -> done < s -> len ){
+		left = s -> len - s -> done;
+		piece = left > BULK_MAX_IO ? BULK_MAX_IO : left;
+		ssize_t rv;
+		if ( write ){
+			rv = pwrite(s -> fd, s -> buf + s -> done, piece, s -> done);
+		}else{
+			rv = pread(s -> fd, s -> buf + s -> done, piece, s -> done);
+		}
+		if ( rv <= 0 ){
+			return 1;
+		}
+		s -> done += rv;
+	}
+	return 0;
+}
+
+/**
+ * Finishes slot file IO: closes the file, frees output buffer.
+ * @param ok - 1 if all the data went OK
+ */
+static void bulk_finish(struct bulk * b, size_t job, char ok){
+	struct bulk_slot * s = & b -> slots[job];
+	if ( SLOT_WRITING == s -> state ){
+		if ( ! ok ){
+			jio_publish_abort(& s -> out);
+		}else if ( jio_publish_commit(& s -> out, s -> len) ){
+			ok = 0;
+		}
+	}else{
+		close(s -> fd);
+	}
+	s -> fd = -1;
+	if ( SLOT_WRITING == s -> state ){
+		free(s -> buf);
+		s -> buf = NULL;
+		b -> writes -= 1;
+		if ( ! ok ){
+			b -> jobs[job].status = 32;
+		}
+		s -> state = SLOT_IDLE;
+	}else{
+		s -> state = ok ? SLOT_READY : SLOT_FAILED;
+	}
+}
+
+/**
+ * Opens carrier and starts reading it
+ */
+static void bulk_start_read(struct bulk * b, size_t job){
+	struct bulk_slot * s = & b -> slots[job];
+	struct stat st;
+	s -> state = SLOT_FAILED;
+	s -> fd = open(b -> jobs[job].infile, O_RDONLY);
+	if ( s -> fd < 0 ){
+		return;
+	}
+	if ( fstat(s -> fd, &st) || st.st_size <= 0 ){
+		close(s -> fd);
+		return;
+	}
+	s -> len = st.st_size;
+	s -> done = 0;
+	s -> buf = malloc(s -> len);
+	if ( NULL == s -> buf ){
+		close(s -> fd);
+		return;
+	}
+	s -> state = SLOT_READING;
+	if ( bulk_next_io(b, job, 0) ){
+		bulk_finish(b, job, 0);
+	}else if ( ! b -> have_ring ){
+		bulk_finish(b, job, 1);
+	}
+}
+
+/**
+ * Opens output file and starts writing the buffer, that is from now on
+ * under the pipeline responsibility.
+ */
+static void bulk_start_write(struct bulk * b, size_t job, char * buf, size_t len){
+	struct bulk_slot * s = & b -> slots[job];
+	if ( jio_publish_open(& s -> out, b -> jobs[job].outfile, len) ){
+		free(buf);
+		b -> jobs[job].status = 32;
+		return;
+	}
+	s -> fd = s -> out.fd;
+	s -> buf = buf;
+	s -> len = len;
+	s -> done = 0;
+	s -> state = SLOT_WRITING;
+	b -> writes += 1;
+	if ( bulk_next_io(b, job, 1) ){
+		bulk_finish(b, job, 0);
+	}else if ( ! b -> have_ring ){
+		bulk_finish(b, job, 1);
+	}
+}
+
+/**
+ * Handles a completed request
+ * @param tag - request tag
+ * @param result - bytes done or -errno
+ */
+static void bulk_complete(struct bulk * b, uint64_t tag, int result){
+	size_t job = tag >> 1;
+	char write = tag & 1;
+	struct bulk_slot * s = & b -> slots[job];
+	if ( result < 0 || (0 == result && write) ){
+		bulk_finish(b, job, 0);
+		return;
+	}
+	s -> done += result;
+	if ( 0 == result ){
+		/* File got shorter after fstat */
+		s -> len = s -> done;
+	}
+	if ( s -> done == s -> len ){
+		bulk_finish(b, job, 1);
+	}else if ( bulk_next_io(b, job, write) ){
+		bulk_finish(b, job, 0);
+	}else if ( ! b -> have_ring ){
+		bulk_finish(b, job, 1);
+	}
+}
+
+/**
+ * Gives up the ring, after the kernel refused to take requests: the ones,
+ * it has taken already, are waited for, as their buffers must live until
+ * then, and the rest of every file is read or written in place.
+ */
+static void bulk_ring_failed(struct bulk * b){
+	const struct timespec pause = { 0, 1000000 };
+	uint64_t tag;
+	int result;
+	size_t job;
+	b -> have_ring = 0;
+	while ( b -> ring.inflight ){
+		if ( ! uring_complete(& b -> ring, &tag, &result) ){
+			nanosleep(& pause, NULL);
+			continue;
+		}
+		bulk_complete(b, tag, result);
+	}
+	uring_free(& b -> ring);
+	/* Requests left were never submitted */
+	for ( job = 0; job < b -> njobs; job += 1 ){
+		struct bulk_slot * s = & b -> slots[job];
+		if ( SLOT_READING == s -> state || SLOT_WRITING == s -> state ){
+			bulk_finish(b, job, 0 == bulk_next_io(b, job, SLOT_WRITING == s -> state));
+		}
+	}
+}
+
+/**
+ * Submits queued requests and handles completions.
+ * @param wait - 1 to wait for a completion if there is none
+ */
+static void bulk_poll(struct bulk * b, char wait){
+	if ( ! b -> have_ring ){
+		return;
+	}
+	if ( uring_submit(& b -> ring, wait) ){
+		bulk_ring_failed(b);
+		return;
+	}
+	uint64_t tag;
+	int result;
+	while ( uring_complete(& b -> ring, &tag, &result) ){
+		bulk_complete(b, tag, result);
+	}
+}
+
+int steganolab_bulk(struct steganolab_job * jobs, size_t njobs,
+		unsigned int prefetch, const char * password, uint8_t DCT_radius,
+		const struct steganolab_options * opts){
+	struct bulk b;
+	b.jobs = jobs;
+	b.njobs = njobs;
+	b.writes = 0;
+	b.slots = calloc(njobs ? njobs : 1, sizeof(struct bulk_slot));
+	if ( NULL == b.slots ){
+		return 20;/* Out of memory */
+	}
+	/* A request per read and per write in flight at most */
+	b.have_ring = 0 == uring_init(& b.ring, 2 * (prefetch + 1));
+	size_t cur, next_read = 0;
+	for ( cur = 0; cur < njobs; cur += 1 ){
+		jobs[cur].out = NULL;
+		jobs[cur].out_len = 0;
+	}
+	for ( cur = 0; cur < njobs; cur += 1 ){
+		/* Keeping `prefetch` carriers ahead of the current one */
+		while ( next_read < njobs && next_read <= cur + prefetch ){
+			bulk_start_read(&b, next_read);
+			next_read += 1;
+		}
+		bulk_poll(&b, 0);
+		while ( SLOT_READING == b.slots[cur].state ){
+			bulk_poll(&b, 1);
+		}
+		struct steganolab_job * j = & jobs[cur];
+		struct bulk_slot * s = & b.slots[cur];
+		if ( SLOT_FAILED == s -> state ){
+			free(s -> buf);
+			s -> buf = NULL;
+			s -> state = SLOT_IDLE;
+			j -> status = 31;
+			continue;
+		}
+		char * in = s -> buf;
+		size_t in_len = s -> len;
+		s -> buf = NULL;
+		s -> state = SLOT_IDLE;
+		if ( NULL != j -> data ){
+			char * out;
+			size_t out_len;
+			j -> status = steganolab_encode_mem(in, in_len, &out, &out_len,
+				j -> data, j -> len, password, DCT_radius, opts, NULL);
+			free(in);
+			if ( 0 == j -> status ){
+				/* Not keeping more outputs than carriers */
+				while ( b.writes > prefetch ){
+					bulk_poll(&b, 1);
+				}
+				bulk_start_write(&b, cur, out, out_len);
+			}
+		}else{
+			j -> status = steganolab_decode_mem_opt(in, in_len, & j -> out,
+				& j -> out_len, password, DCT_radius, opts, NULL);
+			free(in);
+		}
+	}
+	while ( b.writes ){
+		bulk_poll(&b, 1);
+	}
+	if ( b.have_ring ){
+		uring_free(& b.ring);
+	}
+	free(b.slots);
+	return 0;
+}
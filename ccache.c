@@ -0,0 +1,194 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ccache.h"
+#include "jio.h"
+#include "pdecode.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <openssl/sha.h>
+#include <openssl/evp.h>
+
+#define CCACHE_MAGIC	"SLCOEF03"
+#define CCACHE_SUFFIX	".coef"
+
+/**
+ * Entry header, coefficients of components follow it
+ */
+struct ccache_head {
+	char magic[8];
+	unsigned char key[CCACHE_KEY_SIZE];
+	uint32_t image_width, image_height;
+	uint32_t components;
+	uint32_t width[MAX_COMPONENTS];		/* Blocks in row */
+	uint32_t height[MAX_COMPONENTS];	/* Rows */
+	unsigned char digest[SHA256_DIGEST_LENGTH];	/* SHA-256 of coefficients */
+};
+
+/* Header bytes, that are known before coefficients */
+#define CCACHE_GEOMETRY	offsetof(struct ccache_head, digest)
+
+void ccache_key(const unsigned char * data, size_t len, unsigned char * key){
+	SHA1(data, len, key);
+}
+
+/**
+ * Makes entry file name
+ * @return malloced name or NULL if out of memory
+ */
+static char * ccache_path(const char * dir, const unsigned char * key){
+	size_t dlen = strlen(dir);
+	char * path = malloc(dlen + 1 + 2 * CCACHE_KEY_SIZE + sizeof(CCACHE_SUFFIX));
+	if ( NULL == path ){
+		return NULL;
+	}
+	memcpy(path, dir, dlen);
+	char * p = path + dlen;
+	* p++ = '/';
+	int ksi;
+	for ( ksi = 0; ksi < CCACHE_KEY_SIZE; ksi += 1 ){
+		p += sprintf(p, "%02x", key[ksi]);
+	}
+	memcpy(p, CCACHE_SUFFIX, sizeof(CCACHE_SUFFIX));
+	return path;
+}
+
+/**
+ * Fills header for the image
+ * @return entry size
+ */
+static size_t ccache_head_fill(struct ccache_head * head, j_decompress_ptr cinfo,
+		const unsigned char * key){
+	memset(head, 0, sizeof(* head));
+	memcpy(head -> magic, CCACHE_MAGIC, sizeof(head -> magic));
+	memcpy(head -> key, key, CCACHE_KEY_SIZE);
+	head -> image_width = cinfo -> image_width;
+	head -> image_height = cinfo -> image_height;
+	head -> components = cinfo -> num_components;
+	size_t size = sizeof(* head);
+	int ci;
+	for ( ci = 0; ci < cinfo -> num_components; ci += 1 ){
+		head -> width[ci] = cinfo -> comp_info[ci].width_in_blocks;
+		head -> height[ci] = cinfo -> comp_info[ci].height_in_blocks;
+		size += (size_t) head -> width[ci] * head -> height[ci] * sizeof(JBLOCK);
+	}
+	return size;
+}
+
+jvirt_barray_ptr * ccache_load(j_decompress_ptr cinfo, const char * dir,
+		const unsigned char * key){
+	char * path = ccache_path(dir, key);
+	if ( NULL == path ){
+		return NULL;
+	}
+	int fd = open(path, O_RDONLY);
+	free(path);
+	if ( fd < 0 ){
+		return NULL;
+	}
+	struct stat st;
+	struct ccache_head head;
+	size_t size = ccache_head_fill(&head, cinfo, key);
+	if ( fstat(fd, &st) || (uintmax_t) st.st_size != size ){
+		close(fd);
+		return NULL;
+	}
+	const unsigned char * map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if ( MAP_FAILED == map ){
+		return NULL;
+	}
+	madvise((void *) map, size, MADV_SEQUENTIAL);
+	if ( memcmp(map, &head, CCACHE_GEOMETRY) ){
+		/* Other geometry: SHA1 collision or a broken entry */
+		munmap((void *) map, size);
+		return NULL;
+	}
+	/* Checked before anything is allocated, so that a miss changes nothing */
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	if ( 1 != EVP_Digest(map + sizeof(head), size - sizeof(head), digest, NULL,
+				EVP_sha256(), NULL) ||
+			memcmp(((const struct ccache_head *) map) -> digest, digest, sizeof(digest)) ){
+		/* Corrupted or stale coefficients */
+		munmap((void *) map, size);
+		return NULL;
+	}
+	JBLOCKARRAY rows[MAX_COMPONENTS];
+	jvirt_barray_ptr * arrays = pdecode_alloc_arrays(cinfo, rows);
+	const unsigned char * p = map + sizeof(head);
+	int ci;
+	for ( ci = 0; ci < cinfo -> num_components; ci += 1 ){
+		size_t row_size = (size_t) head.width[ci] * sizeof(JBLOCK);
+		JDIMENSION row;
+		for ( row = 0; row < head.height[ci]; row += 1 ){
+			memcpy(rows[ci][row], p, row_size);
+			p += row_size;
+		}
+	}
+	munmap((void *) map, size);
+	return arrays;
+}
+
+void ccache_store(j_decompress_ptr cinfo, jvirt_barray_ptr * arrays,
+		const char * dir, const unsigned char * key){
+	char * path = ccache_path(dir, key);
+	if ( NULL == path ){
+		return;
+	}
+	struct ccache_head head;
+	size_t size = ccache_head_fill(&head, cinfo, key);
+	struct jio_publish out;
+	char fail = jio_publish_open(&out, path, size);
+	free(path);
+	if ( fail ){
+		return;
+	}
+	/* Header goes first, its digest is written, when it is known */
+	EVP_MD_CTX * md = EVP_MD_CTX_new();
+	fail = NULL == md || 1 != EVP_DigestInit_ex(md, EVP_sha256(), NULL) ||
+		jio_write_all(out.fd, &head, sizeof(head));
+	int ci;
+	for ( ci = 0; ci < cinfo -> num_components && ! fail; ci += 1 ){
+		JDIMENSION row;
+		for ( row = 0; row < head.height[ci] && ! fail; row += 1 ){
+			JBLOCKARRAY B = (cinfo -> mem -> access_virt_barray)((j_common_ptr) cinfo,
+				arrays[ci], row, 1, FALSE);
+			fail = jio_write_all(out.fd, B[0], (size_t) head.width[ci] * sizeof(JBLOCK)) ||
+				1 != EVP_DigestUpdate(md, B[0], (size_t) head.width[ci] * sizeof(JBLOCK));
+		}
+	}
+	if ( ! fail ){
+		fail = 1 != EVP_DigestFinal_ex(md, head.digest, NULL) ||
+			(ssize_t) sizeof(head.digest) != pwrite(out.fd, head.digest, sizeof(head.digest),
+				offsetof(struct ccache_head, digest));
+	}
+	EVP_MD_CTX_free(md);
+	if ( fail ){
+		jio_publish_abort(&out);
+	}else{
+		jio_publish_commit(&out, size);
+	}
+}
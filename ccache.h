@@ -0,0 +1,70 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CCACHE_H
+#define CCACHE_H
+#include <stddef.h>
+#include <stdio.h>
+#include <jpeglib.h>
+/**
+ * This module keeps decoded DCT coefficients of carriers in a
+ * directory, so that a carrier, used again, is not Huffman decoded
+ * again. Entries are named by SHA1 of carrier file contents and hold
+ * the same SHA1, component geometry, coefficients of real (not padding)
+ * blocks, row by row, in host byte order, and SHA-256 of the coefficients,
+ * which is checked on every load: a broken entry is a miss. Tables and
+ * the rest of parameters are taken from jpeg header, which is read
+ * anyway.
+ */
+
+#define CCACHE_KEY_SIZE	20
+
+/**
+ * Makes cache key of carrier contents
+ * @param data - whole jpeg file
+ * @param len - file length
+ * @param key - place for CCACHE_KEY_SIZE bytes
+ */
+void ccache_key(const unsigned char * data, size_t len, unsigned char * key);
+
+/**
+ * Loads coefficients from cache. Must be called right after
+ * jpeg_read_header, in place of jpeg_read_coefficients.
+ * @param cinfo - decompressor, that has read the header
+ * @param dir - cache directory
+ * @param key - carrier key
+ * @return coefficient arrays or NULL if there is no (good) entry,
+ * nothing is changed then
+ */
+jvirt_barray_ptr * ccache_load(j_decompress_ptr cinfo, const char * dir,
+		const unsigned char * key);
+
+/**
+ * Puts coefficients to cache. The entry appears at once, when written
+ * completely. Failures are silent: cache is only a cache.
+ * @param cinfo - decompressor, arrays belong to
+ * @param arrays - coefficients, as they are in the carrier
+ * @param dir - cache directory
+ * @param key - carrier key
+ */
+void ccache_store(j_decompress_ptr cinfo, jvirt_barray_ptr * arrays,
+		const char * dir, const unsigned char * key);
+
+#endif
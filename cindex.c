@@ -0,0 +1,416 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define _GNU_SOURCE /* DT_* of dirent */
+#include "steganolab.h"
+#include "jio.h"
+#include "pool.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/**
+ * This file implements carrier index, see steganolab.h
+ *
+ * Index file is: header, entries sorted by usable_blocks (then by
+ * name), and NUL-terminated file names, that entries point to. Numbers
+ * are in host byte order, the file is mapped as is.
+ */
+
+#define INDEX_MAGIC	"SLINDEX1"
+
+struct index_head {
+	char magic[8];
+	uint32_t count;			/* Entries */
+	uint32_t names_size;	/* Bytes of names */
+};
+
+struct index_entry {
+	uint64_t file_size;
+	uint32_t usable_blocks;
+	uint32_t name;			/* Offset of name */
+	uint16_t width, height;
+	uint8_t color_channels;
+	uint8_t sampling[4];
+	uint8_t reserved[7];
+};
+
+struct steganolab_index {
+	void * map;
+	size_t map_len;
+	const struct index_entry * entries;
+	uint32_t count;
+	const char * names;
+};
+
+/**
+ * Carrier, found while scanning
+ */
+struct scan_item {
+	char * path;
+	struct index_entry entry;
+	char ok;				/* Is a jpeg */
+};
+
+/**
+ * Growing list of carriers
+ */
+struct scan_list {
+	struct scan_item * items;
+	size_t count, size;
+};
+
+/**
+ * @return 1 if file name looks like jpeg, 0 if not
+ */
+static char is_jpeg_name(const char * name){
+	const char * dot = strrchr(name, '.');
+	return NULL != dot && ( ! strcasecmp(dot, ".jpg") || ! strcasecmp(dot, ".jpeg") );
+}
+
+/**
+ * Adds jpeg files of directory tree to list. Symbolic links are not
+ * followed, so that loops are impossible.
+ * @return 0 if OK, 33 if root can't be read, 20 if out of memory
+ */
+static int scan_dir(const char * dir, struct scan_list * list){
+	DIR * d = opendir(dir);
+	if ( NULL == d ){
+		return 33;
+	}
+	size_t dlen = strlen(dir);
+	int rv = 0;
+	struct dirent * de;
+	while ( 0 == rv && NULL != (de = readdir(d)) ){
+		if ( ! strcmp(de -> d_name, ".") || ! strcmp(de -> d_name, "..") ){
+			continue;
+		}
+		char * path = malloc(dlen + strlen(de -> d_name) + 2);
+		if ( NULL == path ){
+			rv = 20;
+			break;
+		}
+		sprintf(path, "%s/%s", dir, de -> d_name);
+		unsigned char type = de -> d_type;
+		if ( DT_UNKNOWN == type ){
+			struct stat st;
+			type = lstat(path, &st) ? DT_UNKNOWN : S_ISDIR(st.st_mode) ? DT_DIR :
+				S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+		}
+		if ( DT_DIR == type ){
+			/* Unreadable subdirectories are skipped */
+			if ( 20 == scan_dir(path, list) ){
+				rv = 20;
+			}
+			free(path);
+			continue;
+		}
+		if ( DT_REG != type || ! is_jpeg_name(de -> d_name) ){
+			free(path);
+			continue;
+		}
+		if ( list -> count == list -> size ){
+			size_t size = list -> size * 2 + 64;
+			struct scan_item * items = realloc(list -> items, size * sizeof(* items));
+			if ( NULL == items ){
+				free(path);
+				rv = 20;
+				break;
+			}
+			list -> items = items;
+			list -> size = size;
+		}
+		list -> items[list -> count].path = path;
+		list -> items[list -> count].ok = 0;
+		list -> count += 1;
+	}
+	closedir(d);
+	return rv;
+}
+
+/**
+ * Studies one carrier header: pool task
+ */
+static void study_carrier(void * arg, unsigned int n){
+	struct scan_item * item = ((struct scan_list *) arg) -> items + n;
+	SLFILE * f = fopen(item -> path, "r");
+	if ( NULL == f ){
+		return;
+	}
+	struct stat st;
+	struct steganolab_statistics stats;
+	if ( fstat(fileno(f), &st) || steganolab_estimate(f, 0, &stats) ){
+		fclose(f);
+		return;
+	}
+	fclose(f);
+	struct index_entry * e = & item -> entry;
+	memset(e, 0, sizeof(* e));
+	e -> file_size = st.st_size;
+	e -> color_channels = stats.color_channels;
+	uint8_t ksi;
+	for ( ksi = 0; ksi < stats.color_channels; ksi += 1 ){
+		const struct color_channel_info * c = stats.info + ksi;
+		e -> usable_blocks += c -> usable_DCT_blocks;
+		/* The channel, that is not subsampled, has image size */
+		if ( (unsigned int) c -> w > e -> width ){
+			e -> width = c -> w;
+		}
+		if ( (unsigned int) c -> h > e -> height ){
+			e -> height = c -> h;
+		}
+		if ( ksi < 4 ){
+			e -> sampling[ksi] = (uint8_t)(c -> h_samp_factor << 4 | c -> v_samp_factor);
+		}
+	}
+	steganolab_free_statistics(&stats);
+	item -> ok = 1;
+}
+
+/**
+ * Order of entries in index
+ */
+static int item_compare(const void * a, const void * b){
+	const struct scan_item * x = a, * y = b;
+	if ( x -> entry.usable_blocks != y -> entry.usable_blocks ){
+		return x -> entry.usable_blocks < y -> entry.usable_blocks ? -1 : 1;
+	}
+	return strcmp(x -> path, y -> path);
+}
+
+int steganolab_index_build(const char * root, const char * index_path,
+		unsigned int threads){
+	struct scan_list list = { NULL, 0, 0 };
+	int rv = scan_dir(root, &list);
+	size_t ksi, good = 0, names_size = 0;
+	if ( 0 == rv && list.count > UINT32_MAX ){
+		rv = 20;
+	}
+	if ( 0 == rv ){
+		pool_for(threads, (unsigned int) list.count, study_carrier, &list);
+		/* Leaving jpeg files only */
+		for ( ksi = 0; ksi < list.count; ksi += 1 ){
+			if ( list.items[ksi].ok ){
+				list.items[good++] = list.items[ksi];
+			}else{
+				free(list.items[ksi].path);
+			}
+		}
+		list.count = good;
+		qsort(list.items, list.count, sizeof(* list.items), item_compare);
+		for ( ksi = 0; ksi < list.count; ksi += 1 ){
+			list.items[ksi].entry.name = (uint32_t) names_size;
+			names_size += strlen(list.items[ksi].path) + 1;
+		}
+		if ( names_size > UINT32_MAX ){
+			rv = 20;
+		}
+	}
+	unsigned char * buf = NULL;
+	size_t size = sizeof(struct index_head) + list.count * sizeof(struct index_entry) + names_size;
+	if ( 0 == rv ){
+		buf = malloc(size);
+		if ( NULL == buf ){
+			rv = 20;
+		}
+	}
+	if ( 0 == rv ){
+		struct index_head head;
+		memcpy(head.magic, INDEX_MAGIC, sizeof(head.magic));
+		head.count = (uint32_t) list.count;
+		head.names_size = (uint32_t) names_size;
+		memcpy(buf, &head, sizeof(head));
+		unsigned char * p = buf + sizeof(head);
+		for ( ksi = 0; ksi < list.count; ksi += 1 ){
+			memcpy(p, & list.items[ksi].entry, sizeof(struct index_entry));
+			p += sizeof(struct index_entry);
+		}
+		for ( ksi = 0; ksi < list.count; ksi += 1 ){
+			size_t len = strlen(list.items[ksi].path) + 1;
+			memcpy(p, list.items[ksi].path, len);
+			p += len;
+		}
+		struct jio_publish out;
+		if ( jio_publish_open(&out, index_path, size) ){
+			rv = 32;
+		}else if ( jio_write_all(out.fd, buf, size) ){
+			jio_publish_abort(&out);
+			rv = 32;
+		}else if ( jio_publish_commit(&out, size) ){
+			rv = 32;
+		}
+	}
+	free(buf);
+	for ( ksi = 0; ksi < list.count; ksi += 1 ){
+		free(list.items[ksi].path);
+	}
+	free(list.items);
+	return rv;
+}
+
+int steganolab_index_open(const char * index_path, struct steganolab_index ** index){
+	int fd = open(index_path, O_RDONLY);
+	if ( fd < 0 ){
+		return 31;
+	}
+	struct stat st;
+	if ( fstat(fd, &st) || (uintmax_t) st.st_size < sizeof(struct index_head) ||
+			(uintmax_t) st.st_size > SIZE_MAX ){
+		close(fd);
+		return 34;
+	}
+	size_t len = st.st_size;
+	void * map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if ( MAP_FAILED == map ){
+		return 31;
+	}
+	const struct index_head * head = map;
+	size_t entries_size = (size_t) head -> count * sizeof(struct index_entry);
+	const struct index_entry * entries = (const void *)(head + 1);
+	const char * names = (const char *) entries + entries_size;
+	char bad = memcmp(head -> magic, INDEX_MAGIC, sizeof(head -> magic)) ||
+		len != sizeof(* head) + entries_size + head -> names_size ||
+		( head -> names_size && names[head -> names_size - 1] );
+	uint32_t ksi;
+	for ( ksi = 0; ! bad && ksi < head -> count; ksi += 1 ){
+		bad = entries[ksi].name >= head -> names_size;
+	}
+	if ( bad ){
+		munmap(map, len);
+		return 34;
+	}
+	struct steganolab_index * idx = malloc(sizeof(* idx));
+	if ( NULL == idx ){
+		munmap(map, len);
+		return 20;
+	}
+	idx -> map = map;
+	idx -> map_len = len;
+	idx -> entries = entries;
+	idx -> count = head -> count;
+	idx -> names = names;
+	* index = idx;
+	return 0;
+}
+
+void steganolab_index_close(struct steganolab_index * index){
+	munmap(index -> map, index -> map_len);
+	free(index);
+}
+
+unsigned int steganolab_index_count(const struct steganolab_index * index){
+	return index -> count;
+}
+
+void steganolab_index_get(const struct steganolab_index * index, unsigned int n,
+		struct steganolab_carrier * carrier){
+	const struct index_entry * e = index -> entries + n;
+	carrier -> path = index -> names + e -> name;
+	carrier -> file_size = e -> file_size;
+	carrier -> usable_blocks = e -> usable_blocks;
+	carrier -> width = e -> width;
+	carrier -> height = e -> height;
+	carrier -> color_channels = e -> color_channels;
+	memcpy(carrier -> sampling, e -> sampling, sizeof(carrier -> sampling));
+}
+
+/**
+ * Finds the first of carriers [0, end), that has at least given blocks
+ * @return carrier number or -1 if none
+ */
+static long first_with_blocks(const struct steganolab_index * index,
+		unsigned long long blocks, unsigned int end){
+	unsigned int lo = 0, hi = end;
+	while ( lo < hi ){
+		unsigned int mid = lo + (hi - lo) / 2;
+		if ( index -> entries[mid].usable_blocks < blocks ){
+			lo = mid + 1;
+		}else{
+			hi = mid;
+		}
+	}
+	return lo < end ? (long) lo : -1;
+}
+
+/**
+ * @return blocks, message of given length needs, or 0 if radius
+ * gives no bits
+ */
+static unsigned long long blocks_for(unsigned int len, uint8_t DCT_radius){
+	uint8_t per_block = steganolab_bits_in_block(DCT_radius);
+	if ( 0 == per_block ){
+		return 0;
+	}
+	return (steganolab_message_bits(len) + per_block - 1) / per_block;
+}
+
+long steganolab_index_best_fit(const struct steganolab_index * index,
+		unsigned int len, uint8_t DCT_radius){
+	unsigned long long blocks = blocks_for(len, DCT_radius);
+	if ( 0 == blocks ){
+		return -1;
+	}
+	return first_with_blocks(index, blocks, index -> count);
+}
+
+unsigned int steganolab_index_pack(const struct steganolab_index * index,
+		unsigned long long len, uint8_t DCT_radius,
+		struct steganolab_pick * picks, unsigned int max_picks){
+	uint8_t per_block = steganolab_bits_in_block(DCT_radius);
+	unsigned int n = 0;
+	unsigned int top = index -> count;	/* Carriers [0, top) are free */
+	if ( 0 == per_block ){
+		return 0;
+	}
+	while ( n < max_picks ){
+		if ( len <= UINT_MAX ){
+			/* Does the rest fit in one? */
+			long fit = first_with_blocks(index, blocks_for((unsigned int) len, DCT_radius), top);
+			if ( fit >= 0 ){
+				picks[n].carrier = (unsigned int) fit;
+				picks[n].len = (unsigned int) len;
+				return n + 1;
+			}
+		}
+		if ( 0 == top || n + 1 == max_picks ){
+			break;
+		}
+		/* Filling up the biggest free one */
+		top -= 1;
+		unsigned int cap = steganolab_message_capacity(
+			(unsigned long long) index -> entries[top].usable_blocks * per_block);
+		if ( 0 == cap ){
+			break;
+		}
+		picks[n].carrier = top;
+		picks[n].len = cap;
+		n += 1;
+		len -= cap;
+	}
+	return 0;
+}
@@ -22,6 +22,15 @@
 #include <stdio.h>
 #include <assert.h>
 
+/* Bytes, processed by this thread */
+static __thread unsigned long long ciphered;
+
+unsigned long long cipher_bytes_reset(){
+	unsigned long long bytes = ciphered;
+	ciphered = 0;
+	return bytes;
+}
+
 void cipher(unsigned char * data, size_t len, const char * password, int direction){
 	int enc;
 	assert(direction == ENCRYPT || direction == DECRYPT);
@@ -42,6 +51,7 @@ void cipher(unsigned char * data, size_t len, const char * password, int directi
 	BF_KEY key;
 	BF_set_key(&key, strlen(password), password);
 	size_t nblocks = len / CIPHER_BLOCK_SIZE;	
+	ciphered += nblocks * CIPHER_BLOCK_SIZE;
 	long cipher_batch =  16*1024*CIPHER_BLOCK_SIZE; /* 128 Kb of data to cipher at one time */
 	unsigned char buf[cipher_batch];
 	size_t unciphered, last_pack;
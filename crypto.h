@@ -47,4 +47,11 @@
  */
 void cipher(unsigned char * data, size_t len, const char * password, int direction);
 
+/**
+ * Tells how many bytes cipher() has processed in this thread since the
+ * previous call, and starts counting again.
+ * @return bytes ciphered or deciphered
+ */
+unsigned long long cipher_bytes_reset();
+
 #endif
@@ -0,0 +1,118 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "hist.h"
+#include <string.h>
+
+/**
+ * @return bucket number for value
+ */
+static unsigned int hist_bucket(uint64_t value){
+	unsigned int shift;
+	if ( value < 2 * HIST_SUB ){
+		return value;
+	}
+	shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+	if ( shift > HIST_MAX_SHIFT ){
+		return HIST_BUCKETS - 1;
+	}
+	return (shift + 1) * HIST_SUB + (unsigned int) ((value >> shift) - HIST_SUB);
+}
+
+uint64_t hist_bucket_top(unsigned int n){
+	unsigned int shift;
+	if ( n < 2 * HIST_SUB ){
+		return n;
+	}
+	shift = n / HIST_SUB - 1;
+	return ((uint64_t) (HIST_SUB + n % HIST_SUB) << shift) + ((uint64_t) 1 << shift) - 1;
+}
+
+void hist_init(struct hist * self){
+	memset(self, 0, sizeof(* self));
+}
+
+void hist_add(struct hist * self, uint64_t value, uint64_t count){
+	self -> counts[hist_bucket(value)] += count;
+	self -> total += count;
+	if ( value > self -> max ){
+		self -> max = value;
+	}
+}
+
+void hist_merge(struct hist * self, const struct hist * other){
+	unsigned int i;
+	for(i = 0; i < HIST_BUCKETS; i += 1){
+		self -> counts[i] += other -> counts[i];
+	}
+	self -> total += other -> total;
+	if ( other -> max > self -> max ){
+		self -> max = other -> max;
+	}
+}
+
+void hist_correct(const struct hist * self, struct hist * dest, uint64_t interval){
+	unsigned int i;
+	hist_merge(dest, self);
+	if ( interval == 0 ){
+		return;
+	}
+	for(i = 0; i < HIST_BUCKETS; i += 1){
+		uint64_t value = hist_bucket_top(i), missed;
+		if ( self -> counts[i] == 0 ){
+			continue;
+		}
+		if ( value > self -> max ){
+			value = self -> max;
+		}
+		for(missed = value - interval; value > interval && missed >= interval;
+				missed -= interval){
+			hist_add(dest, missed, self -> counts[i]);
+		}
+	}
+}
+
+uint64_t hist_percentile(const struct hist * self, double p){
+	uint64_t rank, seen = 0;
+	double exact;
+	unsigned int i;
+	if ( self -> total == 0 ){
+		return 0;
+	}
+	if ( p >= 100 ){
+		return self -> max;
+	}
+	/* Nearest rank: ceil(p / 100 * total), counted from 1 */
+	exact = p / 100 * self -> total;
+	rank = (uint64_t) exact;
+	if ( rank < exact ){
+		rank += 1;
+	}
+	if ( rank < 1 ){
+		rank = 1;
+	}
+	for(i = 0; i < HIST_BUCKETS; i += 1){
+		seen += self -> counts[i];
+		if ( seen >= rank ){
+			uint64_t top = hist_bucket_top(i);
+			return top < self -> max ? top : self -> max;
+		}
+	}
+	return self -> max;
+}
@@ -0,0 +1,85 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HIST_H
+#define HIST_H
+#include <stdint.h>
+/**
+ * This module keeps latency histograms in the way of HdrHistogram: a
+ * value falls in a bucket by it's highest bit and the next HIST_SUB_BITS
+ * bits below, so that every value is known within 1/256 of itself, from
+ * one microsecond to days, in a fixed array. Recording is an increment;
+ * histograms of several threads are merged by adding them.
+ */
+
+#define HIST_SUB_BITS	8
+#define HIST_SUB		(1 << HIST_SUB_BITS)
+#define HIST_MAX_SHIFT	32		/* Values up to 2^40 */
+#define HIST_BUCKETS	((HIST_MAX_SHIFT + 2) * HIST_SUB)
+
+struct hist {
+	uint64_t counts[HIST_BUCKETS];
+	uint64_t total;		/* Values recorded */
+	uint64_t max;		/* The largest of them, exactly */
+};
+
+/**
+ * Empties histogram
+ */
+void hist_init(struct hist * self);
+
+/**
+ * Records a value
+ * @param value - in any units, microseconds for latencies
+ * @param count - times to record it
+ */
+void hist_add(struct hist * self, uint64_t value, uint64_t count);
+
+/**
+ * Adds all values of another histogram
+ */
+void hist_merge(struct hist * self, const struct hist * other);
+
+/**
+ * Adds values, that a stalled measurement has missed: when a value is
+ * longer than the interval, jobs should have been started at, values
+ * less by one interval, two intervals and so on are recorded too, as
+ * the jobs, that waited behind it, would have seen them.
+ * @param dest - histogram to add corrected values to, not self
+ * @param interval - expected interval between jobs, 0 for no correction
+ */
+void hist_correct(const struct hist * self, struct hist * dest, uint64_t interval);
+
+/**
+ * Tells a percentile
+ * @param p - percentile, 99.9 for example
+ * @return the highest value, equivalent to the one at p (the largest
+ * value for 100), 0 for empty histogram
+ */
+uint64_t hist_percentile(const struct hist * self, double p);
+
+/**
+ * Tells a bucket
+ * @param n - bucket number, less than HIST_BUCKETS
+ * @return the highest value, that falls in the bucket
+ */
+uint64_t hist_bucket_top(unsigned int n);
+
+#endif
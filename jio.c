@@ -0,0 +1,642 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE /* O_TMPFILE, fallocate, linkat */
+#include "jio.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <jerror.h>
+
+#define JIO_MIN_BUF		(64 * 1024)
+#define JIO_MAX_BUF		(64 * 1024 * 1024)
+
+char jio_write_all(int fd, const void * buf, size_t len){
+	const char * p = buf;
+	while ( len ){
+		ssize_t rv = write(fd, p, len);
+		if ( rv < 0 ){
+			if ( EINTR == errno ){
+				continue;
+			}
+			return 1;
+		}
+		p += rv;
+		len -= rv;
+	}
+	return 0;
+}
+
+size_t jio_dest_size(size_t input_len){
+	/* Output is about as big as input: re-encoding with standard
+	 * tables may grow it a bit */
+	size_t size = input_len + input_len / 8 + JIO_MIN_BUF;
+	if ( size < input_len || size > JIO_MAX_BUF ){
+		size = JIO_MAX_BUF;
+	}
+	return size;
+}
+
+static void jio_init_destination(j_compress_ptr cinfo){
+	struct jio_dest * d = (struct jio_dest *) cinfo -> dest;
+	d -> pub.next_output_byte = d -> buf;
+	d -> pub.free_in_buffer = d -> size;
+	d -> written = 0;
+}
+
+static boolean jio_empty_output_buffer(j_compress_ptr cinfo){
+	struct jio_dest * d = (struct jio_dest *) cinfo -> dest;
+	/* Jpeg library calls this with the whole buffer full */
+	if ( jio_write_all(d -> fd, d -> buf, d -> size) ){
+		ERREXIT(cinfo, JERR_FILE_WRITE);
+	}
+	d -> written += d -> size;
+	d -> pub.next_output_byte = d -> buf;
+	d -> pub.free_in_buffer = d -> size;
+	return TRUE;
+}
+
+static void jio_term_destination(j_compress_ptr cinfo){
+	struct jio_dest * d = (struct jio_dest *) cinfo -> dest;
+	size_t left = d -> size - d -> pub.free_in_buffer;
+	if ( jio_write_all(d -> fd, d -> buf, left) ){
+		ERREXIT(cinfo, JERR_FILE_WRITE);
+	}
+	d -> written += left;
+}
+
+void jio_dest_attach(j_compress_ptr cinfo, struct jio_dest * dest, int fd,
+		JOCTET * buf, size_t size){
+	dest -> pub.init_destination = jio_init_destination;
+	dest -> pub.empty_output_buffer = jio_empty_output_buffer;
+	dest -> pub.term_destination = jio_term_destination;
+	dest -> fd = fd;
+	dest -> buf = buf;
+	dest -> size = size;
+	dest -> written = 0;
+	cinfo -> dest = & dest -> pub;
+}
+
+static void jio_grow_init_destination(j_compress_ptr cinfo){
+	struct jio_grow * g = (struct jio_grow *) cinfo -> dest;
+	g -> pub.next_output_byte = g -> buf;
+	g -> pub.free_in_buffer = g -> size;
+	g -> len = 0;
+}
+
+static boolean jio_grow_empty_output_buffer(j_compress_ptr cinfo){
+	struct jio_grow * g = (struct jio_grow *) cinfo -> dest;
+	/* Jpeg library calls this with the whole buffer full */
+	size_t size = g -> size * 2;
+	JOCTET * buf = size > g -> size ? realloc(g -> buf, size) : NULL;
+	if ( NULL == buf ){
+		ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 10);
+	}
+	g -> pub.next_output_byte = buf + g -> size;
+	g -> pub.free_in_buffer = size - g -> size;
+	g -> buf = buf;
+	g -> size = size;
+	return TRUE;
+}
+
+static void jio_grow_term_destination(j_compress_ptr cinfo){
+	struct jio_grow * g = (struct jio_grow *) cinfo -> dest;
+	g -> len = g -> size - g -> pub.free_in_buffer;
+}
+
+char jio_grow_attach(j_compress_ptr cinfo, struct jio_grow * dest, size_t size){
+	dest -> pub.init_destination = jio_grow_init_destination;
+	dest -> pub.empty_output_buffer = jio_grow_empty_output_buffer;
+	dest -> pub.term_destination = jio_grow_term_destination;
+	dest -> buf = malloc(size);
+	dest -> size = size;
+	dest -> len = 0;
+	cinfo -> dest = & dest -> pub;
+	return NULL == dest -> buf;
+}
+
+/**
+ * @return process file creation mask
+ */
+static mode_t jio_umask(){
+	mode_t mask = umask(0);
+	umask(mask);
+	return mask;
+}
+
+/**
+ * @return directory part of path, malloced, or NULL if out of memory
+ */
+static char * jio_dirname(const char * path){
+	const char * slash = strrchr(path, '/');
+	if ( NULL == slash ){
+		return strdup(".");
+	}
+	if ( slash == path ){
+		return strdup("/");
+	}
+	return strndup(path, slash - path);
+}
+
+char jio_publish_open(struct jio_publish * self, const char * path, size_t size_hint){
+	self -> path = strdup(path);
+	self -> tmp_path = NULL;
+	self -> fd = -1;
+	if ( NULL == self -> path ){
+		return 1;
+	}
+#ifdef O_TMPFILE
+	char * dir = jio_dirname(path);
+	if ( NULL == dir ){
+		free(self -> path);
+		return 1;
+	}
+	self -> fd = open(dir, O_TMPFILE | O_WRONLY, 0666);
+	free(dir);
+#endif
+	if ( self -> fd < 0 ){
+		/* File system can't do anonymous files */
+		size_t len = strlen(path);
+		self -> tmp_path = malloc(len + sizeof(".XXXXXX"));
+		if ( NULL == self -> tmp_path ){
+			free(self -> path);
+			return 1;
+		}
+		memcpy(self -> tmp_path, path, len);
+		memcpy(self -> tmp_path + len, ".XXXXXX", sizeof(".XXXXXX"));
+		self -> fd = mkstemp(self -> tmp_path);
+		if ( self -> fd < 0 ){
+			free(self -> tmp_path);
+			free(self -> path);
+			return 1;
+		}
+		fchmod(self -> fd, 0666 & ~jio_umask());
+	}
+#ifdef __linux__
+	if ( size_hint ){
+		/* Reserving space so that the file is not fragmented; only a
+		 * hint, the file is cut to real length on commit */
+		fallocate(self -> fd, FALLOC_FL_KEEP_SIZE, 0, size_hint);
+	}
+#endif
+	return 0;
+}
+
+/**
+ * Frees object memory
+ */
+static void jio_publish_free(struct jio_publish * self){
+	free(self -> path);
+	free(self -> tmp_path);
+}
+
+char jio_publish_commit(struct jio_publish * self, size_t length){
+	char fail = 0;
+	if ( ftruncate(self -> fd, length) ){
+		fail = 1;
+	}
+	if ( ! fail && NULL == self -> tmp_path ){
+		/* Giving a name to anonymous file */
+		char fdpath[64];
+		snprintf(fdpath, sizeof(fdpath), "/proc/self/fd/%d", self -> fd);
+		if ( 0 == linkat(AT_FDCWD, fdpath, AT_FDCWD, self -> path, AT_SYMLINK_FOLLOW) ){
+			close(self -> fd);
+			jio_publish_free(self);
+			return 0;
+		}
+		if ( EEXIST != errno ){
+			fail = 1;
+		}else{
+			/* Linking to a free temporary name and renaming over the
+			 * old file then. The name is made of process, thread and a
+			 * process-wide counter: libc random numbers are not to be
+			 * touched by the library. */
+			static unsigned int counter;
+			size_t size = strlen(self -> path) + sizeof(".4294967295.4294967295.4294967295");
+			unsigned int tid = syscall(SYS_gettid);
+			unsigned int attempt;
+			self -> tmp_path = malloc(size);
+			fail = 1;
+			for ( attempt = 0; NULL != self -> tmp_path && attempt < 100; attempt += 1 ){
+				snprintf(self -> tmp_path, size, "%s.%u.%u.%u", self -> path,
+					(unsigned int) getpid(), tid,
+					__atomic_fetch_add(& counter, 1, __ATOMIC_RELAXED));
+				if ( 0 == linkat(AT_FDCWD, fdpath, AT_FDCWD, self -> tmp_path, AT_SYMLINK_FOLLOW) ){
+					fail = 0;
+					break;
+				}
+				if ( EEXIST != errno ){
+					break;
+				}
+			}
+			if ( fail ){
+				close(self -> fd);
+				jio_publish_free(self);
+				return 1;
+			}
+		}
+	}
+	close(self -> fd);
+	if ( ! fail && rename(self -> tmp_path, self -> path) ){
+		fail = 1;
+	}
+	if ( fail ){
+		unlink(self -> tmp_path);
+	}
+	jio_publish_free(self);
+	return fail;
+}
+
+void jio_publish_abort(struct jio_publish * self){
+	close(self -> fd);
+	if ( NULL != self -> tmp_path ){
+		unlink(self -> tmp_path);
+	}/* Anonymous file goes away by itself */
+	jio_publish_free(self);
+}
+
+char jio_map_open(struct jio_map * self, FILE * stream){
+	self -> base = NULL;
+	self -> base_len = 0;
+	int fd = fileno(stream);
+	struct stat st;
+	if ( fd < 0 || fstat(fd, &st) || ! S_ISREG(st.st_mode) ){
+		return 1;
+	}
+	/* Stream may have been read already, data starts at it's position */
+	off_t pos = ftello(stream);
+	if ( pos < 0 || pos >= st.st_size || (uintmax_t) st.st_size > SIZE_MAX ){
+		return 1;
+	}
+	void * base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if ( MAP_FAILED == base ){
+		return 1;
+	}
+	/* Jpeg is read from start to end once */
+	madvise(base, st.st_size, MADV_SEQUENTIAL);
+	madvise(base, st.st_size, MADV_WILLNEED);
+	self -> base = base;
+	self -> base_len = st.st_size;
+	self -> data = (const unsigned char *) base + pos;
+	self -> len = st.st_size - pos;
+	self -> stream = stream;
+	self -> start = pos;
+	return 0;
+}
+
+/**
+ * Finds the end of jpeg, that is read up to a position
+ * @param pos - next byte to read
+ * @param marker - marker, that is read, but not processed (it's
+ * segment starts at pos), 0 if none: pos is in entropy coded data, on a
+ * marker, or after EOI
+ * @return position after EOI, len if there is none
+ */
+static size_t jio_image_end(const unsigned char * b, size_t len, size_t pos,
+		int marker){
+	char in_scan = 1;
+	if ( 0 == marker && pos >= 2 && 0xFF == b[pos - 2] && JPEG_EOI == b[pos - 1] ){
+		return pos;/* Everything is read */
+	}
+	for(;;){
+		if ( marker ){
+			size_t seg;
+			if ( JPEG_EOI == marker ){
+				return pos;
+			}
+			/* Only SOS starts entropy coded data, restart markers go
+			 * on with it */
+			if ( marker >= JPEG_RST0 && marker <= JPEG_RST0 + 7 ){
+				in_scan = 1;
+			}else{
+				in_scan = 0xDA == marker;
+			}
+			if ( 0x01 != marker && ( marker < JPEG_RST0 || marker > JPEG_RST0 + 7 ) ){
+				/* Segment with length */
+				if ( pos + 2 > len ){
+					return len;
+				}
+				seg = (size_t) b[pos] << 8 | b[pos + 1];
+				if ( seg < 2 || pos + seg > len ){
+					return len;
+				}
+				pos += seg;
+			}
+			marker = 0;
+		}
+		/* Entropy coded data or fill bytes up to the next marker */
+		while ( pos + 1 < len ){
+			if ( 0xFF != b[pos] ){
+				const unsigned char * ff;
+				if ( ! in_scan ){
+					return len;/* Not jpeg */
+				}
+				ff = memchr(b + pos, 0xFF, len - pos);
+				pos = NULL != ff ? (size_t)(ff - b) : len;
+				continue;
+			}
+			if ( 0xFF == b[pos + 1] ){
+				pos += 1;
+				continue;
+			}
+			if ( 0x00 == b[pos + 1] ){
+				pos += 2;/* Stuffed byte */
+				continue;
+			}
+			marker = b[pos + 1];
+			pos += 2;
+			break;
+		}
+		if ( 0 == marker ){
+			return len;
+		}
+	}
+}
+
+void jio_map_seek(struct jio_map * self, const unsigned char * next, int marker){
+	size_t used = self -> len;
+	if ( NULL == self -> base ){
+		return;
+	}
+	if ( next >= self -> data && next <= self -> data + self -> len ){
+		used = jio_image_end(self -> data, self -> len, next - self -> data, marker);
+	}
+	fseeko(self -> stream, self -> start + (off_t) used, SEEK_SET);
+}
+
+void jio_map_close(struct jio_map * self){
+	if ( NULL != self -> base ){
+		munmap(self -> base, self -> base_len);
+		self -> base = NULL;
+	}
+}
+
+static void jio_window_init_source(j_decompress_ptr cinfo){
+	(void) cinfo;
+}
+
+/**
+ * Suspends at the visible end, gives fake EOI at the real end, as
+ * jpeg_mem_src does
+ */
+static boolean jio_window_fill_input_buffer(j_decompress_ptr cinfo){
+	static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+	struct jio_window * win = (struct jio_window *) cinfo -> src;
+	if ( win -> limit < win -> len ){
+		return FALSE;
+	}
+	WARNMS(cinfo, JWRN_JPEG_EOF);
+	win -> pub.next_input_byte = eoi;
+	win -> pub.bytes_in_buffer = 2;
+	return TRUE;
+}
+
+/**
+ * Moves visible end to cover at least given offset
+ */
+static void jio_window_show(struct jio_window * win, size_t limit){
+	if ( limit > win -> len ){
+		limit = win -> len;
+	}
+	if ( limit <= win -> limit ){
+		return;
+	}
+	win -> limit = limit;
+	/* Not on fake EOI: it is only given when everything is visible */
+	win -> pub.bytes_in_buffer = win -> data + limit - win -> pub.next_input_byte;
+}
+
+static void jio_window_skip_input_data(j_decompress_ptr cinfo, long num_bytes){
+	struct jio_window * win = (struct jio_window *) cinfo -> src;
+	if ( num_bytes <= 0 ){
+		return;
+	}
+	if ( (size_t) num_bytes > win -> pub.bytes_in_buffer ){
+		/* Markers are skipped: showing them costs nothing */
+		size_t pos = win -> pub.next_input_byte - win -> data;
+		jio_window_show(win, pos + num_bytes);
+		if ( (size_t) num_bytes > win -> pub.bytes_in_buffer ){
+			/* Beyond the end */
+			win -> pub.next_input_byte += win -> pub.bytes_in_buffer;
+			win -> pub.bytes_in_buffer = 0;
+			return;
+		}
+	}
+	win -> pub.next_input_byte += num_bytes;
+	win -> pub.bytes_in_buffer -= num_bytes;
+}
+
+static void jio_window_term_source(j_decompress_ptr cinfo){
+	(void) cinfo;
+}
+
+/**
+ * Keeps arrays, the coefficient controller requests, one per component
+ * in order, as jpeg_read_coefficients would give them out
+ */
+static jvirt_barray_ptr jio_window_request_virt_barray(j_common_ptr cinfo,
+		int pool_id, boolean pre_zero, JDIMENSION blocksperrow,
+		JDIMENSION numrows, JDIMENSION maxaccess){
+	j_decompress_ptr dinfo = (j_decompress_ptr) cinfo;
+	struct jio_window * win = (struct jio_window *) dinfo -> src;
+	jvirt_barray_ptr array = (win -> request)(cinfo, pool_id, pre_zero,
+		blocksperrow, numrows, maxaccess);
+	if ( win -> narrays < MAX_COMPONENTS ){
+		win -> arrays[win -> narrays] = array;
+	}
+	win -> narrays += 1;
+	return array;
+}
+
+void jio_window_attach(j_decompress_ptr cinfo, struct jio_window * win,
+		const JOCTET * data, size_t len, size_t limit){
+	win -> pub.init_source = jio_window_init_source;
+	win -> pub.fill_input_buffer = jio_window_fill_input_buffer;
+	win -> pub.skip_input_data = jio_window_skip_input_data;
+	win -> pub.resync_to_restart = jpeg_resync_to_restart;
+	win -> pub.term_source = jio_window_term_source;
+	win -> data = data;
+	win -> len = len;
+	win -> limit = limit < len ? limit : len;
+	win -> pub.next_input_byte = data;
+	win -> pub.bytes_in_buffer = win -> limit;
+	win -> narrays = 0;
+	if ( cinfo -> mem -> request_virt_barray != jio_window_request_virt_barray ){
+		win -> request = NULL;
+	}/* else it is attached again, after jpeg_abort_decompress */
+	cinfo -> src = & win -> pub;
+}
+
+void jio_window_read_header(j_decompress_ptr cinfo, struct jio_window * win){
+	while ( JPEG_SUSPENDED == jpeg_read_header(cinfo, TRUE) ){
+		jio_window_show(win, win -> limit * 2 + JIO_MIN_BUF);
+	}
+}
+
+char jio_window_rows_in_order(j_decompress_ptr cinfo){
+	/* Every other image is completed only by it's last scan */
+	return ! cinfo -> progressive_mode &&
+		cinfo -> comps_in_scan == cinfo -> num_components;
+}
+
+jvirt_barray_ptr * jio_window_read_rows(j_decompress_ptr cinfo,
+		struct jio_window * win, JDIMENSION rows){
+	if ( cinfo -> mem -> request_virt_barray != jio_window_request_virt_barray ){
+		/* The library requests arrays on the first call */
+		win -> request = cinfo -> mem -> request_virt_barray;
+		cinfo -> mem -> request_virt_barray = jio_window_request_virt_barray;
+	}
+	for(;;){
+		jvirt_barray_ptr * arrays = jpeg_read_coefficients(cinfo);
+		if ( NULL != arrays ){
+			return arrays;/* Whole image is there */
+		}
+		JDIMENSION done = cinfo -> input_iMCU_row;
+		if ( done >= rows && jio_window_rows_in_order(cinfo) &&
+				win -> narrays == cinfo -> num_components ){
+			return win -> arrays;
+		}
+		/* Otherwise, if the library requests arrays some other way,
+		 * the whole image is read */
+		/* Guessing bytes for the rows left, as if every row costs
+		 * the same */
+		size_t pos = win -> pub.next_input_byte - win -> data;
+		size_t rest = win -> len - pos;
+		JDIMENSION left = cinfo -> total_iMCU_rows - done;
+		size_t guess = (size_t)((double) rest * (rows - done) / left * 1.25);
+		size_t limit = pos + guess + JIO_MIN_BUF;
+		if ( limit < win -> limit * 3 / 2 ){
+			limit = win -> limit * 3 / 2;
+		}
+		jio_window_show(win, limit);
+	}
+}
+
+static void jio_push_init_source(j_decompress_ptr cinfo){
+	(void) cinfo;
+}
+
+/**
+ * Suspends until more comes, gives fake EOI at the end
+ */
+static boolean jio_push_fill_input_buffer(j_decompress_ptr cinfo){
+	static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+	struct jio_push * push = (struct jio_push *) cinfo -> src;
+	if ( ! push -> ended ){
+		return FALSE;
+	}
+	WARNMS(cinfo, JWRN_JPEG_EOF);
+	push -> pub.next_input_byte = eoi;
+	push -> pub.bytes_in_buffer = 2;
+	return TRUE;
+}
+
+static void jio_push_skip_input_data(j_decompress_ptr cinfo, long num_bytes){
+	struct jio_push * push = (struct jio_push *) cinfo -> src;
+	if ( num_bytes <= 0 ){
+		return;
+	}
+	if ( (size_t) num_bytes > push -> pub.bytes_in_buffer ){
+		/* The rest is skipped, when it comes */
+		push -> skip += num_bytes - push -> pub.bytes_in_buffer;
+		push -> pub.next_input_byte += push -> pub.bytes_in_buffer;
+		push -> pub.bytes_in_buffer = 0;
+		return;
+	}
+	push -> pub.next_input_byte += num_bytes;
+	push -> pub.bytes_in_buffer -= num_bytes;
+}
+
+static void jio_push_term_source(j_decompress_ptr cinfo){
+	(void) cinfo;
+}
+
+void jio_push_attach(j_decompress_ptr cinfo, struct jio_push * push){
+	push -> pub.init_source = jio_push_init_source;
+	push -> pub.fill_input_buffer = jio_push_fill_input_buffer;
+	push -> pub.skip_input_data = jio_push_skip_input_data;
+	push -> pub.resync_to_restart = jpeg_resync_to_restart;
+	push -> pub.term_source = jio_push_term_source;
+	push -> pub.next_input_byte = NULL;
+	push -> pub.bytes_in_buffer = 0;
+	push -> buf = NULL;
+	push -> size = 0;
+	push -> skip = 0;
+	push -> ended = 0;
+	cinfo -> src = & push -> pub;
+}
+
+char jio_push_add(struct jio_push * push, const void * data, size_t len){
+	const JOCTET * p = data;
+	if ( push -> skip ){
+		size_t n = push -> skip < len ? push -> skip : len;
+		push -> skip -= n;
+		p += n;
+		len -= n;
+	}
+	if ( 0 == len ){
+		return 0;
+	}
+	/* On suspension jpeg library backs up to where it can go on from,
+	 * everything before is done */
+	size_t left = push -> pub.bytes_in_buffer;
+	if ( left + len < len ){
+		return 1;
+	}
+	if ( left + len > push -> size ){
+		size_t size = push -> size * 2;
+		if ( size < left + len ){
+			size = left + len;
+		}
+		JOCTET * buf = malloc(size);
+		if ( NULL == buf ){
+			return 1;
+		}
+		if ( left ){
+			memcpy(buf, push -> pub.next_input_byte, left);
+		}
+		free(push -> buf);
+		push -> buf = buf;
+		push -> size = size;
+	}else if ( left ){
+		memmove(push -> buf, push -> pub.next_input_byte, left);
+	}
+	memcpy(push -> buf + left, p, len);
+	push -> pub.next_input_byte = push -> buf;
+	push -> pub.bytes_in_buffer = left + len;
+	return 0;
+}
+
+void jio_push_end(struct jio_push * push){
+	push -> ended = 1;
+}
+
+void jio_push_free(struct jio_push * push){
+	free(push -> buf);
+	push -> buf = NULL;
+	push -> size = 0;
+	push -> pub.next_input_byte = NULL;
+	push -> pub.bytes_in_buffer = 0;
+}
@@ -0,0 +1,252 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JIO_H
+#define JIO_H
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <jpeglib.h>
+/**
+ * This module provides jpeg library data source and destination
+ * managers for file descriptors, and a way to publish an output file
+ * only after it is completely written.
+ */
+
+/**
+ * Destination manager, that writes to a file descriptor through one
+ * big buffer: an output not bigger than the buffer is written with a
+ * single system call.
+ */
+struct jio_dest {
+	struct jpeg_destination_mgr pub;
+	int fd;
+	JOCTET * buf;
+	size_t size;
+	size_t written;	/* Bytes, given to the descriptor */
+};
+
+/**
+ * Chooses buffer size for an output, that is made of the input of
+ * given size.
+ * @param input_len - input length, 0 if unknown
+ * @return buffer size
+ */
+size_t jio_dest_size(size_t input_len);
+
+/**
+ * Makes compressor write to the descriptor
+ * @param dest - manager object, must live until compression ends
+ * @param fd - descriptor to write to
+ * @param buf - buffer to collect output in
+ * @param size - buffer size
+ */
+void jio_dest_attach(j_compress_ptr cinfo, struct jio_dest * dest, int fd,
+		JOCTET * buf, size_t size);
+
+/**
+ * Destination manager, that collects output in a malloced buffer,
+ * growing it as needed. Unlike jpeg_mem_dest, the buffer is known at
+ * any moment, so an output, that is given up, can be freed.
+ */
+struct jio_grow {
+	struct jpeg_destination_mgr pub;
+	JOCTET * buf;	/* Buffer, to be freed by the user */
+	size_t size;
+	size_t len;		/* Bytes written, when compression is finished */
+};
+
+/**
+ * Makes compressor write to memory
+ * @param dest - manager object, must live until compression ends
+ * @param size - buffer size to start with, jio_dest_size tells a good one
+ * @return 0 if OK, 1 if out of memory (dest -> buf is NULL then)
+ */
+char jio_grow_attach(j_compress_ptr cinfo, struct jio_grow * dest, size_t size);
+
+/**
+ * File, that becomes visible under it's name only when it is complete.
+ * It is created anonymous (O_TMPFILE) where the file system allows,
+ * otherwise with a temporary name next to the final one.
+ */
+struct jio_publish {
+	int fd;
+	char * path;		/* final name */
+	char * tmp_path;	/* temporary name, NULL for anonymous file */
+};
+
+/**
+ * Creates the file
+ * @param path - final file name
+ * @param size_hint - expected file size, space is reserved for it
+ * @return 0 if OK, 1 if failed (nothing to free)
+ */
+char jio_publish_open(struct jio_publish * self, const char * path, size_t size_hint);
+
+/**
+ * Gives the file it's final name, replacing a file, that may have it.
+ * The object is freed.
+ * @param length - bytes written, the file is cut to it
+ * @return 0 if OK, 1 if failed (the file is gone)
+ */
+char jio_publish_commit(struct jio_publish * self, size_t length);
+
+/**
+ * Throws the file away. The object is freed.
+ */
+void jio_publish_abort(struct jio_publish * self);
+
+/**
+ * Read-only mapping of a file, that is given to jpeg library as memory
+ * source, so that data is not copied through stdio buffers.
+ */
+struct jio_map {
+	void * base;				/* mapping, NULL if none */
+	size_t base_len;
+	const unsigned char * data;	/* data from current file position */
+	size_t len;
+	FILE * stream;
+	off_t start;				/* stream position, data is from */
+};
+
+/**
+ * Maps a file from it's current position to end
+ * @param stream - open file
+ * @return 0 if OK, 1 if the file can't be mapped (pipe, empty file,
+ * etc.), nothing to free then
+ */
+char jio_map_open(struct jio_map * self, FILE * stream);
+
+/**
+ * Moves the stream past the end of the jpeg (it's EOI), so that next
+ * reads of the caller get what follows the jpeg, however much of it
+ * jpeg library has read: decoders stop in the middle of the scan.
+ * @param next - next byte, jpeg library would read; if it is not in the
+ * mapping (fake EOI at the end), all the data counts as consumed
+ * @param marker - unread_marker of the decompressor
+ */
+void jio_map_seek(struct jio_map * self, const unsigned char * next, int marker);
+
+/**
+ * Unmaps file. Does nothing for object, that wasn't mapped.
+ */
+void jio_map_close(struct jio_map * self);
+
+/**
+ * Memory source, that shows jpeg library only the beginning of data.
+ * Jpeg library suspends, when it reaches the visible end, so that
+ * coefficients of the first image rows can be used before the rest is
+ * decoded. The visible part grows, when more rows are wanted.
+ */
+struct jio_window {
+	struct jpeg_source_mgr pub;
+	const JOCTET * data;
+	size_t len;
+	size_t limit;	/* Bytes visible */
+	/* Coefficient arrays, as the library requests them, since it gives
+	 * them out only when the image is done */
+	jvirt_barray_ptr arrays[MAX_COMPONENTS];
+	int narrays;
+	jvirt_barray_ptr (* request)(j_common_ptr cinfo, int pool_id,
+		boolean pre_zero, JDIMENSION blocksperrow, JDIMENSION numrows,
+		JDIMENSION maxaccess);
+};
+
+/**
+ * Makes decompressor read from memory
+ * @param win - manager object, must live until decompression ends, or
+ * as long as arrays, given by jio_window_read_rows, are used. A
+ * decompressor, attached again, is attached to the same object.
+ * @param data, len - whole jpeg file
+ * @param limit - bytes to show at first
+ */
+void jio_window_attach(j_decompress_ptr cinfo, struct jio_window * win,
+		const JOCTET * data, size_t len, size_t limit);
+
+/**
+ * Reads header as jpeg_read_header(cinfo, TRUE) does, showing more
+ * data if needed
+ */
+void jio_window_read_header(j_decompress_ptr cinfo, struct jio_window * win);
+
+/**
+ * Tells if the image is a single sequential scan, so that it's rows
+ * are complete as soon as they are read. Must be called after reading
+ * header.
+ * @return 1 if so, 0 if not
+ */
+char jio_window_rows_in_order(j_decompress_ptr cinfo);
+
+/**
+ * Reads coefficients, as jpeg_read_coefficients does, stopping after
+ * given MCU rows, if jio_window_rows_in_order. May be called again to
+ * read more rows. Rows, not read yet, are zero.
+ * @param win - the source
+ * @param rows - MCU rows wanted
+ * @return coefficient arrays
+ */
+jvirt_barray_ptr * jio_window_read_rows(j_decompress_ptr cinfo,
+		struct jio_window * win, JDIMENSION rows);
+
+/**
+ * Source for data, that comes in pieces, as from a socket. Jpeg library
+ * suspends, when it has used all the pieces, given so far, and goes on
+ * from there, when more are given. Bytes, the library is done with,
+ * are dropped, so only a piece and the unfinished part of the previous
+ * one are kept.
+ */
+struct jio_push {
+	struct jpeg_source_mgr pub;
+	JOCTET * buf;
+	size_t size;	/* Buffer size */
+	size_t skip;	/* Bytes to skip, that haven't come yet */
+	char ended;		/* No more data will come */
+};
+
+/**
+ * Makes decompressor read pieces, given with jio_push_add
+ * @param push - manager object, must live until decompression ends
+ */
+void jio_push_attach(j_decompress_ptr cinfo, struct jio_push * push);
+
+/**
+ * Gives the next piece of data
+ * @param data, len - piece, copied by the function
+ * @return 0 if OK, 1 if out of memory
+ */
+char jio_push_add(struct jio_push * push, const void * data, size_t len);
+
+/**
+ * Tells, that no more data will come: jpeg library gets the end of
+ * file instead of suspending
+ */
+void jio_push_end(struct jio_push * push);
+
+/**
+ * Frees the buffer. Decompressor must not read from the source after.
+ */
+void jio_push_free(struct jio_push * push);
+
+/**
+ * Writes whole buffer to descriptor
+ * @return 0 if OK, 1 if failed
+ */
+char jio_write_all(int fd, const void * buf, size_t len);
+
+#endif
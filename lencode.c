@@ -47,6 +47,23 @@ unsigned int lencode_produce(size_t num, unsigned char * buf){
 	}
 }
 
+unsigned int lencode_produce_extended(size_t num, unsigned char * buf){
+	unsigned int len = lencode_produce(num, buf);
+	/* Moving stop to the additional byte with no data bits */
+	buf[len - 1] &= 0b01111111;
+	buf[len] = 0b10000000;
+	return len + 1;
+}
+
+char lencode_extended(const unsigned char * buf, size_t record_length){
+	/* A plain record never ends with an empty byte, except for the
+	 * one-byte zero */
+	if ( record_length > 1 && buf[record_length - 1] == 0b10000000 ){
+		return 1;
+	}
+	return 0;
+}
+
 /**
  * Finds the upper non-zero bit except the last (N 8) and returns it's id.
  * Bytes are numbered starting from 1.
@@ -70,6 +70,30 @@ char lencode_yield(const unsigned char * buf, size_t bufsize,
  */
 unsigned int lencode_produce(size_t num, unsigned char * buf);
 
+/**
+ * Encodes given number like lencode_produce does, but finishes the
+ * record with a redundant stop byte carrying no data bits.
+ * lencode_yield reads such a record as the same number, so the form
+ * itself can be used as a one-bit mark.
+ * @param num - number to encode
+ * @param buf - place to put answer to, no more than
+ * lencode_estimate() + 1 bytes will be produced.
+ * @return number of bytes produced
+ */
+unsigned int lencode_produce_extended(size_t num, unsigned char * buf);
+
+/**
+ * Tells whether a record, found by lencode_yield, was produced by
+ * lencode_produce_extended.
+ * @param buf - buffer with the record at it's beginning
+ * @param record_length - record length, reported by lencode_yield
+ * @return 1 for extended record, 0 for plain one
+ */
+char lencode_extended(const unsigned char * buf, size_t record_length);
+
+/* The same as lencode_estimate(), known at compile time */
+#define LENCODE_MAX	((sizeof(size_t) * 8 + 6) / 7)
+
 /**
  * Estimates maximal number of bytes, lencode_produce can occupy
  * @return number of bytes to allocate output buffer of such size for
@@ -0,0 +1,749 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "steganolab.h"
+#include "synth.h"
+#include "hist.h"
+
+/**
+ * This program puts a service-like load on the library: worker threads
+ * run encode and decode jobs, picked by a mix of carrier sizes, message
+ * sizes and keys, either as fast as they can (closed loop) or at a
+ * target rate (open loop). Latencies of every operation are kept in
+ * histograms (see hist.h) and reported as JSON on stdout.
+ *
+ * With a target rate, job i is due at start + i / rate, and it's latency
+ * is counted from then, not from the moment a worker got to it: time,
+ * that jobs wait behind slow ones, is not omitted. In closed loop jobs
+ * have no schedule, so the correction is made afterwards, as HdrHistogram
+ * does, only if the time between jobs of a worker is given (--interval).
+ */
+
+#define MAX_LIST		16
+#define OP_ENCODE		0
+#define OP_DECODE		1
+#define OPS				2
+
+static const char * op_names[OPS] = { "encode", "decode" };
+static const double percentiles[] = { 50, 90, 99, 99.9, 99.99, 100 };
+
+/**
+ * Run settings from command line
+ */
+struct settings {
+	unsigned int workers;		/* Threads, running jobs */
+	double duration;			/* Measured time, seconds */
+	double warmup;				/* Time before that, not measured */
+	double rate;				/* Jobs per second, 0 for closed loop */
+	unsigned int sizes[MAX_LIST], weights[MAX_LIST], nsizes;	/* synth_sizes numbers */
+	unsigned int payloads[MAX_LIST], npayloads;
+	double decode_share;		/* Part of jobs, that are decode */
+	double key_reuse;			/* Part of jobs with a key from the pool */
+	unsigned int keys;			/* Keys in the pool */
+	unsigned int ring;			/* Images with other keys for decode, per kind */
+	unsigned int radius;
+	unsigned int job_threads;	/* Threads for one job */
+	double interval;			/* Expected time between jobs of a worker in closed
+								 * loop, ms, 0 for no correction */
+	double slo_percentile, slo_ms;	/* Latency target, 0 for none */
+	uint32_t seed;
+};
+
+/**
+ * Image with a message for decode jobs
+ */
+struct stego {
+	char * jpeg;
+	size_t len;
+};
+
+/**
+ * Carrier of one size and images, made of it
+ */
+struct kind {
+	const char * name;
+	char * jpeg;
+	size_t len;
+	unsigned int weight;		/* 0 if nothing fits */
+	char fits[MAX_LIST];		/* Payloads, that fit */
+	struct stego * pool;		/* [payload][key] */
+	struct stego * ring;		/* [payload][ring] */
+	unsigned int * ring_next;	/* [payload] */
+};
+
+/**
+ * Results of a worker, merged at the end
+ */
+struct tally {
+	struct hist service[OPS];	/* From job start to it's end */
+	struct hist response[OPS];	/* From the time job was due to it's end */
+	uint64_t jobs[OPS], errors[OPS], bytes[OPS];
+	uint64_t late[OPS];			/* Due, but not started before the end */
+};
+
+/**
+ * State, shared by workers
+ */
+struct load {
+	const struct settings * s;
+	struct kind kinds[MAX_LIST];
+	unsigned int total_weight;
+	const char * message;
+	double start, measure, end;	/* Monotonic seconds */
+	uint64_t next;				/* Job number to take */
+	uint64_t done;				/* Jobs finished */
+};
+
+struct worker {
+	pthread_t thread;
+	struct load * load;
+	struct tally * tally;
+};
+
+static double now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, & ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleep_until(double t){
+	struct timespec ts;
+	ts.tv_sec = (time_t) t;
+	ts.tv_nsec = (long) ((t - ts.tv_sec) * 1e9);
+	while ( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, & ts, NULL) ){
+	}
+}
+
+/**
+ * Pseudorandom numbers of a job, the same for the same job number
+ */
+static uint64_t job_random(uint64_t * s){
+	uint64_t z = (* s += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+static double job_fraction(uint64_t * s){
+	return (job_random(s) >> 11) / 9007199254740992.0;
+}
+
+/**
+ * What a job does, picked by it's number
+ */
+struct job {
+	struct kind * kind;
+	unsigned int p, k;			/* Payload and key numbers */
+	int op;
+	char reuse;
+};
+
+/**
+ * Picks a job
+ * @param n - job number
+ * @param job - place to put it to
+ */
+static void job_pick(struct load * load, uint64_t n, struct job * job){
+	const struct settings * s = load -> s;
+	uint64_t r = s -> seed ^ (n * 0xD1B54A32D192ED03ull);
+	unsigned int pick = job_random(& r) % load -> total_weight;
+	struct kind * kind = load -> kinds;
+
+	while ( pick >= kind -> weight ){
+		pick -= kind -> weight;
+		kind += 1;
+	}
+	job -> kind = kind;
+	/* Message size, of those that fit */
+	do{
+		job -> p = job_random(& r) % s -> npayloads;
+	}while ( ! kind -> fits[job -> p] );
+	job -> op = job_fraction(& r) < s -> decode_share ? OP_DECODE : OP_ENCODE;
+	job -> reuse = job_fraction(& r) < s -> key_reuse;
+	job -> k = job_random(& r) % s -> keys;
+}
+
+/**
+ * Runs one job
+ * @param tally - place to count errors and bytes to
+ * @return operation
+ */
+static int run_job(struct load * load, uint64_t n, struct tally * tally){
+	const struct settings * s = load -> s;
+	struct steganolab_options opts;
+	struct job job;
+	struct kind * kind;
+	unsigned int p, k;
+	char key[64];
+	int op, rv;
+	char reuse;
+
+	job_pick(load, n, & job);
+	kind = job.kind;
+	p = job.p;
+	k = job.k;
+	op = job.op;
+	reuse = job.reuse;
+
+	steganolab_options_init(& opts);
+	opts.threads = s -> job_threads;
+	if ( OP_ENCODE == op ){
+		char * out = NULL;
+		size_t out_len;
+		if ( reuse ){
+			snprintf(key, sizeof(key), "key-%u", k);
+		}else{
+			snprintf(key, sizeof(key), "fresh-%llu", (unsigned long long) n);
+		}
+		rv = steganolab_encode_mem(kind -> jpeg, kind -> len, & out, & out_len,
+			load -> message, s -> payloads[p], key, s -> radius, & opts, NULL);
+		if ( ! rv ){
+			free(out);
+		}
+	}else{
+		const struct stego * img;
+		char * data = NULL;
+		unsigned int len = 0;
+		if ( reuse ){
+			img = kind -> pool + p * s -> keys + k;
+			snprintf(key, sizeof(key), "key-%u", k);
+		}else{
+			/* Keys of the ring come back, one by one */
+			unsigned int j = __atomic_fetch_add(kind -> ring_next + p, 1,
+				__ATOMIC_RELAXED) % s -> ring;
+			img = kind -> ring + p * s -> ring + j;
+			snprintf(key, sizeof(key), "ring-%u-%u", p, j);
+		}
+		rv = steganolab_decode_mem_opt(img -> jpeg, img -> len, & data, & len,
+			key, s -> radius, & opts, NULL);
+		if ( ! rv ){
+			/* Every image has the start of the same message */
+			if ( len != s -> payloads[p] || memcmp(data, load -> message, len) ){
+				rv = -1;
+			}
+			free(data);
+		}
+	}
+	if ( rv ){
+		tally -> errors[op] += 1;
+	}else{
+		tally -> bytes[op] += s -> payloads[p];
+	}
+	return op;
+}
+
+/**
+ * Counts jobs, that were due, but not started before the end. Their
+ * response time is at least from the time they were due to the end.
+ * @param n - first of them, taken already
+ */
+static void drain_late(struct load * load, uint64_t n, struct tally * tally){
+	double rate = load -> s -> rate;
+	for(;;){
+		double due = load -> start + n / rate;
+		struct job job;
+		if ( due >= load -> end ){
+			break;
+		}
+		if ( due >= load -> measure ){
+			job_pick(load, n, & job);
+			tally -> late[job.op] += 1;
+			hist_add(tally -> response + job.op, (load -> end - due) * 1e6 + 0.5, 1);
+		}
+		n = __atomic_fetch_add(& load -> next, 1, __ATOMIC_RELAXED);
+	}
+}
+
+static void * worker_run(void * arg){
+	struct worker * w = arg;
+	struct load * load = w -> load;
+	double rate = load -> s -> rate;
+	for(;;){
+		uint64_t n = __atomic_fetch_add(& load -> next, 1, __ATOMIC_RELAXED);
+		double due, started, finished;
+		int op;
+		if ( rate ){
+			due = load -> start + n / rate;
+			if ( due >= load -> end ){
+				break;
+			}
+			sleep_until(due);
+			started = now();
+			if ( started >= load -> end ){
+				/* Behind schedule: jobs, that are due, are left */
+				drain_late(load, n, w -> tally);
+				break;
+			}
+		}else{
+			started = due = now();
+			if ( started >= load -> end ){
+				break;
+			}
+		}
+		op = run_job(load, n, w -> tally);
+		finished = now();
+		__atomic_fetch_add(& load -> done, 1, __ATOMIC_RELAXED);
+		if ( due < load -> measure ){
+			continue;
+		}
+		w -> tally -> jobs[op] += 1;
+		hist_add(w -> tally -> service + op, (finished - started) * 1e6 + 0.5, 1);
+		hist_add(w -> tally -> response + op, (finished - due) * 1e6 + 0.5, 1);
+	}
+	return NULL;
+}
+
+/**
+ * Makes a message image
+ * @return 0 if OK, library error code otherwise
+ */
+static int make_stego(const struct kind * kind, const char * message,
+		unsigned int len, const char * key, const struct settings * s,
+		struct stego * out){
+	return steganolab_encode_mem(kind -> jpeg, kind -> len, & out -> jpeg,
+		& out -> len, message, len, key, s -> radius, NULL, NULL);
+}
+
+/**
+ * Makes carrier of a kind and images with messages for decode jobs
+ * @return 0 if OK, 1 if something failed
+ */
+static char prepare_kind(struct kind * kind, unsigned int size, unsigned int weight,
+		const char * message, const struct settings * s){
+	struct synth_carrier carrier = { synth_sizes[size].width,
+		synth_sizes[size].height, SYNTH_420, 0, 0, 85, s -> seed + size };
+	struct steganolab_statistics stats;
+	unsigned int capacity, p, k;
+	char key[64];
+	kind -> name = synth_sizes[size].name;
+	kind -> pool = calloc(s -> npayloads * s -> keys, sizeof(struct stego));
+	kind -> ring = calloc(s -> npayloads * s -> ring, sizeof(struct stego));
+	kind -> ring_next = calloc(s -> npayloads, sizeof(unsigned int));
+	if ( NULL == kind -> pool || NULL == kind -> ring || NULL == kind -> ring_next ||
+			synth_make(& carrier, & kind -> jpeg, & kind -> len) ){
+		return 1;
+	}
+	if ( steganolab_estimate_mem(kind -> jpeg, kind -> len, s -> radius, & stats) ){
+		return 1;
+	}
+	capacity = steganolab_message_capacity(stats.bits_available);
+	steganolab_free_statistics(& stats);
+	kind -> weight = 0;
+	for(p = 0; p < s -> npayloads; p += 1){
+		kind -> fits[p] = s -> payloads[p] <= capacity;
+		if ( ! kind -> fits[p] ){
+			fprintf(stderr, "%s: %u bytes don't fit, left out\n", kind -> name,
+				s -> payloads[p]);
+			continue;
+		}
+		kind -> weight = weight;
+		for(k = 0; k < s -> keys; k += 1){
+			snprintf(key, sizeof(key), "key-%u", k);
+			if ( make_stego(kind, message, s -> payloads[p], key, s,
+					kind -> pool + p * s -> keys + k) ){
+				return 1;
+			}
+		}
+		for(k = 0; k < s -> ring; k += 1){
+			snprintf(key, sizeof(key), "ring-%u-%u", p, k);
+			if ( make_stego(kind, message, s -> payloads[p], key, s,
+					kind -> ring + p * s -> ring + k) ){
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static void free_kind(struct kind * kind, const struct settings * s){
+	unsigned int i;
+	if ( NULL != kind -> pool ){
+		for(i = 0; i < s -> npayloads * s -> keys; i += 1){
+			free(kind -> pool[i].jpeg);
+		}
+	}
+	if ( NULL != kind -> ring ){
+		for(i = 0; i < s -> npayloads * s -> ring; i += 1){
+			free(kind -> ring[i].jpeg);
+		}
+	}
+	free(kind -> pool);
+	free(kind -> ring);
+	free(kind -> ring_next);
+	free(kind -> jpeg);
+}
+
+static void print_percentiles(const char * name, const struct hist * h){
+	unsigned int i;
+	printf("      \"%s\": {", name);
+	for(i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i += 1){
+		double p = percentiles[i];
+		if ( p >= 100 ){
+			printf("%s\"max\": %.3f", i ? ", " : "", hist_percentile(h, p) / 1e3);
+		}else{
+			printf("%s\"p%g\": %.3f", i ? ", " : "", p, hist_percentile(h, p) / 1e3);
+		}
+	}
+	printf("},\n");
+}
+
+/**
+ * Prints results of an operation
+ * @return not 0 if latency target is missed
+ */
+static char report_op(int op, const struct tally * t, const struct settings * s,
+		char last){
+	struct hist * corrected = malloc(sizeof(* corrected));
+	uint64_t interval;
+	unsigned int i;
+	char missed = 0, first = 1;
+	if ( NULL == corrected ){
+		return 1;
+	}
+	hist_init(corrected);
+	if ( s -> rate ){
+		hist_merge(corrected, t -> response + op);
+		interval = 0;
+	}else{
+		interval = s -> interval * 1e3;
+		hist_correct(t -> service + op, corrected, interval);
+	}
+	printf("    \"%s\": {\n", op_names[op]);
+	printf("      \"jobs\": %llu, \"errors\": %llu, \"late\": %llu, \"jobs_per_s\": %.3f, "
+		"\"payload_mb_per_s\": %.4f, \"interval_ms\": %.3f,\n",
+		(unsigned long long) t -> jobs[op], (unsigned long long) t -> errors[op],
+		(unsigned long long) t -> late[op],
+		t -> jobs[op] / s -> duration, t -> bytes[op] / s -> duration / 1e6,
+		s -> rate ? 1e3 / s -> rate : interval / 1e3);
+	print_percentiles("service_ms", t -> service + op);
+	print_percentiles("corrected_ms", corrected);
+	/* Non-empty buckets: their top value and count */
+	printf("      \"histogram_us\": [");
+	for(i = 0; i < HIST_BUCKETS; i += 1){
+		if ( corrected -> counts[i] ){
+			printf("%s[%llu, %llu]", first ? "" : ", ",
+				(unsigned long long) hist_bucket_top(i),
+				(unsigned long long) corrected -> counts[i]);
+			first = 0;
+		}
+	}
+	printf("]\n    }%s\n", last ? "" : ",");
+	if ( s -> slo_ms && t -> jobs[op] + t -> late[op] &&
+			hist_percentile(corrected, s -> slo_percentile) > s -> slo_ms * 1e3 ){
+		fprintf(stderr, "%s: p%g is over %g ms\n", op_names[op],
+			s -> slo_percentile, s -> slo_ms);
+		missed = 1;
+	}
+	free(corrected);
+	return missed;
+}
+
+/**
+ * Parses comma separated numbers
+ * @return number of them, 0 if the string is bad
+ */
+static unsigned int parse_list(const char * s, unsigned int * list){
+	unsigned int n = 0;
+	while ( n < MAX_LIST ){
+		char * end;
+		unsigned long v = strtoul(s, & end, 10);
+		if ( end == s ){
+			return 0;
+		}
+		list[n ++] = v;
+		if ( * end == 0 ){
+			return n;
+		}
+		if ( * end != ',' ){
+			return 0;
+		}
+		s = end + 1;
+	}
+	return 0;
+}
+
+/**
+ * Parses comma separated size names with optional weights: thumb:5,1mp
+ * @return 0 if OK, 1 if the string is bad
+ */
+static char parse_sizes(const char * str, struct settings * s){
+	s -> nsizes = 0;
+	while ( s -> nsizes < MAX_LIST ){
+		size_t len = strcspn(str, ":,");
+		unsigned int i;
+		for(i = 0; i < SYNTH_SIZES; i += 1){
+			if ( strlen(synth_sizes[i].name) == len &&
+					! strncmp(synth_sizes[i].name, str, len) ){
+				break;
+			}
+		}
+		if ( i == SYNTH_SIZES ){
+			return 1;
+		}
+		s -> sizes[s -> nsizes] = i;
+		s -> weights[s -> nsizes] = 1;
+		str += len;
+		if ( * str == ':' ){
+			char * end;
+			s -> weights[s -> nsizes] = strtoul(str + 1, & end, 10);
+			if ( end == str + 1 || s -> weights[s -> nsizes] == 0 ){
+				return 1;
+			}
+			str = end;
+		}
+		s -> nsizes += 1;
+		if ( * str == 0 ){
+			return 0;
+		}
+		if ( * str != ',' ){
+			return 1;
+		}
+		str += 1;
+	}
+	return 1;
+}
+
+static void usage(){
+	fprintf(stderr, "Usage:\t... [options] > results.json\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  --workers N        threads, running jobs (processors)\n");
+	fprintf(stderr, "  --duration S       measured seconds (10)\n");
+	fprintf(stderr, "  --warmup S         seconds before that, not measured (1)\n");
+	fprintf(stderr, "  --rate R           jobs per second, all workers together;\n");
+	fprintf(stderr, "                     without it every worker runs jobs one after another\n");
+	fprintf(stderr, "  --sizes A:W,B:W    carrier sizes with weights (thumb:4,1mp:1);\n");
+	fprintf(stderr, "                     sizes are thumb, 1mp, 12mp, 24mp, 100mp\n");
+	fprintf(stderr, "  --payloads A,B     message sizes, bytes, picked evenly (64,1024,16384)\n");
+	fprintf(stderr, "  --decode F         part of jobs, that are decode (0.5)\n");
+	fprintf(stderr, "  --key-reuse F      part of jobs with a key from the pool (0.9)\n");
+	fprintf(stderr, "  --keys N           keys in the pool (4)\n");
+	fprintf(stderr, "  --ring N           images with other keys for decode, per size and payload (8)\n");
+	fprintf(stderr, "  --radius N         DCT radius (2)\n");
+	fprintf(stderr, "  --job-threads N    threads for one job (1, 0 - all processors)\n");
+	fprintf(stderr, "  --interval MS      time between jobs of a worker in closed loop,\n");
+	fprintf(stderr, "                     to correct latencies for (none)\n");
+	fprintf(stderr, "  --slo P:MS         fail, if corrected percentile P is over MS\n");
+	fprintf(stderr, "  --seed N           job mix seed (1)\n");
+}
+
+/**
+ * @return 0 if OK, 1 if command line is bad
+ */
+static char parse_settings(int argc, char ** argv, struct settings * s){
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int i;
+	s -> workers = cpus > 0 ? cpus : 1;
+	s -> duration = 10;
+	s -> warmup = 1;
+	s -> rate = 0;
+	parse_sizes("thumb:4,1mp:1", s);
+	s -> payloads[0] = 64;
+	s -> payloads[1] = 1024;
+	s -> payloads[2] = 16384;
+	s -> npayloads = 3;
+	s -> decode_share = 0.5;
+	s -> key_reuse = 0.9;
+	s -> keys = 4;
+	s -> ring = 8;
+	s -> radius = 2;
+	s -> job_threads = 1;
+	s -> interval = 0;
+	s -> slo_percentile = 0;
+	s -> slo_ms = 0;
+	s -> seed = 1;
+	for(i = 1; i + 1 < argc; i += 2){
+		const char * arg = argv[i], * val = argv[i + 1];
+		if ( ! strcmp(arg, "--workers") ){
+			s -> workers = atoi(val);
+		}else if ( ! strcmp(arg, "--duration") ){
+			s -> duration = atof(val);
+		}else if ( ! strcmp(arg, "--warmup") ){
+			s -> warmup = atof(val);
+		}else if ( ! strcmp(arg, "--rate") ){
+			s -> rate = atof(val);
+		}else if ( ! strcmp(arg, "--sizes") ){
+			if ( parse_sizes(val, s) ){
+				return 1;
+			}
+		}else if ( ! strcmp(arg, "--payloads") ){
+			if ( ! (s -> npayloads = parse_list(val, s -> payloads)) ){
+				return 1;
+			}
+		}else if ( ! strcmp(arg, "--decode") ){
+			s -> decode_share = atof(val);
+		}else if ( ! strcmp(arg, "--key-reuse") ){
+			s -> key_reuse = atof(val);
+		}else if ( ! strcmp(arg, "--keys") ){
+			s -> keys = atoi(val);
+		}else if ( ! strcmp(arg, "--ring") ){
+			s -> ring = atoi(val);
+		}else if ( ! strcmp(arg, "--radius") ){
+			s -> radius = atoi(val);
+		}else if ( ! strcmp(arg, "--job-threads") ){
+			s -> job_threads = atoi(val);
+		}else if ( ! strcmp(arg, "--interval") ){
+			s -> interval = atof(val);
+		}else if ( ! strcmp(arg, "--slo") ){
+			if ( 2 != sscanf(val, "%lf:%lf", & s -> slo_percentile, & s -> slo_ms) ){
+				return 1;
+			}
+		}else if ( ! strcmp(arg, "--seed") ){
+			s -> seed = strtoul(val, NULL, 10);
+		}else{
+			return 1;
+		}
+	}
+	if ( i != argc || s -> workers == 0 || s -> duration <= 0 || s -> keys == 0 ||
+			s -> ring == 0 || s -> rate < 0 || s -> warmup < 0 ){
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char ** argv){
+	struct settings s;
+	struct load load;
+	struct worker * workers;
+	struct tally * total;
+	char * message;
+	unsigned int max_payload = 0, i, op;
+	int toreturn = 0;
+
+	if ( parse_settings(argc, argv, & s) ){
+		usage();
+		return 2;
+	}
+	memset(& load, 0, sizeof(load));
+	load.s = & s;
+	for(i = 0; i < s.npayloads; i += 1){
+		if ( s.payloads[i] > max_payload ){
+			max_payload = s.payloads[i];
+		}
+	}
+	message = malloc(max_payload + 1);
+	workers = calloc(s.workers, sizeof(* workers));
+	total = malloc(sizeof(* total));
+	if ( NULL == message || NULL == workers || NULL == total ){
+		return 2;
+	}
+	for(i = 0; i < max_payload; i += 1){
+		message[i] = (i * 2654435761u) >> 24;
+	}
+	load.message = message;
+
+	for(i = 0; i < s.nsizes; i += 1){
+		fprintf(stderr, "%s: preparing carriers\n", synth_sizes[s.sizes[i]].name);
+		if ( prepare_kind(load.kinds + i, s.sizes[i], s.weights[i], message, & s) ){
+			fprintf(stderr, "%s: can't prepare carriers\n", synth_sizes[s.sizes[i]].name);
+			toreturn = 2;
+			goto out;
+		}
+		load.total_weight += load.kinds[i].weight;
+	}
+	if ( load.total_weight == 0 ){
+		fprintf(stderr, "No message fits in carriers\n");
+		toreturn = 2;
+		goto out;
+	}
+
+	load.start = now();
+	load.measure = load.start + s.warmup;
+	load.end = load.measure + s.duration;
+	for(i = 0; i < s.workers; i += 1){
+		workers[i].load = & load;
+		workers[i].tally = calloc(1, sizeof(struct tally));
+		if ( NULL == workers[i].tally ||
+				pthread_create(& workers[i].thread, NULL, worker_run, workers + i) ){
+			fprintf(stderr, "Can't start worker\n");
+			free(workers[i].tally);
+			/* Workers started so far run out their time */
+			load.end = load.start;
+			s.workers = i;
+			toreturn = 2;
+			break;
+		}
+	}
+	if ( ! toreturn ){
+		/* A line a second, so that one sees a rate, that can't be kept up */
+		double t;
+		for(t = load.start + 1; t < load.end; t += 1){
+			uint64_t next;
+			sleep_until(t);
+			next = __atomic_load_n(& load.next, __ATOMIC_RELAXED);
+			if ( s.rate ){
+				double behind = now() - (load.start + next / s.rate);
+				fprintf(stderr, "%4.0f s: %llu jobs done, %.0f ms behind schedule\n",
+					t - load.start, (unsigned long long) __atomic_load_n(
+					& load.done, __ATOMIC_RELAXED), behind > 0 ? behind * 1e3 : 0);
+			}else{
+				fprintf(stderr, "%4.0f s: %llu jobs done\n", t - load.start,
+					(unsigned long long) __atomic_load_n(& load.done, __ATOMIC_RELAXED));
+			}
+		}
+	}
+
+	memset(total, 0, sizeof(* total));
+	for(i = 0; i < s.workers; i += 1){
+		pthread_join(workers[i].thread, NULL);
+		for(op = 0; op < OPS; op += 1){
+			hist_merge(total -> service + op, workers[i].tally -> service + op);
+			hist_merge(total -> response + op, workers[i].tally -> response + op);
+			total -> jobs[op] += workers[i].tally -> jobs[op];
+			total -> errors[op] += workers[i].tally -> errors[op];
+			total -> bytes[op] += workers[i].tally -> bytes[op];
+			total -> late[op] += workers[i].tally -> late[op];
+		}
+	}
+	if ( ! toreturn ){
+		char missed = 0;
+		printf("{\n  \"mode\": \"%s\", \"rate\": %.3f, \"workers\": %u, "
+			"\"job_threads\": %u, \"duration_s\": %.3f, \"key_reuse\": %.3f, "
+			"\"decode\": %.3f,\n  \"operations\": {\n", s.rate ? "open" : "closed",
+			s.rate, s.workers, s.job_threads, s.duration, s.key_reuse, s.decode_share);
+		for(op = 0; op < OPS; op += 1){
+			missed |= report_op(op, total, & s, op + 1 == OPS);
+		}
+		printf("  }\n}\n");
+		for(op = 0; op < OPS; op += 1){
+			if ( total -> errors[op] ){
+				fprintf(stderr, "%s: %llu jobs failed\n", op_names[op],
+					(unsigned long long) total -> errors[op]);
+				missed = 1;
+			}
+		}
+		toreturn = missed;
+	}
+	for(i = 0; i < s.workers; i += 1){
+		free(workers[i].tally);
+	}
+out:
+	for(i = 0; i < s.nsizes; i += 1){
+		free_kind(load.kinds + i, & s);
+	}
+	free(workers);
+	free(total);
+	free(message);
+	return toreturn;
+}
@@ -0,0 +1,516 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "steganolab.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+/**
+ * This file implements Motion-JPEG streams as carriers: concatenated
+ * jpeg frames, that one message is spread over. Every frame, that has
+ * room, carries a piece of message as a message of it's own, that
+ * starts with a piece header. Frames are read from the stream one by
+ * one, and written out by a writer thread, while the next frame is
+ * being processed, so memory doesn't depend on stream length.
+ */
+
+#define MJPEG_MAGIC		"SLMJ"
+#define MJPEG_HEADER	9	/* Magic, piece number (4 bytes, big endian),
+							 * 1 if this is the last piece */
+#define MJPEG_READ		(64 * 1024)	/* Bytes to read from stream at once */
+#define MJPEG_QUEUE		2	/* Frames, waiting for the writer at most */
+
+/**
+ * Frames, taken from stream one by one
+ */
+struct mjpeg_reader {
+	SLFILE * file;
+	unsigned char * buf;
+	size_t size;		/* buf capacity */
+	size_t len;			/* bytes in buf */
+	size_t pos;			/* where frame scan goes on */
+	char in_scan;		/* pos is in entropy coded data */
+	char eof;
+};
+
+/**
+ * Goes on with looking for the end of frame, that starts buf
+ * @return 1 if found, pos is after EOI, 0 if more data is needed,
+ * -1 if data is not jpeg
+ */
+static int mjpeg_scan(struct mjpeg_reader * r){
+	const unsigned char * b = r -> buf;
+	while ( r -> pos + 1 < r -> len ){
+		if ( r -> in_scan ){
+			if ( 0xFF != b[r -> pos] ){
+				const unsigned char * ff = memchr(b + r -> pos, 0xFF, r -> len - r -> pos);
+				r -> pos = NULL != ff ? (size_t)(ff - b) : r -> len;
+				continue;
+			}
+			unsigned char x = b[r -> pos + 1];
+			if ( 0x00 == x || ( x >= 0xD0 && x <= 0xD7 ) ){
+				/* Stuffed byte or restart marker */
+				r -> pos += 2;
+				continue;
+			}
+			if ( 0xFF == x ){
+				r -> pos += 1;/* Fill byte */
+				continue;
+			}
+			r -> in_scan = 0;/* A marker ends the scan */
+		}
+		if ( 0xFF != b[r -> pos] ){
+			return -1;
+		}
+		unsigned char m = b[r -> pos + 1];
+		if ( 0xFF == m ){
+			r -> pos += 1;
+			continue;
+		}
+		if ( 0xD9 == m ){
+			r -> pos += 2;
+			return 1;
+		}
+		if ( 0x01 == m || ( m >= 0xD0 && m <= 0xD7 ) ){
+			r -> pos += 2;/* No length */
+			continue;
+		}
+		if ( r -> pos + 4 > r -> len ){
+			return 0;
+		}
+		size_t seg = (size_t) b[r -> pos + 2] << 8 | b[r -> pos + 3];
+		if ( seg < 2 ){
+			return -1;
+		}
+		if ( r -> pos + 2 + seg > r -> len ){
+			return 0;
+		}
+		r -> pos += 2 + seg;
+		r -> in_scan = 0xDA == m;
+	}
+	return 0;
+}
+
+/**
+ * Reads more data to reader buffer
+ * @return 0 if something was read, 1 if stream is over, 20 if out of memory
+ */
+static int mjpeg_fill(struct mjpeg_reader * r){
+	if ( r -> eof ){
+		return 1;
+	}
+	if ( r -> size - r -> len < MJPEG_READ ){
+		size_t size = r -> size ? r -> size * 2 : 4 * MJPEG_READ;
+		unsigned char * buf = realloc(r -> buf, size);
+		if ( NULL == buf ){
+			return 20;
+		}
+		r -> buf = buf;
+		r -> size = size;
+	}
+	/* A piece at a time, so that the buffer doesn't run far ahead of
+	 * the frame. fread waits for all of it, so a frame of a live stream
+	 * goes on only when the bytes after it have come or the stream ends */
+	size_t want = r -> size - r -> len < 2 * MJPEG_READ ? r -> size - r -> len : 2 * MJPEG_READ;
+	size_t got = fread(r -> buf + r -> len, 1, want, r -> file);
+	r -> len += got;
+	if ( 0 == got ){
+		r -> eof = 1;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Takes bytes [0, n) off the buffer
+ */
+static void mjpeg_drop(struct mjpeg_reader * r, size_t n){
+	memmove(r -> buf, r -> buf + n, r -> len - n);
+	r -> len -= n;
+	r -> pos = 0;
+	r -> in_scan = 0;
+}
+
+/**
+ * Finds the next frame. Bytes before it, if any, are not jpeg and are
+ * given out as well, so that they may be copied to output. Both stay in
+ * reader buffer until the next call.
+ * @param junk - place to put length of bytes before frame to
+ * @param frame_len - place to put frame length to, frame follows junk
+ * @return 0 if OK, 1 if stream is over (junk may remain), 2 if frame is
+ * broken, 20 if out of memory
+ */
+static int mjpeg_next(struct mjpeg_reader * r, size_t * junk, size_t * frame_len){
+	size_t start = 0;
+	for (;;){
+		/* Looking for SOI */
+		while ( start + 1 < r -> len && ! ( 0xFF == r -> buf[start] &&
+				0xD8 == r -> buf[start + 1] ) ){
+			start += 1;
+		}
+		if ( start + 1 < r -> len ){
+			break;
+		}
+		int rv = mjpeg_fill(r);
+		if ( rv ){
+			* junk = r -> len;
+			* frame_len = 0;
+			return rv;
+		}
+	}
+	r -> pos = start + 2;
+	r -> in_scan = 0;
+	for (;;){
+		int found = mjpeg_scan(r);
+		if ( found > 0 ){
+			break;
+		}
+		if ( found < 0 ){
+			return 2;
+		}
+		int rv = mjpeg_fill(r);
+		if ( 20 == rv ){
+			return 20;
+		}
+		if ( rv ){
+			return 2;/* Cut short */
+		}
+	}
+	* junk = start;
+	* frame_len = r -> pos - start;
+	return 0;
+}
+
+/**
+ * Piece of output, waiting for the writer
+ */
+struct mjpeg_piece {
+	char * data;
+	size_t len;
+};
+
+/**
+ * Writer thread and it's queue
+ */
+struct mjpeg_writer {
+	SLFILE * file;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct mjpeg_piece queue[MJPEG_QUEUE];
+	unsigned int head, count;
+	char closed;	/* no more pieces will come */
+	char failed;
+};
+
+static void * mjpeg_write_thread(void * p){
+	struct mjpeg_writer * w = p;
+	pthread_mutex_lock(& w -> lock);
+	for (;;){
+		while ( 0 == w -> count && ! w -> closed ){
+			pthread_cond_wait(& w -> cond, & w -> lock);
+		}
+		if ( 0 == w -> count ){
+			break;
+		}
+		struct mjpeg_piece piece = w -> queue[w -> head];
+		pthread_mutex_unlock(& w -> lock);
+		if ( ! w -> failed && fwrite(piece.data, 1, piece.len, w -> file) != piece.len ){
+			w -> failed = 1;
+		}
+		free(piece.data);
+		pthread_mutex_lock(& w -> lock);
+		w -> head = (w -> head + 1) % MJPEG_QUEUE;
+		w -> count -= 1;
+		pthread_cond_broadcast(& w -> cond);
+	}
+	pthread_mutex_unlock(& w -> lock);
+	return NULL;
+}
+
+/**
+ * Gives piece to writer, waiting while it's queue is full. The piece
+ * is freed by the writer.
+ * @return 0 if OK, 30 if writing failed before
+ */
+static int mjpeg_put(struct mjpeg_writer * w, char * data, size_t len){
+	pthread_mutex_lock(& w -> lock);
+	while ( MJPEG_QUEUE == w -> count ){
+		pthread_cond_wait(& w -> cond, & w -> lock);
+	}
+	w -> queue[(w -> head + w -> count) % MJPEG_QUEUE] = (struct mjpeg_piece){ data, len };
+	w -> count += 1;
+	pthread_cond_broadcast(& w -> cond);
+	char failed = w -> failed;
+	pthread_mutex_unlock(& w -> lock);
+	return failed ? 30 : 0;
+}
+
+/**
+ * Gives writer a copy of bytes
+ * @return as mjpeg_put, 20 if out of memory
+ */
+static int mjpeg_put_copy(struct mjpeg_writer * w, const unsigned char * data, size_t len){
+	if ( 0 == len ){
+		return 0;
+	}
+	char * copy = malloc(len);
+	if ( NULL == copy ){
+		return 20;
+	}
+	memcpy(copy, data, len);
+	return mjpeg_put(w, copy, len);
+}
+
+/**
+ * Waits for writer to write everything and stops it
+ * @return 0 if OK, 30 if writing failed
+ */
+static int mjpeg_close(struct mjpeg_writer * w){
+	pthread_mutex_lock(& w -> lock);
+	w -> closed = 1;
+	pthread_cond_broadcast(& w -> cond);
+	pthread_mutex_unlock(& w -> lock);
+	pthread_join(w -> thread, NULL);
+	pthread_cond_destroy(& w -> cond);
+	pthread_mutex_destroy(& w -> lock);
+	if ( ! w -> failed && fflush(w -> file) ){
+		w -> failed = 1;
+	}
+	return w -> failed ? 30 : 0;
+}
+
+/**
+ * Tells if a frame has restart markers: a DRI segment with non-zero
+ * interval before the first scan
+ * @return 1 if so, 0 if not or the frame can't be read
+ */
+static char mjpeg_has_restarts(const unsigned char * b, size_t len){
+	size_t pos = 2;/* After SOI */
+	while ( pos + 4 <= len ){
+		if ( 0xFF != b[pos] ){
+			return 0;
+		}
+		unsigned char m = b[pos + 1];
+		if ( 0xFF == m ){
+			pos += 1;/* Fill byte */
+			continue;
+		}
+		if ( 0xDA == m ){
+			return 0;/* SOS */
+		}
+		size_t seg = (size_t) b[pos + 2] << 8 | b[pos + 3];
+		if ( 0xDD == m ){
+			return seg >= 4 && pos + 6 <= len && ( b[pos + 4] || b[pos + 5] );
+		}
+		pos += 2 + seg;
+	}
+	return 0;
+}
+
+/**
+ * Makes message piece for a frame
+ * @param out - place for MJPEG_HEADER + len bytes
+ */
+static void mjpeg_piece(char * out, unsigned int number, char last,
+		const char * data, unsigned int len){
+	memcpy(out, MJPEG_MAGIC, 4);
+	out[4] = (char)(number >> 24);
+	out[5] = (char)(number >> 16);
+	out[6] = (char)(number >> 8);
+	out[7] = (char) number;
+	out[8] = last;
+	memcpy(out + MJPEG_HEADER, data, len);
+}
+
+int steganolab_encode_mjpeg(SLFILE * infile, SLFILE * outfile,
+		const char * data, unsigned int len, const char * password,
+		uint8_t DCT_radius, const struct steganolab_options * opts,
+		struct steganolab_stream_statistics * stats){
+	struct steganolab_options frame_opts;
+	if ( NULL != opts ){
+		frame_opts = * opts;
+	}else{
+		steganolab_options_init(& frame_opts);
+	}
+	/* Pieces are stored as is, so that their size is known in advance.
+	 * Frames keep their layout: only those, that have restart markers,
+	 * may be written with them */
+	unsigned int restart_flags = frame_opts.flags & STEGANOLAB_RESTART_PARALLEL;
+	frame_opts.flags = 0;
+	struct steganolab_stream_statistics st;
+	memset(& st, 0, sizeof(st));
+	struct mjpeg_reader r;
+	memset(& r, 0, sizeof(r));
+	r.file = infile;
+	struct mjpeg_writer w;
+	memset(& w, 0, sizeof(w));
+	w.file = outfile;
+	pthread_mutex_init(& w.lock, NULL);
+	pthread_cond_init(& w.cond, NULL);
+	if ( pthread_create(& w.thread, NULL, mjpeg_write_thread, & w) ){
+		pthread_cond_destroy(& w.cond);
+		pthread_mutex_destroy(& w.lock);
+		return 20;
+	}
+	char * piece = NULL;/* Piece of message with header */
+	unsigned int sent = 0;
+	char done = 0;/* The last piece is embedded */
+	int rv = 0;
+	for (;;){
+		size_t junk, frame_len;
+		int next = mjpeg_next(&r, &junk, &frame_len);
+		if ( 0 == rv ){
+			rv = 20 == next ? 20 : mjpeg_put_copy(&w, r.buf, junk);
+		}
+		if ( rv || 1 == next ){
+			break;
+		}
+		if ( next ){
+			rv = next;
+			break;
+		}
+		const char * frame = (const char *) r.buf + junk;
+		st.frames += 1;
+		unsigned int room = 0;
+		if ( ! done ){
+			struct steganolab_statistics est;
+			if ( 0 == steganolab_estimate_mem(frame, frame_len, DCT_radius, &est) ){
+				room = steganolab_message_capacity(est.bits_available);
+				steganolab_free_statistics(&est);
+			}
+		}
+		if ( room <= MJPEG_HEADER ){
+			/* Nothing to put here */
+			rv = mjpeg_put_copy(&w, (const unsigned char *) frame, frame_len);
+			mjpeg_drop(&r, junk + frame_len);
+			continue;
+		}
+		unsigned int take = len - sent < room - MJPEG_HEADER ? len - sent : room - MJPEG_HEADER;
+		char last = sent + take == len;
+		char * grown = realloc(piece, MJPEG_HEADER + take);
+		if ( NULL == grown ){
+			rv = 20;
+			break;
+		}
+		piece = grown;
+		mjpeg_piece(piece, (unsigned int) st.frames_used, last, data + sent, take);
+		frame_opts.flags = mjpeg_has_restarts((const unsigned char *) frame, frame_len) ?
+			restart_flags : 0;
+		char * out;
+		size_t out_len;
+		rv = steganolab_encode_mem(frame, frame_len, &out, &out_len, piece,
+			MJPEG_HEADER + take, password, DCT_radius, &frame_opts, NULL);
+		mjpeg_drop(&r, junk + frame_len);
+		if ( rv ){
+			break;
+		}
+		/* The writer writes this, while the next frame is processed */
+		rv = mjpeg_put(&w, out, out_len);
+		sent += take;
+		done = last;
+		st.frames_used += 1;
+	}
+	free(piece);
+	free(r.buf);
+	int write_rv = mjpeg_close(&w);
+	if ( 0 == rv ){
+		rv = write_rv;
+	}
+	if ( 0 == rv && ! done ){
+		rv = 10;/* Frames are over before the message */
+	}
+	if ( NULL != stats ){
+		* stats = st;
+	}
+	return rv;
+}
+
+int steganolab_decode_mjpeg(SLFILE * file, char ** data, unsigned int * len,
+		const char * password, uint8_t DCT_radius,
+		const struct steganolab_options * opts,
+		struct steganolab_stream_statistics * stats){
+	struct steganolab_stream_statistics st;
+	memset(& st, 0, sizeof(st));
+	struct mjpeg_reader r;
+	memset(& r, 0, sizeof(r));
+	r.file = file;
+	char * msg = NULL;
+	size_t msg_len = 0;
+	char done = 0;
+	int rv = 0;
+	while ( ! done ){
+		size_t junk, frame_len;
+		int next = mjpeg_next(&r, &junk, &frame_len);
+		if ( 1 == next ){
+			rv = 40;/* No last piece */
+			break;
+		}
+		if ( next ){
+			rv = next;
+			break;
+		}
+		st.frames += 1;
+		char * piece;
+		unsigned int piece_len;
+		int got = steganolab_decode_mem_opt((const char *) r.buf + junk, frame_len,
+			&piece, &piece_len, password, DCT_radius, opts, NULL);
+		mjpeg_drop(&r, junk + frame_len);
+		if ( 40 == got ){
+			continue;/* Frame without piece */
+		}
+		if ( got ){
+			rv = got;
+			break;
+		}
+		const unsigned char * h = (const unsigned char *) piece;
+		if ( piece_len < MJPEG_HEADER || memcmp(piece, MJPEG_MAGIC, 4) ||
+				( (unsigned int) h[4] << 24 | h[5] << 16 | h[6] << 8 | h[7] ) != st.frames_used ||
+				msg_len + (piece_len - MJPEG_HEADER) > UINT_MAX ){
+			free(piece);
+			rv = 40;/* Not ours, or out of order */
+			break;
+		}
+		char * grown = realloc(msg, msg_len + (piece_len - MJPEG_HEADER) + 1);
+		if ( NULL == grown ){
+			free(piece);
+			rv = 20;
+			break;
+		}
+		msg = grown;
+		memcpy(msg + msg_len, piece + MJPEG_HEADER, piece_len - MJPEG_HEADER);
+		msg_len += piece_len - MJPEG_HEADER;
+		done = h[8];
+		free(piece);
+		st.frames_used += 1;
+	}
+	free(r.buf);
+	if ( NULL != stats ){
+		* stats = st;
+	}
+	if ( rv ){
+		free(msg);
+		return rv;
+	}
+	* data = msg;
+	* len = (unsigned int) msg_len;
+	return 0;
+}
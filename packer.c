@@ -0,0 +1,139 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "packer.h"
+#include <limits.h>
+
+#ifdef STEGANOLAB_ZLIB
+#include <zlib.h>
+
+/* zlib counts data in uInt, we feed it by such pieces */
+#define PACKER_STEP ((size_t)UINT_MAX & ~(size_t)0xffff)
+
+char packer_available(){
+	return 1;
+}
+
+/**
+ * Pushes the next piece of input into stream, taking care about
+ * buffers bigger than uInt can describe.
+ */
+static void packer_feed(z_stream * strm, const unsigned char ** in, size_t * left){
+	if ( strm -> avail_in == 0 && * left ){
+		size_t piece = * left > PACKER_STEP ? PACKER_STEP : * left;
+		strm -> next_in = (unsigned char *) * in;
+		strm -> avail_in = (uInt) piece;
+		* in += piece;
+		* left -= piece;
+	}
+}
+
+char packer_deflate(const unsigned char * in, size_t inlen,
+		unsigned char * out, size_t * outlen){
+	z_stream strm;
+	strm.zalloc = Z_NULL;
+	strm.zfree = Z_NULL;
+	strm.opaque = Z_NULL;
+	strm.avail_in = 0;
+	if ( Z_OK != deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+			-15 /* raw deflate */, 8, Z_DEFAULT_STRATEGY) ){
+		return 2;
+	}
+	/* Output is limited by input length: if it is not smaller, there is
+	 * no reason to compress */
+	size_t out_left = inlen, written = 0;
+	int state;
+	do{
+		packer_feed(&strm, &in, &inlen);
+		size_t piece = out_left > PACKER_STEP ? PACKER_STEP : out_left;
+		strm.next_out = out + written;
+		strm.avail_out = (uInt) piece;
+		state = deflate(&strm, inlen ? Z_NO_FLUSH : Z_FINISH);
+		written += piece - strm.avail_out;
+		out_left -= piece - strm.avail_out;
+		if ( Z_STREAM_ERROR == state ){
+			deflateEnd(&strm);
+			return 2;
+		}
+		if ( state != Z_STREAM_END && out_left == 0 ){
+			/* No gain */
+			deflateEnd(&strm);
+			return 1;
+		}
+	}while( state != Z_STREAM_END );
+	deflateEnd(&strm);
+	* outlen = written;
+	return 0;
+}
+
+char packer_inflate(const unsigned char * in, size_t inlen,
+		unsigned char * out, size_t outlen){
+	z_stream strm;
+	strm.zalloc = Z_NULL;
+	strm.zfree = Z_NULL;
+	strm.opaque = Z_NULL;
+	strm.avail_in = 0;
+	strm.next_in = Z_NULL;
+	if ( Z_OK != inflateInit2(&strm, -15) ){
+		return 2;
+	}
+	size_t written = 0;
+	int state;
+	do{
+		packer_feed(&strm, &in, &inlen);
+		size_t out_left = outlen - written;
+		size_t piece = out_left > PACKER_STEP ? PACKER_STEP : out_left;
+		strm.next_out = out + written;
+		strm.avail_out = (uInt) piece;
+		state = inflate(&strm, Z_NO_FLUSH);
+		written += piece - strm.avail_out;
+		if ( Z_MEM_ERROR == state ){
+			inflateEnd(&strm);
+			return 2;
+		}
+		if ( Z_OK != state && Z_STREAM_END != state ){
+			/* Damaged data or stream can't go on: no input, no output */
+			inflateEnd(&strm);
+			return 1;
+		}
+	}while( state != Z_STREAM_END );
+	inflateEnd(&strm);
+	if ( written != outlen || inlen != 0 || strm.avail_in != 0 ){
+		return 1;
+	}
+	return 0;
+}
+
+#else /* No zlib */
+
+char packer_available(){
+	return 0;
+}
+
+char packer_deflate(const unsigned char * in, size_t inlen,
+		unsigned char * out, size_t * outlen){
+	return 2;
+}
+
+char packer_inflate(const unsigned char * in, size_t inlen,
+		unsigned char * out, size_t outlen){
+	return 2;
+}
+
+#endif
@@ -0,0 +1,69 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PACKER_H
+#define PACKER_H
+#include <stddef.h>
+/**
+ * This module compresses messages before they are ciphered.
+ *
+ * Raw deflate stream (no zlib header, no adler32) is used: integrity
+ * is checked with SHA1 by steganolab anyway. The module is compiled
+ * in only if STEGANOLAB_ZLIB is defined, otherwise packer_available
+ * reports 0 and the rest of functions fail.
+ *
+ * Data is deflated from the caller buffer directly into the place,
+ * where it shall be ciphered, and inflated directly into the buffer,
+ * that is given to the library user, so the message is never held in
+ * memory twice.
+ */
+
+/**
+ * @return 1 if compression is compiled in, 0 if not
+ */
+char packer_available();
+
+/**
+ * Compresses data
+ * @param in - data to compress
+ * @param inlen - data length
+ * @param out - buffer of inlen bytes: compressed data that doesn't fit
+ * there is useless
+ * @param outlen - place to report compressed length to
+ * @return	0: OK
+ * 			1: compressed data is not smaller than input, useless
+ * 			2: compression failed (out of memory or not available)
+ */
+char packer_deflate(const unsigned char * in, size_t inlen,
+		unsigned char * out, size_t * outlen);
+
+/**
+ * Decompresses data
+ * @param in - compressed data
+ * @param inlen - compressed data length
+ * @param out - buffer to put data to
+ * @param outlen - exact uncompressed length, known in advance
+ * @return	0: OK
+ * 			1: data is damaged or has other length than expected
+ * 			2: decompression failed (out of memory or not available)
+ */
+char packer_inflate(const unsigned char * in, size_t inlen,
+		unsigned char * out, size_t outlen);
+
+#endif
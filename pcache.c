@@ -0,0 +1,496 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "pcache.h"
+#include "jio.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <openssl/crypto.h>
+#include <openssl/hmac.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#define PCACHE_MAGIC	"SLPERM02"
+#define PCACHE_SUFFIX	".perm"
+#define PCACHE_MIN		(16 * 1024)			/* Smaller tables are made faster than found */
+#define PCACHE_LIMIT	0					/* Default memory limit: none kept */
+#define PCACHE_MAC_SIZE	32
+#define PCACHE_SALT_NAME	"/salt"
+#define PCACHE_SALT_SIZE	16
+#define PCACHE_KDF_ROUNDS	100000			/* PBKDF2 rounds for directory secret */
+
+/**
+ * Generator position, and work, it has done to make the table, so that
+ * a job, that finds the table, counts the same work for statistics
+ */
+struct pcache_state {
+	uint64_t N;
+	unsigned char queue[RGEN_BLOCK];
+	int8_t bytes_in_queue;
+	unsigned char reserved[7];
+	uint64_t bytes_out;
+	uint64_t retries;
+};
+
+/**
+ * Entry file header, ciphered state and table follow it, then MAC of all
+ */
+struct pcache_head {
+	char magic[8];
+	uint32_t n;
+	uint32_t reserved;
+};
+
+/**
+ * Table in memory
+ */
+struct pcache_entry {
+	struct pcache_entry * prev, * next;	/* Most recently used first */
+	unsigned char id[PCACHE_ID_SIZE];
+	struct pcache_state after;
+	unsigned int n;
+	unsigned int values[];
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct pcache_entry * first, * last;
+	size_t bytes, limit;
+} pcache = { PTHREAD_MUTEX_INITIALIZER, NULL, NULL, 0, PCACHE_LIMIT };
+
+void pcache_job_init(struct pcache_job * job, const char * password, const char * dir){
+	job -> password = password;
+	job -> dir = dir;
+	job -> keyed = 0;
+}
+
+/**
+ * Reads salt of directory, making it, if there is none yet. Of processes,
+ * that make it at once, the first one wins, others read it's salt.
+ * @param salt - place for PCACHE_SALT_SIZE bytes
+ * @return 0 if OK, 1 if failed
+ */
+static char pcache_salt(const char * dir, unsigned char * salt){
+	size_t dlen = strlen(dir);
+	char * path = malloc(dlen + sizeof(PCACHE_SALT_NAME ".XXXXXX"));
+	char fail = 1;
+	int attempt;
+	if ( NULL == path ){
+		return 1;
+	}
+	memcpy(path, dir, dlen);
+	for ( attempt = 0; attempt < 2 && fail; attempt += 1 ){
+		memcpy(path + dlen, PCACHE_SALT_NAME, sizeof(PCACHE_SALT_NAME));
+		int fd = open(path, O_RDONLY);
+		if ( fd >= 0 ){
+			fail = PCACHE_SALT_SIZE != read(fd, salt, PCACHE_SALT_SIZE);
+			close(fd);
+			break;
+		}
+		/* Written under a temporary name and linked, so that nobody
+		 * reads a half-written salt and an existing one is kept */
+		memcpy(path + dlen, PCACHE_SALT_NAME ".XXXXXX", sizeof(PCACHE_SALT_NAME ".XXXXXX"));
+		fd = mkstemp(path);
+		if ( fd < 0 ){
+			break;
+		}
+		char bad = 1 != RAND_bytes(salt, PCACHE_SALT_SIZE) ||
+			jio_write_all(fd, salt, PCACHE_SALT_SIZE);
+		close(fd);
+		char * tmp = strdup(path);
+		memcpy(path + dlen, PCACHE_SALT_NAME, sizeof(PCACHE_SALT_NAME));
+		if ( ! bad && NULL != tmp ){
+			fail = 0 != link(tmp, path);
+		}
+		if ( NULL != tmp ){
+			unlink(tmp);
+			free(tmp);
+		}
+		if ( bad || NULL == tmp ){
+			break;
+		}
+		/* Lost the race: the salt, that is there, is read again */
+	}
+	free(path);
+	return fail;
+}
+
+/**
+ * Derives the job secret, once per job, when the first table is big
+ * enough to keep. Tables in memory stay in the process, their secret is
+ * a fast HMAC of the password. Entry names in a directory could be used
+ * to check passwords offline, so there the secret is PBKDF2 of the
+ * password with salt of the directory.
+ * @return 0 if OK, 1 if failed
+ */
+static char pcache_job_key(struct pcache_job * job){
+	static const char label[] = "steganolab shuffle cache";
+	if ( job -> keyed ){
+		return 0;
+	}
+	if ( NULL == job -> dir ){
+		unsigned int len = PCACHE_SECRET_SIZE;
+		if ( NULL == HMAC(EVP_sha256(), job -> password, strlen(job -> password),
+				(const unsigned char *) label, sizeof(label) - 1, job -> secret, &len) ){
+			return 1;
+		}
+	}else{
+		unsigned char salt[PCACHE_SALT_SIZE];
+		if ( pcache_salt(job -> dir, salt) || 1 != PKCS5_PBKDF2_HMAC(job -> password,
+				strlen(job -> password), salt, sizeof(salt), PCACHE_KDF_ROUNDS,
+				EVP_sha256(), PCACHE_SECRET_SIZE, job -> secret) ){
+			return 1;
+		}
+	}
+	job -> keyed = 1;
+	return 0;
+}
+
+void pcache_job_free(struct pcache_job * job){
+	memset(job -> secret, 0, PCACHE_SECRET_SIZE);
+}
+
+/**
+ * Derives a key for entry
+ * @param purpose - 'E' for cipher key, 'M' for MAC key
+ * @param key - place for 32 bytes
+ */
+static void pcache_entry_key(const struct pcache_job * job, const unsigned char * id,
+		char purpose, unsigned char * key){
+	unsigned char msg[PCACHE_ID_SIZE + 1];
+	memcpy(msg, id, PCACHE_ID_SIZE);
+	msg[PCACHE_ID_SIZE] = purpose;
+	unsigned int len = 32;
+	HMAC(EVP_sha256(), job -> secret, PCACHE_SECRET_SIZE, msg, sizeof(msg), key, &len);
+}
+
+/**
+ * Makes entry file name
+ * @return malloced name or NULL if out of memory
+ */
+static char * pcache_path(const char * dir, const unsigned char * id){
+	size_t dlen = strlen(dir);
+	char * path = malloc(dlen + 1 + 2 * PCACHE_ID_SIZE + sizeof(PCACHE_SUFFIX));
+	if ( NULL == path ){
+		return NULL;
+	}
+	memcpy(path, dir, dlen);
+	char * p = path + dlen;
+	* p++ = '/';
+	int ksi;
+	for ( ksi = 0; ksi < PCACHE_ID_SIZE; ksi += 1 ){
+		p += sprintf(p, "%02x", id[ksi]);
+	}
+	memcpy(p, PCACHE_SUFFIX, sizeof(PCACHE_SUFFIX));
+	return path;
+}
+
+/**
+ * Ciphers or deciphers entry body: AES-256-CTR is the same both ways
+ * @param in, out, len - two pieces of body in order and places to put
+ * them to
+ * @return 0 if OK, 1 if failed
+ */
+static char pcache_crypt(const struct pcache_job * job, const unsigned char * id,
+		const unsigned char * in[2], unsigned char * out[2], const size_t len[2]){
+	unsigned char key[32];
+	unsigned char iv[16];
+	pcache_entry_key(job, id, 'E', key);
+	/* Every entry has it's own key, so the counter starts from 0 */
+	memset(iv, 0, sizeof(iv));
+	EVP_CIPHER_CTX * ctx = EVP_CIPHER_CTX_new();
+	char fail = NULL == ctx || 1 != EVP_EncryptInit_ex(ctx, EVP_aes_256_ctr(), NULL, key, iv);
+	int ksi;
+	for ( ksi = 0; ksi < 2 && ! fail; ksi += 1 ){
+		size_t done = 0;
+		while ( done < len[ksi] && ! fail ){
+			/* EVP takes int lengths */
+			int step = len[ksi] - done > (1 << 30) ? (1 << 30) : (int)(len[ksi] - done);
+			int outl;
+			fail = 1 != EVP_EncryptUpdate(ctx, out[ksi] + done, &outl, in[ksi] + done, step);
+			done += step;
+		}
+	}
+	EVP_CIPHER_CTX_free(ctx);
+	memset(key, 0, sizeof(key));
+	return fail;
+}
+
+/**
+ * Unlinks entry from the list
+ */
+static void pcache_unlink(struct pcache_entry * e){
+	if ( NULL != e -> prev ){
+		e -> prev -> next = e -> next;
+	}else{
+		pcache.first = e -> next;
+	}
+	if ( NULL != e -> next ){
+		e -> next -> prev = e -> prev;
+	}else{
+		pcache.last = e -> prev;
+	}
+}
+
+/**
+ * Puts entry first in the list
+ */
+static void pcache_push(struct pcache_entry * e){
+	e -> prev = NULL;
+	e -> next = pcache.first;
+	if ( NULL != pcache.first ){
+		pcache.first -> prev = e;
+	}else{
+		pcache.last = e;
+	}
+	pcache.first = e;
+}
+
+static size_t pcache_entry_size(unsigned int n){
+	return sizeof(struct pcache_entry) + (size_t) n * sizeof(unsigned int);
+}
+
+/**
+ * Drops least recently used entries until memory fits the limit. Must
+ * be called with the lock held.
+ */
+static void pcache_trim(){
+	while ( pcache.bytes > pcache.limit ){
+		struct pcache_entry * e = pcache.last;
+		pcache_unlink(e);
+		size_t size = pcache_entry_size(e -> n);
+		pcache.bytes -= size;
+		/* Tables tell where message bits are */
+		memset(e, 0, size);
+		free(e);
+	}
+}
+
+/**
+ * Adds table to memory
+ */
+static void pcache_remember(const unsigned char * id, const struct pcache_state * after,
+		const unsigned int * values, unsigned int n){
+	size_t size = pcache_entry_size(n);
+	if ( size > __atomic_load_n(& pcache.limit, __ATOMIC_RELAXED) ){
+		return;/* Would be dropped at once */
+	}
+	struct pcache_entry * e = malloc(size);
+	if ( NULL == e ){
+		return;
+	}
+	memcpy(e -> id, id, PCACHE_ID_SIZE);
+	e -> after = * after;
+	e -> n = n;
+	memcpy(e -> values, values, (size_t) n * sizeof(unsigned int));
+	pthread_mutex_lock(& pcache.lock);
+	pcache_push(e);
+	pcache.bytes += size;
+	pcache_trim();
+	pthread_mutex_unlock(& pcache.lock);
+}
+
+/**
+ * Looks for table in memory
+ * @return 0 if found, 1 if not
+ */
+static char pcache_recall(const unsigned char * id, struct pcache_state * after,
+		unsigned int * values, unsigned int n){
+	char fail = 1;
+	pthread_mutex_lock(& pcache.lock);
+	struct pcache_entry * e;
+	for ( e = pcache.first; NULL != e; e = e -> next ){
+		if ( e -> n == n && 0 == memcmp(e -> id, id, PCACHE_ID_SIZE) ){
+			memcpy(values, e -> values, (size_t) n * sizeof(unsigned int));
+			* after = e -> after;
+			pcache_unlink(e);
+			pcache_push(e);
+			fail = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(& pcache.lock);
+	return fail;
+}
+
+/**
+ * Reads entry file
+ * @return 0 if found and good, 1 if not
+ */
+static char pcache_read(const struct pcache_job * job, const unsigned char * id,
+		struct pcache_state * after, unsigned int * values, unsigned int n){
+	char * path = pcache_path(job -> dir, id);
+	if ( NULL == path ){
+		return 1;
+	}
+	int fd = open(path, O_RDONLY);
+	free(path);
+	if ( fd < 0 ){
+		return 1;
+	}
+	size_t table = (size_t) n * sizeof(unsigned int);
+	size_t size = sizeof(struct pcache_head) + sizeof(struct pcache_state) + table +
+		PCACHE_MAC_SIZE;
+	struct stat st;
+	if ( fstat(fd, &st) || (uintmax_t) st.st_size != size ){
+		close(fd);
+		return 1;
+	}
+	const unsigned char * map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if ( MAP_FAILED == map ){
+		return 1;
+	}
+	struct pcache_head head;
+	memcpy(&head, map, sizeof(head));
+	unsigned char key[32], mac[PCACHE_MAC_SIZE];
+	unsigned int mac_len = PCACHE_MAC_SIZE;
+	pcache_entry_key(job, id, 'M', key);
+	HMAC(EVP_sha256(), key, sizeof(key), map, size - PCACHE_MAC_SIZE, mac, &mac_len);
+	memset(key, 0, sizeof(key));
+	char fail = memcmp(head.magic, PCACHE_MAGIC, sizeof(head.magic)) || head.n != n ||
+		CRYPTO_memcmp(mac, map + size - PCACHE_MAC_SIZE, PCACHE_MAC_SIZE);
+	if ( ! fail ){
+		const unsigned char * in[2] = { map + sizeof(head),
+			map + sizeof(head) + sizeof(* after) };
+		unsigned char * out[2] = { (unsigned char *) after, (unsigned char *) values };
+		size_t len[2] = { sizeof(* after), table };
+		fail = pcache_crypt(job, id, in, out, len);
+	}
+	munmap((void *) map, size);
+	return fail;
+}
+
+/**
+ * Writes entry file
+ */
+static void pcache_write(const struct pcache_job * job, const unsigned char * id,
+		const struct pcache_state * after, const unsigned int * values, unsigned int n){
+	size_t table = (size_t) n * sizeof(unsigned int);
+	size_t size = sizeof(struct pcache_head) + sizeof(struct pcache_state) + table +
+		PCACHE_MAC_SIZE;
+	unsigned char * buf = malloc(size);
+	if ( NULL == buf ){
+		return;
+	}
+	struct pcache_head head;
+	memset(&head, 0, sizeof(head));
+	memcpy(head.magic, PCACHE_MAGIC, sizeof(head.magic));
+	head.n = n;
+	memcpy(buf, &head, sizeof(head));
+	const unsigned char * in[2] = { (const unsigned char *) after,
+		(const unsigned char *) values };
+	unsigned char * out[2] = { buf + sizeof(head), buf + sizeof(head) + sizeof(* after) };
+	size_t len[2] = { sizeof(* after), table };
+	char fail = pcache_crypt(job, id, in, out, len);
+	if ( ! fail ){
+		unsigned char key[32];
+		unsigned int mac_len = PCACHE_MAC_SIZE;
+		pcache_entry_key(job, id, 'M', key);
+		HMAC(EVP_sha256(), key, sizeof(key), buf, size - PCACHE_MAC_SIZE,
+			buf + size - PCACHE_MAC_SIZE, &mac_len);
+		memset(key, 0, sizeof(key));
+	}
+	char * path = fail ? NULL : pcache_path(job -> dir, id);
+	struct jio_publish file;
+	if ( NULL != path && 0 == jio_publish_open(&file, path, size) ){
+		if ( jio_write_all(file.fd, buf, size) ){
+			jio_publish_abort(&file);
+		}else{
+			jio_publish_commit(&file, size);
+		}
+	}
+	free(path);
+	free(buf);
+}
+
+/**
+ * Takes generator position and work since the slot was filled
+ */
+static void pcache_state_get(const struct rgen * rge, const struct pcache_slot * slot,
+		struct pcache_state * s){
+	memset(s, 0, sizeof(* s));
+	s -> N = rge -> N;
+	memcpy(s -> queue, rge -> queue, RGEN_BLOCK);
+	s -> bytes_in_queue = rge -> bytes_in_queue;
+	s -> bytes_out = rge -> bytes_out - slot -> bytes_out;
+	s -> retries = rge -> retries - slot -> retries;
+}
+
+char pcache_load(struct pcache_job * job, struct rgen * rge,
+		unsigned int * values, unsigned int n, struct pcache_slot * slot){
+	slot -> bytes_out = rge -> bytes_out;
+	slot -> retries = rge -> retries;
+	slot -> use = n >= PCACHE_MIN &&
+		( __atomic_load_n(& pcache.limit, __ATOMIC_RELAXED) || NULL != job -> dir ) &&
+		0 == pcache_job_key(job);
+	if ( ! slot -> use ){
+		return 1;
+	}
+	/* Generator output depends only on the key and position: the queue
+	 * is made of the block before N */
+	unsigned char msg[sizeof(uint32_t) + sizeof(uint64_t) + 1];
+	memcpy(msg, &n, sizeof(uint32_t));
+	memcpy(msg + sizeof(uint32_t), & rge -> N, sizeof(uint64_t));
+	msg[sizeof(msg) - 1] = rge -> bytes_in_queue;
+	unsigned int len = PCACHE_ID_SIZE;
+	HMAC(EVP_sha256(), job -> secret, PCACHE_SECRET_SIZE, msg, sizeof(msg), slot -> id, &len);
+	struct pcache_state after;
+	if ( pcache_recall(slot -> id, &after, values, n) ){
+		if ( NULL == job -> dir || pcache_read(job, slot -> id, &after, values, n) ){
+			return 1;
+		}
+		pcache_remember(slot -> id, &after, values, n);
+	}
+	rge -> N = after.N;
+	memcpy(rge -> queue, after.queue, RGEN_BLOCK);
+	rge -> bytes_in_queue = after.bytes_in_queue;
+	rge -> bytes_out += after.bytes_out;
+	rge -> retries += after.retries;
+	memset(&after, 0, sizeof(after));
+	return 0;
+}
+
+void pcache_store(const struct pcache_job * job, const struct pcache_slot * slot,
+		const struct rgen * rge, const unsigned int * values, unsigned int n){
+	if ( ! slot -> use ){
+		return;
+	}
+	struct pcache_state after;
+	pcache_state_get(rge, slot, &after);
+	pcache_remember(slot -> id, &after, values, n);
+	if ( NULL != job -> dir ){
+		pcache_write(job, slot -> id, &after, values, n);
+	}
+	memset(&after, 0, sizeof(after));
+}
+
+void pcache_limit(size_t bytes){
+	pthread_mutex_lock(& pcache.lock);
+	__atomic_store_n(& pcache.limit, bytes, __ATOMIC_RELAXED);
+	pcache_trim();
+	pthread_mutex_unlock(& pcache.lock);
+}
@@ -0,0 +1,107 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PCACHE_H
+#define PCACHE_H
+#include <stddef.h>
+#include "rgen.h"
+/**
+ * This module keeps shuffle tables, made by rgen_shuffle_fill, so that
+ * jobs with the same key over images with the same number of usable
+ * positions don't make the same table again. Tables are kept in
+ * process memory, least recently used ones are dropped first, and,
+ * if asked, in a directory.
+ *
+ * An entry is named by HMAC of the table size and generator position,
+ * keyed by a secret, derived from the password, and holds the table and
+ * generator state after it. In a directory entries are ciphered with
+ * AES-256-CTR and signed with HMAC-SHA256 by keys, derived from the same
+ * secret, so they tell nothing without the password. The secret for a
+ * directory is PBKDF2-HMAC-SHA256 of the password with a random salt,
+ * kept in the directory, so that entry names are no fast password check.
+ */
+
+#define PCACHE_SECRET_SIZE	32
+#define PCACHE_ID_SIZE		32
+
+/**
+ * Cache settings of a job
+ */
+struct pcache_job {
+	unsigned char secret[PCACHE_SECRET_SIZE];
+	char keyed;				/* secret is derived */
+	const char * password;	/* to derive it from, when a table is big enough */
+	const char * dir;		/* Directory for entries, NULL for memory only */
+};
+
+/**
+ * Entry name for a table, that is not in cache yet
+ */
+struct pcache_slot {
+	char use;				/* 0 if the table is too small to keep */
+	unsigned char id[PCACHE_ID_SIZE];
+	uint64_t bytes_out;		/* Generator counters before the table */
+	uint64_t retries;
+};
+
+/**
+ * Prepares job settings. The secret is derived later, by the first
+ * pcache_load, that may keep the table.
+ * @param password - job key, it must live as long as the job
+ * @param dir - directory for entries or NULL
+ */
+void pcache_job_init(struct pcache_job * job, const char * password, const char * dir);
+
+/**
+ * Forgets the secret
+ */
+void pcache_job_free(struct pcache_job * job);
+
+/**
+ * Looks for the table, that rgen_shuffle_fill would make with generator
+ * in it's current state.
+ * @param rge - generator, seeded by the job password; if the table is
+ * found, it is moved to the state after the table, as if it made it
+ * @param values - buffer for n elements
+ * @param n - table size
+ * @param slot - place to put entry name to, for pcache_store
+ * @return 0 if found, 1 if not
+ */
+char pcache_load(struct pcache_job * job, struct rgen * rge,
+		unsigned int * values, unsigned int n, struct pcache_slot * slot);
+
+/**
+ * Keeps a table, made after pcache_load has not found it. Failures are
+ * silent: cache is only a cache.
+ * @param slot - as pcache_load has filled it
+ * @param rge - generator after making the table
+ * @param values, n - the table
+ */
+void pcache_store(const struct pcache_job * job, const struct pcache_slot * slot,
+		const struct rgen * rge, const unsigned int * values, unsigned int n);
+
+/**
+ * Sets how much process memory tables may take. Tables over the limit
+ * are dropped at once.
+ * @param bytes - the limit, 0 to keep nothing in memory (the default)
+ */
+void pcache_limit(size_t bytes);
+
+#endif
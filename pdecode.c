@@ -0,0 +1,427 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "pdecode.h"
+#include "pool.h"
+#include <stdint.h>
+#include <string.h>
+#include <jerror.h>
+
+#define LOOKAHEAD	9	/* Bits, Huffman codes are looked up by at once */
+
+/* Zigzag index to natural index. Entries past 63 catch runs in damaged
+ * data, as in jpeg library */
+static const int natural_order[DCTSIZE2 + 16] = {
+	 0,  1,  8, 16,  9,  2,  3, 10,
+	17, 24, 32, 25, 18, 11,  4,  5,
+	12, 19, 26, 33, 40, 48, 41, 34,
+	27, 20, 13,  6,  7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36,
+	29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46,
+	53, 60, 61, 54, 47, 55, 62, 63,
+	63, 63, 63, 63, 63, 63, 63, 63,
+	63, 63, 63, 63, 63, 63, 63, 63
+};
+
+/**
+ * Huffman table, prepared for decoding
+ */
+struct huff {
+	int32_t maxcode[17];	/* Biggest code of length k, -1 if none */
+	int32_t valoffset[17];	/* huffval index of code of length k minus the code */
+	uint16_t look[1 << LOOKAHEAD];	/* Length << 8 | value for short codes, 0 for long */
+	UINT8 huffval[256];
+};
+
+/**
+ * Builds decoding table
+ * @param h - table to build
+ * @param t - table from jpeg file
+ * @return 0 if OK, 1 if the table is bad
+ */
+static char huff_build(struct huff * h, const JHUFF_TBL * t){
+	unsigned char huffsize[257];
+	unsigned int huffcode[257];
+	int p = 0, l, i;
+	for ( l = 1; l <= 16; l += 1 ){
+		i = t -> bits[l];
+		if ( p + i > 256 ){
+			return 1;
+		}
+		while ( i-- ){
+			huffsize[p++] = (unsigned char) l;
+		}
+	}
+	huffsize[p] = 0;
+	/* Codes are consecutive within a length */
+	unsigned int code = 0;
+	int si = huffsize[0];
+	p = 0;
+	while ( huffsize[p] ){
+		while ( huffsize[p] == si ){
+			huffcode[p++] = code;
+			code += 1;
+		}
+		if ( code >= 1U << si ){
+			return 1;
+		}
+		code <<= 1;
+		si += 1;
+	}
+	p = 0;
+	for ( l = 1; l <= 16; l += 1 ){
+		if ( t -> bits[l] ){
+			h -> valoffset[l] = p - (int32_t) huffcode[p];
+			p += t -> bits[l];
+			h -> maxcode[l] = huffcode[p - 1];
+		}else{
+			h -> maxcode[l] = -1;
+		}
+	}
+	memset(h -> look, 0, sizeof(h -> look));
+	p = 0;
+	for ( l = 1; l <= LOOKAHEAD; l += 1 ){
+		for ( i = 0; i < t -> bits[l]; i += 1, p += 1 ){
+			/* All lookahead values, that start with the code */
+			unsigned int first = huffcode[p] << (LOOKAHEAD - l);
+			unsigned int ctr;
+			for ( ctr = 0; ctr < 1U << (LOOKAHEAD - l); ctr += 1 ){
+				h -> look[first + ctr] = (uint16_t)(l << 8 | t -> huffval[p]);
+			}
+		}
+	}
+	memcpy(h -> huffval, t -> huffval, sizeof(h -> huffval));
+	return 0;
+}
+
+/**
+ * Reads entropy coded bits of one restart interval
+ */
+struct bitreader {
+	const JOCTET * p, * end;
+	uint64_t buf;	/* Bits, most significant first */
+	int n;			/* Valid bits in buf */
+};
+
+/**
+ * Tops buffer up. Past the end of interval zeros come, as in jpeg
+ * library.
+ */
+static inline void br_fill(struct bitreader * br){
+	while ( br -> n <= 56 ){
+		unsigned int byte = 0;
+		if ( br -> p < br -> end ){
+			byte = * br -> p++;
+			if ( 0xFF == byte && br -> p < br -> end ){
+				/* Stuffed zero, intervals have no markers inside */
+				br -> p += 1;
+			}
+		}
+		br -> buf |= (uint64_t) byte << (56 - br -> n);
+		br -> n += 8;
+	}
+}
+
+static inline void br_skip(struct bitreader * br, int bits){
+	br -> buf <<= bits;
+	br -> n -= bits;
+}
+
+/**
+ * Decodes Huffman symbol. There must be at least 16 bits in buffer.
+ * @return symbol, -1 for bad code
+ */
+static inline int huff_decode(struct bitreader * br, const struct huff * h){
+	unsigned int e = h -> look[br -> buf >> (64 - LOOKAHEAD)];
+	if ( e ){
+		br_skip(br, e >> 8);
+		return e & 0xFF;
+	}
+	int l;
+	for ( l = LOOKAHEAD + 1; l <= 16; l += 1 ){
+		int32_t code = (int32_t)(br -> buf >> (64 - l));
+		if ( code <= h -> maxcode[l] ){
+			br_skip(br, l);
+			return h -> huffval[(code + h -> valoffset[l]) & 0xFF];
+		}
+	}
+	return -1;
+}
+
+/**
+ * Reads s-bit value and makes it signed, as in section F.2.2.1
+ */
+static inline int get_extend(struct bitreader * br, int s){
+	if ( 0 == s ){
+		return 0;
+	}
+	int v = (int)(br -> buf >> (64 - s));
+	br_skip(br, s);
+	if ( v < 1 << (s - 1) ){
+		v -= (1 << s) - 1;
+	}
+	return v;
+}
+
+/**
+ * Decodes one block
+ * @param pred - DC predictor of the component
+ * @param block - zeroed block to put coefficients to
+ * @return 0 if OK, 1 if data is bad
+ */
+static char decode_block(struct bitreader * br, const struct huff * dc,
+		const struct huff * ac, int * pred, JCOEF * block){
+	if ( br -> n < 32 ){
+		br_fill(br);
+	}
+	int s = huff_decode(br, dc);
+	if ( s < 0 || s > 15 ){
+		return 1;
+	}
+	* pred += get_extend(br, s);
+	block[0] = (JCOEF) * pred;
+	int k;
+	for ( k = 1; k < DCTSIZE2; k += 1 ){
+		if ( br -> n < 32 ){
+			br_fill(br);
+		}
+		int rs = huff_decode(br, ac);
+		if ( rs < 0 ){
+			return 1;
+		}
+		int r = rs >> 4;
+		s = rs & 15;
+		if ( s ){
+			k += r;
+			block[natural_order[k]] = (JCOEF) get_extend(br, s);
+		}else{
+			if ( 15 != r ){
+				break;/* End of block */
+			}
+			k += 15;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Component, as it appears in the scan
+ */
+struct scan_comp {
+	JBLOCKARRAY rows;	/* All rows of component coefficient array */
+	int h, v;			/* Blocks in MCU horizontally and vertically */
+	const struct huff * dc, * ac;
+};
+
+/**
+ * Everything, threads need to decode intervals
+ */
+struct pdecode_job {
+	const JOCTET * data;
+	const size_t * starts, * ends;	/* Interval byte ranges in data */
+	unsigned int interval;			/* MCUs in interval */
+	unsigned int total_mcus;
+	unsigned int mcus_per_row;
+	int ncomp;
+	struct scan_comp comp[MAX_COMPS_IN_SCAN];
+	int errors;						/* Intervals with bad data, atomic */
+	struct pool_watch * watch;		/* NULL if none */
+};
+
+/**
+ * Decodes one restart interval: pool task
+ */
+static void decode_interval(void * arg, unsigned int index){
+	struct pdecode_job * job = arg;
+	struct bitreader br = { job -> data + job -> starts[index],
+		job -> data + job -> ends[index], 0, 0 };
+	int pred[MAX_COMPS_IN_SCAN] = { 0 };
+	if ( pool_watch_stopped(job -> watch) ){
+		return;
+	}
+	unsigned int mcu = index * job -> interval;
+	unsigned int last = mcu + job -> interval;
+	if ( last > job -> total_mcus ){
+		last = job -> total_mcus;
+	}
+	for ( ; mcu < last; mcu += 1 ){
+		unsigned int mrow = mcu / job -> mcus_per_row;
+		unsigned int mcol = mcu % job -> mcus_per_row;
+		int ci;
+		for ( ci = 0; ci < job -> ncomp; ci += 1 ){
+			const struct scan_comp * c = job -> comp + ci;
+			int x, y;
+			for ( y = 0; y < c -> v; y += 1 ){
+				JBLOCKROW row = c -> rows[mrow * c -> v + y];
+				for ( x = 0; x < c -> h; x += 1 ){
+					if ( decode_block(&br, c -> dc, c -> ac, pred + ci,
+							row[mcol * c -> h + x]) ){
+						/* The rest of interval stays zero */
+						__atomic_fetch_add(& job -> errors, 1, __ATOMIC_RELAXED);
+						pool_watch_step(job -> watch, 1);
+						return;
+					}
+				}
+			}
+		}
+	}
+	pool_watch_step(job -> watch, 1);
+}
+
+/**
+ * @return a rounded up to multiple of b
+ */
+static long round_up(long a, long b){
+	return (a + b - 1) / b * b;
+}
+
+char pdecode_find_intervals(const JOCTET * data, size_t len, unsigned int n,
+		size_t * starts, size_t * ends){
+	unsigned int found = 0;
+	size_t pos = 0;
+	starts[0] = 0;
+	for(;;){
+		const JOCTET * ff = memchr(data + pos, 0xFF, len - pos);
+		if ( NULL == ff ){
+			return 1;/* Truncated file: jpeg library knows what to do */
+		}
+		size_t i = ff - data, j = i + 1;
+		while ( j < len && 0xFF == data[j] ){
+			j += 1;/* Fill bytes */
+		}
+		if ( j >= len ){
+			return 1;
+		}
+		JOCTET m = data[j];
+		if ( 0 == m ){
+			pos = j + 1;/* Stuffed byte */
+			continue;
+		}
+		ends[found] = i;
+		found += 1;
+		if ( m >= JPEG_RST0 && m <= JPEG_RST0 + 7 ){
+			if ( found >= n || (unsigned int) (m - JPEG_RST0) != (found - 1) % 8 ){
+				return 1;
+			}
+			starts[found] = j + 1;
+			pos = j + 1;
+			continue;
+		}
+		/* Anything else than EOI means more scans or DNL */
+		return found != n || JPEG_EOI != m;
+	}
+}
+
+jvirt_barray_ptr * pdecode_alloc_arrays(j_decompress_ptr cinfo, JBLOCKARRAY * rows){
+	jvirt_barray_ptr * arrays = (cinfo -> mem -> alloc_small)((j_common_ptr) cinfo,
+		JPOOL_IMAGE, sizeof(jvirt_barray_ptr) * MAX_COMPONENTS);
+	JDIMENSION heights[MAX_COMPONENTS];
+	int ci;
+	for ( ci = 0; ci < cinfo -> num_components; ci += 1 ){
+		jpeg_component_info * comp = cinfo -> comp_info + ci;
+		/* Sizes are as jpeg library rounds them for a full image buffer */
+		heights[ci] = (JDIMENSION) round_up(comp -> height_in_blocks, comp -> v_samp_factor);
+		arrays[ci] = (cinfo -> mem -> request_virt_barray)((j_common_ptr) cinfo,
+			JPOOL_IMAGE, TRUE,
+			(JDIMENSION) round_up(comp -> width_in_blocks, comp -> h_samp_factor),
+			heights[ci], heights[ci]);
+	}
+	(cinfo -> mem -> realize_virt_arrays)((j_common_ptr) cinfo);
+	for ( ci = 0; ci < cinfo -> num_components; ci += 1 ){
+		rows[ci] = (cinfo -> mem -> access_virt_barray)((j_common_ptr) cinfo,
+			arrays[ci], 0, heights[ci], TRUE);
+	}
+	return arrays;
+}
+
+jvirt_barray_ptr * pdecode_read_coefficients(j_decompress_ptr cinfo,
+		const JOCTET * data, size_t len, unsigned int threads,
+		pool_check check, void * check_user){
+	if ( cinfo -> progressive_mode || cinfo -> arith_code ||
+			8 != cinfo -> data_precision || 0 == cinfo -> restart_interval ||
+			0 != cinfo -> Ss || DCTSIZE2 - 1 != cinfo -> Se ||
+			0 != cinfo -> Ah || 0 != cinfo -> Al ){
+		return NULL;
+	}
+	/* One scan with all components */
+	if ( cinfo -> comps_in_scan != cinfo -> num_components ||
+			cinfo -> comps_in_scan > MAX_COMPS_IN_SCAN ){
+		return NULL;
+	}
+	struct pdecode_job job;
+	struct huff tables[2 * MAX_COMPS_IN_SCAN];
+	job.ncomp = cinfo -> comps_in_scan;
+	job.interval = cinfo -> restart_interval;
+	job.errors = 0;
+	unsigned int mcu_rows;
+	if ( 1 == job.ncomp ){
+		/* Non-interleaved scan: MCU is one block */
+		job.mcus_per_row = cinfo -> cur_comp_info[0] -> width_in_blocks;
+		mcu_rows = cinfo -> cur_comp_info[0] -> height_in_blocks;
+	}else{
+		job.mcus_per_row = (cinfo -> image_width + cinfo -> max_h_samp_factor * DCTSIZE - 1) /
+			(cinfo -> max_h_samp_factor * DCTSIZE);
+		mcu_rows = cinfo -> total_iMCU_rows;
+	}
+	job.total_mcus = job.mcus_per_row * mcu_rows;
+	int ci;
+	for ( ci = 0; ci < job.ncomp; ci += 1 ){
+		const jpeg_component_info * comp = cinfo -> cur_comp_info[ci];
+		const JHUFF_TBL * dc = cinfo -> dc_huff_tbl_ptrs[comp -> dc_tbl_no];
+		const JHUFF_TBL * ac = cinfo -> ac_huff_tbl_ptrs[comp -> ac_tbl_no];
+		if ( NULL == dc || NULL == ac || huff_build(tables + 2 * ci, dc) ||
+				huff_build(tables + 2 * ci + 1, ac) ){
+			return NULL;/* Default tables or bad ones: jpeg library's business */
+		}
+		job.comp[ci].dc = tables + 2 * ci;
+		job.comp[ci].ac = tables + 2 * ci + 1;
+		job.comp[ci].h = 1 == job.ncomp ? 1 : comp -> h_samp_factor;
+		job.comp[ci].v = 1 == job.ncomp ? 1 : comp -> v_samp_factor;
+	}
+	unsigned int n = (job.total_mcus + job.interval - 1) / job.interval;
+	size_t * starts = (cinfo -> mem -> alloc_large)((j_common_ptr) cinfo, JPOOL_IMAGE,
+		2 * (size_t) n * sizeof(size_t));
+	size_t * ends = starts + n;
+	if ( pdecode_find_intervals(data, len, n, starts, ends) ){
+		return NULL;
+	}
+	/* Threads don't call the library */
+	JBLOCKARRAY rows[MAX_COMPONENTS];
+	jvirt_barray_ptr * arrays = pdecode_alloc_arrays(cinfo, rows);
+	for ( ci = 0; ci < job.ncomp; ci += 1 ){
+		job.comp[ci].rows = rows[cinfo -> cur_comp_info[ci] -> component_index];
+	}
+	job.data = data;
+	job.starts = starts;
+	job.ends = ends;
+	struct pool_watch watch;
+	job.watch = NULL;
+	if ( NULL != check ){
+		pool_watch_init(& watch, check, check_user, n);
+		job.watch = & watch;
+	}
+	pool_for(threads, n, decode_interval, & job);
+	if ( job.errors ){
+		/* Jpeg library also goes on with zeros */
+		WARNMS(cinfo, JWRN_HUFF_BAD_CODE);
+	}
+	return arrays;
+}
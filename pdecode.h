@@ -0,0 +1,81 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PDECODE_H
+#define PDECODE_H
+#include <stddef.h>
+#include <stdio.h>
+#include <jpeglib.h>
+#include "pool.h"
+/**
+ * This module loads DCT coefficients of baseline jpeg images, that have
+ * restart markers, decoding restart intervals on several threads at
+ * once. Jpeg library decodes them one by one, though every interval
+ * starts from scratch and doesn't depend on others.
+ *
+ * Only single-scan Huffman coded 8-bit images with restart interval
+ * set are handled this way; for others jpeg_read_coefficients shall be
+ * used as usual.
+ */
+
+/**
+ * Loads coefficients. Must be called right after jpeg_read_header, in
+ * place of jpeg_read_coefficients.
+ * @param cinfo - decompressor, that has read the header
+ * @param data - the rest of jpeg file after the first SOS marker (that
+ * is what memory source manager has in buffer after jpeg_read_header)
+ * @param len - data length
+ * @param threads - most threads to use, 0 for all processors
+ * @param check - called on the calling thread after intervals, it has
+ * decoded, with intervals done of all, NULL for none. Once it has told
+ * to stop, intervals left are not decoded, and the arrays are
+ * incomplete: the caller shall find that out from the check.
+ * @param check_user - pointer to pass to it
+ * @return coefficient arrays, as jpeg_read_coefficients gives them, or
+ * NULL if the image is not suitable (nothing is changed then)
+ */
+jvirt_barray_ptr * pdecode_read_coefficients(j_decompress_ptr cinfo,
+		const JOCTET * data, size_t len, unsigned int threads,
+		pool_check check, void * check_user);
+
+/**
+ * Finds restart intervals in entropy coded data of the only scan
+ * @param data - data after SOS marker
+ * @param len - data length, up to the end of file
+ * @param n - intervals expected
+ * @param starts, ends - places for n interval ranges in data: from the
+ * first byte after SOS or RSTn marker to the next marker
+ * @return 0 if there are exactly n intervals and the scan is the last
+ * one, 1 otherwise
+ */
+char pdecode_find_intervals(const JOCTET * data, size_t len, unsigned int n,
+		size_t * starts, size_t * ends);
+
+/**
+ * Makes coefficient arrays, as jpeg_read_coefficients would, but with
+ * every array accessible at once, so that they can be filled without
+ * calling jpeg library. Must be called right after jpeg_read_header.
+ * @param cinfo - decompressor, that has read the header
+ * @param rows - place to put every component's row table to
+ * @return arrays
+ */
+jvirt_barray_ptr * pdecode_alloc_arrays(j_decompress_ptr cinfo, JBLOCKARRAY * rows);
+
+#endif
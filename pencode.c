@@ -0,0 +1,676 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "pencode.h"
+#include "pdecode.h"
+#include "pool.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Marker codes, jpeglib.h has only some of them */
+#define M_SOF0	0xC0
+#define M_SOF1	0xC1
+#define M_DHT	0xC4
+#define M_SOI	0xD8
+#define M_SOS	0xDA
+#define M_DQT	0xDB
+#define M_DRI	0xDD
+
+#define BLOCK_WORST		(2 * DCTSIZE2 * 4)	/* Most bytes a block may take, stuffed */
+#define MAX_INTERVAL	65535				/* DRI field limit */
+#define INTERVALS_PER_THREAD	4			/* For balance when rows are few */
+
+/* Zigzag index to natural index */
+static const int natural_order[DCTSIZE2] = {
+	 0,  1,  8, 16,  9,  2,  3, 10,
+	17, 24, 32, 25, 18, 11,  4,  5,
+	12, 19, 26, 33, 40, 48, 41, 34,
+	27, 20, 13,  6,  7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36,
+	29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46,
+	53, 60, 61, 54, 47, 55, 62, 63
+};
+
+/**
+ * Huffman table, prepared for encoding
+ */
+struct ehuff {
+	unsigned int code[256];
+	char size[256];	/* 0 if symbol has no code */
+};
+
+/**
+ * Builds encoding table
+ * @return 0 if OK, 1 if the table is bad
+ */
+static char ehuff_build(struct ehuff * h, const JHUFF_TBL * t){
+	int p = 0, l, i;
+	unsigned int code = 0;
+	memset(h -> size, 0, sizeof(h -> size));
+	for ( l = 1; l <= 16; l += 1 ){
+		for ( i = 0; i < t -> bits[l]; i += 1, p += 1 ){
+			if ( p > 255 ){
+				return 1;
+			}
+			h -> code[t -> huffval[p]] = code;
+			h -> size[t -> huffval[p]] = (char) l;
+			code += 1;
+		}
+		if ( code > 1U << l ){
+			return 1;
+		}
+		code <<= 1;
+	}
+	return 0;
+}
+
+/**
+ * Entropy coded bytes of one restart interval
+ */
+struct bitwriter {
+	JOCTET * buf;
+	size_t len, size;
+	uint32_t acc;	/* Bits, not yet put to buf */
+	int n;			/* Number of them, less than 8 between calls */
+};
+
+/**
+ * Makes sure, a block fits
+ * @return 0 if OK, 1 if out of memory
+ */
+static char bw_reserve(struct bitwriter * bw){
+	if ( bw -> size - bw -> len >= BLOCK_WORST ){
+		return 0;
+	}
+	size_t size = bw -> size * 2 + BLOCK_WORST;
+	JOCTET * buf = realloc(bw -> buf, size);
+	if ( NULL == buf ){
+		return 1;
+	}
+	bw -> buf = buf;
+	bw -> size = size;
+	return 0;
+}
+
+static inline void bw_put(struct bitwriter * bw, unsigned int bits, int size){
+	bw -> acc = bw -> acc << size | (bits & ((1U << size) - 1));
+	bw -> n += size;
+	while ( bw -> n >= 8 ){
+		bw -> n -= 8;
+		JOCTET byte = (JOCTET)(bw -> acc >> bw -> n);
+		bw -> buf[bw -> len++] = byte;
+		if ( 0xFF == byte ){
+			bw -> buf[bw -> len++] = 0;/* Stuffing */
+		}
+	}
+	bw -> acc &= (1U << bw -> n) - 1;
+}
+
+/**
+ * @return bits needed for absolute value
+ */
+static inline int nbits(unsigned int v){
+	return v ? 32 - __builtin_clz(v) : 0;
+}
+
+/**
+ * Encodes one block
+ * @param pred - DC of the previous block of the component
+ * @return 0 if OK, 1 if a coefficient is too big, or the tables have
+ * no code for it
+ */
+static char encode_block(struct bitwriter * bw, const JCOEF * block,
+		const struct ehuff * dc, const struct ehuff * ac, int * pred){
+	int v = block[0] - * pred;
+	* pred = block[0];
+	int s = nbits(v < 0 ? -v : v);
+	if ( s > 11 || 0 == dc -> size[s] ){
+		return 1;
+	}
+	bw_put(bw, dc -> code[s], dc -> size[s]);
+	if ( s ){
+		bw_put(bw, v < 0 ? v - 1 : v, s);
+	}
+	int r = 0, k;
+	for ( k = 1; k < DCTSIZE2; k += 1 ){
+		v = block[natural_order[k]];
+		if ( 0 == v ){
+			r += 1;
+			continue;
+		}
+		while ( r > 15 ){
+			if ( 0 == ac -> size[0xF0] ){
+				return 1;
+			}
+			bw_put(bw, ac -> code[0xF0], ac -> size[0xF0]);
+			r -= 16;
+		}
+		s = nbits(v < 0 ? -v : v);
+		if ( s > 10 ){
+			return 1;
+		}
+		int rs = r << 4 | s;
+		if ( 0 == ac -> size[rs] ){
+			return 1;
+		}
+		bw_put(bw, ac -> code[rs], ac -> size[rs]);
+		bw_put(bw, v < 0 ? v - 1 : v, s);
+		r = 0;
+	}
+	if ( r ){
+		if ( 0 == ac -> size[0] ){
+			return 1;
+		}
+		bw_put(bw, ac -> code[0], ac -> size[0]);/* End of block */
+	}
+	return 0;
+}
+
+/**
+ * Component, as it appears in the scan
+ */
+struct scan_comp {
+	JBLOCKROW * rows;			/* Rows of component coefficient array */
+	unsigned int wbl, hbl;		/* Real blocks; others in MCU are dummy */
+	int h, v;					/* Blocks in MCU horizontally and vertically */
+	const struct ehuff * dc, * ac;
+};
+
+/**
+ * Everything, threads need to encode intervals
+ */
+struct pencode_job {
+	unsigned int interval;
+	unsigned int total_mcus;
+	unsigned int mcus_per_row;
+	int ncomp;
+	struct scan_comp comp[MAX_COMPS_IN_SCAN];
+	struct bitwriter * out;	/* One for every task */
+	const unsigned int * which;	/* Interval of every task, NULL if task
+								 * number is interval number */
+	int errors;				/* atomic */
+	struct pool_watch * watch;	/* NULL if none */
+};
+
+/**
+ * Encodes one restart interval: pool task
+ */
+static void encode_interval(void * arg, unsigned int index){
+	struct pencode_job * job = arg;
+	struct bitwriter * bw = job -> out + index;
+	if ( pool_watch_stopped(job -> watch) ){
+		return;
+	}
+	int pred[MAX_COMPS_IN_SCAN] = { 0 };
+	unsigned int mcu = ( NULL != job -> which ? job -> which[index] : index ) * job -> interval;
+	unsigned int last = mcu + job -> interval;
+	if ( last > job -> total_mcus ){
+		last = job -> total_mcus;
+	}
+	for ( ; mcu < last; mcu += 1 ){
+		unsigned int mrow = mcu / job -> mcus_per_row;
+		unsigned int mcol = mcu % job -> mcus_per_row;
+		int ci;
+		for ( ci = 0; ci < job -> ncomp; ci += 1 ){
+			const struct scan_comp * c = job -> comp + ci;
+			int x, y;
+			for ( y = 0; y < c -> v; y += 1 ){
+				unsigned int row = mrow * c -> v + y;
+				for ( x = 0; x < c -> h; x += 1 ){
+					unsigned int col = mcol * c -> h + x;
+					if ( bw_reserve(bw) ){
+						__atomic_fetch_add(& job -> errors, 1, __ATOMIC_RELAXED);
+						return;
+					}
+					if ( row >= c -> hbl || col >= c -> wbl ){
+						/* Dummy block past the edge: DC of the previous
+						 * block and no AC, as jpeg library makes it */
+						if ( 0 == c -> dc -> size[0] || 0 == c -> ac -> size[0] ){
+							__atomic_fetch_add(& job -> errors, 1, __ATOMIC_RELAXED);
+							return;
+						}
+						bw_put(bw, c -> dc -> code[0], c -> dc -> size[0]);
+						bw_put(bw, c -> ac -> code[0], c -> ac -> size[0]);
+						continue;
+					}
+					if ( encode_block(bw, c -> rows[row][col], c -> dc, c -> ac, pred + ci) ){
+						__atomic_fetch_add(& job -> errors, 1, __ATOMIC_RELAXED);
+						return;
+					}
+				}
+			}
+		}
+	}
+	/* Padding with ones */
+	if ( bw -> n ){
+		bw_put(bw, 0x7F, 8 - bw -> n);
+	}
+	pool_watch_step(job -> watch, 1);
+}
+
+/**
+ * Puts marker header: FF, code and segment length
+ * @param length - segment length, without length field
+ * @return pointer past the header
+ */
+static JOCTET * put_marker(JOCTET * p, int code, unsigned int length){
+	* p++ = 0xFF;
+	* p++ = (JOCTET) code;
+	if ( length ){
+		length += 2;
+		* p++ = (JOCTET)(length >> 8);
+		* p++ = (JOCTET) length;
+	}
+	return p;
+}
+
+/**
+ * Writes markers, that precede entropy coded data
+ * @param p - buffer, big enough
+ * @return pointer past the markers
+ */
+static JOCTET * put_headers(JOCTET * p, j_compress_ptr cinfo, unsigned int interval){
+	int ci, i, k;
+	p = put_marker(p, M_SOI, 0);
+	if ( cinfo -> write_JFIF_header ){
+		p = put_marker(p, JPEG_APP0, 14);
+		memcpy(p, "JFIF", 5);
+		p += 5;
+		* p++ = cinfo -> JFIF_major_version;
+		* p++ = cinfo -> JFIF_minor_version;
+		* p++ = cinfo -> density_unit;
+		* p++ = (JOCTET)(cinfo -> X_density >> 8);
+		* p++ = (JOCTET) cinfo -> X_density;
+		* p++ = (JOCTET)(cinfo -> Y_density >> 8);
+		* p++ = (JOCTET) cinfo -> Y_density;
+		* p++ = 0;/* No thumbnail */
+		* p++ = 0;
+	}
+	if ( cinfo -> write_Adobe_marker ){
+		p = put_marker(p, JPEG_APP0 + 14, 12);
+		memcpy(p, "Adobe", 5);
+		p += 5;
+		* p++ = 0;/* Version 100 */
+		* p++ = 100;
+		memset(p, 0, 4);/* Flags */
+		p += 4;
+		* p++ = JCS_YCbCr == cinfo -> jpeg_color_space ? 1 :
+			JCS_YCCK == cinfo -> jpeg_color_space ? 2 : 0;
+	}
+	/* Quantization tables of the components, each once */
+	char baseline = 1;
+	unsigned int written = 0;
+	for ( ci = 0; ci < cinfo -> num_components; ci += 1 ){
+		int no = cinfo -> comp_info[ci].quant_tbl_no;
+		if ( written & 1U << no ){
+			continue;
+		}
+		written |= 1U << no;
+		const JQUANT_TBL * q = cinfo -> quant_tbl_ptrs[no];
+		char prec = 0;
+		for ( k = 0; k < DCTSIZE2; k += 1 ){
+			if ( q -> quantval[k] > 255 ){
+				prec = 1;
+				baseline = 0;
+			}
+		}
+		p = put_marker(p, M_DQT, 1 + DCTSIZE2 * (prec + 1));
+		* p++ = (JOCTET)(prec << 4 | no);
+		for ( k = 0; k < DCTSIZE2; k += 1 ){
+			unsigned int val = q -> quantval[natural_order[k]];
+			if ( prec ){
+				* p++ = (JOCTET)(val >> 8);
+			}
+			* p++ = (JOCTET) val;
+		}
+	}
+	/* Frame */
+	p = put_marker(p, baseline ? M_SOF0 : M_SOF1, 6 + 3 * cinfo -> num_components);
+	* p++ = 8;
+	* p++ = (JOCTET)(cinfo -> image_height >> 8);
+	* p++ = (JOCTET) cinfo -> image_height;
+	* p++ = (JOCTET)(cinfo -> image_width >> 8);
+	* p++ = (JOCTET) cinfo -> image_width;
+	* p++ = (JOCTET) cinfo -> num_components;
+	for ( ci = 0; ci < cinfo -> num_components; ci += 1 ){
+		const jpeg_component_info * c = cinfo -> comp_info + ci;
+		* p++ = (JOCTET) c -> component_id;
+		* p++ = (JOCTET)(c -> h_samp_factor << 4 | c -> v_samp_factor);
+		* p++ = (JOCTET) c -> quant_tbl_no;
+	}
+	/* Huffman tables, each once */
+	unsigned int dc_written = 0, ac_written = 0;
+	for ( ci = 0; ci < cinfo -> num_components; ci += 1 ){
+		const jpeg_component_info * c = cinfo -> comp_info + ci;
+		int pass;
+		for ( pass = 0; pass < 2; pass += 1 ){
+			int no = pass ? c -> ac_tbl_no : c -> dc_tbl_no;
+			unsigned int * w = pass ? & ac_written : & dc_written;
+			if ( * w & 1U << no ){
+				continue;
+			}
+			* w |= 1U << no;
+			const JHUFF_TBL * t = pass ? cinfo -> ac_huff_tbl_ptrs[no] : cinfo -> dc_huff_tbl_ptrs[no];
+			unsigned int count = 0;
+			for ( i = 1; i <= 16; i += 1 ){
+				count += t -> bits[i];
+			}
+			p = put_marker(p, M_DHT, 1 + 16 + count);
+			* p++ = (JOCTET)(pass << 4 | no);
+			memcpy(p, t -> bits + 1, 16);
+			p += 16;
+			memcpy(p, t -> huffval, count);
+			p += count;
+		}
+	}
+	p = put_marker(p, M_DRI, 2);
+	* p++ = (JOCTET)(interval >> 8);
+	* p++ = (JOCTET) interval;
+	/* Scan */
+	p = put_marker(p, M_SOS, 1 + 2 * cinfo -> num_components + 3);
+	* p++ = (JOCTET) cinfo -> num_components;
+	for ( ci = 0; ci < cinfo -> num_components; ci += 1 ){
+		const jpeg_component_info * c = cinfo -> comp_info + ci;
+		* p++ = (JOCTET) c -> component_id;
+		* p++ = (JOCTET)(c -> dc_tbl_no << 4 | c -> ac_tbl_no);
+	}
+	* p++ = 0;/* Ss */
+	* p++ = DCTSIZE2 - 1;/* Se */
+	* p++ = 0;/* Ah, Al */
+	return p;
+}
+
+/* Markers take no more than this */
+#define HEADERS_SIZE	(2 + 18 + 16 + NUM_QUANT_TBLS * (5 + 2 * DCTSIZE2) + \
+	(8 + 3 * MAX_COMPONENTS) + 2 * NUM_HUFF_TBLS * (5 + 16 + 256) + 6 + \
+	(6 + 2 * MAX_COMPONENTS + 3))
+
+char pencode_write(j_compress_ptr cinfo, j_decompress_ptr cinfo_in,
+		jvirt_barray_ptr * arrays, unsigned int threads,
+		pool_check check, void * check_user,
+		JOCTET ** out, size_t * out_len){
+	if ( 8 != cinfo -> data_precision || cinfo -> num_components > MAX_COMPS_IN_SCAN ||
+			cinfo -> num_components != cinfo_in -> num_components ){
+		return 1;
+	}
+	struct pencode_job job;
+	struct ehuff tables[2 * MAX_COMPS_IN_SCAN];
+	int ci;
+	job.ncomp = cinfo -> num_components;
+	job.which = NULL;
+	job.errors = 0;
+	for ( ci = 0; ci < job.ncomp; ci += 1 ){
+		const jpeg_component_info * c = cinfo -> comp_info + ci;
+		const jpeg_component_info * c_in = cinfo_in -> comp_info + ci;
+		const JHUFF_TBL * dc = cinfo -> dc_huff_tbl_ptrs[c -> dc_tbl_no];
+		const JHUFF_TBL * ac = cinfo -> ac_huff_tbl_ptrs[c -> ac_tbl_no];
+		if ( NULL == dc || NULL == ac || NULL == cinfo -> quant_tbl_ptrs[c -> quant_tbl_no] ||
+				ehuff_build(tables + 2 * ci, dc) || ehuff_build(tables + 2 * ci + 1, ac) ){
+			return 1;
+		}
+		struct scan_comp * sc = job.comp + ci;
+		sc -> dc = tables + 2 * ci;
+		sc -> ac = tables + 2 * ci + 1;
+		sc -> wbl = c_in -> width_in_blocks;
+		sc -> hbl = c_in -> height_in_blocks;
+		sc -> h = 1 == job.ncomp ? 1 : c -> h_samp_factor;
+		sc -> v = 1 == job.ncomp ? 1 : c -> v_samp_factor;
+		/* Threads don't call jpeg library: arrays are in memory, so
+		 * rows don't move */
+		sc -> rows = (cinfo -> mem -> alloc_small)((j_common_ptr) cinfo, JPOOL_IMAGE,
+			sizeof(JBLOCKROW) * (sc -> hbl + 1));
+		unsigned int row;
+		for ( row = 0; row < sc -> hbl; row += 1 ){
+			JBLOCKARRAY B = (cinfo_in -> mem -> access_virt_barray)((j_common_ptr) cinfo_in,
+				arrays[ci], row, 1, FALSE);
+			sc -> rows[row] = B[0];
+		}
+	}
+	unsigned int mcu_rows;
+	if ( 1 == job.ncomp ){
+		/* Non-interleaved scan: MCU is one block */
+		job.mcus_per_row = job.comp[0].wbl;
+		mcu_rows = job.comp[0].hbl;
+	}else{
+		job.mcus_per_row = (cinfo_in -> image_width + cinfo_in -> max_h_samp_factor * DCTSIZE - 1) /
+			(cinfo_in -> max_h_samp_factor * DCTSIZE);
+		mcu_rows = (cinfo_in -> image_height + cinfo_in -> max_v_samp_factor * DCTSIZE - 1) /
+			(cinfo_in -> max_v_samp_factor * DCTSIZE);
+	}
+	job.total_mcus = job.mcus_per_row * mcu_rows;
+	if ( 0 == job.total_mcus ){
+		return 1;
+	}
+	/* A row of MCUs per interval, smaller ones if rows are few */
+	if ( 0 == threads ){
+		threads = pool_cpus();
+	}
+	job.interval = job.mcus_per_row;
+	if ( mcu_rows < threads * INTERVALS_PER_THREAD ){
+		job.interval = job.total_mcus / (threads * INTERVALS_PER_THREAD);
+	}
+	if ( job.interval < 1 ){
+		job.interval = 1;
+	}
+	if ( job.interval > MAX_INTERVAL ){
+		job.interval = MAX_INTERVAL;
+	}
+	unsigned int n = (job.total_mcus + job.interval - 1) / job.interval;
+	job.out = calloc(n, sizeof(struct bitwriter));
+	if ( NULL == job.out ){
+		return 1;
+	}
+	struct pool_watch watch;
+	job.watch = NULL;
+	if ( NULL != check ){
+		pool_watch_init(& watch, check, check_user, n);
+		job.watch = & watch;
+	}
+	pool_for(threads, n, encode_interval, & job);
+	/* Gluing intervals with RSTn markers between */
+	size_t total = HEADERS_SIZE + 2;
+	unsigned int ksi;
+	for ( ksi = 0; ksi < n; ksi += 1 ){
+		total += job.out[ksi].len + 2;
+	}
+	JOCTET * buf = NULL;
+	char stopped = pool_watch_stopped(job.watch);
+	if ( 0 == job.errors && ! stopped ){
+		buf = malloc(total);
+	}
+	if ( NULL != buf ){
+		JOCTET * p = put_headers(buf, cinfo, job.interval);
+		for ( ksi = 0; ksi < n; ksi += 1 ){
+			if ( ksi ){
+				p = put_marker(p, JPEG_RST0 + (ksi - 1) % 8, 0);
+			}
+			memcpy(p, job.out[ksi].buf, job.out[ksi].len);
+			p += job.out[ksi].len;
+		}
+		p = put_marker(p, JPEG_EOI, 0);
+		* out = buf;
+		* out_len = p - buf;
+	}
+	for ( ksi = 0; ksi < n; ksi += 1 ){
+		free(job.out[ksi].buf);
+	}
+	free(job.out);
+	return stopped ? 2 : NULL == buf;
+}
+
+/**
+ * Tells, whether any real block of an interval has changed
+ */
+static char interval_changed(const struct pencode_job * job, unsigned int index,
+		unsigned char * const * changed, const unsigned int * widths){
+	unsigned int mcu = index * job -> interval;
+	unsigned int last = mcu + job -> interval;
+	if ( last > job -> total_mcus ){
+		last = job -> total_mcus;
+	}
+	for ( ; mcu < last; mcu += 1 ){
+		unsigned int mrow = mcu / job -> mcus_per_row;
+		unsigned int mcol = mcu % job -> mcus_per_row;
+		int ci, x, y;
+		for ( ci = 0; ci < job -> ncomp; ci += 1 ){
+			const struct scan_comp * c = job -> comp + ci;
+			for ( y = 0; y < c -> v; y += 1 ){
+				unsigned int row = mrow * c -> v + y;
+				for ( x = 0; x < c -> h && row < c -> hbl; x += 1 ){
+					unsigned int col = mcol * c -> h + x;
+					if ( col < c -> wbl && changed[ci][(size_t) row * widths[ci] + col] ){
+						return 1;
+					}
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+char pencode_splice(j_decompress_ptr cinfo, jvirt_barray_ptr * arrays,
+		const JOCTET * file, size_t len, size_t scan,
+		unsigned char * const * changed, unsigned int threads,
+		pool_check check, void * check_user,
+		JOCTET ** out, size_t * out_len){
+	if ( cinfo -> progressive_mode || cinfo -> arith_code ||
+			8 != cinfo -> data_precision || 0 == cinfo -> restart_interval ||
+			0 != cinfo -> Ss || DCTSIZE2 - 1 != cinfo -> Se ||
+			0 != cinfo -> Ah || 0 != cinfo -> Al ||
+			cinfo -> comps_in_scan != cinfo -> num_components ||
+			cinfo -> comps_in_scan > MAX_COMPS_IN_SCAN || scan > len ){
+		return 1;
+	}
+	struct pencode_job job;
+	struct ehuff tables[2 * MAX_COMPS_IN_SCAN];
+	unsigned char * scan_changed[MAX_COMPS_IN_SCAN];
+	unsigned int widths[MAX_COMPS_IN_SCAN];
+	int ci;
+	job.ncomp = cinfo -> comps_in_scan;
+	job.interval = cinfo -> restart_interval;
+	job.errors = 0;
+	for ( ci = 0; ci < job.ncomp; ci += 1 ){
+		const jpeg_component_info * c = cinfo -> cur_comp_info[ci];
+		const JHUFF_TBL * dc = cinfo -> dc_huff_tbl_ptrs[c -> dc_tbl_no];
+		const JHUFF_TBL * ac = cinfo -> ac_huff_tbl_ptrs[c -> ac_tbl_no];
+		if ( NULL == dc || NULL == ac ||
+				ehuff_build(tables + 2 * ci, dc) || ehuff_build(tables + 2 * ci + 1, ac) ){
+			return 1;
+		}
+		struct scan_comp * sc = job.comp + ci;
+		sc -> dc = tables + 2 * ci;
+		sc -> ac = tables + 2 * ci + 1;
+		sc -> wbl = c -> width_in_blocks;
+		sc -> hbl = c -> height_in_blocks;
+		sc -> h = 1 == job.ncomp ? 1 : c -> h_samp_factor;
+		sc -> v = 1 == job.ncomp ? 1 : c -> v_samp_factor;
+		scan_changed[ci] = changed[c -> component_index];
+		widths[ci] = c -> width_in_blocks;
+		sc -> rows = (cinfo -> mem -> alloc_small)((j_common_ptr) cinfo, JPOOL_IMAGE,
+			sizeof(JBLOCKROW) * (sc -> hbl + 1));
+		unsigned int row;
+		for ( row = 0; row < sc -> hbl; row += 1 ){
+			JBLOCKARRAY B = (cinfo -> mem -> access_virt_barray)((j_common_ptr) cinfo,
+				arrays[c -> component_index], row, 1, FALSE);
+			sc -> rows[row] = B[0];
+		}
+	}
+	unsigned int mcu_rows;
+	if ( 1 == job.ncomp ){
+		job.mcus_per_row = job.comp[0].wbl;
+		mcu_rows = job.comp[0].hbl;
+	}else{
+		job.mcus_per_row = (cinfo -> image_width + cinfo -> max_h_samp_factor * DCTSIZE - 1) /
+			(cinfo -> max_h_samp_factor * DCTSIZE);
+		mcu_rows = cinfo -> total_iMCU_rows;
+	}
+	job.total_mcus = job.mcus_per_row * mcu_rows;
+	if ( 0 == job.total_mcus ){
+		return 1;
+	}
+	unsigned int n = (job.total_mcus + job.interval - 1) / job.interval;
+	size_t * starts = malloc(2 * (size_t) n * sizeof(size_t));
+	unsigned int * which = malloc((size_t) n * sizeof(unsigned int));
+	if ( NULL == starts || NULL == which ||
+			pdecode_find_intervals(file + scan, len - scan, n, starts, starts + n) ){
+		free(starts);
+		free(which);
+		return 1;
+	}
+	size_t * ends = starts + n;
+	/* Intervals, that must be coded again */
+	unsigned int dirty = 0, ksi;
+	for ( ksi = 0; ksi < n; ksi += 1 ){
+		if ( interval_changed(&job, ksi, scan_changed, widths) ){
+			which[dirty++] = ksi;
+		}
+	}
+	job.which = which;
+	job.out = calloc(dirty ? dirty : 1, sizeof(struct bitwriter));
+	if ( NULL == job.out ){
+		free(starts);
+		free(which);
+		return 1;
+	}
+	struct pool_watch watch;
+	job.watch = NULL;
+	if ( NULL != check ){
+		pool_watch_init(& watch, check, check_user, dirty);
+		job.watch = & watch;
+	}
+	pool_for(threads, dirty, encode_interval, & job);
+	/* Old intervals, except the dirty ones, and everything around them
+	 * as it was */
+	size_t total = len;
+	unsigned int d;
+	for ( d = 0; d < dirty; d += 1 ){
+		total = total - (ends[which[d]] - starts[which[d]]) + job.out[d].len;
+	}
+	JOCTET * buf = NULL;
+	char stopped = pool_watch_stopped(job.watch);
+	if ( 0 == job.errors && ! stopped ){
+		buf = malloc(total ? total : 1);
+	}
+	if ( NULL != buf ){
+		JOCTET * p = buf;
+		size_t from = 0;/* Copied up to this in file */
+		for ( d = 0; d < dirty; d += 1 ){
+			size_t a = scan + starts[which[d]];
+			memcpy(p, file + from, a - from);
+			p += a - from;
+			memcpy(p, job.out[d].buf, job.out[d].len);
+			p += job.out[d].len;
+			from = scan + ends[which[d]];
+		}
+		memcpy(p, file + from, len - from);
+		p += len - from;
+		* out = buf;
+		* out_len = p - buf;
+	}
+	for ( d = 0; d < dirty; d += 1 ){
+		free(job.out[d].buf);
+	}
+	free(job.out);
+	free(starts);
+	free(which);
+	return stopped ? 2 : NULL == buf;
+}
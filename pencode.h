@@ -0,0 +1,82 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PENCODE_H
+#define PENCODE_H
+#include <stddef.h>
+#include <stdio.h>
+#include <jpeglib.h>
+#include "pool.h"
+/**
+ * This module writes a jpeg file of DCT coefficients, as
+ * jpeg_write_coefficients does, but with restart markers, so that
+ * restart intervals are Huffman coded on several threads at once.
+ *
+ * The file has one interleaved baseline scan with standard Huffman
+ * tables, as jpeg library makes when not asked to optimize them.
+ */
+
+/**
+ * Writes a jpeg into memory.
+ * @param cinfo - compressor, set up by jpeg_copy_critical_parameters,
+ * not started; it's memory is used for tables
+ * @param cinfo_in - decompressor, the arrays belong to
+ * @param arrays - coefficients to write, all in memory
+ * @param threads - most threads to use, 0 for all processors
+ * @param check - called on the calling thread after intervals, it has
+ * encoded, with intervals done of all, NULL for none
+ * @param check_user - pointer to pass to it
+ * @param out - place to put malloced jpeg to
+ * @param out_len - place to put jpeg length to
+ * @return 0 if OK, 1 if this can't be done here (out of memory, a
+ * coefficient too big for baseline, unusual parameters): jpeg library
+ * shall be used then, 2 if check has told to stop
+ */
+char pencode_write(j_compress_ptr cinfo, j_decompress_ptr cinfo_in,
+		jvirt_barray_ptr * arrays, unsigned int threads,
+		pool_check check, void * check_user,
+		JOCTET ** out, size_t * out_len);
+
+/**
+ * Makes a copy of a jpeg in memory, where only restart intervals with
+ * changed blocks are coded again, with the file's own Huffman tables,
+ * and everything else is copied byte for byte.
+ * @param cinfo - decompressor, that has read the file
+ * @param arrays - it's coefficients, all in memory
+ * @param file, len - the jpeg file
+ * @param scan - offset of entropy coded data after the SOS marker
+ * @param changed - for every component a byte for every block, row
+ * after row of width_in_blocks, not 0 if the block has changed
+ * @param threads - most threads to use, 0 for all processors
+ * @param check, check_user - as for pencode_write
+ * @param out - place to put malloced jpeg to
+ * @param out_len - place to put jpeg length to
+ * @return 0 if OK, 1 if this can't be done (not a single baseline scan
+ * with restart markers, tables without a code, that is needed, out of
+ * memory): the file shall be written as usual then, 2 if check has told
+ * to stop
+ */
+char pencode_splice(j_decompress_ptr cinfo, jvirt_barray_ptr * arrays,
+		const JOCTET * file, size_t len, size_t scan,
+		unsigned char * const * changed, unsigned int threads,
+		pool_check check, void * check_user,
+		JOCTET ** out, size_t * out_len);
+
+#endif
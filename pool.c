@@ -0,0 +1,254 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "pool.h"
+#include "arena.h"
+#include <pthread.h>
+#include <unistd.h>
+
+#define POOL_MAX_THREADS	256
+#define POOL_ARENA_KEEP		(32 * 1024 * 1024)	/* Job memory, an idle thread keeps */
+
+/**
+ * State, shared by threads of one pool_for call
+ */
+struct pool_run {
+	pool_task task;
+	void * arg;
+	unsigned int n;
+	unsigned int next;	/* next task to take, atomic */
+	/* Under executor lock */
+	unsigned int wanted;	/* Threads more, that may join */
+	unsigned int active;	/* Executor threads, that have joined */
+	struct pool_run * later;/* Next run, offered for help */
+};
+
+/**
+ * The executor
+ */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work;	/* Something to do for idle threads */
+	pthread_cond_t joined;	/* An executor thread has left a run */
+	pthread_once_t once;
+	unsigned int threads;	/* Started */
+	unsigned int idle;
+	struct pool_run * runs;	/* Runs with room for helpers, oldest first */
+	struct pool_job * jobs;	/* Queued jobs, first to start first */
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	PTHREAD_COND_INITIALIZER, PTHREAD_ONCE_INIT, 0, 0, NULL, NULL };
+
+unsigned int pool_cpus(){
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	if ( n < 1 ){
+		return 1;
+	}
+	if ( n > POOL_MAX_THREADS ){
+		return POOL_MAX_THREADS;
+	}
+	return (unsigned int) n;
+}
+
+/**
+ * Takes tasks of a run until there are no more
+ */
+static void pool_work(struct pool_run * run){
+	for(;;){
+		unsigned int index = __atomic_fetch_add(& run -> next, 1, __ATOMIC_RELAXED);
+		if ( index >= run -> n ){
+			break;
+		}
+		run -> task(run -> arg, index);
+	}
+}
+
+/**
+ * Takes a run off the list of runs, offered for help. Executor lock
+ * must be held.
+ */
+static void pool_unlist(struct pool_run * run){
+	struct pool_run ** p;
+	for ( p = & pool.runs; NULL != * p; p = & (* p) -> later ){
+		if ( * p == run ){
+			* p = run -> later;
+			return;
+		}
+	}
+}
+
+/**
+ * Body of an executor thread: helps runs first, then starts jobs.
+ * The thread lives as long as the process. When it runs out of work,
+ * it keeps up to POOL_ARENA_KEEP bytes of job memory in it's arena for
+ * the next job and gives the rest back, so that one big job doesn't
+ * hold memory of every thread, it has run on, for good.
+ */
+static void * pool_thread(void * unused){
+	(void) unused;
+	char worked = 0;/* Arena may hold more than it keeps */
+	pthread_mutex_lock(& pool.lock);
+	for(;;){
+		struct pool_run * run = pool.runs;
+		if ( NULL != run ){
+			run -> wanted -= 1;
+			if ( 0 == run -> wanted ){
+				pool.runs = run -> later;
+			}
+			run -> active += 1;
+			pthread_mutex_unlock(& pool.lock);
+			pool_work(run);
+			worked = 1;
+			pthread_mutex_lock(& pool.lock);
+			run -> active -= 1;
+			if ( 0 == run -> active ){
+				pthread_cond_broadcast(& pool.joined);
+			}
+			continue;
+		}
+		struct pool_job * job = pool.jobs;
+		if ( NULL != job ){
+			pool.jobs = job -> next;
+			pthread_mutex_unlock(& pool.lock);
+			job -> run(job);
+			worked = 1;
+			pthread_mutex_lock(& pool.lock);
+			continue;
+		}
+		if ( worked ){
+			/* Going idle: work may come meanwhile, so looking again */
+			worked = 0;
+			pthread_mutex_unlock(& pool.lock);
+			arena_trim(POOL_ARENA_KEEP);
+			pthread_mutex_lock(& pool.lock);
+			continue;
+		}
+		pool.idle += 1;
+		pthread_cond_wait(& pool.work, & pool.lock);
+		pool.idle -= 1;
+	}
+	return NULL;
+}
+
+/**
+ * Starts executor threads, one for every processor
+ */
+static void pool_start(){
+	unsigned int cpus = pool_cpus();
+	pthread_attr_t attr;
+	pthread_attr_init(& attr);
+	pthread_attr_setdetachstate(& attr, PTHREAD_CREATE_DETACHED);
+	while ( pool.threads < cpus ){
+		pthread_t tid;
+		if ( pthread_create(& tid, & attr, pool_thread, NULL) ){
+			break;/* Doing with those we have */
+		}
+		pool.threads += 1;
+	}
+	pthread_attr_destroy(& attr);
+}
+
+void pool_for(unsigned int threads, unsigned int n, pool_task task, void * arg){
+	struct pool_run run = { task, arg, n, 0, 0, 0, NULL };
+	if ( 0 == threads ){
+		threads = pool_cpus();
+	}
+	if ( threads > n ){
+		threads = n;
+	}
+	if ( threads > POOL_MAX_THREADS ){
+		threads = POOL_MAX_THREADS;
+	}
+	if ( threads > 1 ){
+		pthread_once(& pool.once, pool_start);
+	}
+	char offered = threads > 1 && pool.threads;
+	if ( offered ){
+		/* Offering the rest of the tasks to idle threads */
+		pthread_mutex_lock(& pool.lock);
+		run.wanted = threads - 1;
+		struct pool_run ** p = & pool.runs;
+		while ( NULL != * p ){
+			p = & (* p) -> later;
+		}
+		* p = & run;
+		if ( pool.idle ){
+			pthread_cond_broadcast(& pool.work);
+		}
+		pthread_mutex_unlock(& pool.lock);
+	}
+	/* The calling thread is one of them */
+	pool_work(& run);
+	if ( offered ){
+		pthread_mutex_lock(& pool.lock);
+		if ( run.wanted ){
+			/* Those, who have not come, are not needed */
+			pool_unlist(& run);
+			run.wanted = 0;
+		}
+		while ( run.active ){
+			pthread_cond_wait(& pool.joined, & pool.lock);
+		}
+		pthread_mutex_unlock(& pool.lock);
+	}
+}
+
+char pool_submit(struct pool_job * job){
+	pthread_once(& pool.once, pool_start);
+	if ( 0 == pool.threads ){
+		return 1;
+	}
+	pthread_mutex_lock(& pool.lock);
+	/* Higher priority first, then in order of queuing */
+	struct pool_job ** p = & pool.jobs;
+	while ( NULL != * p && (* p) -> priority >= job -> priority ){
+		p = & (* p) -> next;
+	}
+	job -> next = * p;
+	* p = job;
+	pthread_cond_signal(& pool.work);
+	pthread_mutex_unlock(& pool.lock);
+	return 0;
+}
+
+void pool_watch_init(struct pool_watch * watch, pool_check check,
+		void * user, unsigned long long total){
+	watch -> check = check;
+	watch -> user = user;
+	watch -> owner = pthread_self();
+	watch -> done = 0;
+	watch -> total = total;
+	watch -> stop = 0;
+}
+
+char pool_watch_step(struct pool_watch * watch, unsigned long long done){
+	if ( NULL == watch ){
+		return 0;
+	}
+	done = __atomic_add_fetch(& watch -> done, done, __ATOMIC_RELAXED);
+	if ( pthread_equal(pthread_self(), watch -> owner) && ! pool_watch_stopped(watch) &&
+			(watch -> check)(watch -> user, done, watch -> total) ){
+		__atomic_store_n(& watch -> stop, 1, __ATOMIC_RELAXED);
+	}
+	return pool_watch_stopped(watch);
+}
+
+char pool_watch_stopped(struct pool_watch * watch){
+	return NULL != watch && __atomic_load_n(& watch -> stop, __ATOMIC_RELAXED);
+}
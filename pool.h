@@ -0,0 +1,130 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef POOL_H
+#define POOL_H
+#include <pthread.h>
+/**
+ * This module runs work on threads of one executor, shared by the whole
+ * process: as many threads, as there are processors, started at first
+ * need and kept. Work comes as jobs, queued by priority, and as tasks
+ * of pool_for calls, done by the calling thread together with executor
+ * threads, that are idle. Idle threads help with tasks, that are being
+ * done, before they start a new job, so that a job, that has spread it's
+ * work, is not held back by jobs, queued after it, and cores are shared
+ * by jobs without starting threads for them.
+ *
+ * Jobs wait in one queue and runs in one list, both under one lock,
+ * rather than in per-thread deques with work stealing: a job is a whole
+ * library call and a task a restart interval or a band, so threads take
+ * the lock seldom, and the queue keeps priorities exact. Tasks of a run
+ * are handed out by an atomic counter without the lock.
+ */
+
+/**
+ * Task function
+ * @param arg - pointer, given to pool_for
+ * @param index - task number
+ */
+typedef void (*pool_task)(void * arg, unsigned int index);
+
+/**
+ * Job for the executor. The caller keeps it, usually as the first
+ * member of a bigger structure, until it has run.
+ */
+struct pool_job {
+	void (*run)(struct pool_job * job);	/* Called on an executor thread */
+	int priority;						/* Higher ones are started first */
+	struct pool_job * next;				/* Used by the executor */
+};
+
+/**
+ * @return number of processors online, at least 1
+ */
+unsigned int pool_cpus();
+
+/**
+ * Runs task for every index from 0 to n-1. Tasks are taken in order of
+ * index by the calling thread and by idle executor threads, that join
+ * it, and all of them are done when the function returns.
+ * @param threads - most threads to use, the calling one included, 0
+ * means pool_cpus()
+ * @param n - number of tasks
+ * @param task - function to call
+ * @param arg - argument for function
+ */
+void pool_for(unsigned int threads, unsigned int n, pool_task task, void * arg);
+
+/**
+ * Check of a job, that spreads it's work with pool_for
+ * @param user - pointer, given to pool_watch_init
+ * @param done, total - units of work done so far, of all
+ * @return 0 to go on, not 0 to stop
+ */
+typedef int (*pool_check)(void * user, unsigned long long done,
+		unsigned long long total);
+
+/**
+ * Watch for tasks of a job: they count units of work, they have done,
+ * and the thread, that has set the watch up, calls the check, so that
+ * the caller's callbacks are not called on executor threads. Once the
+ * check has told to stop, tasks look at the watch and skip their work.
+ */
+struct pool_watch {
+	pool_check check;
+	void * user;
+	pthread_t owner;
+	unsigned long long done;	/* atomic */
+	unsigned long long total;
+	char stop;					/* atomic */
+};
+
+/**
+ * Sets watch up on the calling thread
+ * @param check - function to call
+ * @param user - pointer to pass to it
+ * @param total - units of work of the job
+ */
+void pool_watch_init(struct pool_watch * watch, pool_check check,
+		void * user, unsigned long long total);
+
+/**
+ * Counts work, done by a task, and checks the job, if called on the
+ * thread, that has set the watch up
+ * @param watch - the watch or NULL
+ * @param done - units of work done
+ * @return 1 if the job must stop, 0 if not
+ */
+char pool_watch_step(struct pool_watch * watch, unsigned long long done);
+
+/**
+ * @param watch - the watch or NULL
+ * @return 1 if the job must stop, 0 if not
+ */
+char pool_watch_stopped(struct pool_watch * watch);
+
+/**
+ * Queues a job. Jobs of the same priority start in order of queuing.
+ * @param job - job with run and priority set
+ * @return 0 if OK, 1 if the executor has no threads
+ */
+char pool_submit(struct pool_job * job);
+
+#endif
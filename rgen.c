@@ -49,6 +49,8 @@ void rgen_init(struct rgen * obj, const char * str){
 	/* And, of cause */
 	obj -> N = 0;
 	obj -> bytes_in_queue = 0;
+	obj -> bytes_out = 0;
+	obj -> retries = 0;
 }
 
 
@@ -79,6 +81,7 @@ void rgen_produce_nbytes(struct rgen * obj, unsigned int bytes, char * out){
 	if(bytes == 0){
 		return; /* Nothing to do */
 	}
+	obj -> bytes_out += bytes;
 	if(bytes <= obj -> bytes_in_queue){
 		/* We have enough bytes in queue */
 		memcpy(out,
@@ -173,6 +176,9 @@ uint64_t rgen_uniform(struct rgen * obj, uint64_t a, uint64_t b){
 		/* applying mask */
 		uint64_t mask = ~ (0xffffffffffffffffLL << need_bits);
 		rval &= mask;
+		if ( rval > diff ){
+			obj -> retries += 1;
+		}
 	}while(! (rval <= diff));/* generating numbers until our number is not in diapason */
 	return rval + a;
 }
@@ -187,11 +193,26 @@ unsigned int * rgen_shuffle(struct rgen * obj, unsigned int N){
 	if(NULL == values){
 		return NULL; /* out of memory :( */
 	}
+	rgen_shuffle_fill(obj, values, N);
+	return values;
+}
+
+void rgen_shuffle_fill(struct rgen * obj, unsigned int * values, unsigned int N){
 	unsigned int ksi;
+	if( 0 == N ){
+		return;
+	}
 	for(ksi = 0; ksi < N; ksi += 1){
 		values[ksi] = ksi + 1;
 	}
-	for( ksi = N-1; ksi > 0; ksi -= 1 ){
+	rgen_shuffle_step(obj, values, N - 1, N - 1);
+}
+
+unsigned int rgen_shuffle_step(struct rgen * obj, unsigned int * values,
+		unsigned int top, unsigned int count){
+	unsigned int ksi;
+	unsigned int bottom = top > count ? top - count : 0;
+	for( ksi = top; ksi > bottom; ksi -= 1 ){
 		/* for all positions from max down to second from beginning
 		 * inclusive
 		 **/
@@ -211,5 +232,39 @@ unsigned int * rgen_shuffle(struct rgen * obj, unsigned int N){
 			values[e2] = tmp;
 		}
 	}
-	return values;
+	return bottom;
+}
+
+void rgen_shuffle_top(struct rgen * obj, unsigned int N, unsigned int * top,
+		unsigned int count){
+	assert(count <= N);
+	/* Positions below the current one, that got other elements: all the
+	 * rest still hold their own, position + 1 */
+	unsigned int moved_pos[count + 1], moved_val[count + 1];
+	unsigned int moved = 0;
+	unsigned int k;
+	for ( k = 0; k < count; k += 1 ){
+		unsigned int ksi = N - 1 - k;
+		unsigned int choice = ksi ? (unsigned int) rgen_uniform(obj, 0, ksi) : 0;
+		/* Elements at choice and at ksi, before they are exchanged */
+		unsigned int at_choice = choice + 1, at_ksi = ksi + 1;
+		unsigned int m, choice_slot = moved;
+		for ( m = 0; m < moved; m += 1 ){
+			if ( moved_pos[m] == choice ){
+				at_choice = moved_val[m];
+				choice_slot = m;
+			}
+			if ( moved_pos[m] == ksi ){
+				at_ksi = moved_val[m];
+			}
+		}
+		top[k] = at_choice;
+		/* Element from ksi goes down to choice; ksi is never looked at
+		 * again */
+		moved_pos[choice_slot] = choice;
+		moved_val[choice_slot] = at_ksi;
+		if ( choice_slot == moved ){
+			moved += 1;
+		}
+	}
 }
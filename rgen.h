@@ -51,6 +51,8 @@ struct rgen {
 	* stands at last buffer position, are a part of pseudorandom stream
 	* and shall be logically prepended before yet unproduced cipher blocks
 	*/
+	uint64_t bytes_out; /* Pseudorandom bytes consumed, for statistics */
+	uint64_t retries; /* Values, rejected by rgen_uniform */
 };
 
 /**
@@ -95,6 +97,40 @@ uint64_t rgen_uniform(struct rgen * obj, uint64_t a, uint64_t b);
  */
 unsigned int * rgen_shuffle(struct rgen * obj, unsigned int N);
 
+/**
+ * The same as rgen_shuffle, but puts the permutation into the caller's
+ * buffer.
+ * @param values - buffer for N elements
+ * @param N - size of permutation to generate
+ */
+void rgen_shuffle_fill(struct rgen * obj, unsigned int * values, unsigned int N);
+
+/**
+ * Makes a part of the permutation, that rgen_shuffle_fill makes, so that
+ * a long one can be made in steps. Steps, done one after one, give the
+ * same permutation.
+ * @param values - buffer, filled with 1..N before the first step
+ * @param top - position, the step starts from: N-1 for the first step,
+ * the returned one for the next
+ * @param count - positions to do
+ * @return position for the next step, 0 when the permutation is ready
+ */
+unsigned int rgen_shuffle_step(struct rgen * obj, unsigned int * values,
+	unsigned int top, unsigned int count);
+
+/**
+ * Makes the last positions of the permutation, that rgen_shuffle_fill
+ * makes, without making the rest: position N-1 is final after the first
+ * step, N-2 after the second and so on. Time and memory depend on
+ * `count` only, not on N.
+ * @param N - size of permutation
+ * @param top - buffer for `count` elements: top[k] gets the element at
+ * position N-1-k
+ * @param count - positions to make, no more than N
+ */
+void rgen_shuffle_top(struct rgen * obj, unsigned int N, unsigned int * top,
+	unsigned int count);
+
 
 
 #endif
@@ -18,6 +18,7 @@
  */
 
 #include <assert.h>
+#include <string.h>
 #include "rsrce.h"
 
 char rsrce_init(struct rsrce * self){
@@ -25,18 +26,65 @@ char rsrce_init(struct rsrce * self){
 	if(NULL == self -> r){
 		return 1;
 	}
+	self -> gen = NULL;
 	self -> next_bit = 8; /* buffer dirty, needs genning a new random byte */
+	self -> bytes_read = 0;
+	return 0;
+}
+
+/**
+ * Takes a random byte
+ * @return the byte or EOF if the source fails
+ */
+static int rsrce_byte(struct rsrce * self){
+	if(NULL == self -> r){
+		unsigned char c;
+		rgen_produce_nbytes(self -> gen, 1, (char *) & c);
+		return c;
+	}
+	int R = fgetc(self -> r);
+	if(R != EOF){
+		self -> bytes_read += 1;
+	}
+	return R;
+}
+
+char rsrce_init_seeded(struct rsrce * self, struct rsrce * parent,
+		struct rgen * gen){
+	/* Generator takes a string: the seed goes in hex */
+	static const char hex[] = "0123456789abcdef";
+	char seed[RSRCE_SEED_SIZE * 2 + 1];
+	int ksi;
+	for(ksi = 0; ksi < RSRCE_SEED_SIZE; ksi += 1){
+		int R = rsrce_byte(parent);
+		if(R == EOF){
+			return 1;
+		}
+		seed[ksi * 2] = hex[R >> 4];
+		seed[ksi * 2 + 1] = hex[R & 15];
+	}
+	seed[RSRCE_SEED_SIZE * 2] = 0;
+	rgen_init(gen, seed);
+	memset(seed, 0, sizeof(seed));
+	self -> r = NULL;
+	self -> gen = gen;
+	self -> next_bit = 8;
+	self -> bytes_read = 0;
 	return 0;
 }
 
 
 void rsrce_free(struct rsrce * self){
-	fclose(self -> r);
+	if(NULL != self -> r){
+		fclose(self -> r);
+	}else{
+		rgen_free(self -> gen);
+	}
 }
 
 char rsrce_produce(struct rsrce * self){
 	if(self -> next_bit == 8){/* We assume to have 8 bits in byte */
-		int R = fgetc(self -> r);
+		int R = rsrce_byte(self);
 		if (R == EOF){
 			return -1;
 		}
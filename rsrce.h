@@ -20,15 +20,19 @@
 #ifndef RSRCE_H
 #define RSRCE_H
 #include <stdio.h>
+#include "rgen.h"
 /**
  * This module provides a random source, based on /dev/urandom
  * UNIX standart generator.
  */
 #define RANDOM_SOURCE "/dev/urandom"
+#define RSRCE_SEED_SIZE 16 /* bytes, a seeded source takes from another */
 struct rsrce {
 	FILE * r;
+	struct rgen * gen; /* stream, seeded by another source, if r is NULL */
 	unsigned char buf;/* one-byte buffer */
 	char next_bit; /* next unused random bit in buffer, bit = 8 -> we need to take a new byte */
+	unsigned long long bytes_read; /* bytes taken from RANDOM_SOURCE */
 };
 
 /**
@@ -38,6 +42,18 @@ struct rsrce {
  */
 char rsrce_init(struct rsrce * self);
 
+/**
+ * Constructor of a source, that doesn't open RANDOM_SOURCE: it's bits
+ * come from a cipher stream, seeded by RSRCE_SEED_SIZE bytes of another
+ * source, so that sources of many threads cost one descriptor.
+ * @param parent - source to take the seed from
+ * @param gen - generator for the stream, kept by the caller until the
+ * source is freed
+ * @return 0 if OK, other if the parent fails
+ */
+char rsrce_init_seeded(struct rsrce * self, struct rsrce * parent,
+		struct rgen * gen);
+
 /**
  * Destructor
  */
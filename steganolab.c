@@ -23,17 +23,109 @@
 #include <stdint.h>
 #include <limits.h>
 #include <setjmp.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <assert.h>
 #include <jpeglib.h>
 #include <openssl/sha.h>
+#include <openssl/evp.h>
 
 #include "lencode.h" /* length mark generator and reader */
 #include "rsrce.h" /* /dev/urandom as source of random bits */
 #include "rgen.h" /* PRNG based on BLOWFISH */
 #include "crypto.h" /* Interface to OpenSSL Blowfish cipher */
+#include "packer.h" /* Message compression */
+#include "arena.h" /* Per-thread memory for jobs */
+#include "jio.h" /* Descriptor based jpeg IO */
+#include "pdecode.h" /* Parallel coefficient loading */
+#include "pencode.h" /* Parallel jpeg writing */
+#include "ccache.h" /* Decoded carriers cache */
+#include "pool.h" /* Threads */
+#include "tjback.h" /* TurboJPEG backend */
+#include "pcache.h" /* Shuffle tables cache */
+#include "admit.h" /* Heavy jobs queue */
 
 #include <string.h> /* debug */
 
+/**
+ * Message layout: everything below is ciphered as a whole.
+ *
+ * Plain message:
+ * 	| length record (N) | data | SHA1(data) |
+ * Extended message, marked with redundant stop in length record (see
+ * lencode_produce_extended):
+ * 	| length record (N) | format byte | format fields | body | SHA1 |
+ * 	here SHA1 covers format byte, format fields and body.
+ * N is the number of bytes after the length record. An old decoder
+ * reads an extended message as a plain one, with format byte and fields
+ * prepended to data.
+ */
+#define FORMAT_DEFLATE	0x01	/* Field: length record with uncompressed
+								 * data length. Body: deflated data */
+#define FORMAT_CHUNKED	0x02	/* Fields: length records with data length
+								 * and chunk size. Body: empty, data goes
+								 * in chunks after the message */
+#define FORMAT_KNOWN	(FORMAT_DEFLATE | FORMAT_CHUNKED)
+
+/**
+ * Chunked layout. The message above is followed by chunks, each of them
+ * is ciphered separately and starts at a cipher block boundary:
+ * 	| chunk index, 4 bytes LE | chunk size bytes of data | SHA1 |
+ * SHA1 covers index and data. The last chunk may carry less data.
+ * Any chunk can be found, read and verified without touching others.
+ */
+#define CHUNK_INDEX_SIZE	4
+#define CHUNK_DEFAULT_SIZE	(64 * 1024)
+
+/**
+ * Region layout (STEGANOLAB_REGION). The message goes to a band of
+ * contiguous MCU rows, not to rows, scattered over the image, so that
+ * decoder can stop reading the image after it:
+ * 	| rows before | head rows | body rows | the rest, untouched |
+ * The band starts at a row, chosen by password among the first
+ * 1/REGION_SPAN of the image: the first 4 bytes, LE, of
+ * SHA1(password, REGION_FIRST_MAGIC, number of MCU rows) modulo their
+ * number. So the message is not in the same rows of every carrier, and
+ * the decoder still reads a part of the image only.
+ * Head rows carry REGION_HEAD_SIZE bytes, ciphered: the number of body
+ * rows, 4 bytes LE, and a verifier of the rest of the head:
+ * SHA1(password, REGION_MAGIC, number of body rows). Without the
+ * password any head is noise, and a random one passes for a region with
+ * chance 2^-96. Body rows carry the message as usual. Each band is spread
+ * over by it's own shuffle, head first, and offers REGION_FACTOR times
+ * the bits, put there.
+ */
+#define REGION_MAGIC	"SLRG"
+#define REGION_FIRST_MAGIC	"SLRF"
+#define REGION_FACTOR	4
+#define REGION_SPAN	4
+#define REGION_HEAD_SIZE	(2 * CIPHER_BLOCK_SIZE)
+
+/**
+ * Verified layout (STEGANOLAB_VERIFIED), format 2. The length record
+ * moves out of the message to a head of one cipher block, ciphered
+ * alone and put to the last positions of the shuffle, from the end:
+ * 	| length record (N) | verifier | zeroes |
+ * verifier is VERIFIER_SIZE bytes of SHA1(password, length record).
+ * The message goes from the first positions, as an extended one without
+ * length record: format byte is always there.
+ * 	| format byte | format fields | body | SHA1 |
+ * Last positions of a shuffle are known without making the whole table
+ * (see rgen_shuffle_top), so a wrong key is found out after one block,
+ * and nothing is allocated for the message before the head is verified.
+ */
+#define VERIFIER_SIZE	3
+#define VERIFIED_HEAD_BITS	(CIPHER_BLOCK_SIZE * 8)
+
+/**
+ * Rounds length up to a whole number of cipher blocks
+ * @param len - length in bytes
+ * @return length, fitted to cipher blocks
+ */
+static unsigned long long fit_to_blocks(unsigned long long len){
+	return (len + CIPHER_BLOCK_SIZE - 1) / CIPHER_BLOCK_SIZE * CIPHER_BLOCK_SIZE;
+}
+
 /**
  * Number of usable DCT coefficients
  * @param R - radius, i^2+j^2 <= R^2
@@ -90,6 +182,7 @@ static char getij(uint8_t id, uint8_t DCT_radius, uint8_t * I, uint8_t * J){
 struct enumerator_card {
 	unsigned int width;
 	unsigned int height;/* both in DCT blocks */
+	unsigned int first_row;/* Row of the array, where the card starts */
 	unsigned int Nblocks;
 };
 /**
@@ -118,12 +211,14 @@ static void enumerator_init(struct enumerator * self, int8_t DCT_radius) {
  * Appends DCT array of given size to enumerator collection.
  * Arrays with zero dimensions are OK, despite empty
  * @param width, heigth - new array dimensions in DCT blocks
+ * @param first_row - DCT block row of the array, where the new one
+ * starts: a band of rows can be enumerated this way
  * @return	0: OK
  * 			1: full
  * 			2: dimensions too big (so that w*h overflows it's type)
  */
 static char enumerator_add(struct enumerator * self, unsigned int width,
-		unsigned int height){
+		unsigned int height, unsigned int first_row){
 	if (self -> places_reserved == self -> cards_in ){
 		if ( self -> places_reserved == 0xff ){
 			return 1;/* Full! */
@@ -142,8 +237,9 @@ static char enumerator_add(struct enumerator * self, unsigned int width,
 
 	newcard -> width = width;
 	newcard -> height = height;
+	newcard -> first_row = first_row;
 	newcard -> Nblocks = width * height;
-	if (  newcard -> Nblocks / width != height ){
+	if ( width && newcard -> Nblocks / width != height ){
 		/* overflow */
 		return 2;
 	}
@@ -196,7 +292,7 @@ static char enumerator_get_position_by_index(struct enumerator * self,
 	unsigned int block_id = array_offset / inblock;
 	unsigned int block_offset = array_offset % inblock;
 	/* block position ? */
-	pos -> m = block_id / self -> cards[array_id] . width;
+	pos -> m = self -> cards[array_id] . first_row + block_id / self -> cards[array_id] . width;
 	pos -> n = block_id % self -> cards[array_id] . width;
 	/* DCT coefficient address in block */
 	uint8_t i,j;
@@ -207,6 +303,31 @@ static char enumerator_get_position_by_index(struct enumerator * self,
 }
 
 
+/**
+ * Finds element ID by it's location: the reverse of
+ * enumerator_get_position_by_index
+ * @param pos - position, that is known to the enumerator
+ * @return element index
+ */
+static unsigned int enumerator_get_index_by_position(struct enumerator * self,
+		const struct position * pos){
+	uint8_t inblock = usable_DCT( self -> DCT_radius );
+	unsigned int idx = 0;
+	uint8_t ksi;
+	for ( ksi = 0; ksi < pos -> array_id; ksi += 1 ){
+		idx += self -> cards[ksi] . Nblocks * inblock;
+	}
+	const struct enumerator_card * card = self -> cards + pos -> array_id;
+	idx += ( (pos -> m - card -> first_row) * card -> width + pos -> n ) * inblock;
+	uint8_t id, i, j;
+	for ( id = 0; ! getij(id, self -> DCT_radius, &i, &j); id += 1 ){
+		if ( i == pos -> i && j == pos -> j ){
+			break;
+		}
+	}
+	return idx + id;
+}
+
 /**
  * Calculates how many usable DCT coefficients enumerator knows about
  *
@@ -255,14 +376,15 @@ static char enumerator_get_number_of_positions(struct enumerator * self,
  * @param dctc - DCT coefficient to alter
  * @param bit - data bit to embed (0 means zero bit, any other means one bit)
  * @param random_source - object to take random data from, if needed
+ * @return 1 if coefficient was changed, 0 if it allready held the bit
  */
-static void embed_bit ( JCOEF * dctc, unsigned char bit, struct rsrce * random_source ){
+static char embed_bit ( JCOEF * dctc, unsigned char bit, struct rsrce * random_source ){
 	/* According to jmorecfg, dctc holds 16 bit signed integer.
 	 * By altering the coefficient we shall not overflow the value accidentally. */
 	JCOEF lsb = * dctc & 1;
 	if( bit && lsb || ! bit && ! lsb ){
 		/* OK */
-		return;
+		return 0;
 	}
 	/* Need to change */
 	char rbit = rsrce_produce(random_source);
@@ -279,6 +401,7 @@ static void embed_bit ( JCOEF * dctc, unsigned char bit, struct rsrce * random_s
 	}else{
 		* dctc -= 1;
 	}
+	return 1;
 }
 
 
@@ -317,21 +440,202 @@ my_error_exit (j_common_ptr cinfo){
 }
 
 
+#define WATCH_STEP	(64 * 1024)	/* Work units (bits, shuffle positions) between checks */
+
+/**
+ * Watches a job for the caller: reports progress and stops the job, when
+ * it's time is over or it is cancelled. The job is left through the
+ * error manager of the jpeg object, that is at work, as if jpeg library
+ * failed, so the clean-up is the same. The object is also progress
+ * monitor for jpeg library.
+ */
+struct watch {
+	struct jpeg_progress_mgr pub;
+	const struct steganolab_options * opts;
+	char active;				/* Something to watch for */
+	struct timespec deadline;	/* If opts -> timeout_ms */
+	j_common_ptr job;			/* Jpeg object to stop the job through */
+	int status;					/* Code to return, if stopped, 0 if not */
+};
+
+/**
+ * Checks the job: calls progress callback, looks at the cancel flag
+ * and clock.
+ * @param stage, done, total - as for steganolab_progress
+ * @return 0 to go on, code to return from the job otherwise
+ */
+static int watch_poll(struct watch * w, int stage, unsigned long long done,
+		unsigned long long total){
+	if ( NULL == w || ! w -> active ){
+		return 0;
+	}
+	const struct steganolab_options * opts = w -> opts;
+	if ( NULL != opts -> progress &&
+			opts -> progress(opts -> progress_user, stage, done, total) ){
+		w -> status = 45;
+	}else if ( NULL != opts -> cancel &&
+			__atomic_load_n(opts -> cancel, __ATOMIC_RELAXED) ){
+		w -> status = 45;
+	}else if ( opts -> timeout_ms ){
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if ( now.tv_sec > w -> deadline.tv_sec || ( now.tv_sec == w -> deadline.tv_sec &&
+				now.tv_nsec >= w -> deadline.tv_nsec ) ){
+			w -> status = 44;
+		}
+	}
+	return w -> status;
+}
+
+/**
+ * Checks the job as watch_poll does. Leaves the job through error
+ * manager of given object, if it must stop.
+ * @param via - object, that is at work
+ */
+static void watch_check(struct watch * w, int stage, unsigned long long done,
+		unsigned long long total, j_common_ptr via){
+	if ( watch_poll(w, stage, done, total) ){
+		longjmp(((my_error_ptr) via -> err) -> setjmp_buffer, 1);
+	}
+}
+
+/**
+ * Checks for pool tasks of parallel Huffman decoder: pool_check
+ */
+static int watch_pool_read(void * user, unsigned long long done,
+		unsigned long long total){
+	return watch_poll(user, STEGANOLAB_STAGE_READ, done, total);
+}
+
+/**
+ * Checks for pool tasks of parallel Huffman encoder: pool_check
+ */
+static int watch_pool_write(void * user, unsigned long long done,
+		unsigned long long total){
+	return watch_poll(user, STEGANOLAB_STAGE_WRITE, done, total);
+}
+
+/**
+ * Checks the job, that works with the job object
+ */
+static void watch_tick(struct watch * w, int stage, unsigned long long done,
+		unsigned long long total){
+	if ( NULL != w ){
+		watch_check(w, stage, done, total, w -> job);
+	}
+}
+
+/**
+ * Jpeg library progress monitor: called for every row of a pass
+ */
+static void watch_progress_monitor(j_common_ptr cinfo){
+	struct watch * w = (struct watch *) cinfo -> progress;
+	unsigned long long limit = w -> pub.pass_limit > 0 ? w -> pub.pass_limit : 1;
+	watch_check(w, cinfo -> is_decompressor ? STEGANOLAB_STAGE_READ : STEGANOLAB_STAGE_WRITE,
+		w -> pub.completed_passes * limit + w -> pub.pass_counter,
+		w -> pub.total_passes * limit, cinfo);
+}
+
+/**
+ * Sets watch up for a job. If it is active, it shall be given to the
+ * jpeg object as progress monitor, when the object is created.
+ * @param opts - job settings
+ * @param job - jpeg object of the job
+ */
+static void watch_init(struct watch * w, const struct steganolab_options * opts,
+		j_common_ptr job){
+	w -> opts = opts;
+	w -> active = NULL != opts -> progress || NULL != opts -> cancel ||
+		0 != opts -> timeout_ms;
+	w -> job = job;
+	w -> status = 0;
+	w -> pub.progress_monitor = watch_progress_monitor;
+	w -> pub.pass_counter = 0;
+	w -> pub.pass_limit = 0;
+	w -> pub.completed_passes = 0;
+	w -> pub.total_passes = 0;
+	if ( opts -> timeout_ms ){
+		clock_gettime(CLOCK_MONOTONIC, & w -> deadline);
+		w -> deadline.tv_sec += opts -> timeout_ms / 1000;
+		w -> deadline.tv_nsec += (long)(opts -> timeout_ms % 1000) * 1000000;
+		if ( w -> deadline.tv_nsec >= 1000000000 ){
+			w -> deadline.tv_sec += 1;
+			w -> deadline.tv_nsec -= 1000000000;
+		}
+	}
+}
+
+
+
 
 
 
+/**
+ * Describes where jpeg data comes from or goes to: a stdio stream, a
+ * file descriptor or memory.
+ */
+struct jpeg_io {
+	SLFILE * file;					/* stream, or NULL for memory */
+	const unsigned char * in;		/* memory to read from */
+	size_t in_len;
+	unsigned char ** out;			/* place to put malloced output to */
+	size_t * out_len;
+	int fd;							/* descriptor to write to, or -1 */
+	size_t size_hint;				/* expected output size, 0 if unknown */
+	size_t written;					/* bytes written to descriptor */
+	j_decompress_ptr ready;			/* decompressor, that has read the
+									 * image already, or NULL */
+	jvirt_barray_ptr * ready_arrays;/* it's coefficients */
+	char splice;					/* output may keep entropy coded data
+									 * of the input, where no block changed */
+};
+
+/**
+ * Gives out a jpeg, made in memory
+ * @param io - stream, descriptor or memory to put it to
+ * @param buf - malloced jpeg, it is taken by the function
+ * @param len - jpeg length
+ * @return 0 if OK, 10 if writing fails
+ */
+static int put_jpeg(struct jpeg_io * io, unsigned char * buf, size_t len){
+	int rv = 0;
+	if ( io -> fd >= 0 ){
+		if ( jio_write_all(io -> fd, buf, len) ){
+			rv = 10;
+		}
+		io -> written = len;
+	}else if ( NULL != io -> file ){
+		if ( fwrite(buf, 1, len, io -> file) != len ){
+			rv = 10;
+		}
+	}else{
+		* io -> out = buf;
+		* io -> out_len = len;
+		return 0;
+	}
+	free(buf);
+	return rv;
+}
 
 /**
  * Writes a jpeg from specified context of other jpeg as it appears when
  * obtaining DCT coefficients and modifying them.
- * @param file - io stream to write data to
+ * @param io - stream or memory to write data to
  * @param cinfo_in - decompression context pointer
  * @param bvarr - DCT data array to write
+ * @param threads - threads to encode with; with more than one the
+ * image gets restart markers, and intervals are encoded at once
  * @return 0 if OK, other values for errors
  */
-static int write_jpeg_by_other(SLFILE * file,
-	j_decompress_ptr cinfo_in, jvirt_barray_ptr * bvarr
+static int write_jpeg_by_other(struct jpeg_io * io,
+	j_decompress_ptr cinfo_in, jvirt_barray_ptr * bvarr,
+	unsigned int threads
 ){
+	unsigned char * outbuf = NULL;/* For parallel encoder output */
+	JOCTET * fdbuf = NULL;/* For descriptor output, when not in arena */
+	struct jio_dest fddest;
+	struct jio_grow memdest;/* For memory output */
+	memdest.buf = NULL;
 	struct jpeg_compress_struct cinfo;/*compressor states*/
 	struct my_error_mgr jerr; /*error-handling structure*/
 
@@ -348,28 +652,299 @@ static int write_jpeg_by_other(SLFILE * file,
 		 * We need to clean up the JPEG object, close the input file, and return.
 		 */
 		jpeg_destroy_compress(&cinfo);
+		free(outbuf);
+		free(fdbuf);
+		free(memdest.buf);
 		return 10;
 	}
 
 	/*Initialising compression structure (cinfo.err given above)*/
+	cinfo.client_data = ARENA_JPEG_OWNER;
 	jpeg_create_compress(&cinfo);
-	jpeg_stdio_dest(&cinfo, file);/*telling, where to put jpeg data*/
+	/* Job watch, if any, follows writing too */
+	cinfo.progress = cinfo_in -> progress;
 
 	/* Applying parameters from source jpeg */
 	jpeg_copy_critical_parameters(cinfo_in, &cinfo);
 
+	if ( threads > 1 ){
+		/* Intervals are checked by the watch, as rows are by jpeg library */
+		struct watch * w = (struct watch *) cinfo_in -> progress;
+		char rv = pencode_write(&cinfo, cinfo_in, bvarr, threads,
+			NULL != w ? watch_pool_write : NULL, w, &outbuf, &io -> written);
+		if ( 0 == rv ){
+			/* Encoded in memory, giving it out */
+			jpeg_destroy_compress(&cinfo);
+			return put_jpeg(io, outbuf, io -> written);
+		}
+		if ( 2 == rv ){
+			/* Stopped by the watch */
+			jpeg_destroy_compress(&cinfo);
+			return 30;
+		}
+	}
+
+	/*telling, where to put jpeg data*/
+	if ( io -> fd >= 0 ){
+		/* One buffer for the whole image, so that it goes out with a
+		 * few write calls instead of one per 4K */
+		size_t size = jio_dest_size(io -> size_hint);
+		JOCTET * buf = arena_alloc(size);
+		if ( NULL == buf ){
+			buf = fdbuf = malloc(size);
+			if ( NULL == buf ){
+				jpeg_destroy_compress(&cinfo);
+				return 10;
+			}
+		}
+		jio_dest_attach(&cinfo, &fddest, io -> fd, buf, size);
+	}else if ( NULL != io -> file ){
+		jpeg_stdio_dest(&cinfo, io -> file);
+	}else if ( jio_grow_attach(&cinfo, &memdest, jio_dest_size(io -> size_hint)) ){
+		jpeg_destroy_compress(&cinfo);
+		return 10;
+	}
+
 	/* copying DCT */
 	jpeg_write_coefficients(&cinfo, bvarr);
 
 	/*clean-up*/
 	jpeg_finish_compress(&cinfo);
 	jpeg_destroy_compress(&cinfo);
+	if ( io -> fd >= 0 ){
+		io -> written = fddest.written;
+		free(fdbuf);
+	}else if ( NULL == io -> file ){
+		/* Giving the buffer out */
+		* io -> out = memdest.buf;
+		* io -> out_len = memdest.len;
+	}
 	/*Done!*/
 	return 0;
 }
 
 
 
+/**
+ * Counts work, done over DCT arrays, for statistics
+ */
+struct dct_work {
+	unsigned long long accesses;	/* access_virt_barray calls */
+	unsigned long long modified;	/* coefficients changed by embed_bit */
+	unsigned int rows;				/* distinct block rows accessed */
+	unsigned char * row_seen;		/* a byte for every block row of every channel */
+	unsigned int row_base[MAX_COMPONENTS];	/* first row of channel in row_seen */
+	struct watch * watch;			/* job watch, checked now and then, or NULL */
+	struct pcache_job * shuffles;	/* where to look for shuffle tables, or NULL */
+	unsigned int threads;			/* to move bits with */
+	unsigned int row_count;			/* block rows of all channels */
+	unsigned char * changed[MAX_COMPONENTS];/* a byte for every block of channel,
+									 * set when embed_bit changes it, or NULL */
+};
+
+/**
+ * Marks block row as accessed for statistics
+ * @param work - counters
+ * @param array_id - channel
+ * @param row - block row in channel
+ */
+static void note_row(struct dct_work * work, unsigned int array_id,
+		unsigned int row){
+	unsigned char * seen = work -> row_seen + work -> row_base[array_id] + row;
+	if ( ! * seen ){
+		* seen = 1;
+		work -> rows += 1;
+	}
+}
+
+/**
+ * Gets one row of DCT blocks from jpeg library, counting the work
+ * @param work - counters
+ * @param arrays - DCT arrays of all channels
+ * @param array_id - channel
+ * @param row - block row in channel
+ * @param writable - TRUE if the row is going to be changed
+ * @return the row
+ */
+static JBLOCKROW access_row(j_decompress_ptr cinfo, struct dct_work * work,
+		jvirt_barray_ptr * arrays, unsigned int array_id, unsigned int row,
+		boolean writable){
+	note_row(work, array_id, row);
+	work -> accesses += 1;
+	JBLOCKARRAY B = (cinfo -> mem -> access_virt_barray)((j_common_ptr) cinfo,
+				arrays[array_id], row, 1/*1 row, not more */, writable);
+	return B[0];
+}
+
+#define SCATTER_MIN	(256 * 1024)	/* Fewer bits are moved on one thread */
+#define SCATTER_BANDS_PER_THREAD	4
+
+/**
+ * Bits of one embed or read, spread over threads by bands of block
+ * rows. Positions are found first, by chunks of bits, then bits are
+ * sorted by bands, so that every band task owns rows of it's band and
+ * changes them without locks. Bits, read by bands, are put back to
+ * message order by their ids, so the result doesn't depend on threads.
+ */
+struct scatter {
+	struct enumerator * enu;
+	const unsigned int * shuffle;
+	const struct dct_work * work;
+	unsigned int n;				/* Bits */
+	unsigned int * keys;		/* Block row of every bit, as in dct_work */
+	uint32_t * offsets;			/* Coefficient of every bit in it's row */
+	uint32_t * order;			/* Bit ids, sorted by bands */
+	unsigned int * band_start;	/* First bit in order of every band, and the end */
+	unsigned int band_rows;		/* Block rows in a band */
+	unsigned int bands;
+	JBLOCKROW * rows;			/* Row of every key, that has bits */
+	const unsigned char * bits;	/* Embed: data, as for embed_bits */
+	struct rsrce * rsrc;		/* Embed: random source of every band,
+								 * seeded by the job's one */
+	unsigned char ** marks;		/* Embed: row of dct_work change map of
+								 * every key, or NULL */
+	unsigned long long modified;	/* Embed: sum over bands, atomic */
+	unsigned char * values;		/* Read: bit k is values[k] */
+};
+
+/**
+ * Whether bits are worth spreading over threads
+ */
+static char scatter_worth(const struct dct_work * work, unsigned int n){
+	return work -> threads > 1 && n >= SCATTER_MIN;
+}
+
+/**
+ * Finds positions of one chunk of bits: pool_task
+ */
+static void scatter_locate(void * arg, unsigned int index){
+	struct scatter * s = arg;
+	unsigned int chunk = (s -> n + s -> bands - 1) / s -> bands;
+	unsigned int bit = index * chunk;
+	if ( bit >= s -> n ){
+		return;
+	}
+	unsigned int end = s -> n - bit < chunk ? s -> n : bit + chunk;
+	for ( ; bit < end; bit += 1 ){
+		struct position p;
+		char fail = enumerator_get_position_by_index(s -> enu, s -> shuffle[bit] - 1, & p);
+		assert(!fail);
+		s -> keys[bit] = s -> work -> row_base[p.array_id] + p.m;
+		s -> offsets[bit] = p.n * DCTSIZE2 + p.i * DCTSIZE + p.j;
+	}
+}
+
+/**
+ * Embeds bits of one band: pool_task
+ */
+static void scatter_embed(void * arg, unsigned int index){
+	struct scatter * s = arg;
+	unsigned long long modified = 0;
+	unsigned int e;
+	for ( e = s -> band_start[index]; e < s -> band_start[index + 1]; e += 1 ){
+		uint32_t bit = s -> order[e];
+		JCOEF * row = s -> rows[s -> keys[bit]][0];
+		if ( embed_bit( row + s -> offsets[bit],
+				s -> bits[bit / 8] >> bit % 8 & 1, & s -> rsrc[index] ) ){
+			modified += 1;
+			if ( NULL != s -> marks ){
+				s -> marks[s -> keys[bit]][s -> offsets[bit] / DCTSIZE2] = 1;
+			}
+		}
+	}
+	__atomic_fetch_add(& s -> modified, modified, __ATOMIC_RELAXED);
+}
+
+/**
+ * Reads bits of one band: pool_task
+ */
+static void scatter_read(void * arg, unsigned int index){
+	struct scatter * s = arg;
+	unsigned int e;
+	for ( e = s -> band_start[index]; e < s -> band_start[index + 1]; e += 1 ){
+		uint32_t bit = s -> order[e];
+		const JCOEF * row = s -> rows[s -> keys[bit]][0];
+		s -> values[bit] = read_bit( row + s -> offsets[bit] );
+	}
+}
+
+/**
+ * Finds positions of bits, sorts them by bands and gets rows, that
+ * have bits, from jpeg library on the calling thread. Memory is taken
+ * from the job.
+ * @param writable - TRUE if rows are going to be changed
+ * @return 0 if OK, 20 if out of memory
+ */
+static int scatter_prepare(struct scatter * s, j_decompress_ptr cinfo,
+		struct dct_work * work, jvirt_barray_ptr * arrays,
+		struct enumerator * enu, const unsigned int * shuffle,
+		unsigned int n, boolean writable){
+	memset(s, 0, sizeof(* s));
+	s -> enu = enu;
+	s -> shuffle = shuffle;
+	s -> work = work;
+	s -> n = n;
+	s -> bands = work -> threads * SCATTER_BANDS_PER_THREAD;
+	if ( s -> bands > work -> row_count ){
+		s -> bands = work -> row_count;
+	}
+	s -> band_rows = (work -> row_count + s -> bands - 1) / s -> bands;
+	s -> keys = arena_alloc((size_t) n * sizeof(unsigned int));
+	s -> offsets = arena_alloc((size_t) n * sizeof(uint32_t));
+	s -> order = arena_alloc((size_t) n * sizeof(uint32_t));
+	s -> band_start = arena_alloc(((size_t) s -> bands + 1) * sizeof(unsigned int));
+	s -> rows = arena_alloc((size_t) work -> row_count * sizeof(JBLOCKROW));
+	if ( NULL == s -> keys || NULL == s -> offsets || NULL == s -> order ||
+			NULL == s -> band_start || NULL == s -> rows ){
+		return 20;
+	}
+	pool_for(work -> threads, s -> bands, scatter_locate, s);
+	watch_tick(work -> watch, STEGANOLAB_STAGE_BITS, 0, n);
+	/* Counting sort by bands */
+	memset(s -> band_start, 0, ((size_t) s -> bands + 1) * sizeof(unsigned int));
+	memset(s -> rows, 0, (size_t) work -> row_count * sizeof(JBLOCKROW));
+	unsigned int bit, b;
+	for ( bit = 0; bit < n; bit += 1 ){
+		s -> band_start[s -> keys[bit] / s -> band_rows + 1] += 1;
+		/* Any pointer marks a row to get */
+		s -> rows[s -> keys[bit]] = (JBLOCKROW) s;
+	}
+	for ( b = 0; b < s -> bands; b += 1 ){
+		s -> band_start[b + 1] += s -> band_start[b];
+	}
+	for ( bit = 0; bit < n; bit += 1 ){
+		s -> order[s -> band_start[s -> keys[bit] / s -> band_rows]++] = bit;
+	}
+	for ( b = s -> bands; b > 0; b -= 1 ){
+		s -> band_start[b] = s -> band_start[b - 1];
+	}
+	s -> band_start[0] = 0;
+	/* Rows are in memory, so their pointers stay */
+	int ksi;
+	unsigned int row;
+	for ( ksi = 0; ksi < cinfo -> num_components; ksi += 1 ){
+		unsigned int end = ksi + 1 < cinfo -> num_components ?
+			work -> row_base[ksi + 1] : work -> row_count;
+		for ( row = work -> row_base[ksi]; row < end; row += 1 ){
+			if ( NULL != s -> rows[row] ){
+				s -> rows[row] = access_row(cinfo, work, arrays, ksi,
+					row - work -> row_base[ksi], writable);
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * Least significant bits of all coefficients, that the whole image
+ * enumerator offers, collected while the image is read by a backend,
+ * that doesn't keep DCT arrays
+ */
+struct lsb_map {
+	unsigned char * bits;		/* Bit k is bits[k / 8] >> k % 8 & 1 */
+	struct enumerator * enu;	/* The enumerator */
+};
+
 /**
  * Reads message of specified length from DCT array.
  * The routine is a programming convinience, with it there is just less
@@ -377,6 +952,7 @@ static int write_jpeg_by_other(SLFILE * file,
  * @param msg - buffer to put message to. Must have space to put n
  * cipher blocks.
  * @param n - message length to read in CIPHER_BLOCK_SIZE
+ * @param first_bit - id of the bit, the message starts from
  * Checks agains reading more bits than enumeratro can offer, are included.
  * @param color_component_block_arrays - pointer to place, from where
  * jpeglib DCT coefficients can be extracted
@@ -387,21 +963,26 @@ static int write_jpeg_by_other(SLFILE * file,
  * retrieve this number of bits from the image
  * @param shuffle - shuffle table to link between bit id's and
  * enumerator id's: shuffle(bitid) = enumid
+ * @param work - counters to add work to
+ * @param lsb - bits, collected in advance, to read instead of arrays,
+ * or NULL
  * @return	0: OK
  * 			1: Requested message too big
  */
 static int read_steganographic_message_from_DCT_buffer(unsigned char * msg,
-		unsigned int n, jvirt_barray_ptr * color_component_block_arrays,
+		unsigned int n, unsigned int first_bit,
+		jvirt_barray_ptr * color_component_block_arrays,
 		struct jpeg_decompress_struct * cinfo,
 		const char * password, struct enumerator * enu,
 		unsigned int bits_in_enu,
-		const unsigned int * shuffle){
+		const unsigned int * shuffle, struct dct_work * work,
+		const struct lsb_map * lsb){
 	unsigned int need_bits = n * CIPHER_BLOCK_SIZE * 8;
 	if ( need_bits / (CIPHER_BLOCK_SIZE * 8) != n ){
 		/* Overflow */
 		return 1;
 	}
-	if ( bits_in_enu < need_bits ){
+	if ( bits_in_enu < need_bits || bits_in_enu - need_bits < first_bit ){
 		/* Can't get so much */
 		return 1;
 	}
@@ -410,16 +991,36 @@ static int read_steganographic_message_from_DCT_buffer(unsigned char * msg,
 	memset( msg, 0, need_bytes );
 	/* copying raw data */
 	unsigned int bit;
+	struct scatter s;
+	if ( NULL == lsb && scatter_worth(work, need_bits) &&
+			0 == scatter_prepare(&s, cinfo, work, color_component_block_arrays,
+				enu, shuffle + first_bit, need_bits, FALSE) &&
+			NULL != ( s.values = arena_alloc(need_bits) ) ){
+		pool_for(work -> threads, s.bands, scatter_read, &s);
+		for ( bit = 0; bit < need_bits; bit += 1 ){
+			msg [bit / 8] |= s.values[bit] << bit % 8;
+		}
+		cipher(msg, need_bytes, password, DECRYPT);
+		return 0;
+	}
 	for(bit = 0; bit < need_bits; bit += 1){
+		if ( 0 == bit % WATCH_STEP ){
+			watch_tick(work -> watch, STEGANOLAB_STAGE_BITS, bit, need_bits);
+		}
 		struct position pos;
-		char fail = enumerator_get_position_by_index(enu, shuffle[bit]-1, &pos);
+		char fail = enumerator_get_position_by_index(enu, shuffle[first_bit + bit]-1, &pos);
 		assert(!fail);
-		JBLOCKARRAY B = (cinfo -> mem -> access_virt_barray)((j_common_ptr) cinfo,
-						color_component_block_arrays[pos.array_id],
-						pos.m, 1/*1 row, not more */, FALSE /* We are NOT writing to the buffer */);
-		JCOEFPTR dctblck = B[0][pos.n];
+		unsigned char bitval;
+		if ( NULL != lsb ){
+			unsigned int id = enumerator_get_index_by_position(lsb -> enu, &pos);
+			bitval = lsb -> bits[id / 8] >> id % 8 & 1;
+		}else{
+			JBLOCKROW R = access_row(cinfo, work, color_component_block_arrays,
+							pos.array_id, pos.m, FALSE /* We are NOT writing to the buffer */);
+			JCOEFPTR dctblck = R[pos.n];
 
-		unsigned char bitval = read_bit( & dctblck[pos.i * DCTSIZE + pos.j] ); /* 0 or 1 */
+			bitval = read_bit( & dctblck[pos.i * DCTSIZE + pos.j] ); /* 0 or 1 */
+		}
 		if(bitval){
 			msg [bit / 8] |= 1 << bit % 8;
 		}else{
@@ -432,122 +1033,885 @@ static int read_steganographic_message_from_DCT_buffer(unsigned char * msg,
 	return 0;
 }
 
-
-
 /**
- * This structure holds pointers to objects, that need freeing.
- * There is a function that cals the needed freers, called
- * encode_cleanup_func, that calls proper functions.
+ * Bits to embed, sorted by DCT block rows, for a backend, that shows
+ * the image row after row instead of keeping DCT arrays. Every edit is
+ * coefficient offset in the row, shifted left by one, with the bit in
+ * the lowest place.
  */
-struct cleanup {
-	/* These must be set to real objects before freeing */
-	struct jpeg_decompress_struct * cinfo;
-	struct enumerator * enu;
-	struct rgen * rge;
-	/* These may be set to NULL before setting pointing to real objects */
+struct embed_plan {
+	unsigned int * keys;		/* Block row of every edit, as in dct_work */
+	uint32_t * edits;
+	unsigned int count;
+	unsigned int * row_start;	/* After sorting: first edit of every row, and the end */
+	uint32_t * sorted;
+	const struct dct_work * work;
+	const struct color_channel_info * cci;
+	int channels;
 	struct rsrce * rsrc;
-	unsigned char * message;
-	unsigned int * shuffle;
-	struct color_channel_info * cci;
+	unsigned long long modified;
 };
 
-static void cleanup_func(struct cleanup * o){
-	jpeg_destroy_decompress(o -> cinfo);
-	enumerator_free(o -> enu);
-	/* Objects that can be NULL */
-	if ( o -> rge != NULL ){
-		rgen_free(o -> rge);
+/**
+ * Prepares plan for given number of edits in job memory
+ * @return 0 if OK, 20 if out of memory
+ */
+static int plan_init(struct embed_plan * plan, unsigned int n,
+		const struct dct_work * work, const struct color_channel_info * cci,
+		int channels, struct rsrce * rsrc){
+	memset(plan, 0, sizeof(* plan));
+	plan -> keys = arena_alloc((size_t) n * sizeof(unsigned int));
+	plan -> edits = arena_alloc((size_t) n * sizeof(uint32_t));
+	plan -> work = work;
+	plan -> cci = cci;
+	plan -> channels = channels;
+	plan -> rsrc = rsrc;
+	return NULL == plan -> keys || NULL == plan -> edits ? 20 : 0;
+}
+
+/**
+ * Sorts edits by rows
+ * @param rows - block rows of all channels
+ * @return 0 if OK, 20 if out of memory
+ */
+static int plan_sort(struct embed_plan * plan, unsigned int rows){
+	plan -> row_start = arena_alloc(((size_t) rows + 1) * sizeof(unsigned int));
+	plan -> sorted = arena_alloc((size_t) plan -> count * sizeof(uint32_t) + 1);
+	if ( NULL == plan -> row_start || NULL == plan -> sorted ){
+		return 20;
 	}
-	if( NULL != o -> rsrc ){
-		rsrce_free(o -> rsrc);
+	memset(plan -> row_start, 0, ((size_t) rows + 1) * sizeof(unsigned int));
+	unsigned int e, r;
+	for ( e = 0; e < plan -> count; e += 1 ){
+		plan -> row_start[plan -> keys[e] + 1] += 1;
 	}
-	free(o -> message);
-	free(o -> shuffle);
-	free(o -> cci);
+	for ( r = 0; r < rows; r += 1 ){
+		plan -> row_start[r + 1] += plan -> row_start[r];
+	}
+	/* Filling, using row_start as cursor, that ends at the next row start */
+	for ( e = 0; e < plan -> count; e += 1 ){
+		plan -> sorted[plan -> row_start[plan -> keys[e]]++] = plan -> edits[e];
+	}
+	for ( r = rows; r > 0; r -= 1 ){
+		plan -> row_start[r] = plan -> row_start[r - 1];
+	}
+	plan -> row_start[0] = 0;
+	return 0;
 }
 
-
-
-#define DECODE		0
-#define ENCODE		1
-#define ESTIMATE	2
 /**
- * Worker function, that does embeding and reading upon request.
- * This function is convinient, because writer and reader share much of
- * similar code.
- * @param infile - input file stream
- * @param outfile - output file stream
- * @param data_in - message to embed if encoder
- * @param len_in - message length if encoder
- * @param data_out - pointer to pointer to push malloced buffer with
- *  message to if decoder (to be freed by caller)
- * @param len_out - message length if decoder
- * @param action - what to do, DECODE|ENCODE|ESTIMATE.
- * @param password - secret key
- * @param DCT_radius - Constant, limiting DCT block coefficients
- *  use: i^2 + j^2 <= R^2
- * @param stats - statistics object to fill with data if not NULL
- * The object don't need to be freed if the function fails.
- * @return 0 if OK, various error statuses on error, the statuses can be
- * decoded to human-readable from with the function providden
+ * Puts planned bits to a row: tjback visitor
  */
-static int steganolab_worker(SLFILE * infile, SLFILE * outfile, 
-	const char * data_in,
-	unsigned int len_in, char ** data_out, unsigned int * len_out,
-	uint8_t action, const char * password, uint8_t DCT_radius,
-	struct steganolab_statistics * stats
-){
-	struct jpeg_decompress_struct cinfo;
-	struct my_error_mgr jerr;
-
-	struct enumerator enu;/* Thing, able to explain where DCT coefficient is by it's id */
-	enumerator_init(&enu, DCT_radius);
-
-	/* We set up the normal JPEG error routines, then override error_exit. */
-	cinfo.err = jpeg_std_error(&jerr.pub);
-	jerr.pub.error_exit = my_error_exit;
+static int plan_visit(void * user, JCOEF * row, int component,
+		unsigned int block_row){
+	struct embed_plan * plan = user;
+	if ( component >= plan -> channels || block_row >= plan -> cci[component] . Hbl ){
+		return 0;/* Nothing is put here */
+	}
+	unsigned int key = plan -> work -> row_base[component] + block_row;
+	unsigned int e;
+	for ( e = plan -> row_start[key]; e < plan -> row_start[key + 1]; e += 1 ){
+		uint32_t edit = plan -> sorted[e];
+		plan -> modified += embed_bit( row + (edit >> 1), edit & 1, plan -> rsrc );
+	}
+	return 0;
+}
 
-	struct cleanup clu;
-	clu . cinfo = & cinfo;
-	clu . enu = & enu;
-	clu . rge = NULL;
-	clu . message = NULL;/* This will be set after, until this free(NULL) would work OK */
-	clu . shuffle = NULL;
-	clu . rsrc = NULL;
-	clu . cci = NULL;
+/**
+ * Collects least significant bits of usable coefficients, as the whole
+ * image enumerator orders them: tjback visitor
+ */
+struct lsb_collect {
+	unsigned char * bits;
+	const struct color_channel_info * cci;
+	int channels;
+	unsigned int base[MAX_COMPONENTS];	/* First position of channel */
+	uint8_t per_block;
+	uint8_t coef[DCTSIZE2];				/* Usable coefficients of block, i * DCTSIZE + j */
+};
 
-	/* Establish the setjmp return context for my_error_exit to use. */
-	if (setjmp(jerr.setjmp_buffer)) {
-		/* If we get here, the JPEG code has signaled an error.
-		* We need to clean up the JPEG object, close the input file, and return.
-		*/
-		cleanup_func(& clu);
-		return 2;
+static int lsb_visit(void * user, JCOEF * row, int component,
+		unsigned int block_row){
+	struct lsb_collect * c = user;
+	if ( component >= c -> channels || block_row >= c -> cci[component] . Hbl ){
+		return 0;/* Not used */
 	}
-	jpeg_create_decompress(&cinfo);
-	jpeg_stdio_src(&cinfo, infile);
-	(void) jpeg_read_header(&cinfo, TRUE);
-	/* We can ignore the return value from jpeg_read_header since
-	*   (a) suspension is not possible with the stdio data source, and
-	*   (b) we passed TRUE to reject a tables-only JPEG file as an error.
-	* See libjpeg.doc for more info.
-	*/
-	/* Studying image */
-	int color_channels = cinfo.num_components;
-	/* How many blocks will we have? */
-	/* Looking at component properties */
-	struct color_channel_info * cci = malloc(sizeof(struct color_channel_info) * color_channels);
-	if(NULL == cci){
-		cleanup_func(& clu);
-		return 20;/* Out of memory */
+	unsigned int Wbl = c -> cci[component] . Wbl;
+	unsigned int id = c -> base[component] + block_row * Wbl * c -> per_block;
+	unsigned int n;
+	uint8_t k;
+	for ( n = 0; n < Wbl; n += 1 ){
+		const JCOEF * block = row + n * DCTSIZE2;
+		for ( k = 0; k < c -> per_block; k += 1, id += 1 ){
+			if ( read_bit( & block[c -> coef[k]] ) ){
+				c -> bits[id / 8] |= 1 << id % 8;
+			}
+		}
 	}
-	clu.cci = cci;
-	{/* Studying image */
-		int ksi;
-		for(ksi=0; ksi<color_channels; ksi+=1){
-			assert(cinfo.comp_info[ksi].DCT_scaled_size == DCTSIZE);/* We didn't requsted it to be different, so it mustn't be different */
-			int w = cinfo.comp_info[ksi].downsampled_width;
-			int h = cinfo.comp_info[ksi].downsampled_height;
+	return 0;
+}
+
+/**
+ * Embeds bits on threads by bands of rows: every band has it's own
+ * random source, seeded by the job's one, so that only that one holds
+ * a descriptor. Parameters are as for embed_bits.
+ * @return 0 if the bits are embedded, other if nothing is done, and
+ * they should be embedded on one thread
+ */
+static int embed_scattered(j_decompress_ptr cinfo, struct dct_work * work,
+		jvirt_barray_ptr * color_component_block_arrays,
+		struct enumerator * enu, const unsigned int * shuffle,
+		const unsigned char * bits, unsigned int n,
+		struct rsrce * random_source){
+	struct scatter s;
+	if ( scatter_prepare(&s, cinfo, work, color_component_block_arrays,
+			enu, shuffle, n, TRUE) ){
+		return 20;
+	}
+	s.bits = bits;
+	s.rsrc = arena_alloc((size_t) s.bands * sizeof(struct rsrce));
+	struct rgen * gens = arena_alloc((size_t) s.bands * sizeof(struct rgen));
+	if ( NULL == s.rsrc || NULL == gens ){
+		return 20;
+	}
+	if ( NULL != work -> changed[0] ){
+		s.marks = arena_alloc((size_t) work -> row_count * sizeof(unsigned char *));
+		if ( NULL == s.marks ){
+			return 20;
+		}
+		int ksi;
+		unsigned int row;
+		for ( ksi = 0; ksi < cinfo -> num_components; ksi += 1 ){
+			unsigned int end = ksi + 1 < cinfo -> num_components ?
+				work -> row_base[ksi + 1] : work -> row_count;
+			for ( row = work -> row_base[ksi]; row < end; row += 1 ){
+				s.marks[row] = work -> changed[ksi] + (size_t)(row - work -> row_base[ksi]) *
+					cinfo -> comp_info[ksi].width_in_blocks;
+			}
+		}
+	}
+	unsigned int b, opened;
+	for ( opened = 0; opened < s.bands; opened += 1 ){
+		if ( rsrce_init_seeded(& s.rsrc[opened], random_source, gens + opened) ){
+			break;
+		}
+	}
+	if ( opened == s.bands ){
+		pool_for(work -> threads, s.bands, scatter_embed, &s);
+		work -> modified += s.modified;
+	}
+	for ( b = 0; b < opened; b += 1 ){
+		rsrce_free(& s.rsrc[b]);
+	}
+	return opened == s.bands ? 0 : 3;
+}
+
+/**
+ * Embeds bits to DCT coefficients according to shuffle table. There
+ * must be enough positions in enumerator.
+ * @param bits - data, bit k is bits[k / 8] & 1 << k % 8
+ * @param n - number of bits
+ * @param enu, shuffle - where bits go: shuffle(bitid) = enumid
+ * @param random_source - object to take random data from
+ * @param plan - plan to add bits to instead of changing arrays, or NULL
+ * Other parameters are as for read_steganographic_message_from_DCT_buffer
+ */
+static void embed_bits(j_decompress_ptr cinfo, struct dct_work * work,
+		jvirt_barray_ptr * color_component_block_arrays,
+		struct enumerator * enu, const unsigned int * shuffle,
+		const unsigned char * bits, unsigned int n,
+		struct rsrce * random_source, struct embed_plan * plan){
+	if ( NULL == plan && scatter_worth(work, n) &&
+			0 == embed_scattered(cinfo, work, color_component_block_arrays,
+				enu, shuffle, bits, n, random_source) ){
+		return;
+	}
+	unsigned int bit_idx;
+	for ( bit_idx = 0; bit_idx < n; bit_idx += 1 ){
+		if ( 0 == bit_idx % WATCH_STEP ){
+			watch_tick(work -> watch, STEGANOLAB_STAGE_BITS, bit_idx, n);
+		}
+		struct position p;
+		char get_pos_fail = enumerator_get_position_by_index(enu, shuffle[bit_idx] - 1, & p);
+		assert(!get_pos_fail);
+
+		if ( NULL != plan ){
+			note_row(work, p.array_id, p.m);
+			plan -> keys[plan -> count] = work -> row_base[p.array_id] + p.m;
+			plan -> edits[plan -> count] = (uint32_t)(p.n * DCTSIZE2 + p.i * DCTSIZE + p.j) << 1 |
+				( bits[bit_idx/8] >> bit_idx % 8 & 1 );
+			plan -> count += 1;
+			continue;
+		}
+		JBLOCKROW R = access_row(cinfo, work, color_component_block_arrays,
+					p.array_id, p.m, TRUE /* We are writing to the buffer */);
+		JCOEFPTR dctblck = R[p.n];
+		if ( embed_bit( & dctblck[p.i * DCTSIZE + p.j],
+				bits[bit_idx/8] & 1 << bit_idx % 8, random_source ) ){
+			work -> modified += 1;
+			if ( NULL != work -> changed[p.array_id] ){
+				work -> changed[p.array_id][(size_t) p.m *
+					cinfo -> comp_info[p.array_id].width_in_blocks + p.n] = 1;
+			}
+		}
+	}
+}
+
+/**
+ * Makes shuffle table for n enumerator positions in job memory, or
+ * takes it from cache
+ * @param rge - generator, seeded by password
+ * @param work - job: it's watch is checked between steps, it's cache
+ * is used, if any
+ * @return the table, NULL if out of memory
+ */
+static unsigned int * make_shuffle(struct rgen * rge, unsigned int n,
+		struct dct_work * work){
+	if( (size_t) n * sizeof(unsigned int) / sizeof(unsigned int) != n ){
+		return NULL;/* Can't be that much */
+	}
+	unsigned int * shuffle = arena_alloc((size_t) n * sizeof(unsigned int));
+	if ( NULL == shuffle || 0 == n ){
+		return shuffle;
+	}
+	struct pcache_slot slot;
+	if ( NULL != work -> shuffles &&
+			0 == pcache_load(work -> shuffles, rge, shuffle, n, &slot) ){
+		return shuffle;
+	}
+	unsigned int k;
+	for ( k = 0; k < n; k += 1 ){
+		shuffle[k] = k + 1;
+	}
+	unsigned int top = n - 1;
+	while ( top ){
+		watch_tick(work -> watch, STEGANOLAB_STAGE_SHUFFLE, n - 1 - top, n - 1);
+		top = rgen_shuffle_step(rge, shuffle, top, WATCH_STEP);
+	}
+	if ( NULL != work -> shuffles ){
+		pcache_store(work -> shuffles, &slot, rge, shuffle, n);
+	}
+	return shuffle;
+}
+
+/**
+ * Counts bits, one MCU row offers
+ * @param cci - channels, as the worker has studied them
+ * @param row - MCU row
+ * @param per_block - bits in DCT block
+ */
+static unsigned long long region_row_bits(j_decompress_ptr cinfo,
+		const struct color_channel_info * cci, unsigned int row,
+		uint8_t per_block){
+	unsigned long long bits = 0;
+	int ksi;
+	for ( ksi = 0; ksi < cinfo -> num_components; ksi += 1 ){
+		unsigned int v = cinfo -> comp_info[ksi].v_samp_factor;
+		unsigned long long a = (unsigned long long) row * v, b = a + v;
+		if ( b > cci[ksi].Hbl ){
+			b = cci[ksi].Hbl;
+		}
+		if ( a < b ){
+			bits += (b - a) * cci[ksi].Wbl * per_block;
+		}
+	}
+	return bits;
+}
+
+/**
+ * Finds how many MCU rows, starting from the given one, offer enough
+ * bits
+ * @param first - first MCU row
+ * @param bits - bits wanted
+ * @return number of rows, 0 if the image ends before
+ */
+static unsigned int region_rows(j_decompress_ptr cinfo,
+		const struct color_channel_info * cci, unsigned int first,
+		unsigned long long bits, uint8_t per_block){
+	unsigned long long got = 0;
+	unsigned int row;
+	for ( row = first; row < cinfo -> total_iMCU_rows; row += 1 ){
+		got += region_row_bits(cinfo, cci, row, per_block);
+		if ( got >= bits ){
+			return row + 1 - first;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Makes SHA1(password, magic, number), that region layout is keyed with
+ * @param magic - 4 bytes
+ * @param digest - buffer for SHA_DIGEST_LENGTH bytes
+ * @return 0 if OK, 20 if out of memory
+ */
+static int region_digest(const char * password, const char * magic,
+		unsigned int number, unsigned char * digest){
+	EVP_MD_CTX * md = EVP_MD_CTX_new();
+	unsigned char le[4];
+	uint8_t ib;
+	for ( ib = 0; ib < 4; ib += 1 ){
+		le[ib] = number >> 8 * ib & 0xff;
+	}
+	char fail = NULL == md || 1 != EVP_DigestInit_ex(md, EVP_sha1(), NULL) ||
+		1 != EVP_DigestUpdate(md, password, strlen(password)) ||
+		1 != EVP_DigestUpdate(md, magic, 4) ||
+		1 != EVP_DigestUpdate(md, le, 4) ||
+		1 != EVP_DigestFinal_ex(md, digest, NULL);
+	EVP_MD_CTX_free(md);
+	return fail ? 20 : 0;
+}
+
+/**
+ * Makes region head, not ciphered yet
+ * @param head - buffer for REGION_HEAD_SIZE bytes
+ * @param rows - body rows
+ * @return 0 if OK, 20 if out of memory
+ */
+static int region_head(unsigned char * head, unsigned int rows,
+		const char * password){
+	unsigned char sha1[SHA_DIGEST_LENGTH];
+	uint8_t ib;
+	if ( region_digest(password, REGION_MAGIC, rows, sha1) ){
+		return 20;
+	}
+	for ( ib = 0; ib < 4; ib += 1 ){
+		head[ib] = rows >> 8 * ib & 0xff;
+	}
+	memcpy(head + 4, sha1, REGION_HEAD_SIZE - 4);
+	return 0;
+}
+
+/**
+ * Finds the first MCU row of region band
+ * @param first - place to put it to
+ * @return 0 if OK, 20 if out of memory
+ */
+static int region_first(j_decompress_ptr cinfo, const char * password,
+		unsigned int * first){
+	unsigned int span = cinfo -> total_iMCU_rows / REGION_SPAN;
+	unsigned char sha1[SHA_DIGEST_LENGTH];
+	if ( region_digest(password, REGION_FIRST_MAGIC, cinfo -> total_iMCU_rows, sha1) ){
+		return 20;
+	}
+	* first = 0;
+	if ( span ){
+		* first = (sha1[0] | sha1[1] << 8 | sha1[2] << 16 |
+			(unsigned int) sha1[3] << 24) % span;
+	}
+	return 0;
+}
+
+/**
+ * Gives DCT blocks of MCU rows [first, first + n) to empty enumerator
+ */
+static void region_band(struct enumerator * enu, j_decompress_ptr cinfo,
+		const struct color_channel_info * cci, unsigned int first,
+		unsigned int n){
+	int ksi;
+	for ( ksi = 0; ksi < cinfo -> num_components; ksi += 1 ){
+		unsigned int v = cinfo -> comp_info[ksi].v_samp_factor;
+		unsigned int a = first * v, b = (first + n) * v;
+		if ( b > cci[ksi].Hbl ){
+			b = cci[ksi].Hbl;
+		}
+		if ( a > b ){
+			a = b;
+		}
+		char fail = enumerator_add(enu, cci[ksi].Wbl, b - a, a);
+		assert(!fail);
+	}
+}
+
+/**
+ * Looks for region head and, if it is there, reads rows of the body.
+ * @param win - source, that is read so far, as needed, or NULL if the
+ * image is read
+ * @param rge - generator, seeded by password
+ * @param band - empty enumerator to put body rows to, it is left empty
+ * if there is no region
+ * @param shuffle, band_bits - places to put body shuffle table and
+ * number of positions to
+ * @param arrays - place to put coefficient arrays to, that have at
+ * least the rows needed, or, if win is NULL, the arrays
+ * @param lsb - bits to read instead of arrays, or NULL
+ * Other parameters are as for steganolab_worker.
+ * @return	1: found
+ * 			0: no region message here
+ * 			20: out of memory
+ */
+static int region_find(j_decompress_ptr cinfo, struct jio_window * win,
+		const struct color_channel_info * cci, const char * password,
+		uint8_t DCT_radius, struct rgen * rge, struct dct_work * work,
+		struct enumerator * band, unsigned int ** shuffle,
+		unsigned int * band_bits, jvirt_barray_ptr ** arrays,
+		const struct lsb_map * lsb){
+	uint8_t per_block = usable_DCT(DCT_radius);
+	unsigned int first;
+	if ( region_first(cinfo, password, &first) ){
+		return 20;
+	}
+	unsigned int head_rows = region_rows(cinfo, cci, first,
+		REGION_FACTOR * REGION_HEAD_SIZE * 8, per_block);
+	if ( 0 == head_rows ){
+		return 0;
+	}
+	if ( NULL != win ){
+		* arrays = jio_window_read_rows(cinfo, win, first + head_rows);
+	}
+	unsigned int bits;
+	char fail = 0;
+	region_band(band, cinfo, cci, first, head_rows);
+	if ( enumerator_get_number_of_positions(band, &bits) ){
+		fail = 1;
+	}
+	unsigned int * head_shuffle = NULL;
+	if ( ! fail ){
+		head_shuffle = make_shuffle(rge, bits, work);
+		if ( NULL == head_shuffle ){
+			return 20;
+		}
+	}
+	unsigned char head[REGION_HEAD_SIZE], expected[REGION_HEAD_SIZE];
+	if ( ! fail && read_steganographic_message_from_DCT_buffer(head,
+			REGION_HEAD_SIZE / CIPHER_BLOCK_SIZE, 0,
+			* arrays, cinfo, password, band, bits, head_shuffle, work, lsb) ){
+		fail = 1;
+	}
+	enumerator_free(band);
+	enumerator_init(band, DCT_radius);
+	if ( fail ){
+		return 0;
+	}
+	unsigned int body_rows = head[0] | head[1] << 8 | head[2] << 16 |
+		(unsigned int) head[3] << 24;
+	if ( region_head(expected, body_rows, password) ){
+		return 20;
+	}
+	if ( memcmp(head, expected, REGION_HEAD_SIZE) ){
+		return 0;
+	}
+	if ( 0 == body_rows || body_rows > cinfo -> total_iMCU_rows - first - head_rows ){
+		return 0;
+	}
+	if ( NULL != win ){
+		* arrays = jio_window_read_rows(cinfo, win, first + head_rows + body_rows);
+	}
+	region_band(band, cinfo, cci, first + head_rows, body_rows);
+	if ( enumerator_get_number_of_positions(band, band_bits) ){
+		enumerator_free(band);
+		enumerator_init(band, DCT_radius);
+		return 0;
+	}
+	* shuffle = make_shuffle(rge, * band_bits, work);
+	return NULL == * shuffle ? 20 : 1;
+}
+
+
+
+/**
+ * Describes what decoder shall do with the message it has found:
+ * either put it into a malloced buffer for the caller, or push it
+ * piece by piece to the caller's sink. Only message bytes [from, to)
+ * are given out.
+ */
+struct decode_target {
+	char ** data;			/* place to put malloced buffer pointer to, or NULL */
+	unsigned int * len;		/* place to put buffer length to */
+	steganolab_sink sink;	/* used if data is NULL */
+	void * user;			/* passed to sink */
+	unsigned int from, to;
+};
+
+/**
+ * Prepares target to receive the message of given length: fits the
+ * byte range to the message and allocates buffer for the caller.
+ * @param total - message length
+ * @return	0: OK
+ * 			20: out of memory
+ */
+static int target_open(struct decode_target * t, size_t total){
+	if ( t -> to > total ){
+		t -> to = total;
+	}
+	if ( t -> from > t -> to ){
+		t -> from = t -> to;
+	}
+	if ( NULL != t -> data ){
+		unsigned int n = t -> to - t -> from;
+		* t -> data = malloc( n ? n : 1 );
+		if ( NULL == * t -> data ){
+			return 20;
+		}
+		* t -> len = n;
+	}
+	return 0;
+}
+
+/**
+ * Gives a verified piece of message to target, skipping bytes, that
+ * fall out of the requested range.
+ * @param offset - offset of the piece in the message
+ * @param piece - message bytes
+ * @param len - piece length
+ * @return	0: OK
+ * 			42: sink asked to stop
+ */
+static int target_put(struct decode_target * t, size_t offset,
+		const unsigned char * piece, size_t len){
+	size_t a = offset, b = offset + len;
+	if ( a < t -> from ){
+		a = t -> from;
+	}
+	if ( b > t -> to ){
+		b = t -> to;
+	}
+	if ( a >= b ){
+		return 0;/* Nothing wanted here */
+	}
+	piece += a - offset;
+	if ( NULL != t -> data ){
+		memcpy( * t -> data + (a - t -> from), piece, b - a );
+	}else if( t -> sink(t -> user, (const char *) piece, b - a) ){
+		return 42;
+	}
+	return 0;
+}
+
+/**
+ * Makes verified head, not ciphered yet
+ * @param head - buffer for CIPHER_BLOCK_SIZE bytes
+ * @param n - message length after the head
+ * @return 0 if OK, 10 if length record is too long for the head,
+ * 20 if out of memory
+ */
+static int verified_head(unsigned char * head, size_t n, const char * password){
+	unsigned char rec[LENCODE_MAX];
+	unsigned int rec_len = lencode_produce(n, rec);
+	if ( rec_len + VERIFIER_SIZE > CIPHER_BLOCK_SIZE ){
+		return 10;
+	}
+	unsigned char sha1[SHA_DIGEST_LENGTH];
+	EVP_MD_CTX * md = EVP_MD_CTX_new();
+	char fail = NULL == md || 1 != EVP_DigestInit_ex(md, EVP_sha1(), NULL) ||
+		1 != EVP_DigestUpdate(md, password, strlen(password)) ||
+		1 != EVP_DigestUpdate(md, rec, rec_len) ||
+		1 != EVP_DigestFinal_ex(md, sha1, NULL);
+	EVP_MD_CTX_free(md);
+	if ( fail ){
+		return 20;
+	}
+	memset(head, 0, CIPHER_BLOCK_SIZE);
+	memcpy(head, rec, rec_len);
+	memcpy(head + rec_len, sha1, VERIFIER_SIZE);
+	return 0;
+}
+
+/**
+ * Checks deciphered verified head: length record, verifier and zeroes
+ * must be exactly as verified_head makes them
+ * @param n - place to put message length to
+ * @return 0 if the head is right, 1 otherwise
+ */
+static char verified_head_check(const unsigned char * head, const char * password,
+		size_t * n){
+	size_t rec_len;
+	unsigned char expected[CIPHER_BLOCK_SIZE];
+	if ( lencode_yield(head, CIPHER_BLOCK_SIZE - VERIFIER_SIZE, n, &rec_len) ||
+			verified_head(expected, * n, password) ){
+		return 1;
+	}
+	return 0 != memcmp(head, expected, CIPHER_BLOCK_SIZE);
+}
+
+/**
+ * Finds where verified head bits go: last positions of the shuffle, from
+ * the end
+ * @param shuffle - the whole table, NULL to make the positions from a
+ * generator, seeded by password, as make_shuffle would make the table
+ * @param n - shuffle size
+ * @param top - buffer for VERIFIED_HEAD_BITS positions
+ * @return 0 if OK, 1 if the shuffle is too small
+ */
+static char verified_positions(const unsigned int * shuffle, unsigned int n,
+		const char * password, unsigned int * top){
+	if ( n < VERIFIED_HEAD_BITS ){
+		return 1;
+	}
+	unsigned int k;
+	if ( NULL == shuffle ){
+		struct rgen rge;
+		rgen_init(& rge, password);
+		rgen_shuffle_top(& rge, n, top, VERIFIED_HEAD_BITS);
+		rgen_free(& rge);
+	}else{
+		for ( k = 0; k < VERIFIED_HEAD_BITS; k += 1 ){
+			top[k] = shuffle[n - 1 - k];
+		}
+	}
+	return 0;
+}
+
+/**
+ * Reads a length record, that goes among format fields, and moves
+ * pointer to the next field.
+ * @param field - pointer to the field pointer
+ * @param left - pointer to number of bytes left in message
+ * @param num - place to put the number to
+ * @return 0 if OK, not 0 if record is damaged
+ */
+static char read_field(unsigned char ** field, size_t * left, size_t * num){
+	size_t look = * left < lencode_estimate() ? * left : lencode_estimate();
+	size_t rec_len = 0;
+	if ( lencode_yield(* field, look, num, &rec_len) ){
+		return 1;
+	}
+	* field += rec_len;
+	* left -= rec_len;
+	return 0;
+}
+
+/**
+ * This structure holds pointers to objects, that need freeing.
+ * There is a function that cals the needed freers, called
+ * encode_cleanup_func, that calls proper functions.
+ *
+ * Job buffers (message, shuffle table and so on) are taken from the
+ * thread arena and are given back all at once by closing the frame.
+ */
+struct cleanup {
+	/* These must be set to real objects before freeing */
+	struct jpeg_decompress_struct * cinfo;
+	struct enumerator * enu;
+	struct enumerator * band; /* Region of the message, may be empty */
+	struct rgen * rge;
+	struct pcache_job * shuffles;
+	struct arena_frame frame;
+	struct jio_map map; /* Mapped input file, if any */
+	/* These may be set to NULL before setting pointing to real objects */
+	struct rsrce * rsrc;
+	struct color_channel_info * cci;
+	char * data_out; /* Buffer for the caller, given out only on success */
+	char heavy; /* Job has taken room in heavy jobs queue */
+};
+
+static void cleanup_func(struct cleanup * o){
+	if ( NULL != o -> map . base && NULL != o -> cinfo -> src ){
+		/* Caller's stream goes on after the jpeg, though it is read
+		 * only partly on many paths */
+		jio_map_seek(& o -> map, o -> cinfo -> src -> next_input_byte,
+			o -> cinfo -> unread_marker);
+	}
+	jpeg_destroy_decompress(o -> cinfo);
+	enumerator_free(o -> enu);
+	enumerator_free(o -> band);
+	/* Objects that can be NULL */
+	if ( o -> rge != NULL ){
+		rgen_free(o -> rge);
+	}
+	if ( NULL != o -> shuffles ){
+		pcache_job_free(o -> shuffles);
+	}
+	if( NULL != o -> rsrc ){
+		rsrce_free(o -> rsrc);
+	}
+	free(o -> cci);
+	free(o -> data_out);
+	/* Decompressor is gone, nobody reads the mapping anymore */
+	jio_map_close(& o -> map);
+	if ( o -> heavy ){
+		admit_leave();
+	}
+	/* Jpeg objects are destroyed, so their memory can go too */
+	arena_end(& o -> frame);
+}
+
+
+
+/**
+ * Estimates memory, a job will take, by what is known from jpeg header
+ * @param info - channels, as the worker studies them
+ * @param channels - their number
+ * @param bits_available - image capacity
+ * @param len - message length for encoder, 0 for decoder
+ * @return bytes
+ */
+static size_t predict_memory(const struct color_channel_info * info,
+		int channels, unsigned long long bits_available, unsigned int len){
+	/* Jpeg library tables and buffers for decompressor and compressor,
+	 * stdio buffers, arena tags and alignment */
+	size_t total = 512 * 1024;
+	int ksi;
+	for ( ksi = 0; ksi < channels; ksi += 1 ){
+		const struct color_channel_info * c = info + ksi;
+		/* Coefficient arrays are rounded up to sampling factors, a byte
+		 * per row is for counting rows touched */
+		size_t wbl = (c -> w + DCTSIZE - 1) / DCTSIZE + c -> h_samp_factor;
+		size_t hbl = (c -> h + DCTSIZE - 1) / DCTSIZE + c -> v_samp_factor;
+		total += wbl * hbl * sizeof(JBLOCK) + hbl * (sizeof(JBLOCKROW) + 1);
+	}
+	/* Shuffle table */
+	total += (size_t) bits_available * sizeof(unsigned int);
+	/* Message: the whole capacity at worst for decoder, message with
+	 * header, SHA1, padding and a chunk for encoder */
+	if ( len ){
+		total += 2 * (size_t) len + 1024;
+	}else{
+		total += bits_available / 8 + 1024;
+	}
+	return total;
+}
+
+
+#define DECODE		0
+#define ENCODE		1
+#define ESTIMATE	2
+/**
+ * Worker function, that does embeding and reading upon request.
+ * This function is convinient, because writer and reader share much of
+ * similar code.
+ * @param src - input stream or memory
+ * @param dst - output stream or memory
+ * @param data_in - message to embed if encoder
+ * @param len_in - message length if encoder
+ * @param target - where to put the message if decoder
+ * @param action - what to do, DECODE|ENCODE|ESTIMATE.
+ * @param password - secret key
+ * @param DCT_radius - Constant, limiting DCT block coefficients
+ *  use: i^2 + j^2 <= R^2
+ * @param opts - settings, NULL for defaults
+ * @param stats - statistics object to fill with data if not NULL
+ * The object don't need to be freed if the function fails.
+ * @return 0 if OK, various error statuses on error, the statuses can be
+ * decoded to human-readable from with the function providden
+ */
+static int steganolab_worker(struct jpeg_io * src, struct jpeg_io * dst,
+	const char * data_in,
+	unsigned int len_in, struct decode_target * target,
+	uint8_t action, const char * password, uint8_t DCT_radius,
+	const struct steganolab_options * opts,
+	struct steganolab_statistics * stats
+){
+	struct steganolab_options default_opts;
+	if ( NULL == opts ){
+		steganolab_options_init(& default_opts);
+		opts = & default_opts;
+	}
+
+	struct jpeg_decompress_struct own_cinfo;
+	/* Decompressor, that has read the image for us, or our own one */
+	j_decompress_ptr cinfo = NULL != src -> ready ? src -> ready : & own_cinfo;
+	struct my_error_mgr jerr;
+
+	struct enumerator enu;/* Thing, able to explain where DCT coefficient is by it's id */
+	enumerator_init(&enu, DCT_radius);
+	struct enumerator band;/* The same for region rows, if the message is there */
+	enumerator_init(&band, DCT_radius);
+	/* These live until final clean-up, so they are declared here */
+	struct rgen rge;
+	struct rsrce rsrc;
+	struct dct_work work;
+	memset(& work, 0, sizeof(work));
+	struct jio_window win;/* Source for a file in memory */
+	struct watch watch;/* Caller's progress callback, deadline and cancel flag */
+	watch_init(& watch, opts, (j_common_ptr) cinfo);
+	work.watch = & watch;
+	struct pcache_job shuffles;/* Shuffle tables, made before */
+
+	/* We set up the normal JPEG error routines, then override error_exit. */
+	cinfo -> err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = my_error_exit;
+
+	struct cleanup clu;
+	clu . cinfo = cinfo;
+	clu . enu = & enu;
+	clu . band = & band;
+	clu . rge = NULL;
+	clu . shuffles = NULL;
+	if ( NULL != password ){
+		pcache_job_init(& shuffles, password, opts -> shuffle_dir);
+		clu . shuffles = & shuffles;
+		work.shuffles = & shuffles;
+	}
+	clu . data_out = NULL;/* This will be set after, until this free(NULL) would work OK */
+	clu . rsrc = NULL;
+	clu . cci = NULL;
+	clu . map . base = NULL;
+	clu . heavy = 0;
+	arena_begin(& clu . frame);
+	/* Counting work from here */
+	arena_peak_reset();
+	cipher_bytes_reset();
+
+	/* Establish the setjmp return context for my_error_exit to use. */
+	if (setjmp(jerr.setjmp_buffer)) {
+		/* If we get here, the JPEG code has signaled an error.
+		* We need to clean up the JPEG object, close the input file, and return.
+		*/
+		cleanup_func(& clu);
+		return 0 != watch.status ? watch.status : 2;
+	}
+	if ( NULL == src -> ready ){
+		cinfo -> client_data = ARENA_JPEG_OWNER;
+		jpeg_create_decompress(cinfo);
+	}
+	cinfo -> progress = watch.active ? & watch.pub : NULL;
+	/* Decoder may stop reading in the middle, others read it all */
+	size_t first_look = DECODE == action ? 0 : SIZE_MAX;
+	const JOCTET * in_data = (const JOCTET *) src -> in;
+	size_t in_len = src -> in_len;
+	if ( NULL != src -> ready ){
+		/* Header and coefficients are there */
+	}else if ( NULL != src -> file ){
+		if ( 0 == jio_map_open(& clu . map, src -> file) ){
+			/* Regular file: jpeg library reads mapped pages directly */
+			in_data = clu . map . data;
+			in_len = clu . map . len;
+		}else{
+			/* Pipe or something like it */
+			in_data = NULL;
+			jpeg_stdio_src(cinfo, src -> file);
+		}
+	}
+	char in_memory = NULL != in_data;
+	size_t scan_offset = 0;/* Where entropy coded data starts in memory */
+	if ( in_memory ){
+		jio_window_attach(cinfo, &win, in_data, in_len, first_look);
+		jio_window_read_header(cinfo, &win);
+		scan_offset = cinfo -> src -> next_input_byte - in_data;
+	}else if ( NULL == src -> ready ){
+		(void) jpeg_read_header(cinfo, TRUE);
+		/* We can ignore the return value from jpeg_read_header since
+		*   (a) suspension is not possible with the stdio data source, and
+		*   (b) we passed TRUE to reject a tables-only JPEG file as an error.
+		* See libjpeg.doc for more info.
+		*/
+	}
+	/* Resource policy: only the header is read so far */
+	if ( ESTIMATE != action && (
+			( opts -> max_components &&
+				(unsigned int) cinfo -> num_components > opts -> max_components ) ||
+			( opts -> max_pixels && (unsigned long long) cinfo -> image_width *
+				cinfo -> image_height > opts -> max_pixels ) ) ){
+		cleanup_func(& clu);
+		return 46;/* Over limits */
+	}
+	/* Studying image */
+	int color_channels = cinfo -> num_components;
+	/* How many blocks will we have? */
+	/* Looking at component properties */
+	struct color_channel_info * cci = malloc(sizeof(struct color_channel_info) * color_channels);
+	if(NULL == cci){
+		cleanup_func(& clu);
+		return 20;/* Out of memory */
+	}
+	clu.cci = cci;
+	{/* Studying image */
+		int ksi;
+		for(ksi=0; ksi<color_channels; ksi+=1){
+			assert(cinfo -> comp_info[ksi].DCT_scaled_size == DCTSIZE);/* We didn't requsted it to be different, so it mustn't be different */
+			int w = cinfo -> comp_info[ksi].downsampled_width;
+			int h = cinfo -> comp_info[ksi].downsampled_height;
 			char afraid_of_w = 0, afraid_of_h = 0;
 			/* Don't use blocks next to border picture don't fit in blocks precisely */
 			if ( w % DCTSIZE ){
@@ -557,8 +1921,8 @@ static int steganolab_worker(SLFILE * infile, SLFILE * outfile,
 				afraid_of_h = 1;
 			}
 			unsigned int Wbl,Hbl;
-			Wbl = (unsigned int)cinfo.comp_info[ksi].width_in_blocks;/* It's safe because jpeg images can only be 64kx64k (see jmorecfg of jpeglib62)*/
-			Hbl = (unsigned int)cinfo.comp_info[ksi].height_in_blocks;
+			Wbl = (unsigned int)cinfo -> comp_info[ksi].width_in_blocks;/* It's safe because jpeg images can only be 64kx64k (see jmorecfg of jpeglib62)*/
+			Hbl = (unsigned int)cinfo -> comp_info[ksi].height_in_blocks;
 			if(afraid_of_w){
 				assert(Wbl);
 				Wbl -= 1;
@@ -567,24 +1931,60 @@ static int steganolab_worker(SLFILE * infile, SLFILE * outfile,
 				assert(Hbl);
 				Hbl -= 1;
 			}/* Exclude border blocks */
-			char fail_adding_block_record_to_enumerator = enumerator_add(&enu, Wbl, Hbl);
+			char fail_adding_block_record_to_enumerator = enumerator_add(&enu, Wbl, Hbl, 0);
 			assert(!fail_adding_block_record_to_enumerator);
 
 			/* Saving array for statistics */
 			cci [ksi] . afraid = (afraid_of_w) | (afraid_of_h << 1);
 			cci [ksi] . usable_DCT_blocks = Wbl * Hbl; /* If this overflows, we would fail in enumerator_add */
-			cci [ksi] . h_samp_factor = cinfo.comp_info[ksi].h_samp_factor;
-			cci [ksi] . v_samp_factor = cinfo.comp_info[ksi].v_samp_factor;
+			cci [ksi] . h_samp_factor = cinfo -> comp_info[ksi].h_samp_factor;
+			cci [ksi] . v_samp_factor = cinfo -> comp_info[ksi].v_samp_factor;
 			cci [ksi] . Wbl = Wbl;
 			cci [ksi] . Hbl = Hbl;
 			cci [ksi] . h = h;
 			cci [ksi] . w = w;
 		}
 	}/* studying image */
+	unsigned int block_rows = 0;/* Of all channels */
+	{/* Table to count distinct rows in */
+		int ksi;
+		for(ksi=0; ksi<color_channels; ksi+=1){
+			work.row_base[ksi] = block_rows;
+			block_rows += cci[ksi].Hbl;
+		}
+		work.row_count = block_rows;
+		work.row_seen = arena_alloc(block_rows + 1);
+		if(NULL == work.row_seen){
+			cleanup_func(& clu);
+			return 20;/* Out of memory */
+		}
+		memset(work.row_seen, 0, block_rows + 1);
+	}
 	unsigned int all_available;
-	{
-		char fail = enumerator_get_number_of_positions(&enu, &all_available);
-		assert(!fail);
+	if ( enumerator_get_number_of_positions(&enu, &all_available) ){
+		cleanup_func(& clu);
+		return 46;/* Can't even count it's bits */
+	}
+	if ( ESTIMATE != action && ( opts -> max_memory || opts -> heavy_memory ) ){
+		/* Coefficients and shuffle table are not there yet: they are
+		 * what the prediction is mostly about */
+		size_t need = predict_memory(cci, color_channels, all_available,
+			ENCODE == action ? len_in : 0);
+		if ( opts -> max_memory && need > opts -> max_memory ){
+			cleanup_func(& clu);
+			return 46;/* Over limits */
+		}
+		if ( opts -> heavy_memory && need > opts -> heavy_memory &&
+				NULL == src -> ready_arrays ){
+			/* Waiting for other heavy jobs to finish */
+			char waited = admit_enter(opts -> timeout_ms ? & watch.deadline : NULL,
+				opts -> cancel);
+			if ( waited ){
+				cleanup_func(& clu);
+				return 1 == waited ? 44 : 45;
+			}
+			clu . heavy = 1;
+		}
 	}
 
 	/* Now the shuffle is a map from data bit id to enumerator id,
@@ -592,55 +1992,226 @@ static int steganolab_worker(SLFILE * infile, SLFILE * outfile,
 
 	unsigned int bits_used = 0;/* For statistics, this is set to number
 	of bits, used for steganography, in both decoder and encoder */
+	unsigned long long payload_bits = 0;/* The same for message bits, */
+	unsigned int packed_bits = 0;/* before and after compression */
 	/* Requesting to read DCT coefficients and return an array of DCT
 	 * block 2D arrays.
 	 */
-	jvirt_barray_ptr * color_component_block_arrays = jpeg_read_coefficients( &cinfo );
+	jvirt_barray_ptr * color_component_block_arrays = src -> ready_arrays;
+	unsigned int threads = opts -> threads ? opts -> threads : pool_cpus();
+	work.threads = threads;
+	unsigned char cache_key[CCACHE_KEY_SIZE];
+	/* Message is spread over these */
+	struct enumerator * space = & enu;
+	unsigned int space_bits = all_available;
+	unsigned int * shuffle = NULL;
+	char cached = 0;
+	char region_tried = 0;
+	/* TurboJPEG, if it is built in, goes through an image in memory
+	 * itself, instead of jpeg library with virtual arrays */
+	char turbo = ESTIMATE != action && in_memory && NULL == opts -> cache_dir &&
+		( NULL == dst || ! dst -> splice ) && tjback_available();
+	struct lsb_map lsb_map, * lsb = NULL;/* What it has read */
+	if ( ESTIMATE == action ){
+		/* Capacity is known from the header, coefficients are not needed */
+	}else if ( NULL != opts -> cache_dir && in_memory ){
+		/* Carrier may have been decoded before */
+		ccache_key(in_data, in_len, cache_key);
+		color_component_block_arrays = ccache_load( cinfo, opts -> cache_dir, cache_key );
+		cached = NULL != color_component_block_arrays;
+	}
+	if ( DECODE == action && ! cached && in_memory && jio_window_rows_in_order(cinfo) ){
+		/* The message may be in a region at the top: then the rest of
+		 * the image is not needed */
+		rgen_init(& rge, password);
+		clu . rge = & rge;
+		region_tried = 1;
+		int found = region_find(cinfo, &win, cci, password, DCT_radius,
+			&rge, &work, &band, &shuffle, &space_bits, &color_component_block_arrays,
+			NULL);
+		if ( 20 == found ){
+			cleanup_func(& clu);
+			return 20;/* Out of memory */
+		}
+		if ( found ){
+			space = & band;
+		}else{
+			/* The message is spread over the image, if it's there */
+			rgen_free(&rge);
+			clu . rge = NULL;
+			color_component_block_arrays = NULL;
+			if ( threads > 1 || turbo ){
+				/* Starting from scratch to decode intervals at once, or
+				 * to give the image to TurboJPEG */
+				jpeg_abort_decompress(cinfo);
+				jio_window_attach(cinfo, &win, in_data, in_len, SIZE_MAX);
+				jio_window_read_header(cinfo, &win);
+			}else{
+				/* Going on from where it stopped */
+				color_component_block_arrays = jio_window_read_rows(cinfo, &win,
+					cinfo -> total_iMCU_rows);
+			}
+		}
+	}
+	if ( DECODE == action && turbo && space == & enu ){
+		/* Bits of all usable coefficients are enough for decoder */
+		struct lsb_collect collect;
+		collect.bits = arena_alloc(all_available / 8 + 1);
+		if ( NULL == collect.bits ){
+			cleanup_func(& clu);
+			return 20;/* Out of memory */
+		}
+		memset(collect.bits, 0, all_available / 8 + 1);
+		collect.cci = cci;
+		collect.channels = color_channels;
+		collect.per_block = usable_DCT(DCT_radius);
+		uint8_t k, i, j;
+		for ( k = 0; k < collect.per_block; k += 1 ){
+			getij(k, DCT_radius, &i, &j);
+			collect.coef[k] = i * DCTSIZE + j;
+		}
+		unsigned int base = 0;
+		int ksi;
+		for ( ksi = 0; ksi < color_channels; ksi += 1 ){
+			collect.base[ksi] = base;
+			base += cci[ksi].usable_DCT_blocks * collect.per_block;
+		}
+		if ( tjback_visit(in_data, in_len, lsb_visit, &collect, NULL, NULL) ){
+			cleanup_func(& clu);
+			return 2;/* Jpeg error */
+		}
+		lsb_map.bits = collect.bits;
+		lsb_map.enu = & enu;
+		lsb = & lsb_map;
+	}
+	if ( ESTIMATE != action && ! turbo && NULL == color_component_block_arrays ){
+		if ( threads > 1 && in_memory ){
+			/* The whole file is in memory: restart intervals, if any,
+			 * can be decoded at once */
+			color_component_block_arrays = pdecode_read_coefficients( cinfo,
+				cinfo -> src -> next_input_byte, in_data + in_len - cinfo -> src -> next_input_byte,
+				threads, watch.active ? watch_pool_read : NULL, & watch );
+			if ( watch.status ){
+				/* Stopped between intervals */
+				cleanup_func(& clu);
+				return watch.status;
+			}
+		}
+		if ( NULL == color_component_block_arrays ){
+			color_component_block_arrays = in_memory ?
+				jio_window_read_rows( cinfo, &win, cinfo -> total_iMCU_rows ) :
+				jpeg_read_coefficients( cinfo );
+		}
+	}
+	if ( ESTIMATE != action && ! cached && ! turbo && space == & enu &&
+			NULL != opts -> cache_dir && in_memory ){
+		/* Before the encoder changes them. Images, read in part for a
+		 * region, are not kept */
+		ccache_store( cinfo, color_component_block_arrays, opts -> cache_dir, cache_key );
+	}
+	if ( ENCODE == action && dst -> splice && in_memory && ! turbo ){
+		/* Blocks, that embeding changes, are noted, so that only their
+		 * restart intervals are coded again */
+		int ksi;
+		for ( ksi = 0; ksi < color_channels; ksi += 1 ){
+			size_t blocks = (size_t) cinfo -> comp_info[ksi].width_in_blocks *
+				cinfo -> comp_info[ksi].height_in_blocks;
+			work.changed[ksi] = arena_alloc(blocks + 1);
+			if ( NULL == work.changed[ksi] ){
+				cleanup_func(& clu);
+				return 20;/* Out of memory */
+			}
+			memset(work.changed[ksi], 0, blocks + 1);
+		}
+	}
+	if ( DECODE == action && ! region_tried ){
+		/* The image is read, looking for a region in it */
+		rgen_init(& rge, password);
+		clu . rge = & rge;
+		int found = region_find(cinfo, NULL, cci, password, DCT_radius,
+			&rge, &work, &band, &shuffle, &space_bits, &color_component_block_arrays,
+			lsb);
+		if ( 20 == found ){
+			cleanup_func(& clu);
+			return 20;/* Out of memory */
+		}
+		if ( found ){
+			space = & band;
+		}else{
+			rgen_free(&rge);
+			clu . rge = NULL;
+		}
+	}
 	if( DECODE == action || ENCODE == action ){
 		/* Things, needed by encoder/decoder, but not needed for estimation
 		set here */
 
-		struct rgen rge;
-		rgen_init(& rge, password);/* Pseurandom generator, based on BLOWFISH,
-		is created in this line and seeded by password */
-		clu . rge = & rge;/* Setting for clean-up */
-
-		/* generating a random shuffle to know which bit is in which position */
-		unsigned int shuffle_length = all_available;
-		unsigned int * shuffle = rgen_shuffle(&rge, shuffle_length);
-		if( NULL == shuffle ){
-			cleanup_func(& clu);
-			return 20;/* Out of memory */
+		if ( NULL == clu . rge ){
+			rgen_init(& rge, password);/* Pseurandom generator, based on BLOWFISH,
+			is created in this line and seeded by password */
+			clu . rge = & rge;/* Setting for clean-up */
 		}
-		clu . shuffle = shuffle; /* Setting for clean-up */
 
 		if ( DECODE == action ){
-			unsigned int max_len_rec = lencode_estimate();
-			/* Reading max_len_rec bytes from file */
-			/* How many cipher blocks will we need to get the length record? */
-			unsigned int len_rec_blocks = max_len_rec / CIPHER_BLOCK_SIZE;
-			if(max_len_rec % CIPHER_BLOCK_SIZE){
-				len_rec_blocks += 1;
-			}
-			unsigned char msg[len_rec_blocks*CIPHER_BLOCK_SIZE];
-			int readstate = read_steganographic_message_from_DCT_buffer(msg,
-				len_rec_blocks,color_component_block_arrays, &cinfo, password,
-				&enu, all_available, shuffle);
-
-			if(readstate){
-				cleanup_func( &clu );
-				return 40;
-			}
-
 			size_t data_length_big = 0, record_length_big = 0; /* message + SHA1 */
+			char extended;
+			unsigned int head_bits = 0;/* Verified head, if the message has it */
+			int readstate;
+			{/* Verified head is looked for first: it's positions are
+			  * known before the shuffle is made */
+				unsigned int top[VERIFIED_HEAD_BITS];
+				unsigned char head[CIPHER_BLOCK_SIZE];
+				if ( 0 == verified_positions(shuffle, space_bits, password, top) &&
+						0 == read_steganographic_message_from_DCT_buffer(head, 1, 0,
+							color_component_block_arrays, cinfo, password, space,
+							space_bits, top, &work, lsb) &&
+						0 == verified_head_check(head, password, &data_length_big) ){
+					head_bits = VERIFIED_HEAD_BITS;
+					extended = 1;
+				}else if ( opts -> flags & STEGANOLAB_VERIFIED ){
+					/* Nothing else is looked for: wrong key costs no
+					 * shuffle table */
+					cleanup_func( &clu );
+					return 40;
+				}
+			}
+			if ( NULL == shuffle ){
+				/* generating a random shuffle to know which bit is in which position */
+				shuffle = make_shuffle(&rge, all_available, &work);
+				if( NULL == shuffle ){
+					cleanup_func(& clu);
+					return 20;/* Out of memory */
+				}
+			}
+			if ( ! head_bits ){
+				unsigned int max_len_rec = lencode_estimate();
+				/* Reading max_len_rec bytes from file */
+				/* How many cipher blocks will we need to get the length record? */
+				unsigned int len_rec_blocks = max_len_rec / CIPHER_BLOCK_SIZE;
+				if(max_len_rec % CIPHER_BLOCK_SIZE){
+					len_rec_blocks += 1;
+				}
+				unsigned char msg[len_rec_blocks*CIPHER_BLOCK_SIZE];
+				readstate = read_steganographic_message_from_DCT_buffer(msg,
+					len_rec_blocks, 0, color_component_block_arrays, cinfo, password,
+					space, space_bits, shuffle, &work, lsb);
+
+				if(readstate){
+					cleanup_func( &clu );
+					return 40;
+				}
 
-			char data_length_decoding_result = lencode_yield (msg, max_len_rec,
-				&data_length_big, &record_length_big);
+				if ( lencode_yield (msg, max_len_rec,
+						&data_length_big, &record_length_big) ){
+					/* Failed to read length code */
+					cleanup_func( &clu );
+					return 40; /* Garbage */
+				}
+				extended = lencode_extended(msg, record_length_big);
+			}
 
-			if(data_length_decoding_result ||
-				data_length_big + record_length_big > UINT_MAX
+			if ( data_length_big + record_length_big > UINT_MAX
 				/* At least on x86_64 that seriously makes sence */){
-				/* Failed to read length code */
 				cleanup_func( &clu );
 				return 40; /* Garbage */
 			}
@@ -665,10 +2236,10 @@ static int steganolab_worker(SLFILE * infile, SLFILE * outfile,
 				return 40; /* garbage */
 			}
 			/* For statistics */
-			bits_used = full_message_bits_after_fitting_to_blocks;
+			bits_used = full_message_bits_after_fitting_to_blocks + head_bits;
 			/* Generally speaking, the following check is done in read_steganographic_message_from_DCT_buffer */
 			/* However, let's do it before allocating possibly tons of memory in case of garbage input */
-			if ( full_message_bits_after_fitting_to_blocks > all_available ){
+			if ( full_message_bits_after_fitting_to_blocks > space_bits - head_bits ){
 				cleanup_func( & clu );
 				return 40;
 			}
@@ -683,16 +2254,15 @@ static int steganolab_worker(SLFILE * infile, SLFILE * outfile,
 			}
 			unsigned int sha1_offset = full_message_length - SHA_DIGEST_LENGTH;
 			/* Allocating space for message */
-			unsigned char * message = malloc(full_message_length_after_fitting_to_blocks);
+			unsigned char * message = arena_alloc(full_message_length_after_fitting_to_blocks);
 			if(NULL == message){
 				cleanup_func( & clu );
 				return 20;/* out of memory */
 			}
-			clu . message = message;/* Remembering for clean-up */
 
 			readstate = read_steganographic_message_from_DCT_buffer(message,
-				full_message_blocks, color_component_block_arrays, &cinfo,
-				password, &enu, all_available, shuffle);
+				full_message_blocks, 0, color_component_block_arrays, cinfo,
+				password, space, space_bits, shuffle, &work, lsb);
 			if(readstate){
 				cleanup_func( & clu );
 				return 40;
@@ -713,71 +2283,296 @@ static int steganolab_worker(SLFILE * infile, SLFILE * outfile,
 				return 40;/* Garbage! */
 			}
 			/* Woops! A real message. */
-			* len_out = sha1_offset - data_offset;
-			*data_out = malloc( * len_out );
-			if( *data_out == NULL ){
-				/* How sad, we were close to reporting the message */
+			unsigned char * body = message + data_offset;
+			size_t body_len = sha1_offset - data_offset;
+			size_t raw_len = body_len, chunk_size = 0;
+			uint8_t format = 0;
+			if ( extended ){
+				/* Format byte and fields go first */
+				format = body[0];
+				body += 1;
+				body_len -= 1;
+				raw_len = body_len;/* Format 0 has no fields */
+				if ( format & ~FORMAT_KNOWN ||
+						(format & FORMAT_DEFLATE && format & FORMAT_CHUNKED) ){
+					cleanup_func( & clu );
+					return 41;/* Written by a newer version */
+				}
+				/* Both formats start fields with data length */
+				if ( format && read_field(&body, &body_len, &raw_len) ){
+					cleanup_func( & clu );
+					return 40;/* Can't be, SHA1 matched */
+				}
+				if ( format & FORMAT_CHUNKED ){
+					if ( read_field(&body, &body_len, &chunk_size) || 0 == chunk_size ){
+						cleanup_func( & clu );
+						return 40;
+					}
+				}
+			}
+			if ( raw_len > UINT_MAX ){
+				cleanup_func( & clu );
+				return 40;
+			}
+			if ( target_open(target, raw_len) ){
 				cleanup_func( & clu );
 				return 20;/* Out of memory */
 			}
-			/* memory allocated ! */
-			memcpy( * data_out, message + data_offset, * len_out );
+			if ( NULL != target -> data ){
+				clu . data_out = * target -> data;/* Until we are sure */
+			}
+			/* For statistics */
+			payload_bits = (unsigned long long) raw_len * 8;
+			packed_bits = body_len * 8;
+			int put_state = 0;
+			if ( format & FORMAT_CHUNKED ){
+				/* Reading only chunks, that cover requested range */
+				if ( chunk_size > raw_len ){
+					chunk_size = raw_len ? raw_len : 1;/* Only one chunk then */
+				}
+				unsigned long long chunk_rec = fit_to_blocks(CHUNK_INDEX_SIZE +
+					chunk_size + SHA_DIGEST_LENGTH);
+				unsigned long long nchunks = (raw_len + chunk_size - 1) / chunk_size;
+				unsigned long long all_bits = full_message_bits_after_fitting_to_blocks;
+				if ( nchunks ){
+					all_bits += ( (nchunks - 1) * chunk_rec + fit_to_blocks(CHUNK_INDEX_SIZE +
+						raw_len - (nchunks - 1) * chunk_size + SHA_DIGEST_LENGTH) ) * 8;
+				}
+				if ( all_bits > space_bits - head_bits ){
+					cleanup_func( & clu );
+					return 40;/* Header lies */
+				}
+				/* For statistics */
+				bits_used = all_bits + head_bits;
+				packed_bits = raw_len * 8;
+				unsigned char * chunk = arena_alloc(chunk_rec);
+				if ( NULL == chunk ){
+					cleanup_func( & clu );
+					return 20;/* Out of memory */
+				}
+				unsigned long long k;
+				for ( k = target -> from / chunk_size; k * chunk_size < target -> to; k += 1 ){
+					size_t k_len = raw_len - k * chunk_size;
+					if ( k_len > chunk_size ){
+						k_len = chunk_size;
+					}
+					size_t k_data_end = CHUNK_INDEX_SIZE + k_len;
+					readstate = read_steganographic_message_from_DCT_buffer(chunk,
+						fit_to_blocks(k_data_end + SHA_DIGEST_LENGTH) / CIPHER_BLOCK_SIZE,
+						full_message_bits_after_fitting_to_blocks + k * chunk_rec * 8,
+						color_component_block_arrays, cinfo, password, space,
+						space_bits, shuffle, &work, lsb);
+					if ( readstate ){
+						cleanup_func( & clu );
+						return 40;
+					}
+					/* Checking that this is the chunk we are looking for */
+					unsigned long long index = 0;
+					uint8_t ib;
+					for ( ib = 0; ib < CHUNK_INDEX_SIZE; ib += 1 ){
+						index |= (unsigned long long) chunk[ib] << 8 * ib;
+					}
+					SHA1(chunk, k_data_end, sha1);
+					if ( index != k || memcmp(chunk + k_data_end, sha1, SHA_DIGEST_LENGTH) ){
+						cleanup_func( & clu );
+						return 40;/* Damaged chunk */
+					}
+					put_state = target_put(target, k * chunk_size,
+						chunk + CHUNK_INDEX_SIZE, k_len);
+					if ( put_state ){
+						break;
+					}
+				}
+			}else if ( format & FORMAT_DEFLATE ){
+				/* Inflating right into the caller's buffer, if the caller
+				 * wants the whole message there */
+				unsigned char * raw;
+				char direct = NULL != target -> data && target -> from == 0
+					&& target -> to == raw_len;
+				if ( direct ){
+					raw = (unsigned char *) * target -> data;
+				}else{
+					raw = arena_alloc( raw_len );
+					if ( NULL == raw ){
+						cleanup_func( & clu );
+						return 20;/* Out of memory */
+					}
+				}
+				char unpacked = packer_inflate(body, body_len, raw, raw_len);
+				if ( unpacked ){
+					cleanup_func( & clu );
+					return 1 == unpacked ? 40 : 41;
+				}
+				if ( ! direct ){
+					put_state = target_put(target, 0, raw, raw_len);
+				}
+			}else{
+				put_state = target_put(target, 0, body, body_len);
+			}
+			if ( put_state ){
+				cleanup_func( & clu );
+				return put_state;
+			}
+			clu . data_out = NULL;
 			/* Now the malloced patch is under responsibility of the caller, we don't care about it */
 			/* Done decoding! */
 		}else{/* :: ENCODE This is encoder !*/
 			/* We need rsrce to take random data from OS */
-			struct rsrce rsrc;
 			if(rsrce_init(& rsrc )){
 				cleanup_func(& clu);
 				return 3; /* error opening random source */
 			}
 			clu . rsrc = & rsrc;/* Remembering for clean-up */
 
-			/* preparing length record */
-			if(len_in + SHA_DIGEST_LENGTH < len_in ){
-				cleanup_func(& clu);
-				return 10;
-			}
-			unsigned int data_and_sha1_length = len_in + SHA_DIGEST_LENGTH;
+			unsigned char * start; /* Ciphered message to embed */
+			unsigned int message_len_in_blocks;
+			size_t body_len;
+			/* Verified head, with the length record, goes apart */
+			char verified = 0 != (opts -> flags & STEGANOLAB_VERIFIED);
+			unsigned char verified_block[CIPHER_BLOCK_SIZE];
+			unsigned long long verified_len = 0;/* Message length for it */
+			if ( opts -> flags & STEGANOLAB_CHUNKED ){
+				size_t chunk_size = opts -> chunk_size ? opts -> chunk_size : CHUNK_DEFAULT_SIZE;
+				/* Message with format fields only */
+				unsigned char fields[1 + 2 * lencode_estimate()];
+				unsigned int fields_len = 0;
+				fields[fields_len++] = FORMAT_CHUNKED;
+				fields_len += lencode_produce(len_in, fields + fields_len);
+				fields_len += lencode_produce(chunk_size, fields + fields_len);
+				unsigned char head[lencode_estimate() + 1 + sizeof(fields) + SHA_DIGEST_LENGTH];
+				unsigned int head_len = 0;
+				if ( verified ){
+					verified_len = fields_len + SHA_DIGEST_LENGTH;
+				}else{
+					head_len = lencode_produce_extended(fields_len + SHA_DIGEST_LENGTH, head);
+				}
+				memcpy(head + head_len, fields, fields_len);
+				SHA1(fields, fields_len, head + head_len + fields_len);
+				head_len += fields_len + SHA_DIGEST_LENGTH;
+				/* Chunks after it */
+				unsigned long long head_rec = fit_to_blocks(head_len);
+				unsigned long long chunk_rec = fit_to_blocks(CHUNK_INDEX_SIZE + chunk_size + SHA_DIGEST_LENGTH);
+				unsigned long long nchunks = len_in / chunk_size;
+				unsigned long long total = head_rec + nchunks * chunk_rec;
+				if ( len_in % chunk_size ){
+					total += fit_to_blocks(CHUNK_INDEX_SIZE + len_in % chunk_size + SHA_DIGEST_LENGTH);
+					nchunks += 1;
+				}
+				if ( total > UINT_MAX / 8 ){
+					cleanup_func(& clu);
+					return 10;
+				}
+				unsigned char * message = arena_alloc(total);
+				if( NULL == message ){
+					cleanup_func(& clu);
+					return 20;/* Out of memory */
+				}
+				memset(message, 0, total);/* zeroes for padding */
+				memcpy(message, head, head_len);
+				cipher(message, head_rec, password, ENCRYPT);
+				unsigned long long k;
+				for ( k = 0; k < nchunks; k += 1 ){
+					unsigned char * rec = message + head_rec + k * chunk_rec;
+					size_t k_len = len_in - k * chunk_size;
+					if ( k_len > chunk_size ){
+						k_len = chunk_size;
+					}
+					uint8_t ib;
+					for ( ib = 0; ib < CHUNK_INDEX_SIZE; ib += 1 ){
+						rec[ib] = k >> 8 * ib & 0xff;
+					}
+					memcpy(rec + CHUNK_INDEX_SIZE, data_in + k * chunk_size, k_len);
+					SHA1(rec, CHUNK_INDEX_SIZE + k_len, rec + CHUNK_INDEX_SIZE + k_len);
+					cipher(rec, fit_to_blocks(CHUNK_INDEX_SIZE + k_len + SHA_DIGEST_LENGTH),
+						password, ENCRYPT);
+				}
+				start = message;
+				message_len_in_blocks = total / CIPHER_BLOCK_SIZE;
+				body_len = len_in;
+			}else{
+				/* Reserving space for the longest header before the body, so
+				 * that the body can be put to it's place right away */
+				unsigned int head_reserve = lencode_estimate() + 1 /* extended */
+					+ 1 /* format byte */ + lencode_estimate() /* fields */;
+				if ( (unsigned long long) head_reserve + len_in + SHA_DIGEST_LENGTH
+						+ CIPHER_BLOCK_SIZE > UINT_MAX ){
+					cleanup_func(& clu);
+					return 10;
+				}
+				unsigned char * message = arena_alloc(head_reserve + len_in +
+					SHA_DIGEST_LENGTH + CIPHER_BLOCK_SIZE);
+				if( NULL == message ){
+					cleanup_func(& clu);
+					return 20;/* Out of memory */
+				}
 
-			unsigned char len_rec[lencode_estimate()];
-			unsigned int len_rec_len = lencode_produce(data_and_sha1_length, len_rec);
-			/* calculating message digest */
-			unsigned char sha1[SHA_DIGEST_LENGTH];
-			SHA1(data_in,len_in,sha1);/* We have the whole in memory, so it's easy to calculate sha1 */
-			/* packing the whole message in buffer for ciphering */
-			unsigned int message_len = data_and_sha1_length + len_rec_len;
-			if ( message_len < data_and_sha1_length ){
-				/* overflow */
-				cleanup_func(& clu);
-				return 10;
-			}
-			unsigned int message_len_in_blocks = message_len / CIPHER_BLOCK_SIZE;
-			if(message_len % CIPHER_BLOCK_SIZE) message_len_in_blocks += 1;
-			if ( message_len_in_blocks * CIPHER_BLOCK_SIZE / CIPHER_BLOCK_SIZE != message_len_in_blocks){
-				/* overflow */
-				cleanup_func(& clu);
-				return 10;
+				/* Body: compressed data if asked and useful, data as is otherwise */
+				unsigned char * body = message + head_reserve;
+				body_len = len_in;
+				uint8_t format = 0;
+				if ( opts -> flags & STEGANOLAB_COMPRESS ){
+					if ( 0 == packer_deflate((const unsigned char *) data_in, len_in,
+							body, & body_len) ){
+						format |= FORMAT_DEFLATE;
+					}else{
+						body_len = len_in;/* Storing as is */
+					}
+				}
+				if ( ! (format & FORMAT_DEFLATE) ){
+					memcpy(body, data_in, len_in);
+				}
+
+				/* preparing header: length record and format byte with fields */
+				unsigned char head[head_reserve];
+				unsigned int head_len, len_rec_len;
+				if ( format || verified ){
+					unsigned char fields[1 + lencode_estimate()];
+					unsigned int fields_len = 0;
+					fields[fields_len++] = format;
+					if ( format & FORMAT_DEFLATE ){
+						fields_len += lencode_produce(len_in, fields + fields_len);
+					}
+					if ( verified ){
+						len_rec_len = 0;
+						verified_len = fields_len + body_len + SHA_DIGEST_LENGTH;
+					}else{
+						len_rec_len = lencode_produce_extended(fields_len + body_len +
+							SHA_DIGEST_LENGTH, head);
+					}
+					memcpy(head + len_rec_len, fields, fields_len);
+					head_len = len_rec_len + fields_len;
+				}else{
+					len_rec_len = lencode_produce(body_len + SHA_DIGEST_LENGTH, head);
+					head_len = len_rec_len;
+				}
+				start = body - head_len;
+				memcpy(start, head, head_len);
+				/* calculating message digest over everything after length record */
+				SHA1(start + len_rec_len, head_len - len_rec_len + body_len,
+					body + body_len);/* We have the whole in memory, so it's easy to calculate sha1 */
+
+				unsigned int message_len = head_len + body_len + SHA_DIGEST_LENGTH;
+				message_len_in_blocks = message_len / CIPHER_BLOCK_SIZE;
+				if(message_len % CIPHER_BLOCK_SIZE){
+					message_len_in_blocks += 1;
+					/* memsetting the padding so that some data don't
+					 * escape from us */
+					memset(start + message_len, 0,
+						message_len_in_blocks * CIPHER_BLOCK_SIZE - message_len);
+				}
+				/* ciphering the message */
+				cipher(start, message_len_in_blocks*CIPHER_BLOCK_SIZE, password, ENCRYPT);
 			}
-			unsigned char * message = malloc(message_len_in_blocks * CIPHER_BLOCK_SIZE);
-			if( NULL == message ){
-				cleanup_func(& clu);
-				return 20;/* Out of memory */
+			unsigned int head_bits = 0;
+			if ( verified ){
+				int head_status = verified_head(verified_block, verified_len, password);
+				if ( head_status ){
+					cleanup_func(& clu);
+					return head_status;
+				}
+				cipher(verified_block, CIPHER_BLOCK_SIZE, password, ENCRYPT);
+				head_bits = VERIFIED_HEAD_BITS;
 			}
-			clu . message = message;/* remembering for clean-up */
-			if (message_len % CIPHER_BLOCK_SIZE )memset(message +
-				message_len_in_blocks * CIPHER_BLOCK_SIZE - CIPHER_BLOCK_SIZE,
-				0, CIPHER_BLOCK_SIZE);/* memsetting the last block so that some
-				data don't escape from us in case trere is padding */
-
-			size_t mpos = 0; /* To hold next free byte in message */
-			memcpy(message + mpos, len_rec, len_rec_len);
-			mpos += len_rec_len;
-			memcpy(message + mpos, data_in, len_in);
-			mpos += len_in;
-			memcpy(message + mpos, sha1, SHA_DIGEST_LENGTH);/* OK copying */
-			/* ciphering the message */
-			cipher(message, message_len_in_blocks*CIPHER_BLOCK_SIZE, password, ENCRYPT);
 			/* embeding the message according to shuffle table */
 
 			/* Now we can check if we have enough space */
@@ -787,34 +2582,125 @@ static int steganolab_worker(SLFILE * infile, SLFILE * outfile,
 				return 10;
 			}
 
-			if(all_available < message_len_in_blocks * CIPHER_BLOCK_SIZE * 8){
+			if( (unsigned long long) all_available < (unsigned long long)
+					message_len_in_blocks * CIPHER_BLOCK_SIZE * 8 + head_bits ){
 				cleanup_func( & clu );
 				return 10;
 			}
 			unsigned int bits_out = message_len_in_blocks * CIPHER_BLOCK_SIZE * 8; /* Due to previous check, here we'll not get an owerflow */
 
 			/* For statistics */
-			bits_used = bits_out;
-
+			bits_used = bits_out + head_bits;
+			payload_bits = (unsigned long long) len_in * 8;
+			packed_bits = body_len * 8;
+
+			uint8_t per_block = usable_DCT(DCT_radius);
+			unsigned int first_row = 0, head_rows = 0, body_rows = 0;
+			if ( opts -> flags & STEGANOLAB_REGION ){
+				if ( region_first(cinfo, password, &first_row) ){
+					cleanup_func(& clu);
+					return 20;/* Out of memory */
+				}
+				head_rows = region_rows(cinfo, cci, first_row,
+					REGION_FACTOR * REGION_HEAD_SIZE * 8, per_block);
+				if ( head_rows ){
+					body_rows = region_rows(cinfo, cci, first_row + head_rows,
+						(unsigned long long) REGION_FACTOR * (bits_out + head_bits), per_block);
+				}
+			}
+			struct embed_plan plan, * planp = NULL;/* For TurboJPEG */
+			if ( turbo ){
+				if ( plan_init(&plan, bits_out + head_bits + REGION_HEAD_SIZE * 8, &work,
+						cci, color_channels, &rsrc) ){
+					cleanup_func(& clu);
+					return 20;/* Out of memory */
+				}
+				planp = & plan;
+			}
+			if ( body_rows ){
+				/* Head in it's rows */
+				unsigned char head[REGION_HEAD_SIZE];
+				if ( region_head(head, body_rows, password) ){
+					cleanup_func(& clu);
+					return 20;/* Out of memory */
+				}
+				cipher(head, REGION_HEAD_SIZE, password, ENCRYPT);
+				region_band(&band, cinfo, cci, first_row, head_rows);
+				unsigned int head_bits;
+				char fail = enumerator_get_number_of_positions(&band, &head_bits);
+				assert(!fail);
+				shuffle = make_shuffle(&rge, head_bits, &work);
+				if( NULL == shuffle ){
+					cleanup_func(& clu);
+					return 20;/* Out of memory */
+				}
+				embed_bits(cinfo, &work, color_component_block_arrays, &band,
+					shuffle, head, REGION_HEAD_SIZE * 8, &rsrc, planp);
+				/* Message in the rows after */
+				enumerator_free(&band);
+				enumerator_init(&band, DCT_radius);
+				region_band(&band, cinfo, cci, first_row + head_rows, body_rows);
+				fail = enumerator_get_number_of_positions(&band, &space_bits);
+				assert(!fail);
+				space = & band;
+			}else if( opts -> flags & STEGANOLAB_REGION ){
+				/* The image is too small for a region: the message is
+				 * spread over it, as usual */
+			}
+			/* generating a random shuffle to know which bit is in which position */
+			shuffle = make_shuffle(&rge, space_bits, &work);
+			if( NULL == shuffle ){
+				cleanup_func(& clu);
+				return 20;/* Out of memory */
+			}
 			/* we have enough space, because there is a check above */
-			unsigned int bit_idx;
-			for ( bit_idx = 0; bit_idx < bits_out; bit_idx += 1 ){
-				struct position p;
-				char get_pos_fail = enumerator_get_position_by_index(& enu, shuffle[bit_idx] - 1, & p);
-				assert(!get_pos_fail);
-
-				JBLOCKARRAY B = (cinfo.mem -> access_virt_barray)((j_common_ptr) &cinfo,
-							color_component_block_arrays[p.array_id],
-							p.m, 1/*1 row, not more */, TRUE /* We are writing to the buffer */);
-				JCOEFPTR dctblck = B[0][p.n];
-				embed_bit( & dctblck[p.i * DCTSIZE + p.j],
-					message[bit_idx/8] & 1 << bit_idx % 8,
-					&rsrc );
-			}/* Done embeding */
-			int write_status = write_jpeg_by_other(outfile, &cinfo, color_component_block_arrays);
+			embed_bits(cinfo, &work, color_component_block_arrays, space,
+				shuffle, start, bits_out, &rsrc, planp);
+			if ( head_bits ){
+				unsigned int top[VERIFIED_HEAD_BITS];
+				char fail = verified_positions(shuffle, space_bits, password, top);
+				assert(!fail);
+				embed_bits(cinfo, &work, color_component_block_arrays, space,
+					top, verified_block, head_bits, &rsrc, planp);
+			}
+			int write_status;
+			if ( turbo ){
+				/* Bits go to rows, as TurboJPEG shows them, and it writes
+				 * the image */
+				if ( plan_sort(&plan, block_rows) ){
+					cleanup_func(& clu);
+					return 20;/* Out of memory */
+				}
+				unsigned char * out;
+				size_t out_len;
+				write_status = tjback_visit(in_data, in_len, plan_visit, &plan, &out, &out_len);
+				work.modified += plan.modified;
+				if ( 0 == write_status ){
+					write_status = put_jpeg(dst, out, out_len);
+				}
+			}else{
+				/* Done embeding */
+				unsigned char * out;
+				size_t out_len;
+				char spliced = 1;
+				if ( NULL != work.changed[0] ){
+					spliced = pencode_splice(cinfo, color_component_block_arrays,
+						in_data, in_len, scan_offset, work.changed, threads,
+						watch.active ? watch_pool_write : NULL, & watch, &out, &out_len);
+				}
+				if ( 0 == spliced ){
+					write_status = put_jpeg(dst, out, out_len);
+				}else if ( 2 == spliced ){
+					write_status = 30;/* Stopped by the watch */
+				}else{
+					write_status = write_jpeg_by_other(dst, cinfo, color_component_block_arrays,
+						opts -> flags & STEGANOLAB_RESTART_PARALLEL ? threads : 1);
+				}
+			}
 			if(write_status){
 				cleanup_func( & clu );
-				return 30;
+				/* Writing may have been stopped by the watch */
+				return 0 != watch.status ? watch.status : 30;
 			}
 			/* OK! */
 		}
@@ -830,7 +2716,7 @@ static int steganolab_worker(SLFILE * infile, SLFILE * outfile,
 		stats -> bits_in_block = usable_DCT(DCT_radius);
 		const char * cs;
 		const char * undef = "Unknown colorspace";
-		switch(cinfo.jpeg_color_space){
+		switch(cinfo -> jpeg_color_space){
 			case JCS_RGB:
 				cs = "RGB";
 			break;
@@ -848,6 +2734,16 @@ static int steganolab_worker(SLFILE * infile, SLFILE * outfile,
 		}
 		stats -> colorspace = cs;
 		stats -> bits_used = bits_used;
+		stats -> payload_bits = payload_bits;
+		stats -> packed_bits = packed_bits;
+		stats -> coefficients_modified = work.modified;
+		stats -> rows_touched = work.rows;
+		stats -> barray_accesses = work.accesses;
+		stats -> rgen_bytes = NULL != clu . rge ? rge . bytes_out : 0;
+		stats -> rgen_retries = NULL != clu . rge ? rge . retries : 0;
+		stats -> rsrce_bytes = NULL != clu . rsrc ? rsrc . bytes_read : 0;
+		stats -> cipher_bytes = cipher_bytes_reset();
+		stats -> peak_memory = arena_peak_reset();
 		/* Now component info: we have cci array allready allocated and filled
 		 * with proper data. This array is, however, remembered in clu
 		 * structure: it's going to be freed. Let's take it out of there
@@ -875,29 +2771,423 @@ const char * steganolab_describe(int code){
 			return "Out of memory";
 		case 30:
 			return "Error writing file copy";
+		case 31:
+			return "Can't read carrier file";
+		case 32:
+			return "Can't write output file";
+		case 33:
+			return "Can't read carrier directory";
+		case 34:
+			return "Bad carrier index file";
 		case 40:
 			return "Only garbage found";
+		case 41:
+			return "Message format not supported by this build";
+		case 42:
+			return "Stopped by caller";
+		case STEGANOLAB_NEED_MORE:
+			return "Decoder needs more data";
+		case 44:
+			return "Time is over";
+		case 45:
+			return "Cancelled";
+		case 46:
+			return "Carrier exceeds resource limits";
 	}
 	return "Unknown error";
 }
 
 
 
+void steganolab_options_init(struct steganolab_options * opts){
+	opts -> flags = 0;
+	opts -> chunk_size = 0;
+	opts -> threads = 0;
+	opts -> cache_dir = NULL;
+	opts -> progress = NULL;
+	opts -> progress_user = NULL;
+	opts -> timeout_ms = 0;
+	opts -> cancel = NULL;
+	opts -> shuffle_dir = NULL;
+	opts -> max_pixels = 0;
+	opts -> max_components = 0;
+	opts -> max_memory = 0;
+	opts -> heavy_memory = 0;
+}
+
+void steganolab_shuffle_cache_limit(size_t bytes){
+	pcache_limit(bytes);
+}
+
+void steganolab_heavy_jobs(unsigned int n){
+	admit_limit(n);
+}
+
+/**
+ * Makes jpeg_io object for stdio stream
+ */
+static struct jpeg_io io_file(SLFILE * file){
+	struct jpeg_io io = { file, NULL, 0, NULL, NULL, -1, 0, 0, NULL, NULL, 0 };
+	return io;
+}
+
+/**
+ * Makes jpeg_io object for memory
+ */
+static struct jpeg_io io_mem(const char * in, size_t in_len, char ** out, size_t * out_len){
+	struct jpeg_io io = { NULL, (const unsigned char *) in, in_len,
+		(unsigned char **) out, out_len, -1, 0, 0, NULL, NULL, 0 };
+	return io;
+}
+
 int steganolab_encode(SLFILE * infile, SLFILE * outfile, const char * data,
 		unsigned int len, const char * password, uint8_t DCT_radius,
 		struct steganolab_statistics * stats){
-	return steganolab_worker(infile, outfile, data, (unsigned int)len, NULL, NULL, ENCODE, password, DCT_radius, stats);
+	struct jpeg_io src = io_file(infile), dst = io_file(outfile);
+	return steganolab_worker(&src, &dst, data, (unsigned int)len, NULL, ENCODE, password, DCT_radius, NULL, stats);
+}
+
+int steganolab_encode_opt(SLFILE * infile, SLFILE * outfile,
+		const char * data, unsigned int len, const char * password,
+		uint8_t DCT_radius, const struct steganolab_options * opts,
+		struct steganolab_statistics * stats){
+	struct jpeg_io src = io_file(infile), dst = io_file(outfile);
+	return steganolab_worker(&src, &dst, data, len, NULL, ENCODE, password, DCT_radius, opts, stats);
+}
+
+/**
+ * Embeds message to a file, writing output through a temporary file
+ * @param splice - output may keep entropy coded data of the input
+ * Other parameters are as for steganolab_encode_file
+ */
+static int encode_path(const char * inpath, const char * outpath,
+		const char * data, unsigned int len, const char * password,
+		uint8_t DCT_radius, const struct steganolab_options * opts,
+		struct steganolab_statistics * stats, char splice){
+	SLFILE * infile = fopen(inpath, "r");
+	if ( NULL == infile ){
+		return 31;
+	}
+	struct stat st;
+	size_t size_hint = 0;
+	if ( 0 == fstat(fileno(infile), &st) && S_ISREG(st.st_mode) ){
+		/* Output is made of the same coefficients, so it is about as
+		 * big as input */
+		size_hint = (size_t) st.st_size;
+	}
+	struct jio_publish out;
+	if ( jio_publish_open(&out, outpath, size_hint) ){
+		fclose(infile);
+		return 32;
+	}
+	struct jpeg_io src = io_file(infile);
+	struct jpeg_io dst = io_mem(NULL, 0, NULL, NULL);
+	dst.fd = out.fd;
+	dst.splice = splice;
+	dst.size_hint = size_hint;
+	int rv = steganolab_worker(&src, &dst, data, len, NULL, ENCODE, password, DCT_radius, opts, stats);
+	fclose(infile);
+	if ( rv ){
+		/* Nobody sees the partial output */
+		jio_publish_abort(&out);
+		return rv;
+	}
+	if ( jio_publish_commit(&out, dst.written) ){
+		if ( NULL != stats ){
+			steganolab_free_statistics(stats);
+		}
+		return 32;
+	}
+	return 0;
+}
+
+int steganolab_encode_file(const char * inpath, const char * outpath,
+		const char * data, unsigned int len, const char * password,
+		uint8_t DCT_radius, const struct steganolab_options * opts,
+		struct steganolab_statistics * stats){
+	return encode_path(inpath, outpath, data, len, password, DCT_radius, opts, stats, 0);
+}
+
+int steganolab_update_file(const char * path,
+		const char * data, unsigned int len, const char * password,
+		uint8_t DCT_radius, const struct steganolab_options * opts,
+		struct steganolab_statistics * stats){
+	return encode_path(path, path, data, len, password, DCT_radius, opts, stats, 1);
+}
+
+int steganolab_update_mem(const char * jpeg, size_t jpeg_len,
+		char ** out, size_t * out_len, const char * data, unsigned int len,
+		const char * password, uint8_t DCT_radius,
+		const struct steganolab_options * opts,
+		struct steganolab_statistics * stats){
+	struct jpeg_io src = io_mem(jpeg, jpeg_len, NULL, NULL);
+	struct jpeg_io dst = io_mem(NULL, 0, out, out_len);
+	dst.size_hint = jpeg_len;
+	dst.splice = 1;
+	return steganolab_worker(&src, &dst, data, len, NULL, ENCODE, password, DCT_radius, opts, stats);
+}
+
+int steganolab_encode_mem(const char * jpeg, size_t jpeg_len,
+		char ** out, size_t * out_len, const char * data, unsigned int len,
+		const char * password, uint8_t DCT_radius,
+		const struct steganolab_options * opts,
+		struct steganolab_statistics * stats){
+	struct jpeg_io src = io_mem(jpeg, jpeg_len, NULL, NULL);
+	struct jpeg_io dst = io_mem(NULL, 0, out, out_len);
+	dst.size_hint = jpeg_len;/* Output is about as big */
+	return steganolab_worker(&src, &dst, data, len, NULL, ENCODE, password, DCT_radius, opts, stats);
 }
 
 int steganolab_decode(SLFILE * file, char ** data,
 		unsigned int * len, const char * password, uint8_t DCT_radius,
 		struct steganolab_statistics * stats){
-	return steganolab_worker(file, NULL, NULL, 0, data, len, DECODE, password, DCT_radius, stats);
+	struct jpeg_io src = io_file(file);
+	struct decode_target target = { data, len, NULL, NULL, 0, UINT_MAX };
+	return steganolab_worker(&src, NULL, NULL, 0, &target, DECODE, password, DCT_radius, NULL, stats);
+}
+
+int steganolab_decode_mem(const char * jpeg, size_t jpeg_len, char ** data,
+		unsigned int * len, const char * password, uint8_t DCT_radius,
+		struct steganolab_statistics * stats){
+	struct jpeg_io src = io_mem(jpeg, jpeg_len, NULL, NULL);
+	struct decode_target target = { data, len, NULL, NULL, 0, UINT_MAX };
+	return steganolab_worker(&src, NULL, NULL, 0, &target, DECODE, password, DCT_radius, NULL, stats);
+}
+
+int steganolab_decode_opt(SLFILE * file, char ** data,
+		unsigned int * len, const char * password, uint8_t DCT_radius,
+		const struct steganolab_options * opts,
+		struct steganolab_statistics * stats){
+	struct jpeg_io src = io_file(file);
+	struct decode_target target = { data, len, NULL, NULL, 0, UINT_MAX };
+	return steganolab_worker(&src, NULL, NULL, 0, &target, DECODE, password, DCT_radius, opts, stats);
+}
+
+int steganolab_decode_mem_opt(const char * jpeg, size_t jpeg_len, char ** data,
+		unsigned int * len, const char * password, uint8_t DCT_radius,
+		const struct steganolab_options * opts,
+		struct steganolab_statistics * stats){
+	struct jpeg_io src = io_mem(jpeg, jpeg_len, NULL, NULL);
+	struct decode_target target = { data, len, NULL, NULL, 0, UINT_MAX };
+	return steganolab_worker(&src, NULL, NULL, 0, &target, DECODE, password, DCT_radius, opts, stats);
+}
+
+int steganolab_decode_stream(SLFILE * file, steganolab_sink sink, void * user,
+		const char * password, uint8_t DCT_radius,
+		struct steganolab_statistics * stats){
+	struct jpeg_io src = io_file(file);
+	struct decode_target target = { NULL, NULL, sink, user, 0, UINT_MAX };
+	return steganolab_worker(&src, NULL, NULL, 0, &target, DECODE, password, DCT_radius, NULL, stats);
+}
+
+int steganolab_decode_mem_stream(const char * jpeg, size_t jpeg_len,
+		steganolab_sink sink, void * user, const char * password,
+		uint8_t DCT_radius, const struct steganolab_options * opts,
+		struct steganolab_statistics * stats){
+	struct jpeg_io src = io_mem(jpeg, jpeg_len, NULL, NULL);
+	struct decode_target target = { NULL, NULL, sink, user, 0, UINT_MAX };
+	return steganolab_worker(&src, NULL, NULL, 0, &target, DECODE, password, DCT_radius, opts, stats);
+}
+
+int steganolab_decode_range(SLFILE * file, unsigned int from, unsigned int to,
+		char ** data, unsigned int * len, const char * password,
+		uint8_t DCT_radius, struct steganolab_statistics * stats){
+	struct jpeg_io src = io_file(file);
+	struct decode_target target = { data, len, NULL, NULL, from, to };
+	return steganolab_worker(&src, NULL, NULL, 0, &target, DECODE, password, DCT_radius, NULL, stats);
+}
+
+/**
+ * Push decoder state
+ */
+struct steganolab_decoder {
+	struct jpeg_decompress_struct cinfo;
+	struct my_error_mgr jerr;
+	struct jio_push push;
+	char header_read;
+	int status;				/* STEGANOLAB_NEED_MORE until done or failed */
+	char * password;		/* Copy */
+	uint8_t DCT_radius;
+	struct decode_target target;
+	char * data;			/* Message, if there is no sink */
+	unsigned int len;
+	struct steganolab_statistics * stats;
+};
+
+int steganolab_decoder_new(const char * password, uint8_t DCT_radius,
+		steganolab_sink sink, void * user, struct steganolab_statistics * stats,
+		struct steganolab_decoder ** decoder){
+	struct steganolab_decoder * dec = malloc(sizeof(struct steganolab_decoder));
+	if ( NULL == dec ){
+		return 20;
+	}
+	dec -> password = strdup(password);
+	if ( NULL == dec -> password ){
+		free(dec);
+		return 20;
+	}
+	/* Outside of a job frame, jpeg library memory comes from malloc and
+	 * lives across the calls */
+	dec -> cinfo.err = jpeg_std_error(& dec -> jerr.pub);
+	dec -> jerr.pub.error_exit = my_error_exit;
+	if ( setjmp(dec -> jerr.setjmp_buffer) ){
+		free(dec -> password);
+		free(dec);
+		return 20;/* Failed to allocate jpeg object */
+	}
+	jpeg_create_decompress(& dec -> cinfo);
+	jio_push_attach(& dec -> cinfo, & dec -> push);
+	dec -> header_read = 0;
+	dec -> status = STEGANOLAB_NEED_MORE;
+	dec -> DCT_radius = DCT_radius;
+	dec -> data = NULL;
+	dec -> len = 0;
+	dec -> stats = stats;
+	struct decode_target target = { NULL, NULL, sink, user, 0, UINT_MAX };
+	if ( NULL == sink ){
+		target . data = & dec -> data;
+		target . len = & dec -> len;
+	}
+	dec -> target = target;
+	*decoder = dec;
+	return 0;
+}
+
+/**
+ * Reads what has come: header, then coefficients, then, if the image is
+ * complete, the message
+ * @return new decoder status
+ */
+static int decoder_advance(struct steganolab_decoder * dec){
+	if ( setjmp(dec -> jerr.setjmp_buffer) ){
+		dec -> status = 2;
+		jio_push_free(& dec -> push);
+		return 2;
+	}
+	if ( ! dec -> header_read ){
+		if ( JPEG_SUSPENDED == jpeg_read_header(& dec -> cinfo, TRUE) ){
+			return STEGANOLAB_NEED_MORE;
+		}
+		dec -> header_read = 1;
+	}
+	jvirt_barray_ptr * arrays = jpeg_read_coefficients(& dec -> cinfo);
+	if ( NULL == arrays ){
+		return STEGANOLAB_NEED_MORE;/* Suspended */
+	}
+	struct jpeg_io src = io_file(NULL);
+	src . ready = & dec -> cinfo;
+	src . ready_arrays = arrays;
+	dec -> status = steganolab_worker(&src, NULL, NULL, 0, & dec -> target,
+		DECODE, dec -> password, dec -> DCT_radius, NULL, dec -> stats);
+	/* Worker has destroyed decompressor and it's error manager is gone */
+	dec -> cinfo.err = & dec -> jerr.pub;
+	jio_push_free(& dec -> push);
+	return dec -> status;
+}
+
+int steganolab_decoder_feed(struct steganolab_decoder * decoder,
+		const char * bytes, size_t len){
+	if ( STEGANOLAB_NEED_MORE != decoder -> status ){
+		return decoder -> status;
+	}
+	if ( jio_push_add(& decoder -> push, bytes, len) ){
+		decoder -> status = 20;/* Out of memory, the piece is lost */
+		return 20;
+	}
+	return decoder_advance(decoder);
+}
+
+int steganolab_decoder_end(struct steganolab_decoder * decoder){
+	if ( STEGANOLAB_NEED_MORE != decoder -> status ){
+		return decoder -> status;
+	}
+	jio_push_end(& decoder -> push);
+	return decoder_advance(decoder);
+}
+
+int steganolab_decoder_result(struct steganolab_decoder * decoder,
+		char ** data, unsigned int * len){
+	if ( 0 != decoder -> status ){
+		return decoder -> status;
+	}
+	*data = decoder -> data;
+	*len = decoder -> len;
+	decoder -> data = NULL;
+	decoder -> len = 0;
+	return 0;
+}
+
+void steganolab_decoder_free(struct steganolab_decoder * decoder){
+	jpeg_destroy_decompress(& decoder -> cinfo);
+	jio_push_free(& decoder -> push);
+	free(decoder -> data);
+	free(decoder -> password);
+	free(decoder);
 }
 
 int steganolab_estimate(SLFILE * file, uint8_t DCT_radius, struct
 		steganolab_statistics * stats){
-	return steganolab_worker(file, NULL, NULL, 0, NULL, NULL, ESTIMATE, NULL, DCT_radius, stats);
+	struct jpeg_io src = io_file(file);
+	return steganolab_worker(&src, NULL, NULL, 0, NULL, ESTIMATE, NULL, DCT_radius, NULL, stats);
+}
+
+int steganolab_estimate_mem(const char * jpeg, size_t jpeg_len,
+		uint8_t DCT_radius, struct steganolab_statistics * stats){
+	struct jpeg_io src = io_mem(jpeg, jpeg_len, NULL, NULL);
+	return steganolab_worker(&src, NULL, NULL, 0, NULL, ESTIMATE, NULL, DCT_radius, NULL, stats);
+}
+
+uint8_t steganolab_bits_in_block(uint8_t DCT_radius){
+	return usable_DCT(DCT_radius);
+}
+
+unsigned long long steganolab_message_bits(unsigned int len){
+	unsigned char rec[lencode_estimate()];
+	unsigned long long body = (unsigned long long) len + SHA_DIGEST_LENGTH;
+	/* Length record, message and SHA1, padded to cipher blocks */
+	return fit_to_blocks(lencode_produce(body, rec) + body) * 8;
+}
+
+unsigned int steganolab_message_capacity(unsigned long long bits){
+	/* Message bits grow with length: searching for the last length,
+	 * that fits */
+	unsigned long long lo = 0, hi = bits / 8;
+	if ( hi > UINT_MAX ){
+		hi = UINT_MAX;
+	}
+	if ( steganolab_message_bits(0) > bits ){
+		return 0;
+	}
+	while ( lo < hi ){
+		unsigned long long mid = lo + (hi - lo + 1) / 2;
+		if ( steganolab_message_bits((unsigned int) mid) <= bits ){
+			lo = mid;
+		}else{
+			hi = mid - 1;
+		}
+	}
+	return (unsigned int) lo;
+}
+
+size_t steganolab_workspace_size(const struct steganolab_statistics * stats,
+		unsigned int len){
+	return predict_memory(stats -> info, stats -> color_channels,
+		stats -> bits_available, len);
+}
+
+int steganolab_reserve_workspace(size_t bytes, unsigned int flags){
+	unsigned int arena_flags = 0;
+	if ( flags & STEGANOLAB_HUGEPAGES ){
+		arena_flags |= ARENA_HUGEPAGES;
+	}
+	if ( arena_reserve(bytes, arena_flags) ){
+		return 20;/* Out of memory */
+	}
+	return 0;
+}
+
+void steganolab_release_workspace(){
+	arena_release();
 }
 
 /**
@@ -957,9 +3247,21 @@ void steganolab_print_statistics(struct steganolab_statistics * stats, FILE * de
 		}else{
 			fprintf(dest, "%e%%\n", usage);
 		}
+		fprintf(dest, "Message bits: %llu, stored as %u bits%s\n", stats -> payload_bits,
+			stats -> packed_bits, stats -> payload_bits != stats -> packed_bits ?
+			" after compression" : "");
+		fprintf(dest, "Coefficients changed: %llu\n", stats -> coefficients_modified);
 	}else{
 		fprintf(dest, "Statistics produced by estimation\n");
 	}
+	fprintf(dest, "Work done:\n");
+	fprintf(dest, "\tBlock rows touched: %u, row requests: %llu\n", stats -> rows_touched,
+		stats -> barray_accesses);
+	fprintf(dest, "\tPseudorandom bytes: %llu, rejected values: %llu\n", stats -> rgen_bytes,
+		stats -> rgen_retries);
+	fprintf(dest, "\tRandom source bytes: %llu\n", stats -> rsrce_bytes);
+	fprintf(dest, "\tBytes ciphered: %llu\n", stats -> cipher_bytes);
+	fprintf(dest, "\tPeak job memory: %zu bytes\n", stats -> peak_memory);
 	fprintf(dest, "End of statistics.\n");
 }
 
@@ -0,0 +1,256 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "steganolab.hpp"
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+namespace steganolab {
+
+Buffer::Buffer(Buffer && other) noexcept
+	: data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+
+Buffer & Buffer::operator = (Buffer && other) noexcept {
+	if ( this != & other ){
+		std::free(data_);
+		data_ = std::exchange(other.data_, nullptr);
+		size_ = std::exchange(other.size_, 0);
+	}
+	return * this;
+}
+
+Buffer::~Buffer(){
+	std::free(data_);
+}
+
+Statistics::Statistics(){
+	std::memset(& s_, 0, sizeof(s_));
+}
+
+Statistics::Statistics(Statistics && other) noexcept
+	: s_(other.s_), filled_(std::exchange(other.filled_, false)) {}
+
+Statistics & Statistics::operator = (Statistics && other) noexcept {
+	if ( this != & other ){
+		if ( filled_ ){
+			steganolab_free_statistics(& s_);
+		}
+		s_ = other.s_;
+		filled_ = std::exchange(other.filled_, false);
+	}
+	return * this;
+}
+
+Statistics::~Statistics(){
+	if ( filled_ ){
+		steganolab_free_statistics(& s_);
+	}
+}
+
+std::span<const color_channel_info> Statistics::channels() const {
+	if ( ! filled_ || nullptr == s_.info ){
+		return {};
+	}
+	return { s_.info, s_.color_channels };
+}
+
+void Statistics::adopt(const steganolab_statistics & s){
+	if ( filled_ ){
+		steganolab_free_statistics(& s_);
+	}
+	s_ = s;
+	filled_ = true;
+}
+
+Carrier Carrier::view(std::span<const std::byte> jpeg){
+	Carrier c(std::pmr::get_default_resource());
+	c.view_ = jpeg;
+	return c;
+}
+
+Result<Carrier> Carrier::load(const char * path, std::pmr::memory_resource * mr){
+	/* Closed however load ends: the resource may throw on any allocation */
+	std::unique_ptr<FILE, int (*)(FILE *)> file(std::fopen(path, "rb"), & std::fclose);
+	FILE * f = file.get();
+	if ( nullptr == f ){
+		return Error(31);
+	}
+	Carrier c(mr);
+	c.owns_ = true;
+	if ( 0 == std::fseek(f, 0, SEEK_END) ){
+		long size = std::ftell(f);
+		if ( size > 0 ){
+			c.owned_.reserve(size);
+		}
+		std::rewind(f);
+	}
+	std::byte buf[64 * 1024];
+	std::size_t got;
+	while ( ( got = std::fread(buf, 1, sizeof(buf), f) ) > 0 ){
+		c.owned_.insert(c.owned_.end(), buf, buf + got);
+	}
+	bool fail = std::ferror(f);
+	file.reset();
+	if ( fail ){
+		return Error(31);
+	}
+	return c;
+}
+
+Session::Session(Key key, std::pmr::memory_resource * mr)
+	: key_(std::move(key)), mr_(mr) {
+	steganolab_options_init(& opts_);
+}
+
+Result<Buffer> Session::encode(const Carrier & carrier,
+		std::span<const std::byte> message, Statistics * stats) const {
+	if ( message.size() > UINT_MAX ){
+		return Error(10);
+	}
+	auto jpeg = carrier.bytes();
+	char * out = nullptr;
+	std::size_t out_len = 0;
+	steganolab_statistics s;
+	int rv = steganolab_encode_mem(reinterpret_cast<const char *>(jpeg.data()),
+		jpeg.size(), & out, & out_len, reinterpret_cast<const char *>(message.data()),
+		static_cast<unsigned int>(message.size()), key_.password(),
+		key_.DCT_radius(), & opts_, nullptr != stats ? & s : nullptr);
+	if ( rv ){
+		return Error(rv);
+	}
+	if ( nullptr != stats ){
+		stats -> adopt(s);
+	}
+	return Buffer(out, out_len);
+}
+
+Result<Buffer> Session::decode(const Carrier & carrier, Statistics * stats) const {
+	auto jpeg = carrier.bytes();
+	char * data = nullptr;
+	unsigned int len = 0;
+	steganolab_statistics s;
+	int rv = steganolab_decode_mem_opt(reinterpret_cast<const char *>(jpeg.data()),
+		jpeg.size(), & data, & len, key_.password(), key_.DCT_radius(),
+		& opts_, nullptr != stats ? & s : nullptr);
+	if ( rv ){
+		return Error(rv);
+	}
+	if ( nullptr != stats ){
+		stats -> adopt(s);
+	}
+	return Buffer(data, len);
+}
+
+namespace {
+
+/**
+ * Caller's memory, that pieces of message are put to
+ */
+struct span_sink {
+	std::span<std::byte> out;
+	std::size_t len;
+	bool overflow;
+};
+
+int put_to_span(void * user, const char * data, unsigned int len){
+	span_sink * t = static_cast<span_sink *>(user);
+	if ( t -> out.size() - t -> len < len ){
+		t -> overflow = true;
+		return 1;
+	}
+	std::memcpy(t -> out.data() + t -> len, data, len);
+	t -> len += len;
+	return 0;
+}
+
+/**
+ * Vector, that pieces of message are appended to
+ */
+struct vector_sink {
+	std::pmr::vector<std::byte> * out;
+	bool failed;
+};
+
+int put_to_vector(void * user, const char * data, unsigned int len){
+	vector_sink * t = static_cast<vector_sink *>(user);
+	const std::byte * b = reinterpret_cast<const std::byte *>(data);
+	/* Exceptions must not go through C frames */
+	try {
+		t -> out -> insert(t -> out -> end(), b, b + len);
+	} catch ( ... ){
+		t -> failed = true;
+		return 1;
+	}
+	return 0;
+}
+
+}
+
+Result<std::size_t> Session::decode_into(const Carrier & carrier,
+		std::span<std::byte> out, Statistics * stats) const {
+	auto jpeg = carrier.bytes();
+	span_sink target = { out, 0, false };
+	steganolab_statistics s;
+	int rv = steganolab_decode_mem_stream(reinterpret_cast<const char *>(jpeg.data()),
+		jpeg.size(), put_to_span, & target, key_.password(), key_.DCT_radius(),
+		& opts_, nullptr != stats ? & s : nullptr);
+	if ( rv ){
+		return Error(target.overflow ? 10 : rv);
+	}
+	if ( nullptr != stats ){
+		stats -> adopt(s);
+	}
+	return std::size_t(target.len);
+}
+
+Result<std::pmr::vector<std::byte>> Session::decode_vector(const Carrier & carrier,
+		Statistics * stats) const {
+	auto jpeg = carrier.bytes();
+	std::pmr::vector<std::byte> v(mr_);
+	vector_sink target = { & v, false };
+	steganolab_statistics s;
+	int rv = steganolab_decode_mem_stream(reinterpret_cast<const char *>(jpeg.data()),
+		jpeg.size(), put_to_vector, & target, key_.password(), key_.DCT_radius(),
+		& opts_, nullptr != stats ? & s : nullptr);
+	if ( rv ){
+		return Error(target.failed ? 20 : rv);
+	}
+	if ( nullptr != stats ){
+		stats -> adopt(s);
+	}
+	return v;
+}
+
+Result<Statistics> Session::estimate(const Carrier & carrier) const {
+	auto jpeg = carrier.bytes();
+	steganolab_statistics s;
+	int rv = steganolab_estimate_mem(reinterpret_cast<const char *>(jpeg.data()),
+		jpeg.size(), key_.DCT_radius(), & s);
+	if ( rv ){
+		return Error(rv);
+	}
+	Statistics stats;
+	stats.adopt(s);
+	return stats;
+}
+
+}
@@ -25,6 +25,9 @@
 /**
  * This module contains end-user steganographic functions
  */
+#ifdef __cplusplus
+extern "C" {
+#endif
 /* JPEG library is designed so that it's possible to redefine stdio 
  * functions. Steganolab functions pass stream objects directly to 
  * the underlying calls. If you hack jpeg library to use your custom 
@@ -61,8 +64,136 @@ struct steganolab_statistics {
 	uint8_t bits_in_block;				/* Quite static, function of DCT_radius */
 	const char * colorspace;			/* Colorspace string (not for free-ing)*/
 	unsigned int bits_used;				/* Bits, used by the message */
+	unsigned long long payload_bits;	/* Message bits as the user sees them */
+	unsigned int packed_bits;			/* Message bits after compression */
+	/* Work, done by the operation */
+	unsigned long long coefficients_modified;	/* DCT coefficients changed while embeding */
+	unsigned int rows_touched;			/* Distinct rows of DCT blocks accessed */
+	unsigned long long barray_accesses;	/* Calls to jpeg library access_virt_barray */
+	unsigned long long rgen_bytes;		/* Pseudorandom bytes consumed */
+	unsigned long long rgen_retries;	/* Rejected values while making shuffle */
+	unsigned long long rsrce_bytes;		/* Bytes read from random source */
+	unsigned long long cipher_bytes;	/* Bytes ciphered or deciphered */
+	size_t peak_memory;					/* Most bytes taken from job memory at once */
+};
+
+/**
+ * Flags for steganolab_options
+ */
+#define STEGANOLAB_COMPRESS	0x01	/* Deflate message before ciphering, if
+									 * that makes it smaller. The decoder
+									 * detects this automatically. */
+#define STEGANOLAB_CHUNKED	0x02	/* Split message in chunks, ciphered
+									 * and verified one by one, so that
+									 * decoder can give them out as soon
+									 * as read, or read only some of them.
+									 * STEGANOLAB_COMPRESS is ignored. */
+#define STEGANOLAB_REGION	0x04	/* Put message in a band of MCU rows,
+									 * that starts at a row, chosen by
+									 * password in the top quarter of the
+									 * image, and takes as many rows as
+									 * it needs with a margin, so that the
+									 * decoder reads only up to it. If the
+									 * image is too small, the message is
+									 * spread over it. The decoder detects
+									 * this automatically. */
+#define STEGANOLAB_VERIFIED	0x08	/* Put a keyed verifier next to message
+									 * length, so that decoder finds out a
+									 * wrong key after one cipher block,
+									 * before it makes shuffle table or
+									 * allocates anything for the message.
+									 * Decoder detects this automatically;
+									 * with this flag it looks for such
+									 * messages only, and wrong keys cost
+									 * it next to nothing. Older versions
+									 * don't read such messages. */
+#define STEGANOLAB_RESTART_PARALLEL	0x10	/* Write output with a restart
+									 * marker after every MCU row, so that
+									 * intervals are encoded on threads at
+									 * once, and this library decodes and
+									 * updates them on threads too. Output
+									 * bytes depend on thread count. Without
+									 * the flag output is a single baseline
+									 * scan with no restart markers. */
+
+/**
+ * Stages of a job for steganolab_progress
+ */
+#define STEGANOLAB_STAGE_READ		0	/* Jpeg library reads coefficients */
+#define STEGANOLAB_STAGE_SHUFFLE	1	/* Making shuffle table */
+#define STEGANOLAB_STAGE_BITS		2	/* Embeding or reading message bits */
+#define STEGANOLAB_STAGE_WRITE		3	/* Jpeg library writes the output */
+
+/**
+ * Callback to follow a job, called now and then from the thread, that
+ * runs it.
+ * @param user - pointer from steganolab_options
+ * @param stage - STEGANOLAB_STAGE_*
+ * @param done - work of the stage done, in units of the stage
+ * @param total - all work of the stage
+ * @return 0 to go on, not 0 to cancel the job
+ */
+typedef int (*steganolab_progress)(void * user, int stage,
+	unsigned long long done, unsigned long long total);
+
+/**
+ * Additional encoder settings. Initialise with steganolab_options_init
+ * before use, so that fields added later get their defaults.
+ */
+struct steganolab_options {
+	unsigned int flags;		/* STEGANOLAB_* bits */
+	unsigned int chunk_size;/* Data bytes in chunk, 0 for default (64 Kib) */
+	unsigned int threads;	/* Threads to work on one image, 0 for all processors */
+	const char * cache_dir;	/* Directory to keep decoded carriers in, NULL for none */
+	/* A job is watched only if some of these are set. It stops with
+	 * code 44 when it's time is over, with 45 when it is cancelled */
+	steganolab_progress progress;	/* NULL for none */
+	void * progress_user;
+	unsigned int timeout_ms;/* Time for a job, 0 for no limit */
+	const int * cancel;		/* Job is cancelled, when this becomes not 0, may
+							 * be set from other thread; NULL for none */
+	const char * shuffle_dir;/* Directory to keep shuffle tables in, ciphered
+							 * with keys from password, NULL for none */
+	/* Resource policy: checked right after jpeg header is read, before
+	 * coefficients are. Carriers over a limit are refused with code 46 */
+	unsigned long long max_pixels;	/* Image width times height, 0 for no limit */
+	unsigned int max_components;	/* Color channels, 0 for no limit */
+	size_t max_memory;		/* Memory, the job is predicted to take (see
+							 * steganolab_workspace_size), 0 for no limit */
+	size_t heavy_memory;	/* Jobs, predicted to take more, wait for their
+							 * turn: only a few of them run at once (see
+							 * steganolab_heavy_jobs); 0 for no queue */
 };
 
+/**
+ * Shuffle tables, made by jobs, may be kept in process memory, so that a
+ * job with the same password over an image with the same capacity
+ * doesn't make it again. The least recently used ones are dropped,
+ * when they take more memory, than allowed. Statistics of a job, that
+ * finds a table, count the work of making it, as if it was made.
+ * @param bytes - memory for tables, 0 to keep none (the default)
+ */
+void steganolab_shuffle_cache_limit(size_t bytes);
+
+/**
+ * Sets how many heavy jobs (see heavy_memory of steganolab_options) run
+ * at once in the process; the others wait for their turn before they
+ * read coefficients. A waiting job keeps to it's timeout and cancel
+ * flag.
+ * @param n - number of jobs, 1 by default, 0 for no limit
+ */
+void steganolab_heavy_jobs(unsigned int n);
+
+/**
+ * Callback to receive message from steganolab_decode_stream. Pieces
+ * come in order, each of them verified before it is given out.
+ * @param user - pointer, given to steganolab_decode_stream
+ * @param data - message piece, valid until callback returns
+ * @param len - piece length
+ * @return 0 to go on, not 0 to stop decoding
+ */
+typedef int (*steganolab_sink)(void * user, const char * data, unsigned int len);
+
 
 /**
  * By given jpeg file writes another, that contains the hidden message.
@@ -84,9 +215,86 @@ int steganolab_encode(SLFILE * infile, SLFILE * outfile,
 	const char * data, unsigned int len, const char * password,
 	uint8_t DCT_radius, struct steganolab_statistics * stats);
 
+/**
+ * Sets options object to defaults: the behaviour of steganolab_encode.
+ * @param opts - object to initialise
+ */
+void steganolab_options_init(struct steganolab_options * opts);
+
+/**
+ * The same as steganolab_encode, but with additional settings.
+ * @param opts - settings, NULL means defaults
+ * Other parameters and return value are as for steganolab_encode.
+ */
+int steganolab_encode_opt(SLFILE * infile, SLFILE * outfile,
+	const char * data, unsigned int len, const char * password,
+	uint8_t DCT_radius, const struct steganolab_options * opts,
+	struct steganolab_statistics * stats);
+
+/**
+ * The same as steganolab_encode_opt, but jpeg files are given by names.
+ * Output is written through a big buffer to a temporary file, which
+ * replaces outpath only when it is complete: if embedding fails, the
+ * old file, if any, stays as it was.
+ * @param inpath - carrier file name
+ * @param outpath - name for the output jpeg
+ * Other parameters and return value are as for steganolab_encode_opt.
+ */
+int steganolab_encode_file(const char * inpath, const char * outpath,
+	const char * data, unsigned int len, const char * password,
+	uint8_t DCT_radius, const struct steganolab_options * opts,
+	struct steganolab_statistics * stats);
+
+/**
+ * The same as steganolab_encode_opt, but jpeg files are in memory.
+ * @param jpeg - input jpeg file contents
+ * @param jpeg_len - input length
+ * @param out - place to put malloced output jpeg to, to be freed by
+ * the caller if function succeeds
+ * @param out_len - place to put output length to
+ * Other parameters and return value are as for steganolab_encode_opt.
+ */
+int steganolab_encode_mem(const char * jpeg, size_t jpeg_len,
+	char ** out, size_t * out_len, const char * data, unsigned int len,
+	const char * password, uint8_t DCT_radius,
+	const struct steganolab_options * opts,
+	struct steganolab_statistics * stats);
+
+/**
+ * Puts new message to an image, that has a message with the same key
+ * already, or to any other. Message bits keep their places, and only
+ * coefficients, whose bits differ, change: with the same length, a new
+ * message changes bits from the first cipher block, that differs. If
+ * the image has one baseline scan with restart markers (so have images,
+ * written with STEGANOLAB_RESTART_PARALLEL), only restart intervals
+ * with changed blocks are coded again, and the rest of the file, all
+ * markers included, is copied as it is. Other images are written as
+ * steganolab_encode_mem writes them.
+ * Parameters and return value are as for steganolab_encode_mem.
+ */
+int steganolab_update_mem(const char * jpeg, size_t jpeg_len,
+	char ** out, size_t * out_len, const char * data, unsigned int len,
+	const char * password, uint8_t DCT_radius,
+	const struct steganolab_options * opts,
+	struct steganolab_statistics * stats);
+
+/**
+ * The same as steganolab_update_mem, but the file is given by name and
+ * replaced, when the update is complete, as steganolab_encode_file
+ * replaces output.
+ * @param path - jpeg file name
+ */
+int steganolab_update_file(const char * path,
+	const char * data, unsigned int len, const char * password,
+	uint8_t DCT_radius, const struct steganolab_options * opts,
+	struct steganolab_statistics * stats);
+
 /**
  * Reads steganographic message from stream
- * @param file - jpeg stream
+ * @param file - jpeg stream; a regular file is left after the jpeg's
+ * end, so that what follows can be read, even if the message was found
+ * before the end. Position of other streams (pipes) is where jpeg
+ * library stopped reading, which is unspecified.
  * @param data - pointer to pointer to buffer to put data to, needs to be free-d
  * @param len - pointer to push obtained buffer length to
  * @param password - secred string for cipher and PRNG
@@ -104,6 +312,341 @@ int steganolab_decode(SLFILE * file, char ** data,
 
 
 
+/**
+ * The same as steganolab_decode, but jpeg file is in memory.
+ * @param jpeg - jpeg file contents
+ * @param jpeg_len - it's length
+ * Other parameters and return value are as for steganolab_decode.
+ */
+int steganolab_decode_mem(const char * jpeg, size_t jpeg_len, char ** data,
+	unsigned int * len, const char * password, uint8_t DCT_radius,
+	struct steganolab_statistics * stats);
+
+/**
+ * The same as steganolab_decode, but with settings: only the ones,
+ * that are not about embeding, are used.
+ * @param opts - settings, NULL means defaults
+ * Other parameters and return value are as for steganolab_decode.
+ */
+int steganolab_decode_opt(SLFILE * file, char ** data,
+	unsigned int * len, const char * password, uint8_t DCT_radius,
+	const struct steganolab_options * opts,
+	struct steganolab_statistics * stats);
+
+/**
+ * The same as steganolab_decode_opt, but jpeg file is in memory.
+ */
+int steganolab_decode_mem_opt(const char * jpeg, size_t jpeg_len, char ** data,
+	unsigned int * len, const char * password, uint8_t DCT_radius,
+	const struct steganolab_options * opts,
+	struct steganolab_statistics * stats);
+
+/**
+ * Reads steganographic message from stream, giving it out piece by piece.
+ * For a message written with STEGANOLAB_CHUNKED, every chunk is given out
+ * as soon as it is verified, and memory use doesn't depend on message
+ * length. Other messages are given out at once.
+ * If a chunk turns out to be damaged, decoding fails, but pieces, given
+ * before, remain valid.
+ * @param file - jpeg stream
+ * @param sink - callback to push message pieces to
+ * @param user - pointer to pass to sink
+ * Other parameters are as for steganolab_decode.
+ * @return 0: All OK
+ * not 0: fail
+ */
+int steganolab_decode_stream(SLFILE * file, steganolab_sink sink, void * user,
+	const char * password, uint8_t DCT_radius,
+	struct steganolab_statistics * stats);
+
+/**
+ * The same as steganolab_decode_stream, but jpeg file is in memory, and
+ * options are given.
+ */
+int steganolab_decode_mem_stream(const char * jpeg, size_t jpeg_len,
+	steganolab_sink sink, void * user, const char * password,
+	uint8_t DCT_radius, const struct steganolab_options * opts,
+	struct steganolab_statistics * stats);
+
+/**
+ * Reads message bytes [from, to) from stream. For a message written
+ * with STEGANOLAB_CHUNKED, only the chunks, covering the range, are read.
+ * The range is cut down to message length.
+ * @param from, to - byte range to read
+ * Other parameters and return value are as for steganolab_decode.
+ */
+int steganolab_decode_range(SLFILE * file, unsigned int from, unsigned int to,
+	char ** data, unsigned int * len, const char * password,
+	uint8_t DCT_radius, struct steganolab_statistics * stats);
+
+/**
+ * Decoder, that is given jpeg file piece by piece, as it comes, so that
+ * an event loop can decode an upload without blocking on it: jpeg
+ * header and coefficients are read as far as the pieces, given so far,
+ * allow, and the message is read, when the image is complete.
+ */
+struct steganolab_decoder;
+
+#define STEGANOLAB_NEED_MORE	43	/* Decoder waits for more data */
+
+/**
+ * Makes decoder
+ * @param password, DCT_radius - as for steganolab_decode
+ * @param sink - callback to push message pieces to, as for
+ * steganolab_decode_stream, or NULL to keep the message for
+ * steganolab_decoder_result
+ * @param user - pointer to pass to sink
+ * @param stats - statistics object to fill, when decoding is done, or
+ * NULL. It needs freeing only if decoding succeeds.
+ * @param decoder - place to put decoder object to
+ * @return 0 if OK, 20 if out of memory
+ */
+int steganolab_decoder_new(const char * password, uint8_t DCT_radius,
+	steganolab_sink sink, void * user, struct steganolab_statistics * stats,
+	struct steganolab_decoder ** decoder);
+
+/**
+ * Gives decoder the next piece of jpeg file. The piece is copied.
+ * @param bytes - piece
+ * @param len - it's length
+ * @return STEGANOLAB_NEED_MORE if the image is not complete yet, 0 if
+ * the message has been read, other codes as steganolab_decode returns
+ * on error. Once decoder is done or failed, further calls return the
+ * same.
+ */
+int steganolab_decoder_feed(struct steganolab_decoder * decoder,
+	const char * bytes, size_t len);
+
+/**
+ * Tells decoder, that the file is over. A file, cut short, is decoded
+ * as far as it goes, the way steganolab_decode does it.
+ * @return as for steganolab_decoder_feed, except STEGANOLAB_NEED_MORE
+ */
+int steganolab_decoder_end(struct steganolab_decoder * decoder);
+
+/**
+ * Takes the message from decoder, made without sink, that is done.
+ * @param data - place to put malloced message to, to be freed by the
+ * caller
+ * @param len - place to put message length to
+ * @return 0 if OK, the decoder status, if it is not done
+ */
+int steganolab_decoder_result(struct steganolab_decoder * decoder,
+	char ** data, unsigned int * len);
+
+/**
+ * Frees decoder, done or not.
+ */
+void steganolab_decoder_free(struct steganolab_decoder * decoder);
+
+/**
+ * Work, done over a Motion-JPEG stream
+ */
+struct steganolab_stream_statistics {
+	unsigned long long frames;		/* Frames read */
+	unsigned long long frames_used;	/* Frames, that carry message pieces */
+};
+
+/**
+ * Embeds message to Motion-JPEG stream: jpeg frames, one after another.
+ * The message is spread over frames in pieces, as much as every frame
+ * holds, in their order; frames after the last piece, and those too
+ * small for a piece, are copied as they are, and so are bytes between
+ * frames. Every frame is written out while the next one is processed,
+ * and memory use doesn't depend on stream length. Pieces are stored as
+ * is: flags in opts are not used.
+ * @param infile - stream to read
+ * @param outfile - stream to write
+ * @param stats - place to put counts of frames to, or NULL
+ * Other parameters are as for steganolab_encode_opt.
+ * @return 0: All OK
+ * 10: stream is over before the message; the output is written anyway
+ * other as steganolab_encode returns; the output is written as far as
+ * it went
+ */
+int steganolab_encode_mjpeg(SLFILE * infile, SLFILE * outfile,
+	const char * data, unsigned int len, const char * password,
+	uint8_t DCT_radius, const struct steganolab_options * opts,
+	struct steganolab_stream_statistics * stats);
+
+/**
+ * Reads message from Motion-JPEG stream, made by steganolab_encode_mjpeg.
+ * The stream is read until the last piece only.
+ * @param stats - place to put counts of frames to, or NULL
+ * Other parameters and return value are as for steganolab_decode_opt.
+ */
+int steganolab_decode_mjpeg(SLFILE * file, char ** data, unsigned int * len,
+	const char * password, uint8_t DCT_radius,
+	const struct steganolab_options * opts,
+	struct steganolab_stream_statistics * stats);
+
+/**
+ * One job for steganolab_bulk
+ */
+struct steganolab_job {
+	const char * infile;	/* Carrier file name */
+	const char * outfile;	/* File name to write to, for encoder */
+	const char * data;		/* Message to embed, NULL to decode */
+	unsigned int len;
+	/* Results */
+	int status;				/* As steganolab_encode/decode would return */
+	char * out;				/* Decoded message, to be freed by the caller */
+	unsigned int out_len;
+};
+
+/**
+ * Runs many jobs with the same key one after one, so that file reading
+ * and writing overlaps with processing: while a job is processed, next
+ * carriers are being read into memory, and outputs of jobs done are
+ * being written. This is done with Linux io_uring where the kernel
+ * offers it, otherwise files are read and written in place.
+ * @param jobs - jobs to do, results are put there
+ * @param njobs - number of jobs
+ * @param prefetch - how many carriers to read ahead
+ * @param password, DCT_radius - as for steganolab_encode/decode
+ * @param opts - settings, NULL for defaults; a timeout is for every job
+ * @return 0 if jobs were run (see their status), not 0 if the pipeline
+ * failed to start
+ */
+int steganolab_bulk(struct steganolab_job * jobs, size_t njobs,
+	unsigned int prefetch, const char * password, uint8_t DCT_radius,
+	const struct steganolab_options * opts);
+
+/**
+ * Job for steganolab_submit: carrier and message are in memory
+ */
+struct steganolab_task {
+	const char * jpeg;		/* Carrier file contents */
+	size_t jpeg_len;
+	const char * data;		/* Message to embed, NULL to decode */
+	unsigned int len;
+	const char * password;
+	uint8_t DCT_radius;
+	const struct steganolab_options * opts;	/* NULL for defaults */
+	int priority;			/* Jobs with higher ones are started first */
+	struct steganolab_statistics * stats;	/* NULL for none */
+	/* Results */
+	int status;				/* As steganolab_encode_mem/decode_mem would return */
+	char * out;				/* Jpeg with message for encoder, message for
+							 * decoder; to be freed by the caller */
+	size_t out_len;
+};
+
+/**
+ * Callback, that tells about a job done
+ * @param user - pointer, given to steganolab_submit
+ * @param task - the job with results
+ */
+typedef void (*steganolab_callback)(void * user, struct steganolab_task * task);
+
+/**
+ * Queues a job to the library executor: threads, one for every
+ * processor, shared by all jobs. Jobs start by priority, and the work
+ * of a job, that is done on several threads, goes to threads of the
+ * same executor, so that big and small jobs share processors without
+ * starting threads of their own. Blocking functions spread their work
+ * over this executor too.
+ * @param task - job; it, and everything it points to, must live until
+ * the callback
+ * @param done - function to call from an executor thread, when the job
+ * is done
+ * @param user - pointer for the callback
+ * @return 0 if the job is queued, 20 if it can't be
+ */
+int steganolab_submit(struct steganolab_task * task, steganolab_callback done,
+	void * user);
+
+/**
+ * Carrier index: a file, listing jpeg files of a directory tree with
+ * their capacity, sorted by it, so that a carrier for a message can be
+ * found without studying the files.
+ */
+struct steganolab_index;
+
+/**
+ * Carrier, as the index describes it
+ */
+struct steganolab_carrier {
+	const char * path;				/* Points into the index */
+	unsigned long long file_size;
+	unsigned int usable_blocks;		/* DCT blocks of all channels: capacity in
+									 * bits is this times steganolab_bits_in_block */
+	unsigned int width, height;		/* Image size in pixels */
+	uint8_t color_channels;
+	uint8_t sampling[4];			/* h_samp_factor << 4 | v_samp_factor */
+};
+
+/**
+ * Part of a message, given to a carrier by steganolab_index_pack
+ */
+struct steganolab_pick {
+	unsigned int carrier;			/* Carrier number in index */
+	unsigned int len;				/* Message bytes to put there */
+};
+
+/**
+ * Finds jpeg files (*.jpg, *.jpeg) in directory tree, studies their
+ * headers on several threads and writes index file. Files, that are
+ * not jpeg after all, are skipped.
+ * @param root - directory to scan
+ * @param index_path - index file to write, replaced when complete
+ * @param threads - threads to use, 0 for all processors
+ * @return 0 if OK, 33 if the directory can't be read, 32 if the index
+ * can't be written, 20 if out of memory
+ */
+int steganolab_index_build(const char * root, const char * index_path,
+	unsigned int threads);
+
+/**
+ * Opens index file
+ * @param index_path - file, made by steganolab_index_build
+ * @param index - place to put index object to
+ * @return 0 if OK, 31 if the file can't be read, 34 if it is not an
+ * index, 20 if out of memory
+ */
+int steganolab_index_open(const char * index_path, struct steganolab_index ** index);
+
+/**
+ * Closes index
+ */
+void steganolab_index_close(struct steganolab_index * index);
+
+/**
+ * @return number of carriers in index
+ */
+unsigned int steganolab_index_count(const struct steganolab_index * index);
+
+/**
+ * Describes carrier. Carriers are numbered from the smallest capacity up.
+ * @param n - carrier number, less than steganolab_index_count
+ * @param carrier - place to put description to
+ */
+void steganolab_index_get(const struct steganolab_index * index, unsigned int n,
+	struct steganolab_carrier * carrier);
+
+/**
+ * Finds the smallest carrier, that holds the message, stored as is.
+ * @param len - message length
+ * @param DCT_radius - as for steganolab_encode
+ * @return carrier number or -1 if no carrier is big enough
+ */
+long steganolab_index_best_fit(const struct steganolab_index * index,
+	unsigned int len, uint8_t DCT_radius);
+
+/**
+ * Chooses carriers for a message, that is too big for one: the biggest
+ * carriers are filled up, and the rest goes to the one, that fits it
+ * best.
+ * @param len - message length
+ * @param DCT_radius - as for steganolab_encode
+ * @param picks - place for picks: message parts in order
+ * @param max_picks - most carriers to use
+ * @return number of picks, 0 if the message doesn't fit
+ */
+unsigned int steganolab_index_pack(const struct steganolab_index * index,
+	unsigned long long len, uint8_t DCT_radius,
+	struct steganolab_pick * picks, unsigned int max_picks);
+
 /**
  * Outputs jpeg file statistics.
  * @param file - jpeg file stream to study
@@ -117,6 +660,36 @@ int steganolab_decode(SLFILE * file, char ** data,
 int steganolab_estimate(SLFILE * file, uint8_t DCT_radius, struct
 	steganolab_statistics * stats);
 
+/**
+ * The same as steganolab_estimate, but jpeg file is in memory.
+ */
+int steganolab_estimate_mem(const char * jpeg, size_t jpeg_len,
+	uint8_t DCT_radius, struct steganolab_statistics * stats);
+
+/**
+ * Tells how many bits of DCT block are used
+ * @param DCT_radius - radius, as for steganolab_encode
+ * @return bits in block; image capacity is this multiplied by usable
+ * DCT blocks of all channels
+ */
+uint8_t steganolab_bits_in_block(uint8_t DCT_radius);
+
+/**
+ * Tells how many bits a message takes in image, when it is stored as
+ * is: neither compressed nor chunked. With STEGANOLAB_VERIFIED it takes
+ * up to one cipher block (64 bits) more.
+ * @param len - message length
+ * @return bits, the image must have available
+ */
+unsigned long long steganolab_message_bits(unsigned int len);
+
+/**
+ * Tells the longest message, stored as is, that fits in image.
+ * @param bits - bits available in image
+ * @return message length, 0 also if nothing fits
+ */
+unsigned int steganolab_message_capacity(unsigned long long bits);
+
 
 
 /**
@@ -128,6 +701,36 @@ const char * steganolab_describe(int code);
 
 
 
+/**
+ * Every thread, that runs steganolab functions, keeps memory, the jobs
+ * take, for the next job instead of freeing it. The functions below let
+ * the library user prepare this memory in advance and give it back.
+ */
+#define STEGANOLAB_HUGEPAGES	0x01	/* Ask OS for transparent huge pages */
+
+/**
+ * Estimates memory, a job on the image will take.
+ * @param stats - statistics, obtained by steganolab_estimate
+ * @param len - message length for encoder, 0 for decoder
+ * @return bytes to reserve with steganolab_reserve_workspace
+ */
+size_t steganolab_workspace_size(const struct steganolab_statistics * stats,
+	unsigned int len);
+
+/**
+ * Prepares memory for jobs, run by the calling thread.
+ * @param bytes - memory size, see steganolab_workspace_size
+ * @param flags - STEGANOLAB_HUGEPAGES or 0
+ * @return 0 if OK, other values for errors
+ */
+int steganolab_reserve_workspace(size_t bytes, unsigned int flags);
+
+/**
+ * Gives memory, kept by the calling thread, back to OS. Call it
+ * before finishing a thread, that ran steganolab functions.
+ */
+void steganolab_release_workspace();
+
 /**
  * Describes statistics by printing it to specified destination
  * with the help of fprintf(dest, ...)
@@ -143,4 +746,8 @@ void steganolab_print_statistics(struct steganolab_statistics * stats, FILE * de
  */
 void steganolab_free_statistics(struct steganolab_statistics * stats);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,226 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STEGANOLAB_HPP
+#define STEGANOLAB_HPP
+#include "steganolab.h"
+#include <cstddef>
+#include <memory_resource>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+/**
+ * C++20 layer over steganolab.h: handles free what the C functions
+ * give out, inputs are spans, and failures are values.
+ */
+namespace steganolab {
+
+/**
+ * Failure of an operation: code, as the C functions return it
+ */
+class Error {
+public:
+	explicit Error(int code) : code_(code) {}
+	int code() const { return code_; }
+	/**
+	 * @return description from steganolab_describe, not for free-ing
+	 */
+	const char * what() const { return steganolab_describe(code_); }
+private:
+	int code_;
+};
+
+/**
+ * Value or Error, in the manner of std::expected
+ */
+template <class T>
+class Result {
+public:
+	Result(T && value) : v_(std::in_place_index<0>, std::move(value)) {}
+	Result(Error error) : v_(std::in_place_index<1>, error) {}
+	bool has_value() const { return 0 == v_.index(); }
+	explicit operator bool() const { return has_value(); }
+	T & value() & { return std::get<0>(v_); }
+	const T & value() const & { return std::get<0>(v_); }
+	T && value() && { return std::get<0>(std::move(v_)); }
+	T & operator * () & { return value(); }
+	T * operator -> () { return & value(); }
+	const T * operator -> () const { return & value(); }
+	Error error() const { return std::get<1>(v_); }
+private:
+	std::variant<T, Error> v_;
+};
+
+/**
+ * Bytes, that the C library allocated, taken over without copying
+ */
+class Buffer {
+public:
+	Buffer() = default;
+	Buffer(Buffer && other) noexcept;
+	Buffer & operator = (Buffer && other) noexcept;
+	Buffer(const Buffer &) = delete;
+	Buffer & operator = (const Buffer &) = delete;
+	~Buffer();
+	std::span<const std::byte> bytes() const {
+		return { reinterpret_cast<const std::byte *>(data_), size_ };
+	}
+	const std::byte * data() const { return bytes().data(); }
+	std::size_t size() const { return size_; }
+private:
+	friend class Session;
+	Buffer(char * data, std::size_t size) : data_(data), size_(size) {}
+	char * data_ = nullptr;
+	std::size_t size_ = 0;
+};
+
+/**
+ * Statistics of an operation, freed with it's handle
+ */
+class Statistics {
+public:
+	Statistics();
+	Statistics(Statistics && other) noexcept;
+	Statistics & operator = (Statistics && other) noexcept;
+	Statistics(const Statistics &) = delete;
+	Statistics & operator = (const Statistics &) = delete;
+	~Statistics();
+	const steganolab_statistics & get() const { return s_; }
+	const steganolab_statistics * operator -> () const { return & s_; }
+	/**
+	 * @return channel info: an entry for every color channel
+	 */
+	std::span<const color_channel_info> channels() const;
+private:
+	friend class Session;
+	/**
+	 * Takes over statistics, that a successful job filled
+	 */
+	void adopt(const steganolab_statistics & s);
+	steganolab_statistics s_;
+	bool filled_ = false;
+};
+
+/**
+ * Password and DCT radius, that messages are embedded with
+ */
+class Key {
+public:
+	explicit Key(std::string_view password, uint8_t DCT_radius = 2)
+		: password_(password), DCT_radius_(DCT_radius) {}
+	Key(Key &&) noexcept = default;
+	Key & operator = (Key &&) noexcept = default;
+	Key(const Key &) = delete;
+	Key & operator = (const Key &) = delete;
+	const char * password() const { return password_.c_str(); }
+	uint8_t DCT_radius() const { return DCT_radius_; }
+private:
+	std::string password_;
+	uint8_t DCT_radius_;
+};
+
+/**
+ * Jpeg file in memory: a view of the caller's bytes, or bytes, loaded
+ * to memory of a given resource
+ */
+class Carrier {
+public:
+	/**
+	 * Makes carrier over bytes, that must outlive it
+	 */
+	static Carrier view(std::span<const std::byte> jpeg);
+	/**
+	 * Reads file
+	 * @param mr - resource to take memory from
+	 * @return carrier or Error 31 if the file can't be read
+	 */
+	static Result<Carrier> load(const char * path,
+		std::pmr::memory_resource * mr = std::pmr::get_default_resource());
+	Carrier(Carrier &&) noexcept = default;
+	Carrier & operator = (Carrier &&) = default;
+	Carrier(const Carrier &) = delete;
+	Carrier & operator = (const Carrier &) = delete;
+	std::span<const std::byte> bytes() const {
+		return owns_ ? std::span<const std::byte>(owned_) : view_;
+	}
+private:
+	explicit Carrier(std::pmr::memory_resource * mr) : owned_(mr) {}
+	std::pmr::vector<std::byte> owned_;
+	std::span<const std::byte> view_;
+	bool owns_ = false;
+};
+
+/**
+ * Key with options and memory resource: does jobs over carriers.
+ * A session may be used by several threads at once, as long as it's
+ * options are not changed meanwhile.
+ */
+class Session {
+public:
+	explicit Session(Key key,
+		std::pmr::memory_resource * mr = std::pmr::get_default_resource());
+	Session(Session &&) noexcept = default;
+	Session & operator = (Session &&) noexcept = default;
+	Session(const Session &) = delete;
+	Session & operator = (const Session &) = delete;
+	/**
+	 * @return options, given to jobs, initialised with
+	 * steganolab_options_init; pointers in them are not owned
+	 */
+	steganolab_options & options() { return opts_; }
+	const Key & key() const { return key_; }
+	/**
+	 * Embeds message to carrier
+	 * @param stats - object to put statistics to, or nullptr
+	 * @return jpeg file with the message, as steganolab_encode_mem gives it
+	 */
+	Result<Buffer> encode(const Carrier & carrier,
+		std::span<const std::byte> message, Statistics * stats = nullptr) const;
+	/**
+	 * Reads message to memory, that the C library allocates
+	 */
+	Result<Buffer> decode(const Carrier & carrier,
+		Statistics * stats = nullptr) const;
+	/**
+	 * Reads message to caller's memory
+	 * @return message length, Error 10 if it doesn't fit in out
+	 */
+	Result<std::size_t> decode_into(const Carrier & carrier,
+		std::span<std::byte> out, Statistics * stats = nullptr) const;
+	/**
+	 * Reads message to a vector in memory of the session resource
+	 */
+	Result<std::pmr::vector<std::byte>> decode_vector(const Carrier & carrier,
+		Statistics * stats = nullptr) const;
+	/**
+	 * Reports carrier capacity
+	 */
+	Result<Statistics> estimate(const Carrier & carrier) const;
+private:
+	Key key_;
+	steganolab_options opts_;
+	std::pmr::memory_resource * mr_;
+};
+
+}
+
+#endif
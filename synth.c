@@ -0,0 +1,169 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "synth.h"
+#include "jio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+
+#define SYNTH_CELL	64		/* Pixels between points of the smooth field */
+#define SYNTH_NOISE	16		/* Noise amplitude, full range */
+
+const struct synth_size synth_sizes[SYNTH_SIZES] = {
+	{ "thumb", 160, 120 },
+	{ "1mp", 1152, 864 },
+	{ "12mp", 4000, 3000 },
+	{ "24mp", 6000, 4000 },
+	{ "100mp", 11520, 8640 },
+};
+
+const char * synth_layout_name(uint8_t layout){
+	switch(layout){
+	case SYNTH_GRAY: return "gray";
+	case SYNTH_444: return "444";
+	case SYNTH_420: return "420";
+	}
+	return "?";
+}
+
+/**
+ * Mixes numbers to a pseudorandom one, without a state to keep
+ */
+static uint32_t synth_hash(uint32_t seed, uint32_t a, uint32_t b, uint32_t c){
+	uint32_t h = seed ^ 0x9E3779B9u;
+	h = (h ^ a) * 0x85EBCA6Bu;
+	h = (h ^ (h >> 13) ^ b) * 0xC2B2AE35u;
+	h = (h ^ (h >> 16) ^ c) * 0x27D4EB2Fu;
+	return h ^ (h >> 15);
+}
+
+static uint32_t synth_xorshift(uint32_t * s){
+	uint32_t x = * s;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	* s = x;
+	return x;
+}
+
+/**
+ * Value of the smooth field: points on a grid, interpolated between
+ */
+static int synth_field(uint32_t seed, unsigned int x, unsigned int y, uint32_t c){
+	unsigned int gx = x / SYNTH_CELL, gy = y / SYNTH_CELL;
+	int fx = x % SYNTH_CELL, fy = y % SYNTH_CELL;
+	int v00 = synth_hash(seed, gx, gy, c) & 0xFF;
+	int v10 = synth_hash(seed, gx + 1, gy, c) & 0xFF;
+	int v01 = synth_hash(seed, gx, gy + 1, c) & 0xFF;
+	int v11 = synth_hash(seed, gx + 1, gy + 1, c) & 0xFF;
+	int top = v00 * (SYNTH_CELL - fx) + v10 * fx;
+	int bottom = v01 * (SYNTH_CELL - fx) + v11 * fx;
+	return (top * (SYNTH_CELL - fy) + bottom * fy) / (SYNTH_CELL * SYNTH_CELL);
+}
+
+/**
+ * Fills one row of pixels
+ */
+static void synth_row(const struct synth_carrier * desc, unsigned int y,
+		int channels, uint32_t * noise, JSAMPLE * row){
+	unsigned int x;
+	int c;
+	/* A few hard edges: cells, that are much brighter, than the field */
+	for(x = 0; x < desc -> width; x += 1){
+		char edge = (synth_hash(desc -> seed, x / (SYNTH_CELL * 3),
+			y / (SYNTH_CELL * 2), 7) & 7) == 0;
+		for(c = 0; c < channels; c += 1){
+			int v = synth_field(desc -> seed, x, y, c);
+			v += (int) (synth_xorshift(noise) % SYNTH_NOISE) - SYNTH_NOISE / 2;
+			if ( edge ){
+				v += 64;
+			}
+			row[x * channels + c] = v < 0 ? 0 : (v > 255 ? 255 : v);
+		}
+	}
+}
+
+struct synth_error {
+	struct jpeg_error_mgr pub;
+	jmp_buf setjmp_buffer;
+};
+
+static void synth_error_exit(j_common_ptr cinfo){
+	longjmp(((struct synth_error *) cinfo -> err) -> setjmp_buffer, 1);
+}
+
+char synth_make(const struct synth_carrier * desc, char ** jpeg, size_t * len){
+	struct jpeg_compress_struct cinfo;
+	struct synth_error jerr;
+	struct jio_grow dest;
+	int channels = SYNTH_GRAY == desc -> layout ? 1 : 3;
+	uint32_t noise = desc -> seed | 1;
+	JSAMPLE * volatile row = NULL;
+
+	dest.buf = NULL;
+	cinfo.err = jpeg_std_error(& jerr.pub);
+	jerr.pub.error_exit = synth_error_exit;
+	if ( setjmp(jerr.setjmp_buffer) ){
+		jpeg_destroy_compress(& cinfo);
+		free(dest.buf);
+		free(row);
+		return 1;
+	}
+	jpeg_create_compress(& cinfo);
+	cinfo.image_width = desc -> width;
+	cinfo.image_height = desc -> height;
+	cinfo.input_components = channels;
+	cinfo.in_color_space = 1 == channels ? JCS_GRAYSCALE : JCS_RGB;
+	jpeg_set_defaults(& cinfo);
+	jpeg_set_quality(& cinfo, desc -> quality, TRUE);
+	if ( SYNTH_444 == desc -> layout ){
+		cinfo.comp_info[0].h_samp_factor = 1;
+		cinfo.comp_info[0].v_samp_factor = 1;
+	}
+	if ( desc -> progressive ){
+		jpeg_simple_progression(& cinfo);
+	}
+	cinfo.restart_in_rows = desc -> restart_rows;
+	/* About one byte per pixel is enough for this content */
+	if ( jio_grow_attach(& cinfo, & dest, jio_dest_size(
+			(size_t) desc -> width * desc -> height / 2 + 4096)) ){
+		jpeg_destroy_compress(& cinfo);
+		return 1;
+	}
+	row = malloc((size_t) desc -> width * channels);
+	if ( NULL == row ){
+		jpeg_destroy_compress(& cinfo);
+		free(dest.buf);
+		return 1;
+	}
+	jpeg_start_compress(& cinfo, TRUE);
+	while ( cinfo.next_scanline < cinfo.image_height ){
+		JSAMPROW rows[1] = { row };
+		synth_row(desc, cinfo.next_scanline, channels, & noise, row);
+		jpeg_write_scanlines(& cinfo, rows, 1);
+	}
+	jpeg_finish_compress(& cinfo);
+	jpeg_destroy_compress(& cinfo);
+	free(row);
+	* jpeg = (char *) dest.buf;
+	* len = dest.len;
+	return 0;
+}
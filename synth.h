@@ -0,0 +1,77 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SYNTH_H
+#define SYNTH_H
+#include <stddef.h>
+#include <stdint.h>
+/**
+ * This module makes synthetic jpeg carriers for benchmarks: photo-like
+ * pictures (smooth gradients, edges and sensor noise), compressed by
+ * the jpeg library in memory. The same description gives the same
+ * file, byte for byte, on every run, so that results of runs on
+ * different builds can be compared.
+ */
+
+#define SYNTH_GRAY	0	/* One channel */
+#define SYNTH_444	1	/* YCbCr, chroma at full resolution */
+#define SYNTH_420	2	/* YCbCr, chroma halved both ways */
+
+/**
+ * Named carrier sizes, from a thumbnail to 100 megapixels, in order
+ */
+struct synth_size {
+	const char * name;
+	unsigned int width, height;
+};
+
+#define SYNTH_SIZES	5
+extern const struct synth_size synth_sizes[SYNTH_SIZES];
+
+/**
+ * Carrier description
+ */
+struct synth_carrier {
+	unsigned int width, height;
+	uint8_t layout;			/* SYNTH_* */
+	char progressive;		/* not 0 for progressive scans */
+	unsigned int restart_rows;	/* MCU rows between restart markers, 0 for none */
+	int quality;			/* jpeg quality, 1-100 */
+	uint32_t seed;			/* picture content */
+};
+
+/**
+ * Short name of the layout
+ * @return static string
+ */
+const char * synth_layout_name(uint8_t layout);
+
+/**
+ * Makes the carrier
+ * @param desc - carrier description
+ * @param jpeg - place to put malloced jpeg file to, to be freed by
+ * the caller if function succeeds
+ * @param len - place to put it's length to
+ * @return 0 if OK, 1 if out of memory or the jpeg library refused
+ * the description
+ */
+char synth_make(const struct synth_carrier * desc, char ** jpeg, size_t * len);
+
+#endif
@@ -0,0 +1,116 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "tjback.h"
+
+#ifdef STEGANOLAB_TURBOJPEG
+#include <stdlib.h>
+#include <string.h>
+#include <turbojpeg.h>
+
+char tjback_available(){
+	return 1;
+}
+
+/**
+ * Visitor with it's pointer, passed to the filter through transform
+ */
+struct tjback_call {
+	tjback_visitor visit;
+	void * user;
+};
+
+/**
+ * TurboJPEG custom filter: it is called for every block row of every
+ * component in order, with the region of the row in coefficient
+ * array, in pixels
+ */
+static int tjback_filter(short * coeffs, tjregion arrayRegion,
+		tjregion planeRegion, int componentIndex, int transformIndex,
+		tjtransform * transform){
+	struct tjback_call * call = transform -> data;
+	(void) planeRegion;
+	(void) transformIndex;
+	if ( call -> visit(call -> user, (JCOEF *) coeffs, componentIndex,
+			(unsigned int) arrayRegion.y / DCTSIZE) ){
+		return -1;
+	}
+	return 0;
+}
+
+char tjback_visit(const unsigned char * jpeg, size_t len,
+		tjback_visitor visit, void * user,
+		unsigned char ** out, size_t * out_len){
+	if ( len > (unsigned long) -1 ){
+		return 1;
+	}
+	tjhandle handle = tjInitTransform();
+	if ( NULL == handle ){
+		return 1;
+	}
+	struct tjback_call call = { visit, user };
+	tjtransform xform;
+	memset(&xform, 0, sizeof(xform));
+	xform.op = TJXOP_NONE;
+	/* Markers of the carrier are not copied, as with jpeg library */
+	xform.options = TJXOPT_COPYNONE | ( NULL == out ? TJXOPT_NOOUTPUT : 0 );
+	xform.data = &call;
+	xform.customFilter = tjback_filter;
+	unsigned char * dst = NULL;/* Allocated by TurboJPEG */
+	unsigned long dst_len = 0;
+	char rv = 0;
+	if ( tjTransform(handle, jpeg, (unsigned long) len, 1, &dst, &dst_len,
+			&xform, 0) ){
+		rv = 1;
+	}
+	if ( 0 == rv && NULL != out ){
+		/* Caller frees with free() */
+		* out = malloc(dst_len ? dst_len : 1);
+		if ( NULL == * out ){
+			rv = 1;
+		}else{
+			memcpy(* out, dst, dst_len);
+			* out_len = dst_len;
+		}
+	}
+	tjFree(dst);
+	tjDestroy(handle);
+	return rv;
+}
+
+#else /* No TurboJPEG */
+
+char tjback_available(){
+	return 0;
+}
+
+char tjback_visit(const unsigned char * jpeg, size_t len,
+		tjback_visitor visit, void * user,
+		unsigned char ** out, size_t * out_len){
+	(void) jpeg;
+	(void) len;
+	(void) visit;
+	(void) user;
+	(void) out;
+	(void) out_len;
+	return 2;
+}
+
+#endif
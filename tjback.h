@@ -0,0 +1,71 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef TJBACK_H
+#define TJBACK_H
+#include <stddef.h>
+#include <stdio.h>
+#include <jpeglib.h>
+/**
+ * This module gives DCT coefficients of a jpeg image to the caller row
+ * after row through TurboJPEG lossless transform (tjTransform with a
+ * custom filter), and writes the image back. TurboJPEG decodes and
+ * encodes in memory with it's own fast Huffman code, and the caller
+ * doesn't go through jpeg library virtual arrays.
+ *
+ * The module is compiled in only if STEGANOLAB_TURBOJPEG is defined,
+ * otherwise tjback_available reports 0 and tjback_visit fails.
+ */
+
+/**
+ * Callback, that sees one row of DCT blocks
+ * @param user - pointer, given to tjback_visit
+ * @param row - blocks of the row, DCTSIZE2 coefficients each, in
+ * natural order. They may be changed, if the image is written back.
+ * @param component - color component
+ * @param block_row - row number in component
+ * @return 0 to go on, not 0 to fail
+ */
+typedef int (*tjback_visitor)(void * user, JCOEF * row, int component,
+		unsigned int block_row);
+
+/**
+ * @return 1 if TurboJPEG is compiled in, 0 if not
+ */
+char tjback_available();
+
+/**
+ * Visits every row of DCT blocks of every component
+ * @param jpeg, len - jpeg file in memory
+ * @param visit - callback
+ * @param user - pointer to pass to it
+ * @param out - place to put malloced jpeg with changed coefficients to,
+ * NULL if nothing is changed and the image is only read
+ * @param out_len - place to put it's length to
+ * @return	0: OK
+ * 			1: TurboJPEG failed or the callback did
+ * 			2: not available
+ */
+char tjback_visit(const unsigned char * jpeg, size_t len,
+		tjback_visitor visit, void * user,
+		unsigned char ** out, size_t * out_len);
+
+#endif
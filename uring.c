@@ -0,0 +1,205 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "uring.h"
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+/* Ring indices are shared with kernel: reads of what kernel writes
+ * must see it's data, writes of ours must publish data before index */
+#define LOAD_ACQUIRE(p)			__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v)		__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+char uring_init(struct uring * self, unsigned int entries){
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	int fd = syscall(__NR_io_uring_setup, entries, &p);
+	if ( fd < 0 ){
+		return 1;
+	}
+	self -> fd = fd;
+	self -> sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	self -> cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if ( p.features & IORING_FEAT_SINGLE_MMAP ){
+		/* Both rings in one mapping */
+		if ( self -> cq_ring_size > self -> sq_ring_size ){
+			self -> sq_ring_size = self -> cq_ring_size;
+		}
+		self -> cq_ring_size = self -> sq_ring_size;
+	}
+	self -> sq_ring = mmap(NULL, self -> sq_ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if ( MAP_FAILED == self -> sq_ring ){
+		close(fd);
+		return 1;
+	}
+	if ( p.features & IORING_FEAT_SINGLE_MMAP ){
+		self -> cq_ring = self -> sq_ring;
+	}else{
+		self -> cq_ring = mmap(NULL, self -> cq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if ( MAP_FAILED == self -> cq_ring ){
+			munmap(self -> sq_ring, self -> sq_ring_size);
+			close(fd);
+			return 1;
+		}
+	}
+	self -> sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	self -> sqes = mmap(NULL, self -> sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if ( MAP_FAILED == self -> sqes ){
+		if ( self -> cq_ring != self -> sq_ring ){
+			munmap(self -> cq_ring, self -> cq_ring_size);
+		}
+		munmap(self -> sq_ring, self -> sq_ring_size);
+		close(fd);
+		return 1;
+	}
+	unsigned char * sq = self -> sq_ring, * cq = self -> cq_ring;
+	self -> sq_head = (unsigned int *)(sq + p.sq_off.head);
+	self -> sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	self -> sq_mask = * (unsigned int *)(sq + p.sq_off.ring_mask);
+	self -> sq_array = (unsigned int *)(sq + p.sq_off.array);
+	self -> cq_head = (unsigned int *)(cq + p.cq_off.head);
+	self -> cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	self -> cq_mask = * (unsigned int *)(cq + p.cq_off.ring_mask);
+	self -> cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	self -> entries = p.sq_entries;
+	self -> queued = 0;
+	self -> inflight = 0;
+	return 0;
+#else
+	return 1;
+#endif
+}
+
+void uring_free(struct uring * self){
+	munmap(self -> sqes, self -> sqes_size);
+	if ( self -> cq_ring != self -> sq_ring ){
+		munmap(self -> cq_ring, self -> cq_ring_size);
+	}
+	munmap(self -> sq_ring, self -> sq_ring_size);
+	close(self -> fd);
+}
+
+/**
+ * Fills the next submission queue entry
+ * @return 0 if OK, 1 if queue is full
+ */
+static char uring_queue(struct uring * self, uint8_t opcode, int fd,
+		const void * buf, unsigned int len, off_t offset, uint64_t tag){
+	if ( self -> queued + self -> inflight >= self -> entries ){
+		return 1;
+	}
+	unsigned int tail = * self -> sq_tail;/* Only we write it */
+	unsigned int idx = tail & self -> sq_mask;
+	struct io_uring_sqe * sqe = & self -> sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe -> opcode = opcode;
+	sqe -> fd = fd;
+	sqe -> addr = (uint64_t)(uintptr_t) buf;
+	sqe -> len = len;
+	sqe -> off = offset;
+	sqe -> user_data = tag;
+	self -> sq_array[idx] = idx;
+	STORE_RELEASE(self -> sq_tail, tail + 1);
+	self -> queued += 1;
+	return 0;
+}
+
+char uring_read(struct uring * self, int fd, void * buf, unsigned int len,
+		off_t offset, uint64_t tag){
+	return uring_queue(self, IORING_OP_READ, fd, buf, len, offset, tag);
+}
+
+char uring_write(struct uring * self, int fd, const void * buf,
+		unsigned int len, off_t offset, uint64_t tag){
+	return uring_queue(self, IORING_OP_WRITE, fd, buf, len, offset, tag);
+}
+
+char uring_submit(struct uring * self, char wait){
+	if ( wait && LOAD_ACQUIRE(self -> cq_head) != LOAD_ACQUIRE(self -> cq_tail) ){
+		wait = 0;/* Something is there already */
+	}
+	if ( 0 == self -> queued && ! wait ){
+		return 0;
+	}
+	for(;;){
+		int rv = syscall(__NR_io_uring_enter, self -> fd, self -> queued,
+			wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if ( rv < 0 ){
+			if ( EINTR == errno ){
+				continue;
+			}
+			return 1;
+		}
+		self -> inflight += rv;
+		self -> queued -= rv;
+		return 0;
+	}
+}
+
+char uring_complete(struct uring * self, uint64_t * tag, int * result){
+	unsigned int head = * self -> cq_head;/* Only we write it */
+	if ( head == LOAD_ACQUIRE(self -> cq_tail) ){
+		return 0;
+	}
+	struct io_uring_cqe * cqe = & self -> cqes[head & self -> cq_mask];
+	* tag = cqe -> user_data;
+	* result = cqe -> res;
+	STORE_RELEASE(self -> cq_head, head + 1);
+	self -> inflight -= 1;
+	return 1;
+}
+
+#else /* Not Linux */
+
+char uring_init(struct uring * self, unsigned int entries){
+	return 1;
+}
+
+void uring_free(struct uring * self){
+}
+
+char uring_read(struct uring * self, int fd, void * buf, unsigned int len,
+		off_t offset, uint64_t tag){
+	return 1;
+}
+
+char uring_write(struct uring * self, int fd, const void * buf,
+		unsigned int len, off_t offset, uint64_t tag){
+	return 1;
+}
+
+char uring_submit(struct uring * self, char wait){
+	return 1;
+}
+
+char uring_complete(struct uring * self, uint64_t * tag, int * result){
+	return 0;
+}
+
+#endif
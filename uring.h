@@ -0,0 +1,103 @@
+/**	
+ * Copyright 2012 Ivan Zelinskiy
+ * 
+ * This file is part of C-jpeg-steganography.
+ *
+ * C-jpeg-steganography is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C-jpeg-steganography is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C-jpeg-steganography.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef URING_H
+#define URING_H
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+/**
+ * This module is a small interface to Linux io_uring: asynchronous
+ * reads and writes, submitted in batches. It talks to the kernel with
+ * raw system calls, so no liburing is needed. On other systems, or if
+ * the kernel refuses, uring_init fails and the caller shall do
+ * ordinary IO instead.
+ */
+
+struct uring {
+	int fd;
+	/* Submission queue, shared with kernel */
+	unsigned int * sq_head;
+	unsigned int * sq_tail;
+	unsigned int sq_mask;
+	unsigned int * sq_array;
+	struct io_uring_sqe * sqes;
+	/* Completion queue, shared with kernel */
+	unsigned int * cq_head;
+	unsigned int * cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe * cqes;
+	/* Mappings to undo */
+	void * sq_ring;
+	size_t sq_ring_size;
+	void * cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+	unsigned int entries;
+	unsigned int queued;	/* Requests, prepared but not submitted */
+	unsigned int inflight;	/* Requests, submitted and not completed */
+};
+
+/**
+ * Constructor
+ * @param entries - maximal number of requests in flight
+ * @return 0 if OK, 1 if io_uring is not available (no need to free
+ * not created object)
+ */
+char uring_init(struct uring * self, unsigned int entries);
+
+/**
+ * Destructor. Requests in flight must be completed before.
+ */
+void uring_free(struct uring * self);
+
+/**
+ * Queues read request
+ * @param fd - file descriptor
+ * @param buf - buffer, that must live until request completes
+ * @param len - bytes to read
+ * @param offset - file offset
+ * @param tag - number to identify completion with
+ * @return 0 if OK, 1 if queue is full
+ */
+char uring_read(struct uring * self, int fd, void * buf, unsigned int len,
+		off_t offset, uint64_t tag);
+
+/**
+ * Queues write request, the same way as uring_read
+ */
+char uring_write(struct uring * self, int fd, const void * buf,
+		unsigned int len, off_t offset, uint64_t tag);
+
+/**
+ * Submits queued requests and, if asked, waits for a completion.
+ * @param wait - 1 to wait for at least one completion, 0 not to wait
+ * @return 0 if OK, 1 on system call failure
+ */
+char uring_submit(struct uring * self, char wait);
+
+/**
+ * Takes one completion, if there is any
+ * @param tag - place to put request tag to
+ * @param result - place to put result to: bytes done or -errno
+ * @return 1 if a completion is taken, 0 if there is none
+ */
+char uring_complete(struct uring * self, uint64_t * tag, int * result);
+
+#endif
@@ -159,6 +159,19 @@ int read_password_from_fd(int fd, char ** password){
 
 
 
+/**
+ * Sink for steganolab_decode_stream, that puts message to stdout
+ * @return 0 if OK, 1 if stdout fails
+ */
+static int write_to_stdout(void * user, const char * data, unsigned int len){
+	(void) user;
+	if ( fwrite(data, 1, len, stdout) != len ){
+		return 1;
+	}
+	return 0;
+}
+
+
 struct cleanup {
 	SLFILE * infile;
 	SLFILE * outfile;
@@ -183,8 +196,11 @@ static void cleanup_do(struct cleanup * clu){
 
 int main(int argc, char ** argv){
 	if ( !(argc == 3 || argc == 4) ){
-		fprintf(stderr, "Usage:\t... [--write,--read] filename [secret]\n");
+		fprintf(stderr, "Usage:\t... [--write,--write-compressed,--write-chunked,--write-region,--write-verified,--write-parallel,--update,--read] filename [secret]\n");
+		fprintf(stderr, "\t... [--write-mjpeg,--read-mjpeg] streamfile [secret]\n");
 		fprintf(stderr, "\t... --estimate filename\n");
+		fprintf(stderr, "\t... --index directory indexfile\n");
+		fprintf(stderr, "\t... --pick indexfile bytes\n");
 		fprintf(stderr, "Where: secret - key string\n");
 		fprintf(stderr, "       filename - name of jpeg file\n");
 		fprintf(stderr, "If secret is undefined, secret string is read from file descriptor %i\n", SECRET_FD);
@@ -200,21 +216,15 @@ int main(int argc, char ** argv){
 	struct cleanup clu; /* cleanup automation structure */
 	cleanup_init(&clu);
 
-	if( ! strcmp(cmd, "--write") ){
+	if( ! strcmp(cmd, "--write") || ! strcmp(cmd, "--write-compressed") ||
+			! strcmp(cmd, "--write-chunked") || ! strcmp(cmd, "--write-region") ||
+			! strcmp(cmd, "--write-verified") || ! strcmp(cmd, "--write-parallel") ||
+			! strcmp(cmd, "--update") ){
 		/*############################################################*/
 		if(! (argc == 4 || argc == 3) ){
 			return 100;
 		}
 		const char * filename = argv[2];
-		SLFILE * infile = fopen(filename, "r");
-		SLFILE * outfile = fopen("out.jpeg", "w");
-		clu.infile = infile;
-		clu.outfile = outfile;
-		if ( infile == NULL || outfile == NULL ){
-			fprintf(stderr, "Failed to open files\n");
-			cleanup_do(&clu);
-			return 101;
-		}
 		char * password;
 		if (argc == 4){
 			password = argv[3];
@@ -240,7 +250,35 @@ int main(int argc, char ** argv){
 			return 3;
 		}
 
-		int rv = steganolab_encode(infile, outfile, buf, (unsigned int)len, password, DCT_RADIUS, & stats);
+		struct steganolab_options opts;
+		steganolab_options_init(& opts);
+		if ( ! strcmp(cmd, "--write-compressed") ){
+			opts.flags |= STEGANOLAB_COMPRESS;
+		}
+		if ( ! strcmp(cmd, "--write-chunked") ){
+			opts.flags |= STEGANOLAB_CHUNKED;
+		}
+		if ( ! strcmp(cmd, "--write-region") ){
+			opts.flags |= STEGANOLAB_REGION;
+		}
+		if ( ! strcmp(cmd, "--write-verified") ){
+			opts.flags |= STEGANOLAB_VERIFIED;
+		}
+		if ( ! strcmp(cmd, "--write-parallel") ){
+			opts.flags |= STEGANOLAB_RESTART_PARALLEL;
+		}
+		/* Carriers, used often, are decoded once */
+		opts.cache_dir = getenv("STEGANOLAB_CACHE");
+		/* The same goes for shuffle tables of the key */
+		opts.shuffle_dir = getenv("STEGANOLAB_SHUFFLES");
+		int rv;
+		if ( ! strcmp(cmd, "--update") ){
+			/* The file itself gets the new message */
+			rv = steganolab_update_file(filename, buf, (unsigned int)len, password, DCT_RADIUS, & opts, & stats);
+		}else{
+			/* out.jpeg is replaced only if embedding succeeds */
+			rv = steganolab_encode_file(filename, "out.jpeg", buf, (unsigned int)len, password, DCT_RADIUS, & opts, & stats);
+		}
 		free(buf);
 
 		if(rv){
@@ -276,23 +314,78 @@ int main(int argc, char ** argv){
 			/* remember for cleanup */
 			clu.password = password;
 		}
-		char * buf;
-		unsigned int len;
 		struct steganolab_statistics stats;
 
-		int rv = steganolab_decode(file, &buf, &len, password, DCT_RADIUS, & stats);
+		/* Message goes to stdout as soon as it is verified */
+		int rv = steganolab_decode_stream(file, write_to_stdout, NULL, password, DCT_RADIUS, & stats);
 		if(rv){
 			fprintf(stderr, "Decoder failed with message: %s\n", steganolab_describe(rv));
 			toreturn = 20;
 		}else{
-			size_t id;
-			for( id = 0; id < len; id+=1 ){
-				fputc(buf[id], stdout);
-			}
 			steganolab_print_statistics( & stats, stderr );
 			steganolab_free_statistics( & stats );
 			fprintf(stderr, "Decoding OK, your message on stdout\n");
+		}
+	}else if( ! strcmp(cmd, "--write-mjpeg") || ! strcmp(cmd, "--read-mjpeg") ){
+		/*############################################################*/
+		const char * filename = argv[2];
+		SLFILE * file = fopen(filename, "r");
+		if(file == NULL){
+			fprintf(stderr, "Can't open input file\n");
+			return 610;
+		}
+		clu.infile = file;
+		char * password;
+		if (argc == 4){
+			password = argv[3];
+		}else{/* We need to read password from FD */
+			int rv = read_password_from_fd(SECRET_FD, &password);
+			if(rv){
+				fprintf(stderr, "Failed to read password from FD %i\n", SECRET_FD);
+				cleanup_do(&clu);
+				return 601;
+			}
+			/* remember for cleanup */
+			clu.password = password;
+		}
+		struct steganolab_options opts;
+		steganolab_options_init(& opts);
+		opts.shuffle_dir = getenv("STEGANOLAB_SHUFFLES");
+		struct steganolab_stream_statistics stats;
+		int rv;
+		if ( ! strcmp(cmd, "--write-mjpeg") ){
+			char * buf;
+			size_t len;
+			read_from_fd(&buf, &len, 0);
+			if(buf == NULL||len > UINT_MAX){
+				fprintf(stderr, "Can't read data from stdin\n");
+				cleanup_do(&clu);
+				return 3;
+			}
+			clu.outfile = fopen("out.mjpeg", "w");
+			if ( NULL == clu.outfile ){
+				fprintf(stderr, "Can't open out.mjpeg\n");
+				free(buf);
+				cleanup_do(&clu);
+				return 611;
+			}
+			rv = steganolab_encode_mjpeg(file, clu.outfile, buf, (unsigned int)len, password, DCT_RADIUS, & opts, & stats);
 			free(buf);
+		}else{
+			char * msg;
+			unsigned int len;
+			rv = steganolab_decode_mjpeg(file, &msg, &len, password, DCT_RADIUS, & opts, & stats);
+			if ( 0 == rv ){
+				fwrite(msg, 1, len, stdout);
+				free(msg);
+			}
+		}
+		fprintf(stderr, "Frames: %llu, with message: %llu\n", stats.frames, stats.frames_used);
+		if(rv){
+			fprintf(stderr, "Stream failed with message: %s\n", steganolab_describe(rv));
+			toreturn = 60;
+		}else{
+			fprintf(stderr, "Stream OK\n");
 		}
 	}else if (! strcmp(cmd, "--estimate")){
 		if(argc != 3){
@@ -315,6 +408,52 @@ int main(int argc, char ** argv){
 			steganolab_print_statistics( & stats, stderr );
 			steganolab_free_statistics( & stats );
 		}
+	}else if (! strcmp(cmd, "--index")){
+		if(argc != 4){
+			return 402;
+		}
+		int rv = steganolab_index_build(argv[2], argv[3], 0);
+		if(rv){
+			fprintf(stderr, "Indexing failed with message: %s\n", steganolab_describe(rv));
+			toreturn = 40;
+		}else{
+			fprintf(stderr, "Indexing OK\n");
+		}
+	}else if (! strcmp(cmd, "--pick")){
+		if(argc != 4){
+			return 502;
+		}
+		struct steganolab_index * index;
+		int rv = steganolab_index_open(argv[2], & index);
+		if(rv){
+			fprintf(stderr, "Can't open index: %s\n", steganolab_describe(rv));
+			return 50;
+		}
+		unsigned long long bytes = strtoull(argv[3], NULL, 10);
+		struct steganolab_pick picks[64];
+		struct steganolab_carrier carrier;
+		unsigned int n = 0, ksi;
+		/* One carrier if possible, the message is split otherwise */
+		if ( bytes <= UINT_MAX ){
+			long fit = steganolab_index_best_fit(index, (unsigned int) bytes, DCT_RADIUS);
+			if ( fit >= 0 ){
+				picks[0].carrier = (unsigned int) fit;
+				picks[0].len = (unsigned int) bytes;
+				n = 1;
+			}
+		}
+		if ( 0 == n ){
+			n = steganolab_index_pack(index, bytes, DCT_RADIUS, picks, 64);
+		}
+		for ( ksi = 0; ksi < n; ksi += 1 ){
+			steganolab_index_get(index, picks[ksi].carrier, & carrier);
+			printf("%s\t%u\n", carrier.path, picks[ksi].len);
+		}
+		if ( 0 == n ){
+			fprintf(stderr, "No carriers can hold %llu bytes\n", bytes);
+			toreturn = 51;
+		}
+		steganolab_index_close(index);
 	}else{
 		/*############################################################*/
 		fprintf(stderr, "Wrong arguments\n");